@@ -1,17 +1,84 @@
 // aims_cli.cpp
-// Build: g++ -std=c++17 aims_cli.cpp -o aims_cli -lsqlite3
+// Build: g++ -std=c++17 -pthread aims_cli.cpp -o aims_cli -lsqlite3
 // Run: ./aims_cli /path/to/aims.sqlite
+//      ./aims_cli /path/to/aims.sqlite ingest /path/to/csv_dir [--batch-rows N]
+//      ./aims_cli /path/to/aims.sqlite --exec "crops-by-season Winter" [--exec ...] [--batch]
+//      ./aims_cli /path/to/aims.sqlite --batch --write-batch-rows 1000 --write-delay-ms 5 < inserts.txt
+//      ./aims_cli /path/to/aims.sqlite --format csv --exec "sql SELECT * FROM soilsample" > samples.csv
+//      ./aims_cli /path/to/new.sqlite generate [--farmers N] [--fields N] [--samples N] ...
+//      ./aims_cli /path/to/aims.sqlite bench [--iterations N] [--queries file.sql] [--out bench.json]
+//      ./aims_cli /path/to/aims.sqlite migrate | schema-diff file.sql | check-plans
+//      ./aims_cli /path/to/aims.sqlite report [--script file.sql] [--jobs N] [--out-dir DIR] [--format csv]
+//      ./aims_cli /path/to/aims.sqlite rotations [--jobs N] [--min-run N] [--sequences] [--format csv]
+//      ./aims_cli /path/to/aims.sqlite recommend [--top K] [--jobs N] [--season NAME] [--format csv] > recommendations.csv
+//      ./aims_cli /path/to/aims.sqlite snapshot nightly.aimscol
+//      ./aims_cli /path/to/aims.sqlite --snapshot nightly.aimscol --exec "monocrop-runs 4" --exec "planting-inputs all"
+//      ./aims_cli /path/to/aims.sqlite --exec "search sample spill fertilizer"
+//      ./aims_cli /path/to/aims.sqlite shard 4 shards/
+//      ./aims_cli shards/aims.shards --exec avg-npk --exec "latest-sample 42"
+//      ./aims_cli /path/to/aims.sqlite serve [--port 8080] [--bind 127.0.0.1] [--threads N] [--root DIR] [--origin URL]
+//      ./aims_cli /path/to/aims.sqlite --stats stats.json --slow-ms 50 --exec avg-yield   (any mode)
 
 #include <sqlite3.h>
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <cstdio>
 #include <cctype>
 #include <sstream>
-#include <regex>
+#include <ctime>
 #include <iomanip>
 #include <memory>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <set>
+#include <cstring>
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <unordered_map>
+#include <functional>
+#include <cmath>
+#include <random>
+#include <limits>
+#include <charconv>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <future>
+#include <unordered_set>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#endif
+
+#include <fstream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__)
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <csignal>
+#include <cerrno>
+#endif
 
 using std::string;
 using std::cout;
@@ -35,12 +102,6 @@ void clearScreen() {
 #endif
 }
 
-bool valid_date(const string &d) {
-    // Simple YYYY-MM-DD format check (not fully validating days/months/leap years)
-    std::regex re(R"(^\d{4}-\d{2}-\d{2}$)");
-    return std::regex_match(d, re);
-}
-
 bool is_non_negative_double(const string &s) {
     try {
         double v = std::stod(s);
@@ -48,6 +109,30 @@ bool is_non_negative_double(const string &s) {
     } catch (...) { return false; }
 }
 
+static string json_escape(const string &s) {
+    string out;
+    for (char c : s) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if ((unsigned char)c < 0x20) { char buf[8]; snprintf(buf, sizeof buf, "\\u%04x", c); out += buf; }
+                else out += c;
+        }
+    }
+    return out;
+}
+
+// Nearest-rank percentile, q in [0, 1].
+static double percentile_of(vector<double> v, double q) {
+    if (v.empty()) return 0.0;
+    std::sort(v.begin(), v.end());
+    size_t idx = (size_t)std::ceil(q * v.size());
+    return v[std::min(v.size() - 1, idx > 0 ? idx - 1 : 0)];
+}
+
 void print_row(sqlite3_stmt* stmt) {
     int cols = sqlite3_column_count(stmt);
     for (int i = 0; i < cols; ++i) {
@@ -60,25 +145,6 @@ void print_row(sqlite3_stmt* stmt) {
     cout << "\n";
 }
 
-void print_table_header(sqlite3_stmt* stmt) {
-    int cols = sqlite3_column_count(stmt);
-    for (int i = 0; i < cols; ++i) {
-        cout << std::left << std::setw(18) << sqlite3_column_name(stmt, i);
-    }
-    cout << "\n";
-    for (int i = 0; i < cols; ++i) cout << std::setw(18) << std::string(14, '-');
-    cout << "\n";
-}
-
-static int print_generic_callback(void *NotUsed, int argc, char **argv, char **azColName){
-    (void)NotUsed;
-    for (int i = 0; i < argc; i++) {
-        printf("%s = %s | ", azColName[i], argv[i] ? argv[i] : "NULL");
-    }
-    printf("\n");
-    return 0;
-}
-
 void promptContinue(){
     cout << endl;
     while (true) {
@@ -91,446 +157,8300 @@ void promptContinue(){
     }
 }
 
-// ---------- DB wrapper ----------
-struct DB {
-    sqlite3* db = nullptr;
-    bool open(const string &path) {
-        if (sqlite3_open(path.c_str(), &db) != SQLITE_OK) {
-            cout << "Can't open DB: " << sqlite3_errmsg(db) << "\n";
-            return false;
-        }
-        // Enable foreign keys (good practice)
-        sqlite3_exec(db, "PRAGMA foreign_keys = ON;", nullptr, nullptr, nullptr);
-        return true;
-    }
-    void close() {
-        if (db) sqlite3_close(db);
-        db = nullptr;
-    }
+// ---------- Dates ----------
+// Dates are 'YYYY-MM-DD' text in the tables and day numbers (days since 1970-01-01,
+// proleptic Gregorian) everywhere they are compared or bucketed. From schema version 5 the
+// fieldcrop and fieldmaintenance dates have indexed INTEGER twins holding their day numbers
+// (DAY_COLUMNS_SQL); sample and season dates stay text only.
+// Conversions use H. Hinnant's civil-date algorithms: a few integer operations, no tables.
 
-    ~DB() { close(); }
+static const int NO_DAY = std::numeric_limits<int32_t>::min();   // missing or unparsable date
 
-    bool table_exists(const string &name) {
-        string q = "SELECT COUNT(1) FROM sqlite_master WHERE type='table' AND name = ?;";
-        sqlite3_stmt* stmt = nullptr;
-        if (sqlite3_prepare_v2(db, q.c_str(), -1, &stmt, nullptr) != SQLITE_OK) return false;
-        sqlite3_bind_text(stmt, 1, name.c_str(), -1, SQLITE_TRANSIENT);
-        bool exists = false;
-        if (sqlite3_step(stmt) == SQLITE_ROW) {
-            int count = sqlite3_column_int(stmt, 0);
-            exists = (count > 0);
-        }
-        sqlite3_finalize(stmt);
-        return exists;
-    }
+constexpr bool is_leap_year(int y) { return y % 4 == 0 && (y % 100 != 0 || y % 400 == 0); }
 
-    bool id_exists(const string &table, const string &pk_col, int id) {
-        string q = "SELECT 1 FROM " + table + " WHERE " + pk_col + " = ? LIMIT 1;";
-        sqlite3_stmt* stmt = nullptr;
-        if (sqlite3_prepare_v2(db, q.c_str(), -1, &stmt, nullptr) != SQLITE_OK) return false;
-        sqlite3_bind_int(stmt, 1, id);
-        bool found = false;
-        if (sqlite3_step(stmt) == SQLITE_ROW) found = true;
-        sqlite3_finalize(stmt);
-        return found;
-    }
+constexpr int days_in_month(int y, int m) {
+    return m == 2 ? (is_leap_year(y) ? 29 : 28) : (m == 4 || m == 6 || m == 9 || m == 11) ? 30 : 31;
+}
 
-    // Generic function to run a query with no parameters and print results
-    void run_and_print(const string &sql) {
-        sqlite3_stmt* stmt;
-        if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-            cout << "Query prepare error: " << sqlite3_errmsg(db) << "\n";
-            return;
-        }
-        bool header_printed = false;
-        while (sqlite3_step(stmt) == SQLITE_ROW) {
-            if (!header_printed) {
-                print_table_header(stmt);
-                header_printed = true;
-            }
-            int cols = sqlite3_column_count(stmt);
-            for (int i = 0; i < cols; ++i) {
-                const unsigned char* txt = sqlite3_column_text(stmt, i);
-                string val = txt ? reinterpret_cast<const char*>(txt) : "NULL";
-                cout << std::left << std::setw(18) << val;
-            }
-            cout << "\n";
+constexpr int days_from_civil(int y, int m, int d) {
+    y -= m <= 2;
+    int era = (y >= 0 ? y : y - 399) / 400;
+    int yoe = y - era * 400;
+    int doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+struct CivilDate { int y, m, d; };
+
+constexpr CivilDate civil_from_days(int z) {
+    z += 719468;
+    int era = (z >= 0 ? z : z - 146096) / 146097;
+    int doe = z - era * 146097;
+    int yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    int doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    int mp = (5 * doy + 2) / 153;
+    int d = doy - (153 * mp + 2) / 5 + 1;
+    int m = mp + (mp < 10 ? 3 : -9);
+    return {yoe + era * 400 + (m <= 2), m, d};
+}
+
+static_assert(days_from_civil(1970, 1, 1) == 0, "epoch");
+static_assert(days_from_civil(2000, 3, 1) == 11017, "leap century");
+static_assert(civil_from_days(19782).y == 2024 && civil_from_days(19782).m == 2 && civil_from_days(19782).d == 29, "round trip");
+
+// Strict 'YYYY-MM-DD' (exactly ten characters) with real month lengths and leap years.
+constexpr bool parse_date(const char* s, size_t n, int &days) {
+    if (n != 10 || s[4] != '-' || s[7] != '-') return false;
+    int v[3] = {0, 0, 0};
+    const int start[3] = {0, 5, 8}, len[3] = {4, 2, 2};
+    for (int f = 0; f < 3; ++f) {
+        for (int i = start[f]; i < start[f] + len[f]; ++i) {
+            if (s[i] < '0' || s[i] > '9') return false;
+            v[f] = v[f] * 10 + (s[i] - '0');
         }
-        sqlite3_finalize(stmt);
-        if (!header_printed) cout << "(no rows)\n";
     }
-};
+    if (v[1] < 1 || v[1] > 12 || v[2] < 1 || v[2] > days_in_month(v[0], v[1])) return false;
+    days = days_from_civil(v[0], v[1], v[2]);
+    return true;
+}
 
-// ---------- App logic implementing menu operations ----------
+static bool parse_date(const string &s, int &days) { return parse_date(s.data(), s.size(), days); }
 
-void show_all_fields(DB &db) {
-    cout << "\n-- All fields --\n";
-    db.run_and_print("SELECT fld_fieldkey AS id, fld_farmerkey AS farmer_id, fld_soilkey AS soil_type FROM field ORDER BY fld_fieldkey;");
-    promptContinue();
+// Writes 'YYYY-MM-DD' and the terminating NUL into out.
+static void format_date(int days, char out[11]) {
+    CivilDate c = civil_from_days(days);
+    int y = c.y;
+    for (int i = 3; i >= 0; --i) { out[i] = (char)('0' + y % 10); y /= 10; }
+    out[4] = '-'; out[5] = (char)('0' + c.m / 10); out[6] = (char)('0' + c.m % 10);
+    out[7] = '-'; out[8] = (char)('0' + c.d / 10); out[9] = (char)('0' + c.d % 10);
+    out[10] = '\0';
 }
 
-void crops_by_season(DB &db) {
-    // cout << "Enter season_id: ";
-    // int sid; cin >> sid; cin.ignore();
+static string format_date(int days) {
+    if (days == NO_DAY) return "";
+    char buf[11];
+    format_date(days, buf);
+    return buf;
+}
 
-    cout << endl;
-    cout << "Enter season name (e.g. Winter): ";
-    string sName;
-    getline(cin, sName);
+bool valid_date(const string &d) {
+    int days;
+    return parse_date(d, days);
+}
 
-    if (sName == "Fall") sName = "Autumn";
+// 'YYYY-MM' with a real month.
+static bool valid_month(const string &s) {
+    int days;
+    return s.size() == 7 && parse_date((s + "-01").c_str(), 10, days);
+}
 
-    int sid = -1;
-    {
-        string q = "SELECT s_seasonkey FROM season WHERE s_name = ?;";
-        sqlite3_stmt* stmt;
+// Today's day number in local time, and the same calendar day `years` earlier (Feb 29
+// rolls over to Mar 1, as in SQLite's date('now', '-N years')).
+static int today_day() {
+    time_t t = time(nullptr);
+    struct tm lt;
+#ifdef _WIN32
+    localtime_s(&lt, &t);
+#else
+    localtime_r(&t, &lt);
+#endif
+    return days_from_civil(lt.tm_year + 1900, lt.tm_mon + 1, lt.tm_mday);
+}
 
-        if (sqlite3_prepare_v2(db.db, q.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-            cout << "Prepare error\n"; return;
-        }
+static int years_before(int day, int years) {
+    CivilDate c = civil_from_days(day);
+    return days_from_civil(c.y - years, c.m, c.d);
+}
 
-        sqlite3_bind_text(stmt, 1, sName.c_str(), -1, SQLITE_TRANSIENT);
+// ---------- Native SQL aggregates ----------
+// Registered on every connection: stddev(x), variance(x), median(x), percentile(x, p), corr(x, y).
+// One pass each: Welford updates for variance/stddev, co-moment updates for corr and a
+// merging t-digest for median/percentile (exact while the group holds few values).
 
-        if (sqlite3_step(stmt) == SQLITE_ROW) {
-            sid = sqlite3_column_int(stmt, 0);
-        }
-        sqlite3_finalize(stmt);
+struct WelfordState {
+    sqlite3_int64 n = 0;
+    double mean = 0.0, m2 = 0.0;
+    void add(double x) {
+        ++n;
+        double d = x - mean;
+        mean += d / n;
+        m2 += d * (x - mean);
     }
+};
 
-    if (sid == -1) {
-        cout << "Season not found.\n";
-        return;
+struct CorrState {
+    sqlite3_int64 n = 0;
+    double mx = 0.0, my = 0.0, m2x = 0.0, m2y = 0.0, cxy = 0.0;
+    void add(double x, double y) {
+        ++n;
+        double dx = x - mx;
+        mx += dx / n;
+        double dy = y - my;
+        my += dy / n;
+        m2x += dx * (x - mx);
+        m2y += dy * (y - my);
+        cxy += dx * (y - my);
     }
+};
 
-    if (!db.id_exists("season", "s_seasonkey", sid)) {
-        cout << "Season id not found.\n"; return;
-    }
-    string sql = "SELECT s.s_name AS season, c.c_name AS crop, COUNT(fc.fldc_fieldkey) as plantings "
-                 "FROM season s JOIN crop c ON c.c_preferredseason = s.s_seasonkey "
-                 "LEFT JOIN fieldcrop fc ON fc.fldc_cropkey = c.c_cropkey "
-                 "WHERE s.s_seasonkey = ? GROUP BY c.c_cropkey;";
-    sqlite3_stmt* stmt;
-    if (sqlite3_prepare_v2(db.db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-        cout << "Prepare error\n"; return;
+// Merging t-digest (Dunning). Values are kept exactly until the buffer first fills;
+// after that they are compressed into at most ~compression centroids, so memory per
+// group stays bounded no matter how many rows the group has.
+class QuantileSketch {
+public:
+    explicit QuantileSketch(double compression = 200.0) : compression_(compression) {}
+
+    void add(double x) {
+        buffer_.push_back({x, 1.0});
+        if (buffer_.size() >= buffer_limit()) compress();
     }
-    sqlite3_bind_int(stmt, 1, sid);
-    bool printed = false;
-    print_table_header(stmt);
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
-        printed = true;
-        int cols = sqlite3_column_count(stmt);
-        for (int i = 0; i < cols; ++i) {
-            const unsigned char* txt = sqlite3_column_text(stmt, i);
-            string val = txt ? reinterpret_cast<const char*>(txt) : "NULL";
-            cout << std::left << std::setw(18) << val;
+
+    // q in [0, 1]; NaN when empty.
+    double quantile(double q) {
+        compress();
+        if (centroids_.empty()) return std::numeric_limits<double>::quiet_NaN();
+        if (exact_) {
+            // All weights are 1: linear interpolation between order statistics.
+            double pos = q * (centroids_.size() - 1);
+            size_t lo = (size_t)std::floor(pos);
+            size_t hi = std::min(lo + 1, centroids_.size() - 1);
+            return centroids_[lo].mean + (pos - lo) * (centroids_[hi].mean - centroids_[lo].mean);
         }
-        cout << "\n";
+        if (q <= 0) return min_;
+        if (q >= 1) return max_;
+        double target = q * total_, cum = 0.0;
+        for (size_t i = 0; i < centroids_.size(); ++i) {
+            const Centroid &c = centroids_[i];
+            double mid = cum + c.weight / 2;
+            if (target < mid) {
+                if (i == 0) return min_ + (c.mean - min_) * (target / mid);
+                const Centroid &p = centroids_[i - 1];
+                double pmid = cum - p.weight / 2;
+                return p.mean + (c.mean - p.mean) * (target - pmid) / (mid - pmid);
+            }
+            cum += c.weight;
+        }
+        const Centroid &last = centroids_.back();
+        double lmid = total_ - last.weight / 2;
+        return last.mean + (max_ - last.mean) * (target - lmid) / (total_ - lmid);
     }
-    sqlite3_finalize(stmt);
-    if (!printed) cout << "(no rows)\n";
-    promptContinue();
-}
 
-void avg_yield_per_field(DB &db) {
-    cout << "\n-- Avg yield per field (aggregated) --\n";
-    string sql = "SELECT fldc_fieldkey AS fieldkey, ROUND(AVG(fldc_yield), 2) AS avg_yield, COUNT(fldc_fieldkey) AS observations "
-                 "FROM fieldcrop GROUP BY fldc_fieldkey ORDER BY fldc_fieldkey;";
-    db.run_and_print(sql);
-    promptContinue();
-}
+private:
+    struct Centroid { double mean, weight; };
 
-void latest_soil_sample_for_field(DB &db) {
-    cout << endl;
+    size_t buffer_limit() const { return (size_t)(compression_ * 10); }
 
-    cout << "Enter field_id: ";
-    int fid; cin >> fid; cin.ignore();
-    if (!db.id_exists("field", "fld_fieldkey", fid)) { cout << "Field not found.\n"; return; }
-    int index = 1;
+    void compress() {
+        if (buffer_.empty()) return;
+        for (auto &c : buffer_) { min_ = std::min(min_, c.mean); max_ = std::max(max_, c.mean); total_ += c.weight; }
+        buffer_.insert(buffer_.end(), centroids_.begin(), centroids_.end());
+        std::sort(buffer_.begin(), buffer_.end(), [](const Centroid &a, const Centroid &b) { return a.mean < b.mean; });
+        centroids_.clear();
+        if (exact_ && buffer_.size() < buffer_limit()) { centroids_.swap(buffer_); return; }
+        exact_ = false;
+        // k1 scale function: centroid size limit shrinks toward the tails.
+        const double pi = 3.14159265358979323846;
+        auto k = [&](double q) { return compression_ / (2 * pi) * std::asin(2 * q - 1); };
+        double cum = 0.0, k_lo = k(0.0);
+        Centroid cur = buffer_[0];
+        for (size_t i = 1; i < buffer_.size(); ++i) {
+            const Centroid &c = buffer_[i];
+            double q = (cum + cur.weight + c.weight) / total_;
+            if (k(q) - k_lo <= 1.0) {
+                cur.mean += (c.mean - cur.mean) * c.weight / (cur.weight + c.weight);
+                cur.weight += c.weight;
+            } else {
+                cum += cur.weight;
+                centroids_.push_back(cur);
+                k_lo = k(cum / total_);
+                cur = c;
+            }
+        }
+        centroids_.push_back(cur);
+        buffer_.clear();
+    }
 
-    string sql1 = R"(SELECT 
-                        ss_samplekey AS Sample,
-                        ss_fieldkey AS Field,
-                        ss_sampledate AS Date,
-                        ss_sand AS Sand,
-                        ss_silt AS Silt,
-                        ss_clay AS Clay,
-                        ss_ph AS pH,
-                        ss_nitrogen_ppm AS N,
-                        ss_phosphorus_ppm AS P,
-                        ss_potassium_ppm AS K,
-                        ss_organicmatter_pct AS "OM%",
-                        ss_cec AS CEC
-                    FROM soilsample 
-                    WHERE ss_fieldkey = ? 
-                    ORDER BY ss_sampledate DESC LIMIT 1;)";
+    double compression_;
+    bool exact_ = true;
+    double total_ = 0.0;
+    double min_ = std::numeric_limits<double>::infinity();
+    double max_ = -std::numeric_limits<double>::infinity();
+    vector<Centroid> buffer_;
+    vector<Centroid> centroids_;
+};
 
-    string sql2 = R"(SELECT 
-                        ss_lead_ppm AS Lead,
-                        ss_mercury_ppm AS Mercury,
-                        ss_nickel_ppm AS Nickel,
-                        ss_copper_ppm AS Copper,
-                        ss_chromium_ppm AS Chromium,
-                        ss_cadmium_ppm AS Cadmium,
-                        ss_arsenic_ppm AS Arsenic,
-                        ss_zinc_ppm AS Zinc
-                    FROM soilsample 
-                    WHERE ss_fieldkey = ? 
-                    ORDER BY ss_sampledate DESC LIMIT 1;)";
+struct PercentileState {
+    QuantileSketch sketch;
+    double p = -1.0;
+    bool has_rows = false;
+};
 
-    string sql3 = R"(SELECT 
-                        ss_comment AS comment
-                    FROM soilsample 
-                    WHERE ss_fieldkey = ? 
-                    ORDER BY ss_sampledate DESC LIMIT 1;)";
+// Aggregate state lives on the heap; sqlite3_aggregate_context only stores the pointer.
+template <typename T>
+static T* agg_state(sqlite3_context* ctx, bool create) {
+    T** slot = (T**)sqlite3_aggregate_context(ctx, create ? sizeof(T*) : 0);
+    if (!slot) return nullptr;
+    if (!*slot && create) *slot = new T();
+    return *slot;
+}
 
-    begin:
-    string query;
-    if (index == 1){
-        query = sql1;
-    } else if (index == 2){
-        query = sql2;
-    } else query = sql3;
+template <typename T>
+static T* agg_take(sqlite3_context* ctx) {
+    T** slot = (T**)sqlite3_aggregate_context(ctx, 0);
+    if (!slot || !*slot) return nullptr;
+    T* s = *slot; *slot = nullptr;
+    return s;
+}
 
-    sqlite3_stmt* stmt;
-    if (sqlite3_prepare_v2(db.db, query.c_str(), -1, &stmt, nullptr) != SQLITE_OK) { cout << "Prepare error\n"; return; }
-    sqlite3_bind_int(stmt, 1, fid);
-    if (sqlite3_step(stmt) == SQLITE_ROW) {
-        print_table_header(stmt);
-        int cols = sqlite3_column_count(stmt);
-        for (int i = 0; i < cols; ++i) {
-            const unsigned char* txt = sqlite3_column_text(stmt, i);
-            string val = txt ? reinterpret_cast<const char*>(txt) : "NULL";
-            cout << std::left << std::setw(18) << val;
-        }
-        cout << "\n";
-    } else cout << "(no sample rows)\n";
-    sqlite3_finalize(stmt);
+static void welford_step(sqlite3_context* ctx, int, sqlite3_value** argv) {
+    if (sqlite3_value_type(argv[0]) == SQLITE_NULL) return;
+    WelfordState* s = agg_state<WelfordState>(ctx, true);
+    if (!s) { sqlite3_result_error_nomem(ctx); return; }
+    s->add(sqlite3_value_double(argv[0]));
+}
 
-    while(index < 3){
-        string in;
-        cout << endl;
-        cout << "View more? (Y/N): ";
-        cin >> in;
+static void variance_final(sqlite3_context* ctx) {
+    std::unique_ptr<WelfordState> s(agg_take<WelfordState>(ctx));
+    if (!s || s->n < 2) { sqlite3_result_null(ctx); return; }
+    sqlite3_result_double(ctx, s->m2 / (s->n - 1));
+}
 
-        if (in == "Y" || in == "y" || in == "" || !in.empty()){
-            ++index;
-            cout << endl;
-            goto begin;
-        } else if (in == "N" || in == "n"){
-            goto skip_prompt_cont;
-        }
-    }
+static void stddev_final(sqlite3_context* ctx) {
+    std::unique_ptr<WelfordState> s(agg_take<WelfordState>(ctx));
+    if (!s || s->n < 2) { sqlite3_result_null(ctx); return; }
+    sqlite3_result_double(ctx, std::sqrt(s->m2 / (s->n - 1)));
+}
 
-    cin.ignore();
+static void corr_step(sqlite3_context* ctx, int, sqlite3_value** argv) {
+    if (sqlite3_value_type(argv[0]) == SQLITE_NULL || sqlite3_value_type(argv[1]) == SQLITE_NULL) return;
+    CorrState* s = agg_state<CorrState>(ctx, true);
+    if (!s) { sqlite3_result_error_nomem(ctx); return; }
+    s->add(sqlite3_value_double(argv[0]), sqlite3_value_double(argv[1]));
+}
 
-    promptContinue();
-    skip_prompt_cont:
+static void corr_final(sqlite3_context* ctx) {
+    std::unique_ptr<CorrState> s(agg_take<CorrState>(ctx));
+    if (!s || s->n < 2 || s->m2x == 0.0 || s->m2y == 0.0) { sqlite3_result_null(ctx); return; }
+    sqlite3_result_double(ctx, s->cxy / std::sqrt(s->m2x * s->m2y));
 }
 
-void samples_exceeding_thresholds(DB &db) {
-    cout << endl;
-    cout << "Enter lead_limit (ppm) [example 100]: "; double lead; cin >> lead;
-    cout << "Enter cadmium_limit (ppm) [example 0.48]: "; double cad; cin >> cad;
-    cout << "Enter arsenic_limit (ppm) [example 10]: "; double as; cin >> as;
-    cin.ignore();
-    string sql = "SELECT ss.ss_samplekey, ss.ss_sampledate, fld.fld_fieldkey, f.f_farmerkey, f.f_name || ' ' || f.f_surname AS farmer_name, "
-                 "ss.ss_lead_ppm, ss.ss_cadmium_ppm, ss.ss_arsenic_ppm "
-                 "FROM soilsample ss JOIN field fld ON ss.ss_fieldkey = fld.fld_fieldkey JOIN farmer f ON fld.fld_farmerkey = f.f_farmerkey "
-                 "WHERE (ss.ss_lead_ppm IS NOT NULL AND ss.ss_lead_ppm > ?) OR (ss.ss_cadmium_ppm IS NOT NULL AND ss.ss_cadmium_ppm > ?) OR (ss.ss_arsenic_ppm IS NOT NULL AND ss.ss_arsenic_ppm > ?) "
-                 "ORDER BY ss.ss_sampledate DESC;";
-    sqlite3_stmt* stmt;
-    if (sqlite3_prepare_v2(db.db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) { cout << "Prepare error\n"; return; }
-    sqlite3_bind_double(stmt, 1, lead);
-    sqlite3_bind_double(stmt, 2, cad);
-    sqlite3_bind_double(stmt, 3, as);
-    bool printed = false;
-    print_table_header(stmt);
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
-        printed = true;
-        int cols = sqlite3_column_count(stmt);
-        for (int i = 0; i < cols; ++i) {
-            const unsigned char* txt = sqlite3_column_text(stmt, i);
-            string val = txt ? reinterpret_cast<const char*>(txt) : "NULL";
-            cout << std::left << std::setw(18) << val;
-        }
-        cout << "\n";
+static void median_step(sqlite3_context* ctx, int, sqlite3_value** argv) {
+    if (sqlite3_value_type(argv[0]) == SQLITE_NULL) return;
+    PercentileState* s = agg_state<PercentileState>(ctx, true);
+    if (!s) { sqlite3_result_error_nomem(ctx); return; }
+    s->p = 50.0;
+    s->has_rows = true;
+    s->sketch.add(sqlite3_value_double(argv[0]));
+}
+
+// percentile(x, p) with p in [0, 100], constant for the whole group.
+static void percentile_step(sqlite3_context* ctx, int, sqlite3_value** argv) {
+    if (sqlite3_value_type(argv[0]) == SQLITE_NULL) return;
+    double p = sqlite3_value_double(argv[1]);
+    if (sqlite3_value_type(argv[1]) == SQLITE_NULL || p < 0.0 || p > 100.0) {
+        sqlite3_result_error(ctx, "percentile: second argument must be between 0 and 100", -1);
+        return;
     }
-    sqlite3_finalize(stmt);
-    if (!printed) cout << "(no rows)\n";
-    promptContinue();
+    PercentileState* s = agg_state<PercentileState>(ctx, true);
+    if (!s) { sqlite3_result_error_nomem(ctx); return; }
+    if (s->has_rows && s->p != p) {
+        sqlite3_result_error(ctx, "percentile: second argument must be the same for every row", -1);
+        return;
+    }
+    s->p = p;
+    s->has_rows = true;
+    s->sketch.add(sqlite3_value_double(argv[0]));
 }
 
-void fields_no_recent_maintenance(DB &db) {
-    cout << "\n-- Fields with no maintenance in last 3 years (or never) --\n";
-    string sql = R"(
-    WITH last_maint AS (
-      SELECT fldm_fieldkey, MAX(fldm_begindate) AS last_begindate
-      FROM fieldmaintenance
-      GROUP BY fldm_fieldkey
-    )
-    SELECT fld.fld_fieldkey AS fieldkey, fld.fld_farmerkey AS farmerkey, TRIM(f.f_name || ' ' || f.f_surname) AS farmer_name, fld.fld_soilkey AS soilkey, lm.last_begindate
-    FROM field fld
-    LEFT JOIN last_maint lm ON fld.fld_fieldkey = lm.fldm_fieldkey
-    LEFT JOIN farmer f ON fld.fld_farmerkey = f.f_farmerkey
-    WHERE lm.last_begindate IS NULL OR lm.last_begindate < date('now', '-3 years')
-    ORDER BY (lm.last_begindate IS NOT NULL), lm.last_begindate;
-    )";
-    db.run_and_print(sql);
+static void percentile_final(sqlite3_context* ctx) {
+    std::unique_ptr<PercentileState> s(agg_take<PercentileState>(ctx));
+    if (!s || !s->has_rows) { sqlite3_result_null(ctx); return; }
+    sqlite3_result_double(ctx, s->sketch.quantile(s->p / 100.0));
+}
 
-    promptContinue();
+void register_aggregates(sqlite3* db) {
+    const int flags = SQLITE_UTF8 | SQLITE_DETERMINISTIC;
+    sqlite3_create_function_v2(db, "variance", 1, flags, nullptr, nullptr, welford_step, variance_final, nullptr);
+    sqlite3_create_function_v2(db, "stddev", 1, flags, nullptr, nullptr, welford_step, stddev_final, nullptr);
+    sqlite3_create_function_v2(db, "corr", 2, flags, nullptr, nullptr, corr_step, corr_final, nullptr);
+    sqlite3_create_function_v2(db, "median", 1, flags, nullptr, nullptr, median_step, percentile_final, nullptr);
+    sqlite3_create_function_v2(db, "percentile", 2, flags, nullptr, nullptr, percentile_step, percentile_final, nullptr);
 }
 
-void avg_npk_by_soil_texture(DB &db) {
-    cout << "\n-- Avg NPK by soil texture (requires >=5 samples) --\n";
-    string sql = R"(
-    SELECT st.st_soil_texture AS soil_texture, COUNT(ss.ss_samplekey) AS sample_count,
-           ROUND(AVG(ss.ss_nitrogen_ppm),2) AS avg_N,
-           ROUND(AVG(ss.ss_phosphorus_ppm),2) AS avg_P,
-           ROUND(AVG(ss.ss_potassium_ppm),2) AS avg_K,
-           ROUND(AVG(ss.ss_cec),2) AS avg_cec
-    FROM soilsample ss
-    JOIN field fld ON ss.ss_fieldkey = fld.fld_fieldkey
-    JOIN soiltype st ON fld.fld_soilkey = st.st_soilkey
-    GROUP BY st.st_soil_texture
-    HAVING COUNT(ss.ss_samplekey) >= 5
-    ORDER BY st.st_soilkey DESC;
-    )";
-    db.run_and_print(sql);
-    promptContinue();
+// ---------- Native date functions ----------
+// Registered next to the aggregates, for ad-hoc SQL over the day-number columns:
+//   day_number('2024-02-29') -> 19782 (NULL unless a valid YYYY-MM-DD)
+//   day_date(19782) -> '2024-02-29' (NULL outside years 0000..9999), day_year(19782) -> 2024,
+//   day_month(19782) -> 2
+//   today() -> today's day number (local time)
+// The generated columns themselves use julianday(), so databases stay readable and writable
+// from the plain sqlite3 shell.
+
+static bool day_arg(sqlite3_value* v, int &day) {
+    if (sqlite3_value_type(v) == SQLITE_NULL) return false;
+    sqlite3_int64 d = sqlite3_value_int64(v);
+    // Keeps civil_from_days in int range (years -5 877 641 .. 5 881 580).
+    if (d < -2000000000LL || d > 2000000000LL) return false;
+    day = (int)d;
+    return true;
 }
 
-void total_yield_per_season(DB &db) {
-    cout << "\n-- Total yield per season (aggregated) --\n";
-    string sql = R"(
-    SELECT s.s_seasonkey, s.s_name, ROUND(SUM(fc.fldc_yield),2) AS total_yield, COUNT(fc.fldc_fieldkey) AS plantings_count
-    FROM season s
-    JOIN crop c ON c.c_preferredseason = s.s_seasonkey
-    JOIN fieldcrop fc ON fc.fldc_cropkey = c.c_cropkey
-    GROUP BY s.s_seasonkey, s.s_name
-    ORDER BY total_yield DESC;
-    )";
-    db.run_and_print(sql);
-    promptContinue();
+static void day_number_fn(sqlite3_context* ctx, int, sqlite3_value** argv) {
+    const char* s = (const char*)sqlite3_value_text(argv[0]);
+    int day;
+    if (s && parse_date(s, (size_t)sqlite3_value_bytes(argv[0]), day)) sqlite3_result_int(ctx, day);
+    else sqlite3_result_null(ctx);
 }
 
-void crop_rotation_history(DB &db) {
-    cout << endl;
-    cout << "Enter field_id to view recent rotation: ";
-    int fid; cin >> fid; cin.ignore();
-    if (!db.id_exists("field", "fld_fieldkey", fid)) { cout << "Field not found.\n"; return; }
-    string sql = R"(
-    WITH crop_history AS (
-      SELECT fc.fldc_fieldkey, fc.fldc_cropkey, fc.fldc_enddate,
-             ROW_NUMBER() OVER (PARTITION BY fc.fldc_fieldkey ORDER BY fc.fldc_enddate DESC) AS rn
-      FROM fieldcrop fc
-      WHERE fc.fldc_fieldkey = ?
-    )
-    SELECT current_harvest.fldc_fieldkey, current_harvest.fldc_cropkey AS current_cropkey, previous_harvest.fldc_cropkey AS previous_cropkey,
-           c1.c_name AS current_crop_name, c2.c_name AS previous_crop_name
-    FROM crop_history current_harvest
-    JOIN crop_history previous_harvest ON current_harvest.fldc_fieldkey = previous_harvest.fldc_fieldkey
-    JOIN crop c1 ON current_harvest.fldc_cropkey = c1.c_cropkey
-    JOIN crop c2 ON previous_harvest.fldc_cropkey = c2.c_cropkey
-    WHERE current_harvest.rn = 1 AND previous_harvest.rn = 2 AND current_harvest.fldc_cropkey <> previous_harvest.fldc_cropkey;
-    )";
-    sqlite3_stmt* stmt;
-    if (sqlite3_prepare_v2(db.db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) { cout << "Prepare error\n"; return; }
-    sqlite3_bind_int(stmt, 1, fid);
-    bool printed = false;
-    print_table_header(stmt);
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
-        printed = true;
-        int cols = sqlite3_column_count(stmt);
-        for (int i = 0; i < cols; ++i) {
-            const unsigned char* txt = sqlite3_column_text(stmt, i);
-            string val = txt ? reinterpret_cast<const char*>(txt) : "NULL";
-            cout << std::left << std::setw(18) << val;
-        }
-        cout << "\n";
-    }
-    sqlite3_finalize(stmt);
-    if (!printed) cout << "(no rotation info found)\n";
-    promptContinue();
+static void day_date_fn(sqlite3_context* ctx, int, sqlite3_value** argv) {
+    int day;
+    // format_date writes four year digits: 0000-01-01 .. 9999-12-31.
+    if (!day_arg(argv[0], day) || day < -719528 || day > 2932896) { sqlite3_result_null(ctx); return; }
+    char buf[11];
+    format_date(day, buf);
+    sqlite3_result_text(ctx, buf, 10, SQLITE_TRANSIENT);
 }
 
-// ---------- Insert operations (safe, parameterized) ----------
+static void day_year_fn(sqlite3_context* ctx, int, sqlite3_value** argv) {
+    int day;
+    if (day_arg(argv[0], day)) sqlite3_result_int(ctx, civil_from_days(day).y);
+    else sqlite3_result_null(ctx);
+}
 
-void insert_fieldcrop(DB &db) {
-    cout << endl;
-    cout << "Inserting new fieldcrop entry.\n";
-    int field_id, crop_id;
-    string bdate, edate;
-    double yield; string unit;
-    cout << "field_id: "; cin >> field_id;
-    if (!db.id_exists("field", "fld_fieldkey", field_id)) { cout << "Field id not found.\n"; cin.ignore(); return; }
-    cout << "crop_id: "; cin >> crop_id;
-    if (!db.id_exists("crop", "c_cropkey", crop_id)) { cout << "Crop id not found.\n"; cin.ignore(); return; }
-    cout << "begin_date (YYYY-MM-DD): "; cin >> bdate;
-    if (!valid_date(bdate)) { cout << "Invalid date format.\n"; cin.ignore(); return; }
-    cout << "end_date (YYYY-MM-DD or empty if ongoing): "; cin >> edate;
-    if (!edate.empty() && !valid_date(edate)) { cout << "Invalid date format.\n"; cin.ignore(); return; }
-    cout << "yield (>=0): "; cin >> yield;
-    if (yield < 0) { cout << "Yield must be non-negative.\n"; cin.ignore(); return; }
-    cout << "unit (text): "; cin >> unit;
-    cin.ignore();
+static void day_month_fn(sqlite3_context* ctx, int, sqlite3_value** argv) {
+    int day;
+    if (day_arg(argv[0], day)) sqlite3_result_int(ctx, civil_from_days(day).m);
+    else sqlite3_result_null(ctx);
+}
 
-    string sql = "INSERT INTO fieldcrop (fldc_fieldkey, fldc_cropkey, fldc_begindate, fldc_enddate, fldc_yield, fldc_yield_unit) VALUES (?, ?, ?, ?, ?, ?);";
-    sqlite3_stmt* stmt;
-    if (sqlite3_prepare_v2(db.db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) { cout << "Prepare error: " << sqlite3_errmsg(db.db) << "\n"; return; }
-    sqlite3_bind_int(stmt, 1, field_id);
-    sqlite3_bind_int(stmt, 2, crop_id);
-    sqlite3_bind_text(stmt, 3, bdate.c_str(), -1, SQLITE_TRANSIENT);
-    if (edate.empty()) sqlite3_bind_null(stmt, 4); else sqlite3_bind_text(stmt, 4, edate.c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_double(stmt, 5, yield);
-    sqlite3_bind_text(stmt, 6, unit.c_str(), -1, SQLITE_TRANSIENT);
-    if (sqlite3_step(stmt) != SQLITE_DONE) {
-        cout << "Insert failed: " << sqlite3_errmsg(db.db) << "\n";
-    } else cout << "Inserted fieldcrop row successfully.\n";
-    sqlite3_finalize(stmt);
-    promptContinue();
+static void today_fn(sqlite3_context* ctx, int, sqlite3_value**) { sqlite3_result_int(ctx, today_day()); }
+
+void register_date_functions(sqlite3* db) {
+    const int flags = SQLITE_UTF8 | SQLITE_DETERMINISTIC | SQLITE_INNOCUOUS;
+    sqlite3_create_function_v2(db, "day_number", 1, flags, nullptr, day_number_fn, nullptr, nullptr, nullptr);
+    sqlite3_create_function_v2(db, "day_date", 1, flags, nullptr, day_date_fn, nullptr, nullptr, nullptr);
+    sqlite3_create_function_v2(db, "day_year", 1, flags, nullptr, day_year_fn, nullptr, nullptr, nullptr);
+    sqlite3_create_function_v2(db, "day_month", 1, flags, nullptr, day_month_fn, nullptr, nullptr, nullptr);
+    sqlite3_create_function_v2(db, "today", 0, SQLITE_UTF8, nullptr, today_fn, nullptr, nullptr, nullptr);
 }
 
-void insert_soilsample(DB &db) {
-    cout << "Inserting new soilsample entry.\n";
-    int field_id;
-    string sdate;
-    double ph, nppm, pppm, kppm, om;
-    cout << "field_id: "; cin >> field_id;
-    if (!db.id_exists("field", "fld_fieldkey", field_id)) { cout << "Field id not found.\n"; cin.ignore(); return; }
-    cout << "sample_date (YYYY-MM-DD): "; cin >> sdate;
-    if (!valid_date(sdate)) { cout << "Invalid date format.\n"; cin.ignore(); return; }
-    cout << "ph (3.0 - 9.0): "; cin >> ph;
-    if (ph < 3.0 || ph > 9.0) { cout << "ph out of expected range.\n"; cin.ignore(); return; }
-    cout << "nitrogen_ppm (>=0): "; cin >> nppm;
-    if (nppm < 0) { cout << "must be >=0\n"; cin.ignore(); return; }
-    cout << "phosphorus_ppm (>=0): "; cin >> pppm;
-    if (pppm < 0) { cout << "must be >=0\n"; cin.ignore(); return; }
-    cout << "potassium_ppm (>=0): "; cin >> kppm;
-    if (kppm < 0) { cout << "must be >=0\n"; cin.ignore(); return; }
-    cout << "organic_matter_pct (>=0): "; cin >> om;
-    if (om < 0) { cout << "must be >=0\n"; cin.ignore(); return; }
-    cin.ignore();
+// ---------- Sample keys ----------
+// next_sample_key(max) picks the ss_samplekey of an insert from the current MAX. On a plain
+// database that is max + 1. A shard (see Sharded databases) carries a shard_info row; its
+// keys are then the next ones above both max and the split-time maximum that fall in the
+// shard's own residue class mod the shard count, so no two shards hand out the same key.
 
-    string sql = R"(INSERT INTO soilsample
-      (ss_fieldkey, ss_sampledate, ss_ph, ss_nitrogen_ppm, ss_phosphorus_ppm, ss_potassium_ppm, ss_organicmatter_pct)
-      VALUES (?, ?, ?, ?, ?, ?, ?);)";
-    sqlite3_stmt* stmt;
-    if (sqlite3_prepare_v2(db.db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) { cout << "Prepare error\n"; return; }
-    sqlite3_bind_int(stmt, 1, field_id);
-    sqlite3_bind_text(stmt, 2, sdate.c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_double(stmt, 3, ph);
-    sqlite3_bind_double(stmt, 4, nppm);
-    sqlite3_bind_double(stmt, 5, pppm);
-    sqlite3_bind_double(stmt, 6, kppm);
-    sqlite3_bind_double(stmt, 7, om);
-    if (sqlite3_step(stmt) != SQLITE_DONE) {
-        cout << "Insert failed: " << sqlite3_errmsg(db.db) << "\n";
-    } else cout << "Inserted soilsample row successfully.\n";
+struct ShardKeyRule {
+    int shard = 0;
+    int count = 1;
+    sqlite3_int64 base = 0;   // largest key when the database was split
+};
+
+// Leaves `rule` at its default when the database has no shard_info table.
+static void load_shard_key_rule(sqlite3* db, ShardKeyRule &rule) {
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db, "SELECT si_shard, si_count, si_key_base FROM shard_info;", -1, &stmt, nullptr) == SQLITE_OK &&
+        sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_int(stmt, 1) > 0) {
+        rule.shard = sqlite3_column_int(stmt, 0);
+        rule.count = sqlite3_column_int(stmt, 1);
+        rule.base = sqlite3_column_int64(stmt, 2);
+    }
     sqlite3_finalize(stmt);
-    promptContinue();
 }
 
-// ---------- Main menu ----------
+static void next_sample_key_fn(sqlite3_context* ctx, int, sqlite3_value** argv) {
+    const ShardKeyRule &r = *static_cast<const ShardKeyRule*>(sqlite3_user_data(ctx));
+    sqlite3_int64 max = sqlite3_value_type(argv[0]) == SQLITE_NULL ? 0 : sqlite3_value_int64(argv[0]);
+    sqlite3_int64 next = std::max(max, r.base) + 1;
+    next += ((r.shard - next) % r.count + r.count) % r.count;
+    sqlite3_result_int64(ctx, next);
+}
+
+void register_key_function(sqlite3* db, const ShardKeyRule* rule) {
+    sqlite3_create_function_v2(db, "next_sample_key", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, (void*)rule, next_sample_key_fn,
+                               nullptr, nullptr, nullptr);
+}
+
+// ---------- Result output ----------
+// Buffered result sink shared by every query that prints rows. Cells are copied straight
+// from sqlite3_column_text/_blob into a large staging buffer (no per-cell std::string),
+// which is handed to the target stream in big chunks.
+//
+//   table   aligned columns; widths come from the first TABLE_SAMPLE_ROWS rows, wider
+//           values later on are printed in full rather than cut
+//   csv/tsv RFC 4180 quoting for csv, \t \n \\ escapes for tsv
+//   ndjson  one JSON object per row, numbers unquoted
+//   json    the same objects as one JSON array per result set, one array per line
+//   binary  "AIMSROWS" u32 ncols, (u32 len, name) per column, then per row a 0x01 marker
+//           and per cell a type byte (0 null, 1 int64, 2 double, 3 text, 4 blob) followed
+//           by 8 little-endian bytes or u32 len + bytes; ends with 0x00 and u64 row count
+
+enum class OutputFormat { Table, Csv, Tsv, Ndjson, Json, Binary };
+
+static bool parse_output_format(const string &s, OutputFormat &f) {
+    if (s == "table") f = OutputFormat::Table;
+    else if (s == "csv") f = OutputFormat::Csv;
+    else if (s == "tsv") f = OutputFormat::Tsv;
+    else if (s == "ndjson") f = OutputFormat::Ndjson;
+    else if (s == "json") f = OutputFormat::Json;
+    else if (s == "binary") f = OutputFormat::Binary;
+    else return false;
+    return true;
+}
+
+class ResultWriter {
+public:
+    static const size_t BUFFER_BYTES = 1 << 18;
+    static const size_t TABLE_SAMPLE_ROWS = 1000;
+
+    explicit ResultWriter(std::streambuf* target = nullptr) : target_(target) { buf_.reserve(BUFFER_BYTES + 4096); }
+
+    // Writes go to target (default: std::cout's current buffer) or, if set, append to a string.
+    void set_target(std::streambuf* target) { flush(); target_ = target; text_ = nullptr; }
+    void set_target(string* text) { flush(); text_ = text; }
+    void set_format(OutputFormat f) { format_ = f; }
+    OutputFormat format() const { return format_; }
+    sqlite3_int64 rows() const { return rows_; }   // rows in the last result set
+
+    // Free-form text (report titles, .print lines); only shown in table format so the
+    // machine-readable formats stay parseable.
+    void note(const string &text) {
+        if (format_ != OutputFormat::Table) return;
+        put(text.data(), text.size());
+        flush();
+    }
+
+    void begin(sqlite3_stmt* stmt) {
+        ncols_ = sqlite3_column_count(stmt);
+        rows_ = 0;
+        names_.assign(ncols_, nullptr);
+        for (int i = 0; i < ncols_; ++i) names_[i] = sqlite3_column_name(stmt, i);
+        if (format_ == OutputFormat::Table) {
+            widths_.assign(ncols_, 0);
+            for (int i = 0; i < ncols_; ++i) widths_[i] = strlen(names_[i]);
+            sample_.clear();
+            sample_cells_.clear();
+            sampling_ = true;
+        } else if (format_ == OutputFormat::Csv || format_ == OutputFormat::Tsv) {
+            char sep = format_ == OutputFormat::Csv ? ',' : '\t';
+            for (int i = 0; i < ncols_; ++i) {
+                if (i) put(sep);
+                put_delimited(names_[i], strlen(names_[i]));
+            }
+            put('\n');
+        } else if (format_ == OutputFormat::Json) {
+            put('[');
+        } else if (format_ == OutputFormat::Binary) {
+            put("AIMSROWS", 8);
+            put_u32((uint32_t)ncols_);
+            for (int i = 0; i < ncols_; ++i) {
+                uint32_t n = (uint32_t)strlen(names_[i]);
+                put_u32(n);
+                put(names_[i], n);
+            }
+        }
+    }
+
+    void row(sqlite3_stmt* stmt) {
+        ++rows_;
+        switch (format_) {
+            case OutputFormat::Table: table_row(stmt); break;
+            case OutputFormat::Csv:
+            case OutputFormat::Tsv: {
+                char sep = format_ == OutputFormat::Csv ? ',' : '\t';
+                for (int i = 0; i < ncols_; ++i) {
+                    if (i) put(sep);
+                    int type = sqlite3_column_type(stmt, i);
+                    if (type == SQLITE_NULL) continue;
+                    if ((type == SQLITE_INTEGER || type == SQLITE_FLOAT) && put_number(stmt, i, type)) continue;
+                    const char* t = (const char*)sqlite3_column_text(stmt, i);
+                    put_delimited(t, (size_t)sqlite3_column_bytes(stmt, i));
+                }
+                put('\n');
+                break;
+            }
+            case OutputFormat::Ndjson:
+            case OutputFormat::Json: {
+                if (format_ == OutputFormat::Json && rows_ > 1) put(',');
+                put('{');
+                for (int i = 0; i < ncols_; ++i) {
+                    if (i) put(',');
+                    put_json_string(names_[i], strlen(names_[i]));
+                    put(':');
+                    int type = sqlite3_column_type(stmt, i);
+                    if (type == SQLITE_NULL) { put("null", 4); continue; }
+                    if ((type == SQLITE_INTEGER || type == SQLITE_FLOAT) && put_number(stmt, i, type)) continue;
+                    const char* t = (const char*)sqlite3_column_text(stmt, i);
+                    size_t n = (size_t)sqlite3_column_bytes(stmt, i);
+                    if (type == SQLITE_FLOAT && json_number(t, n)) put(t, n);
+                    else put_json_string(t, n);
+                }
+                if (format_ == OutputFormat::Json) put('}'); else put("}\n", 2);
+                break;
+            }
+            case OutputFormat::Binary: {
+                put('\x01');
+                for (int i = 0; i < ncols_; ++i) {
+                    switch (sqlite3_column_type(stmt, i)) {
+                        case SQLITE_NULL: put('\x00'); break;
+                        case SQLITE_INTEGER: { put('\x01'); int64_t v = sqlite3_column_int64(stmt, i); put_le(&v, 8); break; }
+                        case SQLITE_FLOAT: { put('\x02'); double v = sqlite3_column_double(stmt, i); put_le(&v, 8); break; }
+                        case SQLITE_TEXT: {
+                            put('\x03');
+                            const char* t = (const char*)sqlite3_column_text(stmt, i);
+                            uint32_t n = (uint32_t)sqlite3_column_bytes(stmt, i);
+                            put_u32(n); put(t, n);
+                            break;
+                        }
+                        default: {
+                            put('\x04');
+                            const char* b = (const char*)sqlite3_column_blob(stmt, i);
+                            uint32_t n = (uint32_t)sqlite3_column_bytes(stmt, i);
+                            put_u32(n); put(b, n);
+                        }
+                    }
+                }
+                break;
+            }
+        }
+        if (buf_.size() >= BUFFER_BYTES) flush();
+    }
+
+    // Finishes the result set; empty_msg is printed (table format only) when there were no rows.
+    sqlite3_int64 end(const char* empty_msg = "(no rows)") {
+        if (format_ == OutputFormat::Table) {
+            if (sampling_) emit_table_sample();
+            if (rows_ == 0 && empty_msg) { put(empty_msg, strlen(empty_msg)); put('\n'); }
+        } else if (format_ == OutputFormat::Json) {
+            put("]\n", 2);
+        } else if (format_ == OutputFormat::Binary) {
+            put('\x00');
+            uint64_t n = (uint64_t)rows_;
+            put_le(&n, 8);
+        }
+        flush();
+        return rows_;
+    }
+
+    void flush() {
+        if (buf_.empty()) return;
+        if (text_) text_->append(buf_);
+        else (target_ ? target_ : cout.rdbuf())->sputn(buf_.data(), (std::streamsize)buf_.size());
+        buf_.clear();
+    }
+
+    ~ResultWriter() { flush(); }
+
+private:
+    void put(char c) { buf_.push_back(c); }
+    void put(const char* p, size_t n) { buf_.append(p, n); }
+    void put_u32(uint32_t v) { put_le(&v, 4); }
+    void put_le(const void* v, size_t n) {
+        // x86/ARM hosts are little-endian; byte-swap here if a big-endian target ever matters
+        put((const char*)v, n);
+    }
+
+    // Numbers are formatted here rather than through sqlite3_column_text, whose REAL to
+    // text conversion dominates export time. Output matches SQLite's ("%!.15g", so 60
+    // prints as 60.0); exponent and non-finite forms are left to SQLite.
+    bool put_number(sqlite3_stmt* stmt, int col, int type) {
+        char tmp[32];
+        std::to_chars_result r;
+        if (type == SQLITE_INTEGER) {
+            r = std::to_chars(tmp, tmp + sizeof tmp, (long long)sqlite3_column_int64(stmt, col));
+            put(tmp, r.ptr - tmp);
+            return true;
+        }
+        double v = sqlite3_column_double(stmt, col);
+        if (!std::isfinite(v)) return false;
+        if (v == 0) v = 0.0; // SQLite prints -0.0 as 0.0
+        // Shortest round-trip form first; it equals %.15g whenever it needs 15 digits or fewer.
+        r = std::to_chars(tmp, tmp + sizeof tmp - 2, v, std::chars_format::general);
+        if (r.ec != std::errc()) return false;
+        int digits = 0;
+        for (char* c = tmp; c < r.ptr && *c != 'e'; ++c) digits += *c >= '0' && *c <= '9';
+        if (digits > 15) r = std::to_chars(tmp, tmp + sizeof tmp - 2, v, std::chars_format::general, 15);
+        if (r.ec != std::errc()) return false;
+        bool has_point = false;
+        for (char* c = tmp; c < r.ptr; ++c) {
+            if (*c == 'e') return false;
+            if (*c == '.') has_point = true;
+        }
+        if (!has_point) { *r.ptr++ = '.'; *r.ptr++ = '0'; }
+        put(tmp, r.ptr - tmp);
+        return true;
+    }
+
+    void put_delimited(const char* t, size_t n) {
+        if (format_ == OutputFormat::Csv) {
+            bool quote = false;
+            for (size_t i = 0; i < n && !quote; ++i) quote = t[i] == ',' || t[i] == '"' || t[i] == '\n' || t[i] == '\r';
+            if (!quote) { put(t, n); return; }
+            put('"');
+            for (size_t i = 0; i < n; ++i) { if (t[i] == '"') put('"'); put(t[i]); }
+            put('"');
+        } else {
+            for (size_t i = 0; i < n; ++i) {
+                char c = t[i];
+                if (c == '\t') put("\\t", 2);
+                else if (c == '\n') put("\\n", 2);
+                else if (c == '\r') put("\\r", 2);
+                else if (c == '\\') put("\\\\", 2);
+                else put(c);
+            }
+        }
+    }
+
+    void put_json_string(const char* t, size_t n) {
+        put('"');
+        for (size_t i = 0; i < n; ++i) {
+            unsigned char c = (unsigned char)t[i];
+            if (c == '"') put("\\\"", 2);
+            else if (c == '\\') put("\\\\", 2);
+            else if (c == '\n') put("\\n", 2);
+            else if (c == '\r') put("\\r", 2);
+            else if (c == '\t') put("\\t", 2);
+            else if (c < 0x20) { char esc[8]; snprintf(esc, sizeof esc, "\\u%04x", c); put(esc, 6); }
+            else put((char)c);
+        }
+        put('"');
+    }
+
+    // SQLite renders non-finite doubles as "Inf"/"NaN", which JSON cannot carry unquoted.
+    static bool json_number(const char* t, size_t n) {
+        for (size_t i = 0; i < n; ++i) if (t[i] == 'I' || t[i] == 'N' || t[i] == 'n') return false;
+        return true;
+    }
+
+    void table_row(sqlite3_stmt* stmt) {
+        if (!sampling_) { table_cells(stmt); return; }
+        // Hold the first rows in one flat arena to size the columns.
+        for (int i = 0; i < ncols_; ++i) {
+            bool null = sqlite3_column_type(stmt, i) == SQLITE_NULL;
+            const char* t = null ? "NULL" : (const char*)sqlite3_column_text(stmt, i);
+            size_t n = null ? 4 : (size_t)sqlite3_column_bytes(stmt, i);
+            sample_cells_.push_back({sample_.size(), n});
+            sample_.append(t, n);
+            widths_[i] = std::max(widths_[i], n);
+        }
+        if ((size_t)rows_ >= TABLE_SAMPLE_ROWS) emit_table_sample();
+    }
+
+    void emit_table_sample() {
+        sampling_ = false;
+        if (rows_ == 0) return;
+        for (int i = 0; i < ncols_; ++i) pad_cell(names_[i], strlen(names_[i]), i);
+        put('\n');
+        for (int i = 0; i < ncols_; ++i) { buf_.append(widths_[i], '-'); if (i + 1 < ncols_) put("  ", 2); }
+        put('\n');
+        for (size_t c = 0; c < sample_cells_.size(); ++c) {
+            pad_cell(sample_.data() + sample_cells_[c].first, sample_cells_[c].second, (int)(c % ncols_));
+            if ((int)(c % ncols_) == ncols_ - 1) put('\n');
+        }
+        sample_.clear();
+        sample_cells_.clear();
+    }
+
+    void table_cells(sqlite3_stmt* stmt) {
+        for (int i = 0; i < ncols_; ++i) {
+            int type = sqlite3_column_type(stmt, i);
+            if (type == SQLITE_NULL) { pad_cell("NULL", 4, i); continue; }
+            if (type == SQLITE_INTEGER || type == SQLITE_FLOAT) {
+                size_t start = buf_.size();
+                if (put_number(stmt, i, type)) { pad_after(buf_.size() - start, i); continue; }
+            }
+            pad_cell((const char*)sqlite3_column_text(stmt, i), (size_t)sqlite3_column_bytes(stmt, i), i);
+        }
+        put('\n');
+    }
+
+    void pad_cell(const char* t, size_t n, int col) {
+        put(t, n);
+        pad_after(n, col);
+    }
+
+    void pad_after(size_t n, int col) {
+        if (col + 1 == ncols_) return; // no trailing padding on the last column
+        if (n < widths_[col]) buf_.append(widths_[col] - n, ' ');
+        put("  ", 2);
+    }
+
+    std::streambuf* target_;
+    string* text_ = nullptr;
+    OutputFormat format_ = OutputFormat::Table;
+    string buf_;
+    int ncols_ = 0;
+    sqlite3_int64 rows_ = 0;
+    vector<const char*> names_;
+    vector<size_t> widths_;
+    bool sampling_ = false;
+    string sample_;
+    vector<std::pair<size_t, size_t>> sample_cells_;
+};
+
+// ---------- Query statistics ----------
+// --stats FILE (or "-" for stderr) turns on instrumentation for every connection the run
+// opens. Each DB registers sqlite3_trace_v2 callbacks. Per distinct SQL text they collect
+// runs, rows returned, a latency histogram, sqlite3_stmt_status counters (VM steps,
+// full-scan steps, sorts, automatic indexes) and page-cache hits and misses from
+// sqlite3_db_status. Batch and serve commands also get a latency histogram per operation.
+// The merged JSON is written on exit and is available on demand from the "stats" command
+// and from GET /api/stats in serve mode.
+//
+// --slow-ms N logs every statement that took at least N ms, with its bound parameters
+// expanded, to --slow-log FILE (default stderr).
+//
+// A statement is timed from its first step (SQLITE_TRACE_STMT) to its profile event (done
+// or reset) on the steady clock; SQLite's own profile time is only millisecond-grained. A
+// caller that keeps a statement open while printing rows is charged for the printing.
+
+struct StatsConfig {
+    bool enabled = false;
+    string out;               // JSON written on exit; "-" is stderr
+    double slow_ms = -1;      // < 0: no slow-query log
+    string slow_log;          // empty: stderr
+};
+static StatsConfig stats_config;
+
+// Log-linear histogram in the style of HdrHistogram: each power-of-two range of nanoseconds
+// is split into SUB_BUCKETS linear buckets, so every percentile is within 1/SUB_BUCKETS
+// (about 3%) of the exact value at any scale, with O(1) recording and fixed memory.
+class LatencyHistogram {
+public:
+    static const int SUB_BITS = 5;
+    static const uint64_t SUB_BUCKETS = 1u << SUB_BITS;
+    static const int RANGES = 40;   // up to 2^44 ns, about 4.9 hours
+
+    void record(uint64_t ns) {
+        if (counts_.empty()) counts_.assign((RANGES + 1) * SUB_BUCKETS, 0);
+        ++counts_[std::min(index(ns), counts_.size() - 1)];
+        if (count_ == 0 || ns < min_) min_ = ns;
+        max_ = std::max(max_, ns);
+        sum_ += ns;
+        ++count_;
+    }
+
+    void merge(const LatencyHistogram &o) {
+        if (o.count_ == 0) return;
+        if (counts_.empty()) counts_.assign(o.counts_.size(), 0);
+        for (size_t i = 0; i < counts_.size(); ++i) counts_[i] += o.counts_[i];
+        min_ = count_ ? std::min(min_, o.min_) : o.min_;
+        max_ = std::max(max_, o.max_);
+        sum_ += o.sum_;
+        count_ += o.count_;
+    }
+
+    uint64_t count() const { return count_; }
+    uint64_t sum() const { return sum_; }
+
+    // Value at quantile q in [0, 1]: the middle of the bucket holding that rank, clamped
+    // to the exact min and max.
+    uint64_t percentile(double q) const {
+        if (count_ == 0) return 0;
+        uint64_t rank = std::max<uint64_t>(1, (uint64_t)std::ceil(q * count_)), seen = 0;
+        for (size_t i = 0; i < counts_.size(); ++i) {
+            seen += counts_[i];
+            if (seen >= rank) return std::min(max_, std::max(min_, bucket_mid(i)));
+        }
+        return max_;
+    }
+
+    // {"min":..,"p50":..,"p90":..,"p99":..,"p999":..,"max":..,"mean":..} in microseconds.
+    string json_us() const {
+        std::ostringstream js;
+        js << std::fixed << std::setprecision(1);
+        auto us = [](uint64_t ns) { return ns / 1000.0; };
+        js << "{\"min\": " << us(count_ ? min_ : 0) << ", \"p50\": " << us(percentile(0.50)) << ", \"p90\": " << us(percentile(0.90))
+           << ", \"p99\": " << us(percentile(0.99)) << ", \"p999\": " << us(percentile(0.999)) << ", \"max\": " << us(max_)
+           << ", \"mean\": " << (count_ ? us(sum_) / count_ : 0.0) << "}";
+        return js.str();
+    }
+
+private:
+    // Values below 2 * SUB_BUCKETS map to themselves; above, a range is selected by the
+    // highest set bit and a sub-bucket by the next SUB_BITS bits.
+    static size_t index(uint64_t v) {
+        int shift = 0;
+        while ((v >> shift) >= 2 * SUB_BUCKETS) ++shift;
+        return (size_t)shift * SUB_BUCKETS + (size_t)(v >> shift);
+    }
+
+    static uint64_t bucket_mid(size_t i) {
+        size_t shift = i < 2 * SUB_BUCKETS ? 0 : i / SUB_BUCKETS - 1;
+        uint64_t low = (uint64_t)(i - shift * SUB_BUCKETS) << shift;
+        return low + ((1ull << shift) >> 1);
+    }
+
+    vector<uint64_t> counts_;
+    uint64_t count_ = 0, min_ = 0, max_ = 0, sum_ = 0;
+};
+
+struct QueryStat {
+    uint64_t rows = 0, vm_steps = 0, fullscan_steps = 0, sorts = 0, autoindexes = 0;
+    uint64_t cache_hits = 0, cache_misses = 0;
+    LatencyHistogram latency;
+
+    void merge(const QueryStat &o) {
+        rows += o.rows; vm_steps += o.vm_steps; fullscan_steps += o.fullscan_steps;
+        sorts += o.sorts; autoindexes += o.autoindexes;
+        cache_hits += o.cache_hits; cache_misses += o.cache_misses;
+        latency.merge(o.latency);
+    }
+};
+
+// One connection's statistics. Written by the thread that owns the connection; the mutex
+// lets snapshots (stats command, /api/stats) read it from other threads.
+class QueryStats {
+public:
+    // SQLITE_TRACE_STMT: the statement starts running (trigger programs are skipped).
+    void start(sqlite3_stmt* stmt, const char* text) {
+        if (text && text[0] == '-' && text[1] == '-') return;
+        Running &r = running_[stmt];
+        r.started = std::chrono::steady_clock::now();
+        r.rows = 0;
+        last_stmt_ = nullptr;
+    }
+
+    // SQLITE_TRACE_ROW: counted against the running statement until its profile event.
+    void count_row(sqlite3_stmt* stmt) {
+        if (stmt != last_stmt_) { last_stmt_ = stmt; last_rows_ = &running_[stmt].rows; }
+        ++*last_rows_;
+    }
+
+    // SQLITE_TRACE_PROFILE: the statement finished or was reset.
+    void record(sqlite3* db, sqlite3_stmt* stmt);
+
+    void record_operation(const string &name, uint64_t ns) {
+        std::lock_guard<std::mutex> lk(mu_);
+        operations_[name].record(ns);
+    }
+
+    void merge_into(QueryStats &into) {
+        std::lock_guard<std::mutex> lk(mu_);
+        std::lock_guard<std::mutex> lk2(into.mu_);
+        for (auto &q : queries_) into.queries_[q.first].merge(q.second);
+        for (auto &o : operations_) into.operations_[o.first].merge(o.second);
+        into.slow_ += slow_;
+    }
+
+    string json(int connections);
+
+private:
+    std::mutex mu_;
+    std::unordered_map<string, QueryStat> queries_;
+    std::map<string, LatencyHistogram> operations_;
+    uint64_t slow_ = 0;
+
+    struct Running {
+        std::chrono::steady_clock::time_point started;
+        uint64_t rows = 0;
+    };
+    std::unordered_map<sqlite3_stmt*, Running> running_;   // owning thread only
+    sqlite3_stmt* last_stmt_ = nullptr;
+    uint64_t* last_rows_ = nullptr;
+};
+
+// Connections register while open; on close their numbers fold into `retired`.
+class StatsRegistry {
+public:
+    void attach(QueryStats* s) {
+        std::lock_guard<std::mutex> lk(mu_);
+        live_.insert(s);
+        ++connections_;
+    }
+
+    void detach(QueryStats* s) {
+        std::lock_guard<std::mutex> lk(mu_);
+        s->merge_into(retired_);
+        live_.erase(s);
+    }
+
+    string json() {
+        QueryStats all;
+        int connections;
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            retired_.merge_into(all);
+            for (auto s : live_) s->merge_into(all);
+            connections = connections_;
+        }
+        return all.json(connections);
+    }
+
+    void log_slow(const string &line) {
+        std::lock_guard<std::mutex> lk(log_mu_);
+        if (!log_opened_) {
+            log_opened_ = true;
+            if (!stats_config.slow_log.empty()) log_.open(stats_config.slow_log, std::ios::app);
+        }
+        std::ostream &os = log_.is_open() ? (std::ostream&)log_ : std::cerr;
+        os << line << "\n";
+        os.flush();
+    }
+
+private:
+    std::mutex mu_, log_mu_;
+    QueryStats retired_;
+    std::set<QueryStats*> live_;
+    int connections_ = 0;
+    std::ofstream log_;
+    bool log_opened_ = false;
+};
+
+static StatsRegistry &stats_registry() {
+    static StatsRegistry registry;
+    return registry;
+}
+
+void QueryStats::record(sqlite3* db, sqlite3_stmt* stmt) {
+    auto it = running_.find(stmt);
+    if (it == running_.end()) return;
+    uint64_t rows = it->second.rows;
+    uint64_t ns = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - it->second.started).count();
+    running_.erase(it);
+    last_stmt_ = nullptr;
+
+    int hits = 0, misses = 0, high = 0;
+    sqlite3_db_status(db, SQLITE_DBSTATUS_CACHE_HIT, &hits, &high, 1);
+    sqlite3_db_status(db, SQLITE_DBSTATUS_CACHE_MISS, &misses, &high, 1);
+    uint64_t fullscan = (uint64_t)sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_FULLSCAN_STEP, 1);
+    uint64_t sorts = (uint64_t)sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_SORT, 1);
+    uint64_t autoindexes = (uint64_t)sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_AUTOINDEX, 1);
+    uint64_t vm_steps = (uint64_t)sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_VM_STEP, 1);
+    const char* sql = sqlite3_sql(stmt);
+    bool slow = stats_config.slow_ms >= 0 && ns >= stats_config.slow_ms * 1e6;
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        QueryStat &q = queries_[sql ? sql : ""];
+        q.rows += rows;
+        q.vm_steps += vm_steps;
+        q.fullscan_steps += fullscan;
+        q.sorts += sorts;
+        q.autoindexes += autoindexes;
+        q.cache_hits += (uint64_t)hits;
+        q.cache_misses += (uint64_t)misses;
+        q.latency.record(ns);
+        if (slow) ++slow_;
+    }
+    if (slow) {
+        char* expanded = sqlite3_expanded_sql(stmt);
+        std::ostringstream line;
+        line << std::fixed << std::setprecision(3) << "slow query " << ns / 1e6 << " ms rows=" << rows << " fullscan_steps=" << fullscan
+             << " sorts=" << sorts << " cache_misses=" << misses << ": ";
+        // one line per query: whitespace runs collapse to a space
+        const char* c = expanded ? expanded : sql ? sql : "";
+        while (std::isspace((unsigned char)*c)) ++c;
+        for (; *c; ++c) {
+            if (!std::isspace((unsigned char)*c)) line << *c;
+            else if (!std::isspace((unsigned char)c[1])) line << ' ';
+        }
+        sqlite3_free(expanded);
+        stats_registry().log_slow(line.str());
+    }
+}
+
+// Queries and operations, most total time first.
+string QueryStats::json(int connections) {
+    std::lock_guard<std::mutex> lk(mu_);
+    vector<std::pair<const string*, const QueryStat*>> queries;
+    for (auto &q : queries_) queries.push_back({&q.first, &q.second});
+    std::sort(queries.begin(), queries.end(), [](auto &a, auto &b) { return a.second->latency.sum() > b.second->latency.sum(); });
+    vector<std::pair<const string*, const LatencyHistogram*>> ops;
+    for (auto &o : operations_) ops.push_back({&o.first, &o.second});
+    std::sort(ops.begin(), ops.end(), [](auto &a, auto &b) { return a.second->sum() > b.second->sum(); });
+
+    std::ostringstream js;
+    js << std::fixed << std::setprecision(3);
+    js << "{\n  \"connections\": " << connections << ",\n  \"slow_queries\": " << slow_ << ",\n  \"operations\": [";
+    for (size_t i = 0; i < ops.size(); ++i) {
+        js << (i ? ",\n" : "\n") << "    {\"name\": \"" << json_escape(*ops[i].first) << "\", \"runs\": " << ops[i].second->count()
+           << ", \"total_ms\": " << ops[i].second->sum() / 1e6 << ", \"latency_us\": " << ops[i].second->json_us() << "}";
+    }
+    js << (ops.empty() ? "],\n" : "\n  ],\n") << "  \"queries\": [";
+    for (size_t i = 0; i < queries.size(); ++i) {
+        const QueryStat &q = *queries[i].second;
+        js << (i ? ",\n" : "\n") << "    {\"sql\": \"" << json_escape(*queries[i].first) << "\", \"runs\": " << q.latency.count()
+           << ", \"rows\": " << q.rows << ", \"total_ms\": " << q.latency.sum() / 1e6 << ", \"latency_us\": " << q.latency.json_us()
+           << ", \"vm_steps\": " << q.vm_steps << ", \"fullscan_steps\": " << q.fullscan_steps << ", \"sorts\": " << q.sorts
+           << ", \"autoindexes\": " << q.autoindexes << ", \"cache_hits\": " << q.cache_hits << ", \"cache_misses\": " << q.cache_misses << "}";
+    }
+    js << (queries.empty() ? "]\n}\n" : "\n  ]\n}\n");
+    return js.str();
+}
+
+static bool write_stats_json(const string &path) {
+    string js = stats_registry().json();
+    if (path == "-") { std::cerr << js; return true; }
+    std::ofstream f(path, std::ios::binary);
+    if (!f) { std::cerr << "Can't write stats to " << path << "\n"; return false; }
+    f << js;
+    return true;
+}
+
+// ---------- DB wrapper ----------
+struct DB;
+struct SoilColumns;
+struct ComplianceIndex;
+class ColumnSnapshot;
+class WritePipeline;
+
+// Outcome of one queued insert; see WritePipeline.
+struct WriteResult {
+    bool ok = false;
+    string message;
+    bool busy = false;   // turned away because the queue was full; nothing was written
+};
+using WriteTicket = std::shared_future<WriteResult>;
+
+// One entry of DB's prepared statement cache. List nodes don't move, so a borrowed Stmt
+// keeps a pointer to its entry and gives the statement back without a search.
+struct CachedStmt {
+    string sql;
+    sqlite3_stmt* stmt;
+    bool in_use;
+};
+
+// Borrowed statement from the DB cache. Converts to sqlite3_stmt* so the usual
+// sqlite3_bind_* / sqlite3_step calls work unchanged; on destruction the statement
+// is reset and its bindings cleared so the next user gets a clean statement.
+class Stmt {
+public:
+    Stmt() {}
+    Stmt(DB* owner, sqlite3_stmt* stmt, CachedStmt* entry) : owner_(owner), stmt_(stmt), entry_(entry) {}
+    Stmt(Stmt &&o) noexcept : owner_(o.owner_), stmt_(o.stmt_), entry_(o.entry_) { o.stmt_ = nullptr; }
+    Stmt& operator=(Stmt &&o) noexcept {
+        if (this != &o) { release(); owner_ = o.owner_; stmt_ = o.stmt_; entry_ = o.entry_; o.stmt_ = nullptr; }
+        return *this;
+    }
+    Stmt(const Stmt&) = delete;
+    Stmt& operator=(const Stmt&) = delete;
+    ~Stmt() { release(); }
+
+    operator sqlite3_stmt*() const { return stmt_; }
+    sqlite3_stmt* get() const { return stmt_; }
+    void release();
+
+private:
+    DB* owner_ = nullptr;
+    sqlite3_stmt* stmt_ = nullptr;
+    CachedStmt* entry_ = nullptr;   // null for a private, uncached statement
+};
+
+struct DB {
+    sqlite3* db = nullptr;
+
+    // Prepared statement cache, keyed by SQL text, least recently used at the back.
+    std::list<CachedStmt> stmt_lru;
+    std::unordered_map<string, std::list<CachedStmt>::iterator> stmt_index;
+    size_t stmt_cache_capacity = 64;
+    uint64_t stmt_cache_hits = 0;
+    uint64_t stmt_cache_misses = 0;
+    uint64_t stmt_cache_evictions = 0;
+
+    // Row-change notifications (sqlite3_update_hook) for in-memory copies layered on this
+    // connection. Listeners run inside sqlite3_step and must not use the connection.
+    using ChangeListener = std::function<void(int op, const char* table, sqlite3_int64 rowid)>;
+    vector<ChangeListener> change_listeners;
+
+    // Optional in-memory column store of soilsample, built on first use.
+    std::shared_ptr<SoilColumns> soil_columns;
+    // Optional exceedance index over contaminant limits (see Contaminant compliance).
+    std::shared_ptr<ComplianceIndex> compliance;
+    // Columnar snapshot opened with --snapshot; analytics read it instead of the tables.
+    std::shared_ptr<ColumnSnapshot> snapshot;
+
+    // Where and how query results are printed (--format / "format" command).
+    ResultWriter out;
+
+    // Status and error messages from operations ("Field not found.", "Inserted ..."). cout
+    // unless a caller such as serve collects them per request.
+    std::ostream* messages = &cout;
+    std::ostream &msg() { return *messages; }
+
+    // Threads a whole-table pass run as a command (rotation-matrix, recommend) may use. Serve
+    // workers set 1, so a request stays on its worker's thread and connection.
+    int scan_jobs = (int)std::max(1u, std::thread::hardware_concurrency());
+
+    // Group-commit writer for inserts (batch and serve modes); nullptr writes directly.
+    WritePipeline* writes = nullptr;
+    // Batch and serve modes: inserts are queued without waiting; drain_writes() (or the
+    // serve worker) reports them.
+    vector<WriteTicket>* deferred_writes = nullptr;
+    // Called on the writer thread once a batch holding inserts from this connection is done.
+    std::function<void()> writes_done;
+
+    // --stats: per-statement counters through sqlite3_trace_v2 (see Query statistics).
+    std::unique_ptr<QueryStats> stats;
+
+    // Key rule of next_sample_key() on this connection (see Sample keys).
+    ShardKeyRule shard_key;
+
+    int schema_version_cache = -1;   // see schema_version()
+
+    bool open(const string &path) {
+        if (sqlite3_open(path.c_str(), &db) != SQLITE_OK) {
+            cout << "Can't open DB: " << sqlite3_errmsg(db) << "\n";
+            return false;
+        }
+        // Enable foreign keys (good practice)
+        sqlite3_exec(db, "PRAGMA foreign_keys = ON;", nullptr, nullptr, nullptr);
+        register_aggregates(db);
+        register_date_functions(db);
+        load_shard_key_rule(db, shard_key);
+        register_key_function(db, &shard_key);
+        if (stats_config.enabled) enable_stats();
+        return true;
+    }
+
+    // Read-only connection for the report pool. One thread at a time per connection, so
+    // sqlite's own mutexes are skipped; busy_timeout covers WAL checkpoints by the writer.
+    bool open_readonly(const string &path) {
+        if (sqlite3_open_v2(path.c_str(), &db, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, nullptr) != SQLITE_OK) {
+            cout << "Can't open DB: " << sqlite3_errmsg(db) << "\n";
+            return false;
+        }
+        sqlite3_busy_timeout(db, 5000);
+        register_aggregates(db);
+        register_date_functions(db);
+        if (stats_config.enabled) enable_stats();
+        return true;
+    }
+
+    void enable_stats() {
+        stats = std::make_unique<QueryStats>();
+        stats_registry().attach(stats.get());
+        unsigned mask = SQLITE_TRACE_STMT | SQLITE_TRACE_ROW | SQLITE_TRACE_PROFILE;
+        sqlite3_trace_v2(db, mask, [](unsigned type, void* self, void* p, void* x) {
+            DB* owner = static_cast<DB*>(self);
+            if (type == SQLITE_TRACE_ROW) owner->stats->count_row((sqlite3_stmt*)p);
+            else if (type == SQLITE_TRACE_STMT) owner->stats->start((sqlite3_stmt*)p, (const char*)x);
+            else owner->stats->record(owner->db, (sqlite3_stmt*)p);
+            return 0;
+        }, this);
+    }
+
+    void add_change_listener(ChangeListener fn) {
+        change_listeners.push_back(std::move(fn));
+        sqlite3_update_hook(db, [](void* self, int op, const char*, const char* table, sqlite3_int64 rowid) {
+            for (auto &l : static_cast<DB*>(self)->change_listeners) l(op, table, rowid);
+        }, this);
+    }
+    void close() {
+        clear_stmt_cache();
+        if (stats) {
+            sqlite3_trace_v2(db, 0, nullptr, nullptr);
+            stats_registry().detach(stats.get());
+            stats.reset();
+        }
+        if (db) sqlite3_close(db);
+        db = nullptr;
+    }
+
+    ~DB() { close(); }
+
+    // Returns a ready-to-bind statement for sql, compiling it only on a cache miss.
+    // A null Stmt means the SQL failed to prepare (see sqlite3_errmsg).
+    Stmt prepare(const string &sql) {
+        auto it = stmt_index.find(sql);
+        if (it != stmt_index.end()) {
+            auto entry = it->second;
+            if (!entry->in_use) {
+                ++stmt_cache_hits;
+                entry->in_use = true;
+                stmt_lru.splice(stmt_lru.begin(), stmt_lru, entry);
+                return Stmt(this, entry->stmt, &*entry);
+            }
+            // Same SQL already borrowed (nested use): hand out a private, uncached copy.
+            ++stmt_cache_misses;
+            sqlite3_stmt* stmt = nullptr;
+            if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) { sqlite3_finalize(stmt); return Stmt(); }
+            return Stmt(this, stmt, nullptr);
+        }
+        ++stmt_cache_misses;
+        sqlite3_stmt* stmt = nullptr;
+        if (sqlite3_prepare_v3(db, sql.c_str(), -1, SQLITE_PREPARE_PERSISTENT, &stmt, nullptr) != SQLITE_OK) {
+            sqlite3_finalize(stmt);
+            return Stmt();
+        }
+        evict_stmts(stmt_cache_capacity > 0 ? stmt_cache_capacity - 1 : 0);
+        stmt_lru.push_front(CachedStmt{sql, stmt, true});
+        stmt_index[sql] = stmt_lru.begin();
+        return Stmt(this, stmt, &stmt_lru.front());
+    }
+
+    void release_stmt(sqlite3_stmt* stmt, CachedStmt* entry) {
+        sqlite3_reset(stmt);
+        if (!entry) { sqlite3_finalize(stmt); return; }
+        sqlite3_clear_bindings(stmt);
+        entry->in_use = false;
+        evict_stmts(stmt_cache_capacity);
+    }
+
+    // Drop least recently used idle statements until at most `keep` remain.
+    void evict_stmts(size_t keep) {
+        auto it = stmt_lru.end();
+        while (stmt_lru.size() > keep && it != stmt_lru.begin()) {
+            --it;
+            if (it->in_use) continue;
+            sqlite3_finalize(it->stmt);
+            stmt_index.erase(it->sql);
+            it = stmt_lru.erase(it);
+            ++stmt_cache_evictions;
+        }
+    }
+
+    void clear_stmt_cache() {
+        for (auto &e : stmt_lru) sqlite3_finalize(e.stmt);
+        stmt_lru.clear();
+        stmt_index.clear();
+    }
+
+    bool table_exists(const string &name) {
+        Stmt stmt = prepare("SELECT COUNT(1) FROM sqlite_master WHERE type='table' AND name = ?;");
+        if (!stmt) return false;
+        sqlite3_bind_text(stmt, 1, name.c_str(), -1, SQLITE_TRANSIENT);
+        bool exists = false;
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            int count = sqlite3_column_int(stmt, 0);
+            exists = (count > 0);
+        }
+        return exists;
+    }
+
+    // PRAGMA user_version, maintained by migrate(); -1 if it can't be read. Read once per
+    // connection: whatever sets user_version calls forget_schema_version() afterwards.
+    int schema_version() {
+        if (schema_version_cache >= 0) return schema_version_cache;
+        Stmt stmt = prepare("PRAGMA user_version;");
+        if (!stmt || sqlite3_step(stmt) != SQLITE_ROW) return -1;
+        return schema_version_cache = sqlite3_column_int(stmt, 0);
+    }
+    void forget_schema_version() { schema_version_cache = -1; }
+
+    bool id_exists(const string &table, const string &pk_col, sqlite3_int64 id) {
+        Stmt stmt = prepare("SELECT 1 FROM " + table + " WHERE " + pk_col + " = ? LIMIT 1;");
+        if (!stmt) return false;
+        sqlite3_bind_int64(stmt, 1, id);
+        return sqlite3_step(stmt) == SQLITE_ROW;
+    }
+
+    // Generic function to run a query with no parameters and print results
+    bool run_and_print(const string &sql) {
+        Stmt stmt = prepare(sql);
+        if (!stmt) {
+            msg() << "Query prepare error: " << sqlite3_errmsg(db) << "\n";
+            return false;
+        }
+        return print_result(stmt);
+    }
+
+    // Steps an already bound statement to completion, streaming every row through `out`.
+    bool print_result(sqlite3_stmt* stmt, const char* empty_msg = "(no rows)") {
+        out.begin(stmt);
+        int rc;
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) out.row(stmt);
+        out.end(empty_msg);
+        if (rc != SQLITE_DONE) {
+            msg() << "Query error: " << sqlite3_errmsg(db) << "\n";
+            return false;
+        }
+        return true;
+    }
+};
+
+void Stmt::release() {
+    if (stmt_ && owner_) owner_->release_stmt(stmt_, entry_);
+    stmt_ = nullptr;
+}
+
+// Result set computed in C++ rather than by a query: each row is bound to a
+// "SELECT ?1 AS <col>, ..." statement and stepped once, so db.out prints and types the
+// cells exactly as it does for query results, in every output format.
+class RowPrinter {
+public:
+    RowPrinter(DB &db, const vector<string> &columns) : db_(db) {
+        string sql = "SELECT ";
+        for (size_t i = 0; i < columns.size(); ++i) sql += (i ? ", ?" : "?") + std::to_string(i + 1) + " AS \"" + columns[i] + "\"";
+        stmt_ = db.prepare(sql);
+        if (stmt_) db.out.begin(stmt_);
+    }
+    explicit operator bool() const { return stmt_.get() != nullptr; }
+
+    void set(int col, sqlite3_int64 v) { sqlite3_bind_int64(stmt_, col + 1, v); }
+    void set(int col, double v) { sqlite3_bind_double(stmt_, col + 1, v); }
+    void set(int col, const string &v) { sqlite3_bind_text(stmt_, col + 1, v.c_str(), (int)v.size(), SQLITE_TRANSIENT); }
+    void set_null(int col) { sqlite3_bind_null(stmt_, col + 1); }
+
+    void emit() {
+        if (sqlite3_step(stmt_) == SQLITE_ROW) db_.out.row(stmt_);
+        sqlite3_reset(stmt_);
+    }
+    sqlite3_int64 end(const char* empty_msg = "(no rows)") { return db_.out.end(empty_msg); }
+
+private:
+    DB &db_;
+    Stmt stmt_;
+};
+
+// ---------- Typed queries ----------
+// A query's parameter and result column types are declared once, next to its SQL, and the
+// compiler checks every call against them: binding goes through the matching sqlite3_bind_*,
+// and rows decode into a struct through sqlite3_column_int64 / double, so numbers never
+// round-trip through text and nothing is allocated per row. Text columns decode to a
+// string_view over sqlite's buffer, valid until the next row. That the SQL really returns
+// the declared number of columns is checked once per call, after prepare.
+//
+//   Statement<int, string_view>               bind, then print through db.out
+//   Query<Columns<&Row::a, &Row::b>, int>     bind, then decode each row into a Row
+//   Query<Value<sqlite3_int64>, int>          single-column result
+
+template<typename T> struct SqlValue;
+
+template<> struct SqlValue<int> {
+    static int bind(sqlite3_stmt* s, int i, int v) { return sqlite3_bind_int(s, i, v); }
+    static int get(sqlite3_stmt* s, int c) { return sqlite3_column_int(s, c); }
+};
+template<> struct SqlValue<sqlite3_int64> {
+    static int bind(sqlite3_stmt* s, int i, sqlite3_int64 v) { return sqlite3_bind_int64(s, i, v); }
+    static sqlite3_int64 get(sqlite3_stmt* s, int c) { return sqlite3_column_int64(s, c); }
+};
+template<> struct SqlValue<double> {
+    static int bind(sqlite3_stmt* s, int i, double v) { return sqlite3_bind_double(s, i, v); }
+    static double get(sqlite3_stmt* s, int c) { return sqlite3_column_double(s, c); }
+};
+// Parameters are bound SQLITE_STATIC: they outlive the call that binds and steps them.
+template<> struct SqlValue<std::string_view> {
+    static int bind(sqlite3_stmt* s, int i, std::string_view v) { return sqlite3_bind_text(s, i, v.data(), (int)v.size(), SQLITE_STATIC); }
+    static std::string_view get(sqlite3_stmt* s, int c) {
+        const char* t = (const char*)sqlite3_column_text(s, c);
+        return t ? std::string_view(t, (size_t)sqlite3_column_bytes(s, c)) : std::string_view();
+    }
+};
+template<> struct SqlValue<string> {
+    static int bind(sqlite3_stmt* s, int i, const string &v) { return sqlite3_bind_text(s, i, v.c_str(), (int)v.size(), SQLITE_STATIC); }
+    static string get(sqlite3_stmt* s, int c) { return string(SqlValue<std::string_view>::get(s, c)); }
+};
+// NULL in either direction.
+template<typename T> struct SqlValue<std::optional<T>> {
+    static int bind(sqlite3_stmt* s, int i, const std::optional<T> &v) { return v ? SqlValue<T>::bind(s, i, *v) : sqlite3_bind_null(s, i); }
+    static std::optional<T> get(sqlite3_stmt* s, int c) {
+        if (sqlite3_column_type(s, c) == SQLITE_NULL) return std::nullopt;
+        return SqlValue<T>::get(s, c);
+    }
+};
+
+template<typename M> struct MemberOf;
+template<typename C, typename T> struct MemberOf<T C::*> { using Class = C; using Type = T; };
+
+// Result columns mapped in order onto members of one struct.
+template<auto First, auto... Rest>
+struct Columns {
+    using Row = typename MemberOf<decltype(First)>::Class;
+    static constexpr int count = 1 + (int)sizeof...(Rest);
+    static_assert((std::is_same_v<Row, typename MemberOf<decltype(Rest)>::Class> && ...), "columns must be members of one row type");
+
+    static void decode(sqlite3_stmt* s, Row &row) { decode_from<0, First, Rest...>(s, row); }
+
+private:
+    template<int I, auto M, auto... Ms>
+    static void decode_from(sqlite3_stmt* s, Row &row) {
+        row.*M = SqlValue<typename MemberOf<decltype(M)>::Type>::get(s, I);
+        if constexpr (sizeof...(Ms) > 0) decode_from<I + 1, Ms...>(s, row);
+    }
+};
+
+// A single result column decoded as T.
+template<typename T>
+struct Value {
+    using Row = T;
+    static constexpr int count = 1;
+    static void decode(sqlite3_stmt* s, Row &row) { row = SqlValue<T>::get(s, 0); }
+};
+
+template<typename... Params>
+class Statement {
+public:
+    constexpr Statement(const char* sql) : sql_(sql) {}
+    const char* sql() const { return sql_; }
+
+    // Cached statement with every parameter bound; null (and reported) if it didn't prepare.
+    Stmt bind(DB &db, const Params&... ps) const {
+        Stmt stmt = db.prepare(sql_);
+        if (!stmt) { db.msg() << "Prepare error: " << sqlite3_errmsg(db.db) << "\n"; return stmt; }
+        bind_all(stmt, std::index_sequence_for<Params...>(), ps...);
+        return stmt;
+    }
+
+    bool print(DB &db, const Params&... ps, const char* empty_msg = "(no rows)") const {
+        Stmt stmt = bind(db, ps...);
+        return stmt && db.print_result(stmt, empty_msg);
+    }
+
+private:
+    template<size_t... I>
+    static void bind_all([[maybe_unused]] sqlite3_stmt* s, std::index_sequence<I...>, const Params&... ps) {
+        (SqlValue<Params>::bind(s, (int)I + 1, ps), ...);
+    }
+
+    const char* sql_;
+};
+
+template<typename Cols, typename... Params>
+class Query : public Statement<Params...> {
+public:
+    using Row = typename Cols::Row;
+    using Statement<Params...>::Statement;
+
+    // Streams rows to fn(const Row&); a fn returning bool stops the scan on false.
+    template<typename Fn>
+    bool each(DB &db, const Params&... ps, Fn &&fn) const {
+        Stmt stmt = open(db, ps...);
+        if (!stmt) return false;
+        Row row{};
+        int rc;
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+            Cols::decode(stmt, row);
+            if constexpr (std::is_same_v<decltype(fn(row)), bool>) {
+                if (!fn(row)) return true;
+            } else {
+                fn(row);
+            }
+        }
+        return step_done(db, rc);
+    }
+
+    // The first row, if any; `found` is false when there are none.
+    bool first(DB &db, const Params&... ps, Row &row, bool &found) const {
+        found = false;
+        Stmt stmt = open(db, ps...);
+        if (!stmt) return false;
+        int rc = sqlite3_step(stmt);
+        if (rc == SQLITE_ROW) { Cols::decode(stmt, row); found = true; return true; }
+        return step_done(db, rc);
+    }
+
+private:
+    Stmt open(DB &db, const Params&... ps) const {
+        Stmt stmt = this->bind(db, ps...);
+        if (stmt && sqlite3_column_count(stmt) != Cols::count) {
+            db.msg() << "Query returns " << sqlite3_column_count(stmt) << " columns, expected " << Cols::count << "\n";
+            return Stmt();
+        }
+        return stmt;
+    }
+
+    static bool step_done(DB &db, int rc) {
+        if (rc == SQLITE_DONE) return true;
+        db.msg() << "Query error: " << sqlite3_errmsg(db.db) << "\n";
+        return false;
+    }
+};
+
+// ---------- Field summary ----------
+// field_summary holds one row per field with what the dashboard lookups need: sample count
+// and latest sample, last maintenance date, planting count and yield sum, and the last two
+// plantings for rotation. Triggers on soilsample, fieldcrop, fieldmaintenance and field keep
+// it current, so reading a field's state is a primary-key lookup however long its history is.
+//
+// Each column is defined once below. Counts and sums also have a per-row delta, which the
+// triggers add for NEW rows and subtract for OLD ones; the other columns are re-probed for
+// the affected field through the migration 1 indexes (one LIMIT 1 / MAX step). The same
+// definitions generate the full rebuild and the consistency check.
+//
+//   summary-rebuild   recompute every row from the base tables (and restore the triggers)
+//   summary-check     list missing, orphaned and stale rows (none means consistent)
+
+static const int FIELD_SUMMARY_VERSION = 3;   // migration that installs it
+
+struct SummaryColumn {
+    const char* name;
+    const char* expr;    // value for field $F
+    const char* delta;   // contribution of one source row $R, or nullptr to re-probe
+};
+
+struct SummarySource {
+    const char* table;
+    const char* fieldkey;
+    const char* watched;   // columns whose update can change the summary
+    vector<SummaryColumn> columns;
+};
+
+// Latest sample and plantings use the same ORDER BY as the legacy queries, so ties on a
+// date resolve to the same row either way.
+static const SummarySource SUMMARY_SOURCES[] = {
+    {"soilsample", "ss_fieldkey", "ss_fieldkey, ss_samplekey, ss_sampledate", {
+        {"fs_sample_count", "(SELECT COUNT(*) FROM soilsample WHERE ss_fieldkey = $F)", "1"},
+        {"fs_latest_samplekey", "(SELECT ss_samplekey FROM soilsample WHERE ss_fieldkey = $F ORDER BY ss_sampledate DESC LIMIT 1)", nullptr},
+        {"fs_latest_sampledate", "(SELECT MAX(ss_sampledate) FROM soilsample WHERE ss_fieldkey = $F)", nullptr},
+    }},
+    {"fieldcrop", "fldc_fieldkey", "fldc_fieldkey, fldc_cropkey, fldc_enddate, fldc_yield", {
+        {"fs_planting_count", "(SELECT COUNT(*) FROM fieldcrop WHERE fldc_fieldkey = $F)", "1"},
+        {"fs_yield_sum", "(SELECT TOTAL(fldc_yield) FROM fieldcrop WHERE fldc_fieldkey = $F)", "$R.fldc_yield"},
+        {"fs_current_cropkey", "(SELECT fldc_cropkey FROM fieldcrop WHERE fldc_fieldkey = $F ORDER BY fldc_enddate DESC LIMIT 1)", nullptr},
+        {"fs_current_enddate", "(SELECT MAX(fldc_enddate) FROM fieldcrop WHERE fldc_fieldkey = $F)", nullptr},
+        {"fs_previous_cropkey", "(SELECT fldc_cropkey FROM fieldcrop WHERE fldc_fieldkey = $F ORDER BY fldc_enddate DESC LIMIT 1 OFFSET 1)", nullptr},
+        {"fs_previous_enddate", "(SELECT fldc_enddate FROM fieldcrop WHERE fldc_fieldkey = $F ORDER BY fldc_enddate DESC LIMIT 1 OFFSET 1)", nullptr},
+    }},
+    {"fieldmaintenance", "fldm_fieldkey", "fldm_fieldkey, fldm_begindate", {
+        {"fs_last_maintenance", "(SELECT MAX(fldm_begindate) FROM fieldmaintenance WHERE fldm_fieldkey = $F)", nullptr},
+    }},
+};
+
+static const char* FIELD_SUMMARY_TABLE_SQL = R"(
+CREATE TABLE IF NOT EXISTS field_summary (
+    fs_fieldkey          INTEGER PRIMARY KEY,
+    fs_sample_count      INTEGER NOT NULL DEFAULT 0,
+    fs_latest_samplekey  DECIMAL(12,0),
+    fs_latest_sampledate DATE,
+    fs_planting_count    INTEGER NOT NULL DEFAULT 0,
+    fs_yield_sum         REAL NOT NULL DEFAULT 0,
+    fs_current_cropkey   DECIMAL(4,0),
+    fs_current_enddate   DATE,
+    fs_previous_cropkey  DECIMAL(4,0),
+    fs_previous_enddate  DATE,
+    fs_last_maintenance  DATE
+);
+)";
+
+static string replace_all(string s, const string &from, const string &to) {
+    for (size_t pos = 0; (pos = s.find(from, pos)) != string::npos; pos += to.size()) s.replace(pos, from.size(), to);
+    return s;
+}
+
+// "INSERT OR REPLACE INTO field_summary (...) SELECT <key>, <every column for that key>"
+static string summary_row_select(const string &key) {
+    string cols = "fs_fieldkey", vals = key;
+    for (auto &src : SUMMARY_SOURCES) {
+        for (auto &c : src.columns) {
+            cols += string(", ") + c.name;
+            vals += ", " + replace_all(c.expr, "$F", key);
+        }
+    }
+    return "INSERT OR REPLACE INTO field_summary (" + cols + ") SELECT " + vals;
+}
+
+// Trigger step applying row `rec` (NEW or OLD) of one source table: deltas added or
+// subtracted, other columns re-probed.
+static string summary_trigger_update(const SummarySource &src, const string &rec, char sign) {
+    string key = rec + "." + src.fieldkey, set;
+    for (auto &c : src.columns) {
+        if (!set.empty()) set += ", ";
+        if (c.delta) set += string(c.name) + " = " + c.name + " " + sign + " " + replace_all(c.delta, "$R", rec);
+        else set += string(c.name) + " = " + replace_all(c.expr, "$F", key);
+    }
+    return "UPDATE field_summary SET " + set + " WHERE fs_fieldkey = " + key + ";\n";
+}
+
+static string field_summary_triggers_sql() {
+    string sql;
+    for (auto &src : SUMMARY_SOURCES) {
+        string t = src.table;
+        sql += "CREATE TRIGGER IF NOT EXISTS trg_" + t + "_summary_ins AFTER INSERT ON " + t + " BEGIN\n" +
+               summary_trigger_update(src, "NEW", '+') + "END;\n";
+        sql += "CREATE TRIGGER IF NOT EXISTS trg_" + t + "_summary_del AFTER DELETE ON " + t + " BEGIN\n" +
+               summary_trigger_update(src, "OLD", '-') + "END;\n";
+        sql += "CREATE TRIGGER IF NOT EXISTS trg_" + t + "_summary_upd AFTER UPDATE OF " + src.watched + " ON " + t + " BEGIN\n" +
+               summary_trigger_update(src, "OLD", '-') + summary_trigger_update(src, "NEW", '+') + "END;\n";
+    }
+    // A (re)inserted field picks up whatever rows already reference it.
+    sql += "CREATE TRIGGER IF NOT EXISTS trg_field_summary_ins AFTER INSERT ON field BEGIN\n" +
+           summary_row_select("NEW.fld_fieldkey") + ";\nEND;\n";
+    sql += "CREATE TRIGGER IF NOT EXISTS trg_field_summary_del AFTER DELETE ON field BEGIN\n"
+           "DELETE FROM field_summary WHERE fs_fieldkey = OLD.fld_fieldkey;\nEND;\n";
+    sql += "CREATE TRIGGER IF NOT EXISTS trg_field_summary_upd AFTER UPDATE OF fld_fieldkey ON field BEGIN\n"
+           "DELETE FROM field_summary WHERE fs_fieldkey = OLD.fld_fieldkey;\n" +
+           summary_row_select("NEW.fld_fieldkey") + ";\nEND;\n";
+    return sql;
+}
+
+// Bulk loads drop the triggers and rebuild once afterwards (install_field_summary) rather
+// than paying a summary update per row.
+static bool drop_field_summary_triggers(DB &db) {
+    string sql;
+    for (auto &src : SUMMARY_SOURCES) {
+        for (const char* op : {"ins", "del", "upd"}) sql += string("DROP TRIGGER IF EXISTS trg_") + src.table + "_summary_" + op + ";\n";
+    }
+    for (const char* op : {"ins", "del", "upd"}) sql += string("DROP TRIGGER IF EXISTS trg_field_summary_") + op + ";\n";
+    return sqlite3_exec(db.db, sql.c_str(), nullptr, nullptr, nullptr) == SQLITE_OK;
+}
+
+bool rebuild_field_summary(DB &db) {
+    string sql = "DELETE FROM field_summary;\n" + summary_row_select("f.fld_fieldkey") + " FROM field f;";
+    char* err = nullptr;
+    if (sqlite3_exec(db.db, sql.c_str(), nullptr, nullptr, &err) != SQLITE_OK) {
+        db.msg() << "Summary rebuild failed: " << (err ? err : sqlite3_errmsg(db.db)) << "\n";
+        sqlite3_free(err);
+        return false;
+    }
+    return true;
+}
+
+// Migration hook: table, triggers and the initial contents, inside the migration's transaction.
+static bool install_field_summary(DB &db) {
+    string sql = string(FIELD_SUMMARY_TABLE_SQL) + field_summary_triggers_sql();
+    char* err = nullptr;
+    if (sqlite3_exec(db.db, sql.c_str(), nullptr, nullptr, &err) != SQLITE_OK) {
+        db.msg() << "Summary install failed: " << (err ? err : sqlite3_errmsg(db.db)) << "\n";
+        sqlite3_free(err);
+        return false;
+    }
+    return rebuild_field_summary(db);
+}
+
+static bool has_field_summary(DB &db) { return db.schema_version() >= FIELD_SUMMARY_VERSION; }
+
+// Recomputes every row into a materialized CTE and compares. Delta columns allow for the
+// rounding drift of adding and subtracting float yields.
+static string field_summary_check_sql() {
+    string exprs, checks;
+    for (auto &src : SUMMARY_SOURCES) {
+        for (auto &c : src.columns) {
+            string n = c.name;
+            exprs += ", " + replace_all(c.expr, "$F", "f.fld_fieldkey") + " AS " + n;
+            string differs = c.delta ? "ABS(s." + n + " - e." + n + ") > 1e-6" : "s." + n + " IS NOT e." + n;
+            checks += "UNION ALL SELECT e.fieldkey, 'stale " + n + "', s." + n + ", e." + n +
+                      " FROM expected e JOIN field_summary s ON s.fs_fieldkey = e.fieldkey WHERE " + differs + "\n";
+        }
+    }
+    return "WITH expected AS MATERIALIZED (SELECT f.fld_fieldkey AS fieldkey" + exprs + " FROM field f)\n"
+           "SELECT e.fieldkey, 'missing' AS problem, NULL AS summary, NULL AS expected FROM expected e "
+           "WHERE NOT EXISTS (SELECT 1 FROM field_summary WHERE fs_fieldkey = e.fieldkey)\n"
+           "UNION ALL SELECT s.fs_fieldkey, 'orphan', NULL, NULL FROM field_summary s "
+           "WHERE NOT EXISTS (SELECT 1 FROM field WHERE fld_fieldkey = s.fs_fieldkey)\n" + checks + "ORDER BY 1, 2;";
+}
+
+// Prints every inconsistency; false if there were any.
+bool check_field_summary(DB &db) {
+    if (!has_field_summary(db)) { db.msg() << "No field_summary table; run 'migrate' first.\n"; return false; }
+    Stmt stmt = db.prepare(field_summary_check_sql());
+    if (!stmt) { db.msg() << "Prepare error: " << sqlite3_errmsg(db.db) << "\n"; return false; }
+    if (!db.print_result(stmt, "field_summary is consistent.")) return false;
+    return db.out.rows() == 0;
+}
+
+bool rebuild_field_summary_command(DB &db) {
+    if (!has_field_summary(db)) { db.msg() << "No field_summary table; run 'migrate' first.\n"; return false; }
+    auto t0 = std::chrono::steady_clock::now();
+    if (sqlite3_exec(db.db, "BEGIN IMMEDIATE;", nullptr, nullptr, nullptr) != SQLITE_OK) {
+        db.msg() << "Could not start transaction: " << sqlite3_errmsg(db.db) << "\n";
+        return false;
+    }
+    if (!install_field_summary(db)) { sqlite3_exec(db.db, "ROLLBACK;", nullptr, nullptr, nullptr); return false; }
+    int fields = sqlite3_changes(db.db);
+    if (sqlite3_exec(db.db, "COMMIT;", nullptr, nullptr, nullptr) != SQLITE_OK) {
+        db.msg() << "Commit failed: " << sqlite3_errmsg(db.db) << "\n";
+        sqlite3_exec(db.db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        return false;
+    }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    std::ostringstream line;
+    line << "Rebuilt field_summary (" << fields << " fields, " << std::fixed << std::setprecision(2) << secs << " s)\n";
+    db.msg() << line.str();
+    return true;
+}
+
+// ---------- Field rollups ----------
+// field_rollup holds per-field aggregates for every calendar month ('YYYY-MM') and year
+// ('YYYY') that has data: soil sample count, pH sum and sum of squares, N/P/K and metal sums,
+// plantings and yield by harvest date, maintenance count and amount by start date. Trend and
+// window queries read a handful of these buckets instead of rescanning the history, and
+// combine them (sums add, averages are sum / count) for any range of whole months.
+//
+// Like field_summary, each measure is defined once below as the contribution of one source
+// row $R. The insert trigger adds it to the row's month and year buckets (UPSERT), the delete
+// trigger subtracts it and drops buckets that became empty; the rebuild and the consistency
+// check aggregate the same expressions over the base tables.
+//
+//   rollup-rebuild   recompute every bucket from the base tables (and restore the triggers)
+//   rollup-check     list missing, orphaned and stale buckets (none means consistent)
+
+static const int FIELD_ROLLUP_VERSION = 4;   // migration that installs it
+
+struct RollupMeasure {
+    const char* name;
+    const char* value;   // contribution of one source row $R
+};
+
+struct RollupSource {
+    const char* table;
+    const char* fieldkey;
+    const char* date;      // bucket date
+    const char* watched;   // columns whose update can change the rollup
+    vector<RollupMeasure> measures;   // the first one counts rows
+};
+
+static const RollupSource ROLLUP_SOURCES[] = {
+    {"soilsample", "ss_fieldkey", "ss_sampledate",
+     "ss_fieldkey, ss_sampledate, ss_ph, ss_nitrogen_ppm, ss_phosphorus_ppm, ss_potassium_ppm, ss_lead_ppm, ss_mercury_ppm, "
+     "ss_nickel_ppm, ss_copper_ppm, ss_chromium_ppm, ss_cadmium_ppm, ss_arsenic_ppm, ss_zinc_ppm", {
+        {"fr_samples", "1"},
+        {"fr_ph_sum", "$R.ss_ph"},
+        {"fr_ph_sumsq", "$R.ss_ph * $R.ss_ph"},
+        {"fr_n_sum", "$R.ss_nitrogen_ppm"},
+        {"fr_p_sum", "$R.ss_phosphorus_ppm"},
+        {"fr_k_sum", "$R.ss_potassium_ppm"},
+        {"fr_lead_sum", "$R.ss_lead_ppm"},
+        {"fr_mercury_sum", "$R.ss_mercury_ppm"},
+        {"fr_nickel_sum", "$R.ss_nickel_ppm"},
+        {"fr_copper_sum", "$R.ss_copper_ppm"},
+        {"fr_chromium_sum", "$R.ss_chromium_ppm"},
+        {"fr_cadmium_sum", "$R.ss_cadmium_ppm"},
+        {"fr_arsenic_sum", "$R.ss_arsenic_ppm"},
+        {"fr_zinc_sum", "$R.ss_zinc_ppm"},
+    }},
+    {"fieldcrop", "fldc_fieldkey", "fldc_enddate", "fldc_fieldkey, fldc_enddate, fldc_yield", {
+        {"fr_plantings", "1"},
+        {"fr_yield_sum", "$R.fldc_yield"},
+    }},
+    {"fieldmaintenance", "fldm_fieldkey", "fldm_begindate", "fldm_fieldkey, fldm_begindate, fldm_amount", {
+        {"fr_maintenance", "1"},
+        {"fr_maint_amount", "COALESCE($R.fldm_amount, 0)"},
+    }},
+};
+
+// Bucket keys of date $D: month first, then year.
+static const char* ROLLUP_PERIODS[] = {"substr($D, 1, 7)", "substr($D, 1, 4)"};
+
+static string field_rollup_table_sql() {
+    string cols;
+    for (auto &src : ROLLUP_SOURCES) {
+        for (auto &m : src.measures) {
+            bool count = string(m.value) == "1";
+            cols += string("    ") + m.name + (count ? " INTEGER" : " REAL") + " NOT NULL DEFAULT 0,\n";
+        }
+    }
+    return "CREATE TABLE IF NOT EXISTS field_rollup (\n"
+           "    fr_fieldkey DECIMAL(12,0) NOT NULL,\n"
+           "    fr_period   TEXT NOT NULL,\n" + cols +
+           "    PRIMARY KEY (fr_fieldkey, fr_period)\n) WITHOUT ROWID;\n";
+}
+
+// "fr_samples = 0 AND fr_plantings = 0 AND fr_maintenance = 0"
+static string rollup_empty_sql() {
+    string sql;
+    for (auto &src : ROLLUP_SOURCES) sql += string(sql.empty() ? "" : " AND ") + src.measures[0].name + " = 0";
+    return sql;
+}
+
+// Trigger steps adding row `rec` (NEW) of one source table to its two buckets.
+static string rollup_trigger_add(const RollupSource &src, const string &rec) {
+    string cols, vals, set;
+    for (auto &m : src.measures) {
+        cols += string(", ") + m.name;
+        vals += ", " + replace_all(m.value, "$R", rec);
+        set += string(set.empty() ? "" : ", ") + m.name + " = " + m.name + " + excluded." + m.name;
+    }
+    string date = rec + "." + src.date, sql;
+    for (const char* period : ROLLUP_PERIODS) {
+        sql += "INSERT INTO field_rollup (fr_fieldkey, fr_period" + cols + ") SELECT " + rec + "." + src.fieldkey + ", " +
+               replace_all(period, "$D", date) + vals + " WHERE " + date + " IS NOT NULL\n"
+               "  ON CONFLICT (fr_fieldkey, fr_period) DO UPDATE SET " + set + ";\n";
+    }
+    return sql;
+}
+
+// Trigger steps taking row `rec` (OLD) back out of its buckets.
+static string rollup_trigger_remove(const RollupSource &src, const string &rec) {
+    string set;
+    for (auto &m : src.measures) set += string(set.empty() ? "" : ", ") + m.name + " = " + m.name + " - " + replace_all(m.value, "$R", rec);
+    string date = rec + "." + src.date;
+    string where = " WHERE fr_fieldkey = " + rec + "." + src.fieldkey + " AND fr_period IN (" +
+                   replace_all(ROLLUP_PERIODS[0], "$D", date) + ", " + replace_all(ROLLUP_PERIODS[1], "$D", date) + ")";
+    return "UPDATE field_rollup SET " + set + where + ";\n"
+           "DELETE FROM field_rollup" + where + " AND " + rollup_empty_sql() + ";\n";
+}
+
+static string field_rollup_triggers_sql() {
+    string sql;
+    for (auto &src : ROLLUP_SOURCES) {
+        string t = src.table;
+        sql += "CREATE TRIGGER IF NOT EXISTS trg_" + t + "_rollup_ins AFTER INSERT ON " + t + " BEGIN\n" +
+               rollup_trigger_add(src, "NEW") + "END;\n";
+        sql += "CREATE TRIGGER IF NOT EXISTS trg_" + t + "_rollup_del AFTER DELETE ON " + t + " BEGIN\n" +
+               rollup_trigger_remove(src, "OLD") + "END;\n";
+        sql += "CREATE TRIGGER IF NOT EXISTS trg_" + t + "_rollup_upd AFTER UPDATE OF " + src.watched + " ON " + t + " BEGIN\n" +
+               rollup_trigger_remove(src, "OLD") + rollup_trigger_add(src, "NEW") + "END;\n";
+    }
+    return sql;
+}
+
+// Buckets recomputed from the base tables: (fieldkey, period, <every measure>).
+static string rollup_expected_sql() {
+    string rows;
+    for (auto &src : ROLLUP_SOURCES) {
+        string vals;
+        for (auto &other : ROLLUP_SOURCES) {
+            for (auto &m : other.measures) {
+                vals += ", " + (&other == &src ? replace_all(m.value, "$R.", "") : string("0")) + " AS " + m.name;
+            }
+        }
+        for (const char* period : ROLLUP_PERIODS) {
+            rows += string(rows.empty() ? "" : "    UNION ALL ") + "SELECT " + src.fieldkey + " AS fieldkey, " +
+                    replace_all(period, "$D", src.date) + " AS period" + vals + " FROM " + src.table +
+                    " WHERE " + src.date + " IS NOT NULL\n";
+        }
+    }
+    string sums;
+    for (auto &src : ROLLUP_SOURCES) {
+        for (auto &m : src.measures) sums += string(", SUM(") + m.name + ") AS " + m.name;
+    }
+    return "SELECT fieldkey, period" + sums + " FROM (\n    " + rows + ") GROUP BY fieldkey, period";
+}
+
+// Bulk loads drop the triggers and rebuild once afterwards (install_field_rollup).
+static bool drop_field_rollup_triggers(DB &db) {
+    string sql;
+    for (auto &src : ROLLUP_SOURCES) {
+        for (const char* op : {"ins", "del", "upd"}) sql += string("DROP TRIGGER IF EXISTS trg_") + src.table + "_rollup_" + op + ";\n";
+    }
+    return sqlite3_exec(db.db, sql.c_str(), nullptr, nullptr, nullptr) == SQLITE_OK;
+}
+
+bool rebuild_field_rollup(DB &db) {
+    string cols;
+    for (auto &src : ROLLUP_SOURCES) {
+        for (auto &m : src.measures) cols += string(", ") + m.name;
+    }
+    string sql = "DELETE FROM field_rollup;\nINSERT INTO field_rollup (fr_fieldkey, fr_period" + cols + ")\n" + rollup_expected_sql() + ";";
+    char* err = nullptr;
+    if (sqlite3_exec(db.db, sql.c_str(), nullptr, nullptr, &err) != SQLITE_OK) {
+        db.msg() << "Rollup rebuild failed: " << (err ? err : sqlite3_errmsg(db.db)) << "\n";
+        sqlite3_free(err);
+        return false;
+    }
+    return true;
+}
+
+// Migration hook: table, triggers and the initial contents, inside the migration's transaction.
+static bool install_field_rollup(DB &db) {
+    string sql = field_rollup_table_sql() + field_rollup_triggers_sql();
+    char* err = nullptr;
+    if (sqlite3_exec(db.db, sql.c_str(), nullptr, nullptr, &err) != SQLITE_OK) {
+        db.msg() << "Rollup install failed: " << (err ? err : sqlite3_errmsg(db.db)) << "\n";
+        sqlite3_free(err);
+        return false;
+    }
+    return rebuild_field_rollup(db);
+}
+
+static bool has_field_rollup(DB &db) { return db.schema_version() >= FIELD_ROLLUP_VERSION; }
+
+// One pass over the recomputed buckets; a stale bucket lists the columns that differ. Sums
+// are compared with a relative tolerance for the drift of adding and subtracting floats.
+static string field_rollup_check_sql() {
+    string differs;
+    for (auto &src : ROLLUP_SOURCES) {
+        for (auto &m : src.measures) {
+            string n = m.name;
+            differs += " || CASE WHEN ABS(r." + n + " - e." + n + ") > 1e-6 * MAX(1, ABS(e." + n + ")) THEN ' " + n + "' ELSE '' END";
+        }
+    }
+    return "WITH expected AS MATERIALIZED (" + rollup_expected_sql() + ")\n"
+           "SELECT e.fieldkey, e.period, 'missing' AS problem FROM expected e "
+           "WHERE NOT EXISTS (SELECT 1 FROM field_rollup WHERE fr_fieldkey = e.fieldkey AND fr_period = e.period)\n"
+           "UNION ALL SELECT r.fr_fieldkey, r.fr_period, 'orphan' FROM field_rollup r "
+           "WHERE NOT EXISTS (SELECT 1 FROM expected WHERE fieldkey = r.fr_fieldkey AND period = r.fr_period)\n"
+           "UNION ALL SELECT fieldkey, period, problem FROM (SELECT e.fieldkey, e.period, 'stale:' || ''" + differs + " AS problem "
+           "FROM expected e JOIN field_rollup r ON r.fr_fieldkey = e.fieldkey AND r.fr_period = e.period) WHERE problem <> 'stale:'\n"
+           "ORDER BY 1, 2;";
+}
+
+// Prints every inconsistency; false if there were any.
+bool check_field_rollup(DB &db) {
+    if (!has_field_rollup(db)) { db.msg() << "No field_rollup table; run 'migrate' first.\n"; return false; }
+    Stmt stmt = db.prepare(field_rollup_check_sql());
+    if (!stmt) { db.msg() << "Prepare error: " << sqlite3_errmsg(db.db) << "\n"; return false; }
+    if (!db.print_result(stmt, "field_rollup is consistent.")) return false;
+    return db.out.rows() == 0;
+}
+
+bool rebuild_field_rollup_command(DB &db) {
+    if (!has_field_rollup(db)) { db.msg() << "No field_rollup table; run 'migrate' first.\n"; return false; }
+    auto t0 = std::chrono::steady_clock::now();
+    if (sqlite3_exec(db.db, "BEGIN IMMEDIATE;", nullptr, nullptr, nullptr) != SQLITE_OK) {
+        db.msg() << "Could not start transaction: " << sqlite3_errmsg(db.db) << "\n";
+        return false;
+    }
+    if (!install_field_rollup(db)) { sqlite3_exec(db.db, "ROLLBACK;", nullptr, nullptr, nullptr); return false; }
+    int buckets = sqlite3_changes(db.db);
+    if (sqlite3_exec(db.db, "COMMIT;", nullptr, nullptr, nullptr) != SQLITE_OK) {
+        db.msg() << "Commit failed: " << sqlite3_errmsg(db.db) << "\n";
+        sqlite3_exec(db.db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        return false;
+    }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    std::ostringstream line;
+    line << "Rebuilt field_rollup (" << buckets << " buckets, " << std::fixed << std::setprecision(2) << secs << " s)\n";
+    db.msg() << line.str();
+    return true;
+}
+
+// ---------- Full-text search ----------
+// search_index is an FTS5 table over the free text in the database: soil sample comments,
+// maintenance products (name; category, active ingredient and notes), crops (name; scientific
+// name and nutrient use), farmer names and season names. Each document has a title, weighted
+// double in the bm25 rank, and a body. Its rowid is kind << 44 | source key, so the triggers
+// on the source tables replace a document by rowid and a kind is one rowid range.
+//
+// Query words are matched as typed when the index has them, as prefixes when they end in '*'
+// or only start some indexed word ("fertiliz"), and otherwise by the indexed words one edit
+// away (a letter dropped, added, changed or two swapped); words with no match are left out.
+//
+//   search <kind|all> <text>   best matches first, with a snippet
+//   search-rebuild             re-index every source table
+
+static const int SEARCH_INDEX_VERSION = 6;   // migration that installs it
+static const int SEARCH_KIND_SHIFT = 44;     // keys are DECIMAL(12,0), below 2^40
+static const int SEARCH_LIMIT = 50;
+
+struct SearchSource {
+    int kind;
+    const char* name;
+    const char* table;
+    const char* key;
+    const char* title;     // text of source row $R
+    const char* body;
+    const char* indexed;   // condition for $R to have a document
+    const char* watched;   // columns whose update changes the document
+};
+
+static const SearchSource SEARCH_SOURCES[] = {
+    {1, "sample", "soilsample", "ss_samplekey", "''", "$R.ss_comment", "$R.ss_comment <> ''", "ss_samplekey, ss_comment"},
+    {2, "maintenance", "maintenance", "m_maintenancekey", "$R.m_name",
+     "$R.m_category || ' ' || $R.m_activeingredient || ' ' || COALESCE($R.m_notes, '')", "1",
+     "m_maintenancekey, m_category, m_name, m_activeingredient, m_notes"},
+    {3, "crop", "crop", "c_cropkey", "$R.c_name", "COALESCE($R.c_scientific, '') || ' ' || COALESCE($R.c_nutrientuse, '')", "1",
+     "c_cropkey, c_name, c_scientific, c_nutrientuse"},
+    {4, "farmer", "farmer", "f_farmerkey", "$R.f_name || ' ' || $R.f_surname", "''", "1", "f_farmerkey, f_name, f_surname"},
+    {5, "season", "season", "s_seasonkey", "$R.s_name", "''", "1", "s_seasonkey, s_name"},
+};
+
+struct SearchHit {
+    std::string_view kind;
+    sqlite3_int64 key;
+    double score;
+    std::string_view text;
+};
+
+// Kind names from SEARCH_SOURCES, split off the rowid by SEARCH_KIND_SHIFT. ?2..?3 is the
+// rowid range of the kinds searched.
+static string search_hits_sql() {
+    string shift = std::to_string(SEARCH_KIND_SHIFT), kinds;
+    for (auto &src : SEARCH_SOURCES) kinds += " WHEN " + std::to_string(src.kind) + " THEN '" + src.name + "'";
+    return "SELECT CASE rowid >> " + shift + kinds + " END AS kind,\n"
+           "       rowid & ((1 << " + shift + ") - 1) AS key, ROUND(-rank, 3) AS score,\n"
+           "       snippet(search_index, -1, '[', ']', '...', 12) AS text\n"
+           "FROM search_index\n"
+           "WHERE search_index MATCH ?1 AND rowid BETWEEN ?2 AND ?3\n"
+           "ORDER BY rank LIMIT ?4;";
+}
+
+static const string SEARCH_SQL_TEXT = search_hits_sql();
+static const Query<Columns<&SearchHit::kind, &SearchHit::key, &SearchHit::score, &SearchHit::text>,
+                   string, sqlite3_int64, sqlite3_int64, int> SEARCH_SQL = SEARCH_SQL_TEXT.c_str();
+
+static const char* SEARCH_INDEX_TABLE_SQL = R"(
+CREATE VIRTUAL TABLE IF NOT EXISTS search_index USING fts5(title, body, tokenize = 'unicode61 remove_diacritics 2', prefix = '2 3');
+INSERT INTO search_index (search_index, rank) VALUES ('rank', 'bm25(2.0, 1.0)');
+)";
+
+static string search_rowid(const SearchSource &src, const string &rec) {
+    return "(" + std::to_string(src.kind) + " << " + std::to_string(SEARCH_KIND_SHIFT) + ") + " + rec + "." + src.key;
+}
+
+static string search_trigger_insert(const SearchSource &src, const string &rec) {
+    return "INSERT INTO search_index (rowid, title, body) SELECT " + search_rowid(src, rec) + ", " +
+           replace_all(src.title, "$R", rec) + ", " + replace_all(src.body, "$R", rec) +
+           " WHERE " + replace_all(src.indexed, "$R", rec) + ";\n";
+}
+
+static string search_trigger_delete(const SearchSource &src, const string &rec) {
+    return "DELETE FROM search_index WHERE rowid = " + search_rowid(src, rec) + ";\n";
+}
+
+static string search_triggers_sql() {
+    string sql;
+    for (auto &src : SEARCH_SOURCES) {
+        string t = src.table;
+        sql += "CREATE TRIGGER IF NOT EXISTS trg_" + t + "_search_ins AFTER INSERT ON " + t + " BEGIN\n" +
+               search_trigger_insert(src, "NEW") + "END;\n";
+        sql += "CREATE TRIGGER IF NOT EXISTS trg_" + t + "_search_del AFTER DELETE ON " + t + " BEGIN\n" +
+               search_trigger_delete(src, "OLD") + "END;\n";
+        sql += "CREATE TRIGGER IF NOT EXISTS trg_" + t + "_search_upd AFTER UPDATE OF " + src.watched + " ON " + t + " BEGIN\n" +
+               search_trigger_delete(src, "OLD") + search_trigger_insert(src, "NEW") + "END;\n";
+    }
+    return sql;
+}
+
+// Bulk loads drop the triggers and rebuild once afterwards (install_search_index).
+static bool drop_search_triggers(DB &db) {
+    string sql;
+    for (auto &src : SEARCH_SOURCES) {
+        for (const char* op : {"ins", "del", "upd"}) sql += string("DROP TRIGGER IF EXISTS trg_") + src.table + "_search_" + op + ";\n";
+    }
+    return sqlite3_exec(db.db, sql.c_str(), nullptr, nullptr, nullptr) == SQLITE_OK;
+}
+
+bool rebuild_search_index(DB &db) {
+    string sql = "DELETE FROM search_index;\n";
+    for (auto &src : SEARCH_SOURCES) {
+        sql += string("INSERT INTO search_index (rowid, title, body) SELECT ") + replace_all(search_rowid(src, "$R"), "$R.", "") + ", " +
+               replace_all(src.title, "$R.", "") + ", " + replace_all(src.body, "$R.", "") + " FROM " + src.table +
+               " WHERE " + replace_all(src.indexed, "$R.", "") + ";\n";
+    }
+    sql += "INSERT INTO search_index (search_index) VALUES ('optimize');";
+    char* err = nullptr;
+    if (sqlite3_exec(db.db, sql.c_str(), nullptr, nullptr, &err) != SQLITE_OK) {
+        db.msg() << "Search index rebuild failed: " << (err ? err : sqlite3_errmsg(db.db)) << "\n";
+        sqlite3_free(err);
+        return false;
+    }
+    return true;
+}
+
+// Migration hook: table, triggers and the initial contents, inside the migration's transaction.
+static bool install_search_index(DB &db) {
+    string sql = string(SEARCH_INDEX_TABLE_SQL) + search_triggers_sql();
+    char* err = nullptr;
+    if (sqlite3_exec(db.db, sql.c_str(), nullptr, nullptr, &err) != SQLITE_OK) {
+        db.msg() << "Search index install failed: " << (err ? err : sqlite3_errmsg(db.db)) << "\n";
+        sqlite3_free(err);
+        return false;
+    }
+    return rebuild_search_index(db);
+}
+
+static bool has_search_index(DB &db) { return db.schema_version() >= SEARCH_INDEX_VERSION; }
+
+// Lower-cased query words; a trailing '*' is kept as the prefix marker.
+static vector<string> search_words(const string &text) {
+    vector<string> words;
+    string cur;
+    for (size_t i = 0; i <= text.size(); ++i) {
+        unsigned char c = i < text.size() ? (unsigned char)text[i] : ' ';
+        if (std::isalnum(c) || c >= 0x80) { cur += (char)std::tolower(c); continue; }
+        if (cur.empty()) continue;
+        if (c == '*') cur += '*';
+        words.push_back(cur);
+        cur.clear();
+    }
+    return words;
+}
+
+// True if b is one edit from a: a byte dropped, added or changed, or two adjacent bytes
+// swapped.
+static bool one_edit_apart(const string &a, const string &b) {
+    if (a == b) return false;
+    if (a.size() == b.size()) {
+        size_t i = 0;
+        while (a[i] == b[i]) ++i;
+        if (a.compare(i + 1, string::npos, b, i + 1, string::npos) == 0) return true;
+        return i + 1 < a.size() && a[i] == b[i + 1] && a[i + 1] == b[i] && a.compare(i + 2, string::npos, b, i + 2, string::npos) == 0;
+    }
+    const string &l = a.size() > b.size() ? a : b, &s = a.size() > b.size() ? b : a;
+    if (l.size() != s.size() + 1) return false;
+    size_t i = 0;
+    while (i < s.size() && l[i] == s[i]) ++i;
+    return l.compare(i + 1, string::npos, s, i, string::npos) == 0;
+}
+
+// The index's own term list, for spelling alternatives. A temp table, so it needs no
+// migration and works on read-only connections.
+static const char* SEARCH_VOCAB_SQL =
+    "CREATE VIRTUAL TABLE IF NOT EXISTS temp.search_vocab USING fts5vocab(main, search_index, row);";
+
+// FTS5 expression for the query text; `notes` says how words were read when not as typed.
+// An empty expression means no word matched anything. Each word costs at most two MATCH
+// probes; the misspelled ones then share one pass over the vocabulary.
+static bool search_expression(DB &db, const string &text, string &expr, string &notes) {
+    Stmt probe = db.prepare("SELECT 1 FROM search_index WHERE search_index MATCH ?1 LIMIT 1;");
+    if (!probe) { db.msg() << "Prepare error: " << sqlite3_errmsg(db.db) << "\n"; return false; }
+    auto matches = [&](const string &e) {
+        sqlite3_bind_text(probe, 1, e.c_str(), -1, SQLITE_TRANSIENT);
+        bool found = sqlite3_step(probe) == SQLITE_ROW;
+        sqlite3_reset(probe);
+        return found;
+    };
+    struct Part {
+        string word, match, note;
+        bool fuzzy = false;
+    };
+    vector<Part> parts;
+    size_t shortest = SIZE_MAX, longest = 0;   // of the words left for the vocabulary pass
+    for (string w : search_words(text)) {
+        bool prefix = w.back() == '*';
+        if (prefix) w.pop_back();
+        if (w.empty()) continue;
+        Part p;
+        p.word = w;
+        string term = "\"" + w + "\"";
+        if (prefix) p.match = term + "*";
+        else if (matches(term)) p.match = term;
+        else if (w.size() >= 3 && matches(term + "*")) { p.match = term + "*"; p.note = w + " -> " + w + "*"; }
+        else if (w.size() >= 4) {
+            p.fuzzy = true;
+            shortest = std::min(shortest, w.size());
+            longest = std::max(longest, w.size());
+        }
+        parts.push_back(p);
+    }
+
+    if (longest > 0) {
+        if (sqlite3_exec(db.db, SEARCH_VOCAB_SQL, nullptr, nullptr, nullptr) != SQLITE_OK) {
+            db.msg() << "Search vocabulary: " << sqlite3_errmsg(db.db) << "\n";
+            return false;
+        }
+        Stmt vocab = db.prepare("SELECT term FROM temp.search_vocab WHERE length(term) BETWEEN ?1 AND ?2;");
+        if (!vocab) { db.msg() << "Prepare error: " << sqlite3_errmsg(db.db) << "\n"; return false; }
+        sqlite3_bind_int64(vocab, 1, (sqlite3_int64)shortest - 1);
+        sqlite3_bind_int64(vocab, 2, (sqlite3_int64)longest + 1);
+        while (sqlite3_step(vocab) == SQLITE_ROW) {
+            string t((const char*)sqlite3_column_text(vocab, 0), (size_t)sqlite3_column_bytes(vocab, 0));
+            for (auto &p : parts) {
+                if (!p.fuzzy || !one_edit_apart(p.word, t)) continue;
+                p.match += (p.match.empty() ? "\"" : " OR \"") + t + "\"";
+                p.note += (p.note.empty() ? p.word + " -> " : "|") + t;
+            }
+        }
+        for (auto &p : parts) if (p.fuzzy && !p.match.empty()) p.match = "(" + p.match + ")";
+    }
+
+    expr.clear();
+    for (auto &p : parts) {
+        if (p.match.empty()) p.note = "no match for " + p.word;
+        else expr += (expr.empty() ? "" : " AND ") + p.match;
+        if (!p.note.empty()) notes += (notes.empty() ? "" : ", ") + p.note;
+    }
+    return true;
+}
+
+static bool search_kind(const string &name, int &kind) {
+    kind = 0;
+    if (name == "all") return true;
+    for (auto &src : SEARCH_SOURCES) if (name == src.name) { kind = src.kind; return true; }
+    return false;
+}
+
+static sqlite3_int64 search_kind_lo(int kind) { return kind ? (sqlite3_int64)kind << SEARCH_KIND_SHIFT : 0; }
+static sqlite3_int64 search_kind_hi(int kind) {
+    return kind ? ((sqlite3_int64)(kind + 1) << SEARCH_KIND_SHIFT) - 1 : std::numeric_limits<sqlite3_int64>::max();
+}
+
+bool search_text(DB &db, const string &kind_name, const string &text) {
+    if (!has_search_index(db)) { db.msg() << "No search index; run 'migrate' first.\n"; return false; }
+    int kind;
+    if (!search_kind(kind_name, kind)) { db.msg() << "Unknown kind: " << kind_name << "\n"; return false; }
+    string expr, notes;
+    if (!search_expression(db, text, expr, notes)) return false;
+    if (!notes.empty()) db.out.note("(" + notes + ")\n");
+    if (expr.empty()) expr = "\"\"";
+    return SEARCH_SQL.print(db, expr, search_kind_lo(kind), search_kind_hi(kind), SEARCH_LIMIT, "(no matches)");
+}
+
+// Key of the best match of `kind`, or -1 (no index, or nothing matched).
+static sqlite3_int64 search_best_key(DB &db, int kind, const string &text) {
+    string expr, notes;
+    if (!has_search_index(db) || !search_expression(db, text, expr, notes) || expr.empty()) return -1;
+    SearchHit hit;
+    bool found;
+    if (!SEARCH_SQL.first(db, expr, search_kind_lo(kind), search_kind_hi(kind), 1, hit, found) || !found) return -1;
+    return hit.key;
+}
+
+bool rebuild_search_index_command(DB &db) {
+    if (!has_search_index(db)) { db.msg() << "No search index; run 'migrate' first.\n"; return false; }
+    auto t0 = std::chrono::steady_clock::now();
+    if (sqlite3_exec(db.db, "BEGIN IMMEDIATE;", nullptr, nullptr, nullptr) != SQLITE_OK) {
+        db.msg() << "Could not start transaction: " << sqlite3_errmsg(db.db) << "\n";
+        return false;
+    }
+    if (!rebuild_search_index(db)) { sqlite3_exec(db.db, "ROLLBACK;", nullptr, nullptr, nullptr); return false; }
+    if (sqlite3_exec(db.db, "COMMIT;", nullptr, nullptr, nullptr) != SQLITE_OK) {
+        db.msg() << "Commit failed: " << sqlite3_errmsg(db.db) << "\n";
+        sqlite3_exec(db.db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        return false;
+    }
+    sqlite3_int64 docs = 0;
+    {
+        Stmt stmt = db.prepare("SELECT COUNT(*) FROM search_index;");
+        if (stmt && sqlite3_step(stmt) == SQLITE_ROW) docs = sqlite3_column_int64(stmt, 0);
+    }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    std::ostringstream line;
+    line << "Rebuilt search_index (" << docs << " documents, " << std::fixed << std::setprecision(2) << secs << " s)\n";
+    db.msg() << line.str();
+    return true;
+}
+
+void search_text(DB &db) {
+    cout << endl;
+    cout << "Kind (all, sample, maintenance, crop, farmer, season): ";
+    string kind; getline(cin, kind);
+    if (kind.empty()) kind = "all";
+    cout << "Search for: ";
+    string text; getline(cin, text);
+    if (!search_text(db, kind, text)) return;
+    promptContinue();
+}
+
+// ---------- App logic implementing menu operations ----------
+// Each operation takes its inputs as arguments so it can run from the menu
+// (interactive wrappers below prompt for them) or from --exec / --batch.
+
+static const char* ALL_FIELDS_SQL =
+    "SELECT fld_fieldkey AS id, fld_farmerkey AS farmer_id, fld_soilkey AS soil_type FROM field ORDER BY fld_fieldkey;";
+
+void show_all_fields(DB &db) {
+    db.out.note("\n-- All fields --\n");
+    db.run_and_print(ALL_FIELDS_SQL);
+}
+
+static const Query<Value<int>, string> SEASON_BY_NAME_SQL = "SELECT s_seasonkey FROM season WHERE s_name = ?;";
+
+static const Statement<int> CROPS_BY_SEASON_SQL =
+    "SELECT s.s_name AS season, c.c_name AS crop, COUNT(fc.fldc_fieldkey) as plantings "
+    "FROM season s JOIN crop c ON c.c_preferredseason = s.s_seasonkey "
+    "LEFT JOIN fieldcrop fc ON fc.fldc_cropkey = c.c_cropkey "
+    "WHERE s.s_seasonkey = ? GROUP BY c.c_cropkey;";
+
+bool crops_by_season(DB &db, string sName) {
+    if (sName == "Fall") sName = "Autumn";
+
+    int sid = -1;
+    bool found;
+    if (!SEASON_BY_NAME_SQL.first(db, sName, sid, found)) return false;
+
+    // Otherwise the closest season name in the search index ("winter", "Sumer"), said so
+    // in the output.
+    int season_kind;
+    if (sid == -1 && search_kind("season", season_kind)) {
+        sid = (int)search_best_key(db, season_kind, sName);
+        if (sid != -1) db.out.note("(no season named '" + sName + "'; showing the closest match)\n");
+    }
+    if (sid == -1) {
+        db.msg() << "Season not found.\n";
+        return false;
+    }
+
+    if (!db.id_exists("season", "s_seasonkey", sid)) {
+        db.msg() << "Season id not found.\n"; return false;
+    }
+    return CROPS_BY_SEASON_SQL.print(db, sid);
+}
+
+void crops_by_season(DB &db) {
+    // cout << "Enter season_id: ";
+    // int sid; cin >> sid; cin.ignore();
+
+    cout << endl;
+    cout << "Enter season name (e.g. Winter): ";
+    string sName;
+    getline(cin, sName);
+
+    if (!crops_by_season(db, sName)) return;
+    promptContinue();
+}
+
+static const char* AVG_YIELD_SQL =
+    "SELECT fldc_fieldkey AS fieldkey, ROUND(AVG(fldc_yield), 2) AS avg_yield, COUNT(fldc_fieldkey) AS observations "
+    "FROM fieldcrop GROUP BY fldc_fieldkey ORDER BY fldc_fieldkey;";
+
+static const char* AVG_YIELD_SUMMARY_SQL =
+    "SELECT fs_fieldkey AS fieldkey, ROUND(fs_yield_sum / fs_planting_count, 2) AS avg_yield, fs_planting_count AS observations "
+    "FROM field_summary WHERE fs_planting_count > 0 ORDER BY fs_fieldkey;";
+
+void avg_yield_per_field(DB &db) {
+    db.out.note("\n-- Avg yield per field (aggregated) --\n");
+    db.run_and_print(has_field_summary(db) ? AVG_YIELD_SUMMARY_SQL : AVG_YIELD_SQL);
+}
+
+static const Statement<std::optional<sqlite3_int64>> LATEST_SAMPLE_SQL[3] = {
+    R"(SELECT
+                        ss_samplekey AS Sample,
+                        ss_fieldkey AS Field,
+                        ss_sampledate AS Date,
+                        ss_sand AS Sand,
+                        ss_silt AS Silt,
+                        ss_clay AS Clay,
+                        ss_ph AS pH,
+                        ss_nitrogen_ppm AS N,
+                        ss_phosphorus_ppm AS P,
+                        ss_potassium_ppm AS K,
+                        ss_organicmatter_pct AS "OM%",
+                        ss_cec AS CEC
+                    FROM soilsample
+                    WHERE ss_samplekey = ?;)",
+
+    R"(SELECT
+                        ss_lead_ppm AS Lead,
+                        ss_mercury_ppm AS Mercury,
+                        ss_nickel_ppm AS Nickel,
+                        ss_copper_ppm AS Copper,
+                        ss_chromium_ppm AS Chromium,
+                        ss_cadmium_ppm AS Cadmium,
+                        ss_arsenic_ppm AS Arsenic,
+                        ss_zinc_ppm AS Zinc
+                    FROM soilsample
+                    WHERE ss_samplekey = ?;)",
+
+    R"(SELECT
+                        ss_comment AS comment
+                    FROM soilsample
+                    WHERE ss_samplekey = ?;)"
+};
+
+static const Query<Value<std::optional<sqlite3_int64>>, int> LATEST_SAMPLE_KEY_SQL =
+    "SELECT ss_samplekey FROM soilsample WHERE ss_fieldkey = ? ORDER BY ss_sampledate DESC LIMIT 1;";
+static const Query<Value<std::optional<sqlite3_int64>>, int> LATEST_SAMPLE_SUMMARY_SQL = "SELECT fs_latest_samplekey FROM field_summary WHERE fs_fieldkey = ?;";
+
+// Finds the field's latest sample once (a field_summary read once migrated); the sections
+// are then fetched by key. `found` is false when the field has no samples.
+bool latest_sample_key(DB &db, int fid, sqlite3_int64 &key, bool &found) {
+    std::optional<sqlite3_int64> latest;
+    if (!(has_field_summary(db) ? LATEST_SAMPLE_SUMMARY_SQL : LATEST_SAMPLE_KEY_SQL).first(db, fid, latest, found)) return false;
+    found = found && latest;
+    key = latest.value_or(0);
+    return true;
+}
+
+// Prints one section (1 = soil properties, 2 = heavy metals, 3 = comment) of sample `key`.
+bool print_latest_sample_section(DB &db, sqlite3_int64 key, bool found, int index) {
+    return LATEST_SAMPLE_SQL[index - 1].print(db, found ? std::optional<sqlite3_int64>(key) : std::nullopt, "(no sample rows)");
+}
+
+bool latest_soil_sample_for_field(DB &db, int fid) {
+    if (!db.id_exists("field", "fld_fieldkey", fid)) { db.msg() << "Field not found.\n"; return false; }
+    sqlite3_int64 key; bool found;
+    if (!latest_sample_key(db, fid, key, found)) return false;
+    for (int index = 1; index <= 3; ++index) {
+        if (!print_latest_sample_section(db, key, found, index)) return false;
+    }
+    return true;
+}
+
+void latest_soil_sample_for_field(DB &db) {
+    cout << endl;
+
+    cout << "Enter field_id: ";
+    int fid; cin >> fid; cin.ignore();
+    if (!db.id_exists("field", "fld_fieldkey", fid)) { cout << "Field not found.\n"; return; }
+    sqlite3_int64 key; bool found;
+    if (!latest_sample_key(db, fid, key, found)) return;
+    int index = 1;
+
+    begin:
+    if (!print_latest_sample_section(db, key, found, index)) return;
+
+    while(index < 3){
+        string in;
+        cout << endl;
+        cout << "View more? (Y/N): ";
+        cin >> in;
+
+        if (in == "Y" || in == "y" || in == "" || !in.empty()){
+            ++index;
+            cout << endl;
+            goto begin;
+        } else if (in == "N" || in == "n"){
+            goto skip_prompt_cont;
+        }
+    }
+
+    cin.ignore();
+
+    promptContinue();
+    skip_prompt_cont:;
+}
+
+static const Statement<double, double, double> THRESHOLDS_SQL =
+    "SELECT ss.ss_samplekey, ss.ss_sampledate, fld.fld_fieldkey, f.f_farmerkey, f.f_name || ' ' || f.f_surname AS farmer_name, "
+    "ss.ss_lead_ppm, ss.ss_cadmium_ppm, ss.ss_arsenic_ppm "
+    "FROM soilsample ss JOIN field fld ON ss.ss_fieldkey = fld.fld_fieldkey JOIN farmer f ON fld.fld_farmerkey = f.f_farmerkey "
+    "WHERE (ss.ss_lead_ppm IS NOT NULL AND ss.ss_lead_ppm > ?) OR (ss.ss_cadmium_ppm IS NOT NULL AND ss.ss_cadmium_ppm > ?) OR (ss.ss_arsenic_ppm IS NOT NULL AND ss.ss_arsenic_ppm > ?) "
+    "ORDER BY ss.ss_sampledate DESC;";
+
+bool samples_exceeding_thresholds(DB &db, double lead, double cad, double as) {
+    return THRESHOLDS_SQL.print(db, lead, cad, as);
+}
+
+void samples_exceeding_thresholds(DB &db) {
+    cout << endl;
+    cout << "Enter lead_limit (ppm) [example 100]: "; double lead; cin >> lead;
+    cout << "Enter cadmium_limit (ppm) [example 0.48]: "; double cad; cin >> cad;
+    cout << "Enter arsenic_limit (ppm) [example 10]: "; double as; cin >> as;
+    cin.ignore();
+    if (!samples_exceeding_thresholds(db, lead, cad, as)) return;
+    promptContinue();
+}
+
+// The last maintenance date is a MAX() probe per field on idx_fieldmaintenance_field_begin.
+// ?1 is the cutoff date, worked out once by fields_no_recent_maintenance.
+static const Statement<string> NO_RECENT_MAINTENANCE_SQL = R"(
+    SELECT fld.fld_fieldkey AS fieldkey, fld.fld_farmerkey AS farmerkey, TRIM(f.f_name || ' ' || f.f_surname) AS farmer_name, fld.fld_soilkey AS soilkey,
+           (SELECT MAX(fldm_begindate) FROM fieldmaintenance WHERE fldm_fieldkey = fld.fld_fieldkey) AS last_begindate
+    FROM field fld
+    LEFT JOIN farmer f ON fld.fld_farmerkey = f.f_farmerkey
+    WHERE last_begindate IS NULL OR last_begindate < ?1
+    ORDER BY (last_begindate IS NOT NULL), last_begindate;
+    )";
+
+static const Statement<string> NO_RECENT_MAINTENANCE_SUMMARY_SQL = R"(
+    SELECT fld.fld_fieldkey AS fieldkey, fld.fld_farmerkey AS farmerkey, TRIM(f.f_name || ' ' || f.f_surname) AS farmer_name, fld.fld_soilkey AS soilkey,
+           fs.fs_last_maintenance AS last_begindate
+    FROM field fld
+    JOIN field_summary fs ON fs.fs_fieldkey = fld.fld_fieldkey
+    LEFT JOIN farmer f ON fld.fld_farmerkey = f.f_farmerkey
+    WHERE last_begindate IS NULL OR last_begindate < ?1
+    ORDER BY (last_begindate IS NOT NULL), last_begindate;
+    )";
+
+void fields_no_recent_maintenance(DB &db) {
+    db.out.note("\n-- Fields with no maintenance in last 3 years (or never) --\n");
+    string cutoff = format_date(years_before(today_day(), 3));
+    (has_field_summary(db) ? NO_RECENT_MAINTENANCE_SUMMARY_SQL : NO_RECENT_MAINTENANCE_SQL).print(db, cutoff);
+}
+
+static const char* AVG_NPK_SQL = R"(
+    SELECT st.st_soil_texture AS soil_texture, COUNT(ss.ss_samplekey) AS sample_count,
+           ROUND(AVG(ss.ss_nitrogen_ppm),2) AS avg_N,
+           ROUND(AVG(ss.ss_phosphorus_ppm),2) AS avg_P,
+           ROUND(AVG(ss.ss_potassium_ppm),2) AS avg_K,
+           ROUND(AVG(ss.ss_cec),2) AS avg_cec
+    FROM soilsample ss
+    JOIN field fld ON ss.ss_fieldkey = fld.fld_fieldkey
+    JOIN soiltype st ON fld.fld_soilkey = st.st_soilkey
+    GROUP BY st.st_soil_texture
+    HAVING COUNT(ss.ss_samplekey) >= 5
+    ORDER BY st.st_soilkey DESC;
+    )";
+
+void avg_npk_by_soil_texture(DB &db) {
+    db.out.note("\n-- Avg NPK by soil texture (requires >=5 samples) --\n");
+    db.run_and_print(AVG_NPK_SQL);
+}
+
+// Totals per crop come off idx_fieldcrop_crop in key order; only the handful of per-crop
+// rows are then grouped by season.
+static const char* YIELD_PER_SEASON_SQL = R"(
+    WITH per_crop AS (
+      SELECT fldc_cropkey, SUM(fldc_yield) AS yield_sum, COUNT(fldc_fieldkey) AS plantings
+      FROM fieldcrop
+      GROUP BY fldc_cropkey
+    )
+    SELECT s.s_seasonkey, s.s_name, ROUND(SUM(pc.yield_sum),2) AS total_yield, SUM(pc.plantings) AS plantings_count
+    FROM season s
+    JOIN crop c ON c.c_preferredseason = s.s_seasonkey
+    JOIN per_crop pc ON pc.fldc_cropkey = c.c_cropkey
+    GROUP BY s.s_seasonkey, s.s_name
+    ORDER BY total_yield DESC;
+    )";
+
+void total_yield_per_season(DB &db) {
+    db.out.note("\n-- Total yield per season (aggregated) --\n");
+    db.run_and_print(YIELD_PER_SEASON_SQL);
+}
+
+// Latest and previous harvest are two probes down idx_fieldcrop_field_end (newest first),
+// instead of numbering the field's whole history with ROW_NUMBER() and self-joining it.
+static const Statement<int> ROTATION_SQL = R"(
+    SELECT cur.fldc_fieldkey, cur.fldc_cropkey AS current_cropkey, prev.fldc_cropkey AS previous_cropkey,
+           c1.c_name AS current_crop_name, c2.c_name AS previous_crop_name
+    FROM (SELECT fldc_fieldkey, fldc_cropkey FROM fieldcrop WHERE fldc_fieldkey = ?1
+          ORDER BY fldc_enddate DESC LIMIT 1) cur
+    JOIN (SELECT fldc_fieldkey, fldc_cropkey FROM fieldcrop WHERE fldc_fieldkey = ?1
+          ORDER BY fldc_enddate DESC LIMIT 1 OFFSET 1) prev ON cur.fldc_fieldkey = prev.fldc_fieldkey
+    JOIN crop c1 ON cur.fldc_cropkey = c1.c_cropkey
+    JOIN crop c2 ON prev.fldc_cropkey = c2.c_cropkey
+    WHERE cur.fldc_cropkey <> prev.fldc_cropkey;
+    )";
+
+static const Statement<int> ROTATION_SUMMARY_SQL = R"(
+    SELECT fs.fs_fieldkey AS fldc_fieldkey, fs.fs_current_cropkey AS current_cropkey, fs.fs_previous_cropkey AS previous_cropkey,
+           c1.c_name AS current_crop_name, c2.c_name AS previous_crop_name
+    FROM field_summary fs
+    JOIN crop c1 ON fs.fs_current_cropkey = c1.c_cropkey
+    JOIN crop c2 ON fs.fs_previous_cropkey = c2.c_cropkey
+    WHERE fs.fs_fieldkey = ? AND fs.fs_current_cropkey <> fs.fs_previous_cropkey;
+    )";
+
+// Every field's harvests in a key range, in rotation order (see Rotation analysis).
+struct HarvestRow {
+    sqlite3_int64 field, crop;
+    std::string_view enddate;
+    double yield;
+};
+static const Query<Columns<&HarvestRow::field, &HarvestRow::crop, &HarvestRow::enddate, &HarvestRow::yield>,
+                   sqlite3_int64, sqlite3_int64> ROTATION_SCAN_SQL = R"(
+    SELECT fldc_fieldkey, fldc_cropkey, fldc_enddate, fldc_yield
+    FROM fieldcrop
+    WHERE fldc_fieldkey >= ?1 AND fldc_fieldkey <= ?2
+    ORDER BY fldc_fieldkey, fldc_enddate, fldc_cropkey;
+    )";
+
+// Plantings and maintenance applications of a key range, each in field order, for the
+// interval join (see Planting inputs). The dates are parsed to day numbers in C++.
+static const char* PLANTING_SCAN_SQL = R"(
+    SELECT fldc_fieldkey, fldc_cropkey, fldc_begindate, fldc_enddate, fldc_yield, fldc_yield_unit
+    FROM fieldcrop
+    WHERE fldc_fieldkey >= ?1 AND fldc_fieldkey <= ?2
+    ORDER BY fldc_fieldkey;
+    )";
+
+static const char* APPLICATION_SCAN_SQL = R"(
+    SELECT fldm_fieldkey, fldm_amount, fldm_amount_unit, fldm_begindate, fldm_enddate
+    FROM fieldmaintenance
+    WHERE fldm_fieldkey >= ?1 AND fldm_fieldkey <= ?2
+    ORDER BY fldm_fieldkey, fldm_begindate;
+    )";
+
+// Each field of a key range with its soil type's texture and its latest sample (see Crop
+// recommendations): a probe down idx_soilsample_field_date per field, or the sample key
+// kept in field_summary once migrated.
+struct FieldSoilRow {
+    sqlite3_int64 field;
+    std::optional<double> ph, n, p, k, cec, sand, silt, clay;   // latest sample
+    std::optional<double> type_sand, type_silt, type_clay;       // soil type averages
+};
+using FieldSoilQuery = Query<Columns<&FieldSoilRow::field, &FieldSoilRow::ph, &FieldSoilRow::n, &FieldSoilRow::p, &FieldSoilRow::k,
+                                     &FieldSoilRow::cec, &FieldSoilRow::sand, &FieldSoilRow::silt, &FieldSoilRow::clay,
+                                     &FieldSoilRow::type_sand, &FieldSoilRow::type_silt, &FieldSoilRow::type_clay>,
+                             sqlite3_int64, sqlite3_int64>;
+
+static const FieldSoilQuery FIELD_SOIL_SCAN_SQL = R"(
+    SELECT fld.fld_fieldkey, ss.ss_ph, ss.ss_nitrogen_ppm, ss.ss_phosphorus_ppm, ss.ss_potassium_ppm, ss.ss_cec,
+           ss.ss_sand, ss.ss_silt, ss.ss_clay, st.st_sand_pct, st.st_silt_pct, st.st_clay_pct
+    FROM field fld
+    LEFT JOIN soiltype st ON st.st_soilkey = fld.fld_soilkey
+    LEFT JOIN soilsample ss ON ss.ss_samplekey =
+        (SELECT ss_samplekey FROM soilsample WHERE ss_fieldkey = fld.fld_fieldkey ORDER BY ss_sampledate DESC LIMIT 1)
+    WHERE fld.fld_fieldkey >= ?1 AND fld.fld_fieldkey <= ?2
+    ORDER BY fld.fld_fieldkey;
+    )";
+
+static const FieldSoilQuery FIELD_SOIL_SCAN_SUMMARY_SQL = R"(
+    SELECT fld.fld_fieldkey, ss.ss_ph, ss.ss_nitrogen_ppm, ss.ss_phosphorus_ppm, ss.ss_potassium_ppm, ss.ss_cec,
+           ss.ss_sand, ss.ss_silt, ss.ss_clay, st.st_sand_pct, st.st_silt_pct, st.st_clay_pct
+    FROM field fld
+    LEFT JOIN soiltype st ON st.st_soilkey = fld.fld_soilkey
+    LEFT JOIN field_summary fs ON fs.fs_fieldkey = fld.fld_fieldkey
+    LEFT JOIN soilsample ss ON ss.ss_samplekey = fs.fs_latest_samplekey
+    WHERE fld.fld_fieldkey >= ?1 AND fld.fld_fieldkey <= ?2
+    ORDER BY fld.fld_fieldkey;
+    )";
+
+// What was on field ?1 on date ?2: plantings and applications whose window contains it.
+static const char* ON_FIELD_SQL = R"(
+    SELECT 'planting' AS kind, c.c_name AS name, fc.fldc_begindate AS begins, fc.fldc_enddate AS ends,
+           fc.fldc_yield || ' ' || fc.fldc_yield_unit AS detail
+    FROM fieldcrop fc JOIN crop c ON c.c_cropkey = fc.fldc_cropkey
+    WHERE fc.fldc_fieldkey = ?1 AND fc.fldc_enddate >= ?2 AND fc.fldc_begindate <= ?2
+    UNION ALL
+    SELECT 'maintenance', m.m_name, fm.fldm_begindate, COALESCE(fm.fldm_enddate, fm.fldm_begindate),
+           fm.fldm_amount || ' ' || fm.fldm_amount_unit
+    FROM fieldmaintenance fm JOIN maintenance m ON m.m_maintenancekey = fm.fldm_maintenancekey
+    WHERE fm.fldm_fieldkey = ?1 AND fm.fldm_begindate <= ?2 AND COALESCE(fm.fldm_enddate, fm.fldm_begindate) >= ?2
+    ORDER BY 1 DESC, 3;
+    )";
+
+// The same on the day-number columns (schema version 5): ?2 is a day number and both
+// halves are range probes on idx_fieldcrop_field_day / idx_fieldmaintenance_field_day.
+static const char* ON_FIELD_DAY_SQL = R"(
+    SELECT 'planting' AS kind, c.c_name AS name, fc.fldc_begindate AS begins, fc.fldc_enddate AS ends,
+           fc.fldc_yield || ' ' || fc.fldc_yield_unit AS detail
+    FROM fieldcrop fc JOIN crop c ON c.c_cropkey = fc.fldc_cropkey
+    WHERE fc.fldc_fieldkey = ?1 AND fc.fldc_beginday <= ?2 AND fc.fldc_endday >= ?2
+    UNION ALL
+    SELECT 'maintenance', m.m_name, fm.fldm_begindate, COALESCE(fm.fldm_enddate, fm.fldm_begindate),
+           fm.fldm_amount || ' ' || fm.fldm_amount_unit
+    FROM fieldmaintenance fm JOIN maintenance m ON m.m_maintenancekey = fm.fldm_maintenancekey
+    WHERE fm.fldm_fieldkey = ?1 AND fm.fldm_beginday <= ?2 AND COALESCE(fm.fldm_endday, fm.fldm_beginday) >= ?2
+    ORDER BY 1 DESC, 3;
+    )";
+
+bool crop_rotation_history(DB &db, int fid) {
+    if (!db.id_exists("field", "fld_fieldkey", fid)) { db.msg() << "Field not found.\n"; return false; }
+    return (has_field_summary(db) ? ROTATION_SUMMARY_SQL : ROTATION_SQL).print(db, fid, "(no rotation info found)");
+}
+
+void crop_rotation_history(DB &db) {
+    cout << endl;
+    cout << "Enter field_id to view recent rotation: ";
+    int fid; cin >> fid; cin.ignore();
+    if (!crop_rotation_history(db, fid)) return;
+    promptContinue();
+}
+
+static const Statement<int> FIELD_DASHBOARD_SQL = R"(
+    SELECT fs.fs_fieldkey AS field, fld.fld_farmerkey AS farmer, fs.fs_sample_count AS samples,
+           fs.fs_latest_samplekey AS latest_sample, fs.fs_latest_sampledate AS sampled_on,
+           fs.fs_planting_count AS plantings, ROUND(fs.fs_yield_sum / NULLIF(fs.fs_planting_count, 0), 2) AS avg_yield,
+           c1.c_name AS current_crop, fs.fs_current_enddate AS harvested_on, c2.c_name AS previous_crop,
+           fs.fs_last_maintenance AS last_maintenance
+    FROM field_summary fs
+    JOIN field fld ON fld.fld_fieldkey = fs.fs_fieldkey
+    LEFT JOIN crop c1 ON c1.c_cropkey = fs.fs_current_cropkey
+    LEFT JOIN crop c2 ON c2.c_cropkey = fs.fs_previous_cropkey
+    WHERE fs.fs_fieldkey = ?;
+    )";
+
+bool field_dashboard(DB &db, int fid) {
+    if (!has_field_summary(db)) { db.msg() << "No field_summary table; run 'migrate' first.\n"; return false; }
+    if (!db.id_exists("field", "fld_fieldkey", fid)) { db.msg() << "Field not found.\n"; return false; }
+    return FIELD_DASHBOARD_SQL.print(db, fid, "(no summary row; try summary-rebuild)");
+}
+
+void field_dashboard(DB &db) {
+    cout << endl;
+    cout << "Enter field_id: ";
+    int fid; cin >> fid; cin.ignore();
+    if (!field_dashboard(db, fid)) return;
+    promptContinue();
+}
+
+// Trend queries read field_rollup buckets (schema version 4). Averages are bucket sums over
+// bucket counts, so a window of months is just the sum of its buckets. `trend` shows the
+// last N calendar months up to the field's latest month with data.
+static const Statement<int, int> FIELD_TREND_SQL = R"(
+    SELECT fr_period AS month, fr_samples AS samples,
+           ROUND(fr_ph_sum / NULLIF(fr_samples, 0), 2) AS avg_ph,
+           ROUND(fr_n_sum / NULLIF(fr_samples, 0), 2) AS avg_n_ppm,
+           ROUND(fr_p_sum / NULLIF(fr_samples, 0), 2) AS avg_p_ppm,
+           ROUND(fr_k_sum / NULLIF(fr_samples, 0), 2) AS avg_k_ppm,
+           fr_plantings AS plantings, ROUND(fr_yield_sum, 2) AS yield,
+           fr_maintenance AS applications, ROUND(fr_maint_amount, 2) AS amount
+    FROM field_rollup
+    WHERE fr_fieldkey = ?1
+      AND fr_period > strftime('%Y-%m', (SELECT MAX(fr_period) FROM field_rollup WHERE fr_fieldkey = ?1 AND length(fr_period) = 7) || '-01',
+                               '-' || ?2 || ' months')
+      AND length(fr_period) = 7
+    ORDER BY fr_period;
+    )";
+
+// Year buckets against the calendar year before (not just the previous row).
+static const Statement<int> FIELD_YOY_SQL = R"(
+    SELECT y.fr_period AS year, y.fr_samples AS samples,
+           ROUND(y.fr_ph_sum / NULLIF(y.fr_samples, 0), 2) AS avg_ph,
+           ROUND(y.fr_ph_sum / NULLIF(y.fr_samples, 0) - p.fr_ph_sum / NULLIF(p.fr_samples, 0), 2) AS ph_change,
+           ROUND(y.fr_n_sum / NULLIF(y.fr_samples, 0), 2) AS avg_n_ppm,
+           ROUND(y.fr_n_sum / NULLIF(y.fr_samples, 0) - p.fr_n_sum / NULLIF(p.fr_samples, 0), 2) AS n_change,
+           y.fr_plantings AS plantings, ROUND(y.fr_yield_sum, 2) AS yield,
+           ROUND(100.0 * (y.fr_yield_sum - p.fr_yield_sum) / NULLIF(p.fr_yield_sum, 0), 1) AS yield_change_pct,
+           ROUND(y.fr_maint_amount, 2) AS amount
+    FROM field_rollup y
+    LEFT JOIN field_rollup p ON p.fr_fieldkey = y.fr_fieldkey AND p.fr_period = CAST(y.fr_period - 1 AS TEXT)
+    WHERE y.fr_fieldkey = ? AND length(y.fr_period) = 4
+    ORDER BY y.fr_period;
+    )";
+
+// Months ?2..?3 ('YYYY-MM') combined: whole years inside the range come from their year
+// bucket, the partial years at either end from month buckets.
+static const Statement<int, string, string> FIELD_WINDOW_SQL = R"(
+    WITH buckets AS (
+        SELECT * FROM field_rollup
+        WHERE fr_fieldkey = ?1 AND fr_period >= substr(?2, 1, 4) AND fr_period <= ?3
+          AND (substr(fr_period, 1, 4) || '-01' >= ?2 AND substr(fr_period, 1, 4) || '-12' <= ?3) = (length(fr_period) = 4)
+          AND (length(fr_period) = 4 OR fr_period >= ?2)
+    )
+    SELECT ?2 AS from_month, ?3 AS to_month, COUNT(*) AS buckets, SUM(fr_samples) AS samples,
+           ROUND(SUM(fr_ph_sum) / NULLIF(SUM(fr_samples), 0), 2) AS avg_ph,
+           ROUND(SQRT(MAX(0, SUM(fr_ph_sumsq) / NULLIF(SUM(fr_samples), 0) - (SUM(fr_ph_sum) / NULLIF(SUM(fr_samples), 0)) * (SUM(fr_ph_sum) / NULLIF(SUM(fr_samples), 0)))), 3) AS ph_stddev,
+           ROUND(SUM(fr_n_sum) / NULLIF(SUM(fr_samples), 0), 2) AS avg_n_ppm,
+           ROUND(SUM(fr_p_sum) / NULLIF(SUM(fr_samples), 0), 2) AS avg_p_ppm,
+           ROUND(SUM(fr_k_sum) / NULLIF(SUM(fr_samples), 0), 2) AS avg_k_ppm,
+           ROUND(SUM(fr_lead_sum) / NULLIF(SUM(fr_samples), 0), 3) AS avg_lead_ppm,
+           ROUND(SUM(fr_mercury_sum) / NULLIF(SUM(fr_samples), 0), 3) AS avg_mercury_ppm,
+           ROUND(SUM(fr_nickel_sum) / NULLIF(SUM(fr_samples), 0), 3) AS avg_nickel_ppm,
+           ROUND(SUM(fr_copper_sum) / NULLIF(SUM(fr_samples), 0), 3) AS avg_copper_ppm,
+           ROUND(SUM(fr_chromium_sum) / NULLIF(SUM(fr_samples), 0), 3) AS avg_chromium_ppm,
+           ROUND(SUM(fr_cadmium_sum) / NULLIF(SUM(fr_samples), 0), 3) AS avg_cadmium_ppm,
+           ROUND(SUM(fr_arsenic_sum) / NULLIF(SUM(fr_samples), 0), 3) AS avg_arsenic_ppm,
+           ROUND(SUM(fr_zinc_sum) / NULLIF(SUM(fr_samples), 0), 3) AS avg_zinc_ppm,
+           SUM(fr_plantings) AS plantings, ROUND(SUM(fr_yield_sum), 2) AS yield,
+           SUM(fr_maintenance) AS applications, ROUND(SUM(fr_maint_amount), 2) AS amount
+    FROM buckets;
+    )";
+
+// QUERY 8 of queries.sql (maintenance amount against yield per field and year) from the
+// year buckets.
+static const Statement<> MAINT_VS_YIELD_SQL = R"(
+    SELECT fr_fieldkey AS fieldkey, fr_period AS year, fr_maint_amount AS total_maint_amount,
+           fr_yield_sum AS total_yield,
+           CASE WHEN fr_yield_sum = 0 THEN NULL ELSE ROUND(fr_maint_amount / fr_yield_sum, 6) END AS amount_per_yield_unit
+    FROM field_rollup
+    WHERE length(fr_period) = 4 AND fr_maintenance > 0
+    ORDER BY fr_fieldkey, fr_period;
+    )";
+
+bool field_trend(DB &db, int fid, int months) {
+    if (!has_field_rollup(db)) { db.msg() << "No field_rollup table; run 'migrate' first.\n"; return false; }
+    if (months < 1) { db.msg() << "Months must be at least 1.\n"; return false; }
+    if (!db.id_exists("field", "fld_fieldkey", fid)) { db.msg() << "Field not found.\n"; return false; }
+    return FIELD_TREND_SQL.print(db, fid, months, "(no data for this field)");
+}
+
+bool field_year_over_year(DB &db, int fid) {
+    if (!has_field_rollup(db)) { db.msg() << "No field_rollup table; run 'migrate' first.\n"; return false; }
+    if (!db.id_exists("field", "fld_fieldkey", fid)) { db.msg() << "Field not found.\n"; return false; }
+    return FIELD_YOY_SQL.print(db, fid, "(no data for this field)");
+}
+
+bool field_window(DB &db, int fid, const string &from, const string &to) {
+    if (!has_field_rollup(db)) { db.msg() << "No field_rollup table; run 'migrate' first.\n"; return false; }
+    if (!valid_month(from) || !valid_month(to) || from > to) { db.msg() << "Expected months YYYY-MM, from <= to.\n"; return false; }
+    if (!db.id_exists("field", "fld_fieldkey", fid)) { db.msg() << "Field not found.\n"; return false; }
+    return FIELD_WINDOW_SQL.print(db, fid, from, to);
+}
+
+bool maintenance_vs_yield(DB &db) {
+    if (!has_field_rollup(db)) { db.msg() << "No field_rollup table; run 'migrate' first.\n"; return false; }
+    return MAINT_VS_YIELD_SQL.print(db);
+}
+
+void field_trend(DB &db) {
+    cout << endl;
+    cout << "Enter field_id: ";
+    int fid; cin >> fid;
+    cout << "Months to show: ";
+    int months; cin >> months; cin.ignore();
+    if (!field_trend(db, fid, months)) return;
+    cout << endl;
+    if (!field_year_over_year(db, fid)) return;
+    promptContinue();
+}
+
+// ---------- Insert operations (safe, parameterized) ----------
+
+struct FieldCropRow {
+    int field_id = 0, crop_id = 0;
+    string bdate, edate;
+    double yield = 0.0;
+    string unit;
+};
+
+// Every NOT NULL column of soilsample; the key is assigned at insert time.
+struct SoilSampleRow {
+    int field_id = 0;
+    string sdate;
+    double sand = 0.0, silt = 0.0, clay = 0.0;
+    double ph = 0.0, nppm = 0.0, pppm = 0.0, kppm = 0.0, om = 0.0, cec = 0.0;
+    double lead = 0.0, mercury = 0.0, nickel = 0.0, copper = 0.0, chromium = 0.0, cadmium = 0.0, arsenic = 0.0, zinc = 0.0;
+    string comment;   // empty stores NULL
+
+    // Non-negative measurements in column order after ss_ph, for range checks.
+    vector<double> amounts() const {
+        return {sand, silt, clay, nppm, pppm, kppm, om, cec, lead, mercury, nickel, copper, chromium, cadmium, arsenic, zinc};
+    }
+};
+
+static const char* FIELDCROP_INSERT_SQL =
+    "INSERT INTO fieldcrop (fldc_fieldkey, fldc_cropkey, fldc_begindate, fldc_enddate, fldc_yield, fldc_yield_unit) VALUES (?, ?, ?, ?, ?, ?);";
+
+// ss_samplekey is not a rowid alias, so the next key is taken inside the statement (the
+// primary key index makes MAX a single seek); same rule as the web UI's insert, except
+// that on a shard next_sample_key() keeps the key out of the other shards' way.
+static const char* SOILSAMPLE_INSERT_SQL = R"(INSERT INTO soilsample
+  (ss_samplekey, ss_fieldkey, ss_sampledate, ss_sand, ss_silt, ss_clay, ss_ph,
+   ss_nitrogen_ppm, ss_phosphorus_ppm, ss_potassium_ppm, ss_organicmatter_pct, ss_cec,
+   ss_lead_ppm, ss_mercury_ppm, ss_nickel_ppm, ss_copper_ppm, ss_chromium_ppm, ss_cadmium_ppm,
+   ss_arsenic_ppm, ss_zinc_ppm, ss_comment)
+  VALUES ((SELECT next_sample_key(MAX(ss_samplekey)) FROM soilsample),
+          ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);)";
+
+// Value checks shared by every insert path (keys are checked by the caller). Empty if valid.
+static string fieldcrop_value_error(const FieldCropRow &r) {
+    if (!valid_date(r.bdate)) return "Invalid date format.";
+    if (!r.edate.empty() && !valid_date(r.edate)) return "Invalid date format.";
+    if (r.yield < 0) return "Yield must be non-negative.";
+    return "";
+}
+
+static string soilsample_value_error(const SoilSampleRow &r) {
+    if (!valid_date(r.sdate)) return "Invalid date format.";
+    if (r.ph < 3.0 || r.ph > 9.0) return "ph out of expected range.";
+    for (double v : r.amounts()) if (v < 0) return "must be >=0";
+    return "";
+}
+
+static void bind_fieldcrop(sqlite3_stmt* stmt, const FieldCropRow &r) {
+    sqlite3_bind_int(stmt, 1, r.field_id);
+    sqlite3_bind_int(stmt, 2, r.crop_id);
+    sqlite3_bind_text(stmt, 3, r.bdate.c_str(), -1, SQLITE_TRANSIENT);
+    if (r.edate.empty()) sqlite3_bind_null(stmt, 4); else sqlite3_bind_text(stmt, 4, r.edate.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_double(stmt, 5, r.yield);
+    sqlite3_bind_text(stmt, 6, r.unit.c_str(), -1, SQLITE_TRANSIENT);
+}
+
+static void bind_soilsample(sqlite3_stmt* stmt, const SoilSampleRow &r) {
+    sqlite3_bind_int(stmt, 1, r.field_id);
+    sqlite3_bind_text(stmt, 2, r.sdate.c_str(), -1, SQLITE_TRANSIENT);
+    vector<double> amounts = r.amounts();
+    // sand, silt, clay, ph, then the rest in column order
+    for (int i = 0; i < 3; ++i) sqlite3_bind_double(stmt, 3 + i, amounts[i]);
+    sqlite3_bind_double(stmt, 6, r.ph);
+    for (size_t i = 3; i < amounts.size(); ++i) sqlite3_bind_double(stmt, 4 + (int)i, amounts[i]);
+    if (r.comment.empty()) sqlite3_bind_null(stmt, 20); else sqlite3_bind_text(stmt, 20, r.comment.c_str(), -1, SQLITE_TRANSIENT);
+}
+
+// ---------- Write pipeline ----------
+// Inserts from batch scripts and serve requests are queued to one writer thread with its own
+// connection, which commits whatever has accumulated in one transaction: a journal sync per
+// batch instead of per row. A batch closes at batch_rows rows or once its oldest row has
+// waited delay_ms. With the default delay of 0 the writer commits as soon as the previous
+// commit is done, so a lone insert is not held back and a burst still shares commits.
+//
+// Rows are checked before they are queued: values first, then field and crop keys against
+// in-memory sets loaded on first use. A key missing from its set is probed once on a private
+// read connection, since another connection may have added it; rows whose parent disappears
+// in the meantime are still rejected by the writer's foreign key constraints.
+//
+// Serve workers don't wait on their tickets: each passes a callback that wakes its event
+// loop when the batch is done, and answers the request then. Nor do they wait for room in
+// a full queue; the row is turned away and the request answered 503.
+
+struct WriteOptions {
+    size_t batch_rows = 1000;
+    int delay_ms = 0;
+    bool reject_when_full = false;   // serve: turn rows away rather than block the event loop
+};
+
+class WritePipeline {
+public:
+    ~WritePipeline() { stop(); }
+
+    bool start(const string &path, const WriteOptions &o) {
+        opt_ = o;
+        if (!writer_db_.open(path) || !probe_db_.open_readonly(path)) return false;
+        sqlite3_busy_timeout(writer_db_.db, 5000);
+        writer_ = std::thread([this] { run(); });
+        return true;
+    }
+
+    // Closes the batch being collected without waiting out delay_ms, for a caller that is
+    // about to wait on its tickets.
+    void flush() {
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            flush_ = true;
+        }
+        cv_.notify_all();
+    }
+
+    // Commits everything still queued, then stops the writer.
+    void stop() {
+        if (!writer_.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            stopping_ = true;
+        }
+        cv_.notify_all();
+        writer_.join();
+    }
+
+    // `done`, if set, runs on the writer thread after the row's batch; rows rejected here
+    // come back with a ticket that is already resolved.
+    WriteTicket submit(const FieldCropRow &r, std::function<void()> done = nullptr) {
+        if (!key_known(fields_, r.field_id)) return resolved(false, "Field id not found.");
+        if (!key_known(crops_, r.crop_id)) return resolved(false, "Crop id not found.");
+        string err = fieldcrop_value_error(r);
+        if (!err.empty()) return resolved(false, err);
+        Pending p;
+        p.fieldcrop = r;
+        p.notify = std::move(done);
+        return enqueue(std::move(p));
+    }
+
+    WriteTicket submit(const SoilSampleRow &r, std::function<void()> done = nullptr) {
+        if (!key_known(fields_, r.field_id)) return resolved(false, "Field id not found.");
+        string err = soilsample_value_error(r);
+        if (!err.empty()) return resolved(false, err);
+        Pending p;
+        p.soil = true;
+        p.soilsample = r;
+        p.notify = std::move(done);
+        return enqueue(std::move(p));
+    }
+
+    uint64_t rows_written() {
+        std::lock_guard<std::mutex> lk(mu_);
+        return rows_;
+    }
+
+    // Commit count, batch sizes as power-of-two buckets and enqueue-to-commit latency.
+    void print_stats(std::ostream &os) {
+        std::lock_guard<std::mutex> lk(mu_);
+        if (batches_ == 0) { os << "Writes: none\n"; return; }
+        os << std::fixed << std::setprecision(2);
+        os << "Writes: " << rows_ << " rows (" << failed_ << " failed) in " << batches_ << " commits, "
+           << (double)rows_ / batches_ << " rows/commit avg, " << max_batch_ << " max";
+        if (rejected_) os << "; " << rejected_ << " turned away, queue full";
+        os << "\n";
+        os << "  rows/commit:";
+        for (int b = 0; b < BATCH_BUCKETS; ++b) {
+            if (!batch_hist_[b]) continue;
+            uint64_t lo = 1ull << b, hi = (2ull << b) - 1;
+            os << " " << lo;
+            if (hi > lo) os << "-" << hi;
+            os << ":" << batch_hist_[b];
+        }
+        auto ms = [this](double q) { return latency_.percentile(q) / 1e6; };
+        os << "\n  latency ms: p50 " << ms(0.50) << "  p95 " << ms(0.95) << "  p99 " << ms(0.99) << "  max " << ms(1.0) << "\n";
+        os.unsetf(std::ios::floatfield);
+        os << std::setprecision(6);
+    }
+
+private:
+    static const int BATCH_BUCKETS = 32;
+    static const size_t QUEUE_BATCHES = 4;   // queued rows are capped at this many batches
+
+    struct Pending {
+        bool soil = false;
+        FieldCropRow fieldcrop;
+        SoilSampleRow soilsample;
+        std::chrono::steady_clock::time_point queued;
+        std::promise<WriteResult> done;
+        std::function<void()> notify;
+    };
+
+    struct KeySet {
+        const char* table;
+        const char* column;
+        std::unordered_set<sqlite3_int64> keys = {};
+        bool loaded = false;
+    };
+
+    static WriteTicket resolved(bool ok, const string &message, bool busy = false) {
+        std::promise<WriteResult> p;
+        p.set_value(WriteResult{ok, message, busy});
+        return p.get_future().share();
+    }
+
+    WriteTicket enqueue(Pending p) {
+        p.queued = std::chrono::steady_clock::now();
+        WriteTicket t = p.done.get_future().share();
+        {
+            // Backpressure: a producer faster than the disk waits instead of growing the
+            // queue, unless it is an event loop that must not wait.
+            std::unique_lock<std::mutex> lk(mu_);
+            auto has_space = [this] { return queue_.size() < QUEUE_BATCHES * opt_.batch_rows; };
+            if (opt_.reject_when_full && !has_space()) {
+                ++rejected_;
+                return resolved(false, "Write queue full; try again.", true);
+            }
+            space_.wait(lk, has_space);
+            queue_.push_back(std::move(p));
+        }
+        cv_.notify_one();
+        return t;
+    }
+
+    bool key_known(KeySet &ks, sqlite3_int64 id) {
+        std::lock_guard<std::mutex> lk(keys_mu_);
+        if (!ks.loaded) {
+            Stmt stmt = probe_db_.prepare(string("SELECT ") + ks.column + " FROM " + ks.table + ";");
+            while (stmt && sqlite3_step(stmt) == SQLITE_ROW) ks.keys.insert(sqlite3_column_int64(stmt, 0));
+            ks.loaded = true;
+        }
+        if (ks.keys.count(id)) return true;
+        if (!probe_db_.id_exists(ks.table, ks.column, id)) return false;
+        ks.keys.insert(id);
+        return true;
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lk(mu_);
+        for (;;) {
+            cv_.wait(lk, [this] { return stopping_ || !queue_.empty(); });
+            if (queue_.empty()) return;
+            if (opt_.delay_ms > 0 && !stopping_) {
+                auto deadline = queue_.front().queued + std::chrono::milliseconds(opt_.delay_ms);
+                cv_.wait_until(lk, deadline, [this] { return stopping_ || flush_ || queue_.size() >= opt_.batch_rows; });
+            }
+            flush_ = false;
+            size_t n = std::min(queue_.size(), opt_.batch_rows);
+            vector<Pending> batch;
+            batch.reserve(n);
+            for (size_t i = 0; i < n; ++i) { batch.push_back(std::move(queue_.front())); queue_.pop_front(); }
+            lk.unlock();
+            space_.notify_all();
+            commit(batch);
+            lk.lock();
+        }
+    }
+
+    // One transaction for the batch. A row that fails a constraint only loses its own
+    // statement; anything that ends the transaction fails the rows not yet committed.
+    void commit(vector<Pending> &batch) {
+        sqlite3* h = writer_db_.db;
+        vector<WriteResult> results(batch.size());
+        string lost;
+        if (sqlite3_exec(h, "BEGIN IMMEDIATE;", nullptr, nullptr, nullptr) != SQLITE_OK) {
+            lost = string("Could not start write transaction: ") + sqlite3_errmsg(h);
+        } else {
+            for (size_t i = 0; i < batch.size() && lost.empty(); ++i) {
+                Pending &p = batch[i];
+                Stmt stmt = writer_db_.prepare(p.soil ? SOILSAMPLE_INSERT_SQL : FIELDCROP_INSERT_SQL);
+                if (!stmt) { lost = string("Prepare error: ") + sqlite3_errmsg(h); break; }
+                if (p.soil) bind_soilsample(stmt, p.soilsample); else bind_fieldcrop(stmt, p.fieldcrop);
+                if (sqlite3_step(stmt) == SQLITE_DONE) {
+                    results[i] = {true, p.soil ? "Inserted soilsample row successfully." : "Inserted fieldcrop row successfully."};
+                } else {
+                    results[i] = {false, string("Insert failed: ") + sqlite3_errmsg(h)};
+                    if (sqlite3_get_autocommit(h)) lost = results[i].message;   // transaction rolled back
+                }
+            }
+            if (lost.empty() && sqlite3_exec(h, "COMMIT;", nullptr, nullptr, nullptr) != SQLITE_OK) {
+                lost = string("Commit failed: ") + sqlite3_errmsg(h);
+            }
+            if (!lost.empty() && !sqlite3_get_autocommit(h)) sqlite3_exec(h, "ROLLBACK;", nullptr, nullptr, nullptr);
+        }
+        if (!lost.empty()) {
+            for (auto &r : results) if (r.ok || r.message.empty()) r = {false, lost};
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            ++batches_;
+            rows_ += batch.size();
+            max_batch_ = std::max(max_batch_, batch.size());
+            int bucket = 0;
+            while (bucket + 1 < BATCH_BUCKETS && (2ull << bucket) <= batch.size()) ++bucket;
+            ++batch_hist_[bucket];
+            for (size_t i = 0; i < batch.size(); ++i) {
+                if (!results[i].ok) ++failed_;
+                latency_.record((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(now - batch[i].queued).count());
+            }
+        }
+        for (size_t i = 0; i < batch.size(); ++i) batch[i].done.set_value(std::move(results[i]));
+        for (auto &p : batch) if (p.notify) p.notify();
+    }
+
+    DB writer_db_, probe_db_;
+    WriteOptions opt_;
+    std::thread writer_;
+
+    std::mutex mu_;   // queue and statistics
+    std::condition_variable cv_, space_;
+    std::deque<Pending> queue_;
+    bool stopping_ = false, flush_ = false;
+    uint64_t batches_ = 0, rows_ = 0, failed_ = 0, rejected_ = 0;
+    size_t max_batch_ = 0;
+    uint64_t batch_hist_[BATCH_BUCKETS] = {};
+    LatencyHistogram latency_;   // enqueue to commit
+
+    std::mutex keys_mu_;   // key sets and the probe connection
+    KeySet fields_{"field", "fld_fieldkey"};
+    KeySet crops_{"crop", "c_cropkey"};
+};
+
+// Waits for the inserts queued in batch mode and reports each one in order; returns the
+// number that failed.
+static int drain_writes(DB &db) {
+    if (!db.deferred_writes || db.deferred_writes->empty()) return 0;
+    db.writes->flush();
+    int failures = 0;
+    for (auto &t : *db.deferred_writes) {
+        const WriteResult &r = t.get();
+        db.msg() << r.message << "\n";
+        if (!r.ok) ++failures;
+    }
+    db.deferred_writes->clear();
+    return failures;
+}
+
+// Through db.writes when set (waiting for the commit, or queued in batch mode), otherwise
+// as one autocommit statement.
+static bool submit_write(DB &db, WriteTicket t) {
+    if (db.deferred_writes) { db.deferred_writes->push_back(std::move(t)); return true; }
+    const WriteResult &r = t.get();
+    db.msg() << r.message << "\n";
+    return r.ok;
+}
+
+bool insert_fieldcrop(DB &db, const FieldCropRow &r) {
+    if (db.writes) return submit_write(db, db.writes->submit(r, db.writes_done));
+    if (!db.id_exists("field", "fld_fieldkey", r.field_id)) { db.msg() << "Field id not found.\n"; return false; }
+    if (!db.id_exists("crop", "c_cropkey", r.crop_id)) { db.msg() << "Crop id not found.\n"; return false; }
+    string err = fieldcrop_value_error(r);
+    if (!err.empty()) { db.msg() << err << "\n"; return false; }
+
+    Stmt stmt = db.prepare(FIELDCROP_INSERT_SQL);
+    if (!stmt) { db.msg() << "Prepare error: " << sqlite3_errmsg(db.db) << "\n"; return false; }
+    bind_fieldcrop(stmt, r);
+    if (sqlite3_step(stmt) != SQLITE_DONE) {
+        db.msg() << "Insert failed: " << sqlite3_errmsg(db.db) << "\n";
+        return false;
+    }
+    db.msg() << "Inserted fieldcrop row successfully.\n";
+    return true;
+}
+
+void insert_fieldcrop(DB &db) {
+    cout << endl;
+    cout << "Inserting new fieldcrop entry.\n";
+    FieldCropRow r;
+    cout << "field_id: "; cin >> r.field_id;
+    if (!db.id_exists("field", "fld_fieldkey", r.field_id)) { cout << "Field id not found.\n"; cin.ignore(); return; }
+    cout << "crop_id: "; cin >> r.crop_id;
+    if (!db.id_exists("crop", "c_cropkey", r.crop_id)) { cout << "Crop id not found.\n"; cin.ignore(); return; }
+    cout << "begin_date (YYYY-MM-DD): "; cin >> r.bdate;
+    if (!valid_date(r.bdate)) { cout << "Invalid date format.\n"; cin.ignore(); return; }
+    cout << "end_date (YYYY-MM-DD or empty if ongoing): "; cin >> r.edate;
+    if (!r.edate.empty() && !valid_date(r.edate)) { cout << "Invalid date format.\n"; cin.ignore(); return; }
+    cout << "yield (>=0): "; cin >> r.yield;
+    if (r.yield < 0) { cout << "Yield must be non-negative.\n"; cin.ignore(); return; }
+    cout << "unit (text): "; cin >> r.unit;
+    cin.ignore();
+
+    insert_fieldcrop(db, r);
+    promptContinue();
+}
+
+bool insert_soilsample(DB &db, const SoilSampleRow &r) {
+    if (db.writes) return submit_write(db, db.writes->submit(r, db.writes_done));
+    if (!db.id_exists("field", "fld_fieldkey", r.field_id)) { db.msg() << "Field id not found.\n"; return false; }
+    string err = soilsample_value_error(r);
+    if (!err.empty()) { db.msg() << err << "\n"; return false; }
+
+    Stmt stmt = db.prepare(SOILSAMPLE_INSERT_SQL);
+    if (!stmt) { db.msg() << "Prepare error\n"; return false; }
+    bind_soilsample(stmt, r);
+    if (sqlite3_step(stmt) != SQLITE_DONE) {
+        db.msg() << "Insert failed: " << sqlite3_errmsg(db.db) << "\n";
+        return false;
+    }
+    db.msg() << "Inserted soilsample row successfully.\n";
+    return true;
+}
+
+void insert_soilsample(DB &db) {
+    cout << "Inserting new soilsample entry.\n";
+    SoilSampleRow r;
+    cout << "field_id: "; cin >> r.field_id;
+    if (!db.id_exists("field", "fld_fieldkey", r.field_id)) { cout << "Field id not found.\n"; cin.ignore(); return; }
+    cout << "sample_date (YYYY-MM-DD): "; cin >> r.sdate;
+    if (!valid_date(r.sdate)) { cout << "Invalid date format.\n"; cin.ignore(); return; }
+    cout << "ph (3.0 - 9.0): "; cin >> r.ph;
+    if (r.ph < 3.0 || r.ph > 9.0) { cout << "ph out of expected range.\n"; cin.ignore(); return; }
+    const std::pair<const char*, double*> amounts[] = {
+        {"sand_pct", &r.sand}, {"silt_pct", &r.silt}, {"clay_pct", &r.clay},
+        {"nitrogen_ppm", &r.nppm}, {"phosphorus_ppm", &r.pppm}, {"potassium_ppm", &r.kppm},
+        {"organic_matter_pct", &r.om}, {"cec", &r.cec},
+        {"lead_ppm", &r.lead}, {"mercury_ppm", &r.mercury}, {"nickel_ppm", &r.nickel}, {"copper_ppm", &r.copper},
+        {"chromium_ppm", &r.chromium}, {"cadmium_ppm", &r.cadmium}, {"arsenic_ppm", &r.arsenic}, {"zinc_ppm", &r.zinc},
+    };
+    for (auto &a : amounts) {
+        cout << a.first << " (>=0): "; cin >> *a.second;
+        if (*a.second < 0) { cout << "must be >=0\n"; cin.ignore(); return; }
+    }
+    cin.ignore();
+    cout << "comment (optional): "; getline(cin, r.comment);
+
+    insert_soilsample(db, r);
+    promptContinue();
+}
+
+// ---------- Columnar soil sample store ----------
+// Structure-of-arrays copy of soilsample: one contiguous, 32-byte aligned array per
+// numeric column so threshold sweeps run as vector compares instead of SQL joins.
+// Refreshed incrementally: new rows (rowid above the last loaded one) are appended on
+// the next use; updates/deletes seen through the update hook force a full reload.
+
+enum SoilMetal { LEAD, MERCURY, NICKEL, COPPER, CHROMIUM, CADMIUM, ARSENIC, ZINC, METAL_COUNT };
+
+static const char* METAL_COLUMNS[METAL_COUNT] = {
+    "ss_lead_ppm", "ss_mercury_ppm", "ss_nickel_ppm", "ss_copper_ppm",
+    "ss_chromium_ppm", "ss_cadmium_ppm", "ss_arsenic_ppm", "ss_zinc_ppm"
+};
+static const char* METAL_NAMES[METAL_COUNT] = {
+    "lead", "mercury", "nickel", "copper", "chromium", "cadmium", "arsenic", "zinc"
+};
+
+enum SoilNutrient { PH, NITROGEN, PHOSPHORUS, POTASSIUM, ORGANIC_MATTER, CEC, NUTRIENT_COUNT };
+
+static const char* NUTRIENT_COLUMNS[NUTRIENT_COUNT] = {
+    "ss_ph", "ss_nitrogen_ppm", "ss_phosphorus_ppm", "ss_potassium_ppm", "ss_organicmatter_pct", "ss_cec"
+};
+
+template <typename T, size_t Align = 32>
+struct AlignedAllocator {
+    using value_type = T;
+    template <typename U> struct rebind { using other = AlignedAllocator<U, Align>; };
+    AlignedAllocator() {}
+    template <typename U> AlignedAllocator(const AlignedAllocator<U, Align>&) {}
+    T* allocate(size_t n) {
+        void* p = ::operator new(n * sizeof(T), std::align_val_t(Align));
+        return static_cast<T*>(p);
+    }
+    void deallocate(T* p, size_t) { ::operator delete(p, std::align_val_t(Align)); }
+    bool operator==(const AlignedAllocator&) const { return true; }
+    bool operator!=(const AlignedAllocator&) const { return false; }
+};
+
+using DoubleColumn = std::vector<double, AlignedAllocator<double>>;
+
+// Read-only view of one column: SoilColumns' own vectors or an attached snapshot's
+// mapped arrays (see Columnar snapshot).
+template <typename T>
+struct ColumnView {
+    const T* ptr = nullptr;
+    size_t n = 0;
+
+    ColumnView() {}
+    ColumnView(const T* p, size_t count) : ptr(p), n(count) {}
+    template <typename V> ColumnView(const V &v) : ptr(v.data()), n(v.size()) {}
+
+    const T &operator[](size_t i) const { return ptr[i]; }
+    const T* data() const { return ptr; }
+    size_t size() const { return n; }
+    const T* begin() const { return ptr; }
+    const T* end() const { return ptr + n; }
+};
+
+struct SnapshotZoneF { double min, max; };   // one zone-map block of a double column
+
+struct SoilColumns {
+    ColumnView<sqlite3_int64> samplekey;
+    ColumnView<sqlite3_int64> fieldkey;
+    ColumnView<int32_t> sample_day;            // day number, NO_DAY if unparsable
+    ColumnView<double> metal[METAL_COUNT];     // NaN where the value is NULL
+    ColumnView<double> nutrient[NUTRIENT_COUNT];
+
+    // Set by attach(): the columns then live in the mapped file and are never refreshed.
+    const ColumnSnapshot* snapshot = nullptr;
+    const SnapshotZoneF* metal_zones[METAL_COUNT] = {};
+    size_t zone_rows = 0;
+
+    sqlite3_int64 max_rowid = 0;
+    bool needs_reload = false;
+
+    size_t size() const { return samplekey.size(); }
+
+    void clear() {
+        rowid_.clear(); samplekey_.clear(); fieldkey_.clear(); sample_day_.clear();
+        for (auto &c : metal_) c.clear();
+        for (auto &c : nutrient_) c.clear();
+        max_rowid = 0;
+        point_views();
+    }
+
+    // Pulls rows added since the last refresh (or everything after an update/delete).
+    // Returns the number of rows appended, or -1 on error.
+    long long refresh(DB &db) {
+        if (snapshot) return 0;
+        if (needs_reload) { clear(); needs_reload = false; }
+        string sql = "SELECT rowid, ss_samplekey, ss_fieldkey, ss_sampledate";
+        for (auto c : METAL_COLUMNS) sql += string(", ") + c;
+        for (auto c : NUTRIENT_COLUMNS) sql += string(", ") + c;
+        sql += " FROM soilsample WHERE rowid > ? ORDER BY rowid;";
+        Stmt stmt = db.prepare(sql);
+        if (!stmt) return -1;
+        sqlite3_bind_int64(stmt, 1, max_rowid);
+        long long added = 0;
+        auto num = [&](int col) {
+            return sqlite3_column_type(stmt, col) == SQLITE_NULL ? std::numeric_limits<double>::quiet_NaN()
+                                                                 : sqlite3_column_double(stmt, col);
+        };
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            rowid_.push_back(sqlite3_column_int64(stmt, 0));
+            samplekey_.push_back(sqlite3_column_int64(stmt, 1));
+            fieldkey_.push_back(sqlite3_column_int64(stmt, 2));
+            const char* d = (const char*)sqlite3_column_text(stmt, 3);
+            int day;
+            sample_day_.push_back(d && parse_date(d, (size_t)sqlite3_column_bytes(stmt, 3), day) ? day : NO_DAY);
+            for (int k = 0; k < METAL_COUNT; ++k) metal_[k].push_back(num(4 + k));
+            for (int k = 0; k < NUTRIENT_COUNT; ++k) nutrient_[k].push_back(num(4 + METAL_COUNT + k));
+            ++added;
+        }
+        if (!rowid_.empty()) max_rowid = rowid_.back();
+        point_views();
+        return added;
+    }
+
+    // Uses the soilsample columns of a snapshot in place (defined with the snapshot reader).
+    bool attach(const ColumnSnapshot &snap, string &err);
+
+    // out[i] bit k is set when metal k of sample i is strictly above thr[k] (NULL never exceeds).
+    void exceedance_mask(const double thr[METAL_COUNT], uint8_t* out) const;
+
+private:
+    void point_views() {
+        samplekey = samplekey_; fieldkey = fieldkey_; sample_day = sample_day_;
+        for (int k = 0; k < METAL_COUNT; ++k) metal[k] = metal_[k];
+        for (int k = 0; k < NUTRIENT_COUNT; ++k) nutrient[k] = nutrient_[k];
+    }
+
+    vector<sqlite3_int64> rowid_, samplekey_, fieldkey_;
+    vector<int32_t> sample_day_;
+    DoubleColumn metal_[METAL_COUNT];
+    DoubleColumn nutrient_[NUTRIENT_COUNT];
+};
+
+static void exceedance_mask_scalar(const ColumnView<double>* metal, const double* thr, size_t begin, size_t n, uint8_t* out) {
+    for (size_t i = begin; i < n; ++i) {
+        unsigned m = 0;
+        for (int k = 0; k < METAL_COUNT; ++k) m |= (unsigned)(metal[k][i] > thr[k]) << k;
+        out[i] = (uint8_t)m;
+    }
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define AIMS_X86_SIMD 1
+
+// Spreads the low 4 bits of a compare movemask into 4 bytes (one 0/1 byte per sample).
+static const uint32_t SPREAD4[16] = {
+    0x00000000, 0x00000001, 0x00000100, 0x00000101, 0x00010000, 0x00010001, 0x00010100, 0x00010101,
+    0x01000000, 0x01000001, 0x01000100, 0x01000101, 0x01010000, 0x01010001, 0x01010100, 0x01010101
+};
+
+__attribute__((target("avx2")))
+static size_t exceedance_mask_avx2(const ColumnView<double>* metal, const double* thr, size_t begin, size_t n, uint8_t* out) {
+    __m256d t[METAL_COUNT];
+    for (int k = 0; k < METAL_COUNT; ++k) t[k] = _mm256_set1_pd(thr[k]);
+    size_t i = begin;
+    for (; i + 4 <= n; i += 4) {
+        uint32_t acc = 0;
+        for (int k = 0; k < METAL_COUNT; ++k) {
+            __m256d v = _mm256_load_pd(metal[k].data() + i);
+            int bits = _mm256_movemask_pd(_mm256_cmp_pd(v, t[k], _CMP_GT_OQ));
+            acc |= SPREAD4[bits] << k;
+        }
+        memcpy(out + i, &acc, 4);
+    }
+    return i;
+}
+
+__attribute__((target("sse2")))
+static size_t exceedance_mask_sse2(const ColumnView<double>* metal, const double* thr, size_t begin, size_t n, uint8_t* out) {
+    __m128d t[METAL_COUNT];
+    for (int k = 0; k < METAL_COUNT; ++k) t[k] = _mm_set1_pd(thr[k]);
+    size_t i = begin;
+    for (; i + 4 <= n; i += 4) {
+        uint32_t acc = 0;
+        for (int k = 0; k < METAL_COUNT; ++k) {
+            const double* p = metal[k].data() + i;
+            int lo = _mm_movemask_pd(_mm_cmpgt_pd(_mm_load_pd(p), t[k]));
+            int hi = _mm_movemask_pd(_mm_cmpgt_pd(_mm_load_pd(p + 2), t[k]));
+            acc |= SPREAD4[lo | (hi << 2)] << k;
+        }
+        memcpy(out + i, &acc, 4);
+    }
+    return i;
+}
+#endif
+
+// Rows [begin, end); begin must be a multiple of 4 so the aligned loads stay aligned.
+static void exceedance_mask_range(const ColumnView<double>* metal, const double* thr, size_t begin, size_t end, uint8_t* out) {
+    size_t done = begin;
+#ifdef AIMS_X86_SIMD
+    static const bool has_avx2 = __builtin_cpu_supports("avx2");
+    done = has_avx2 ? exceedance_mask_avx2(metal, thr, begin, end, out) : exceedance_mask_sse2(metal, thr, begin, end, out);
+#endif
+    exceedance_mask_scalar(metal, thr, done, end, out);
+}
+
+// With a snapshot's zone maps, blocks where no metal reaches its limit are zeroed unread.
+void SoilColumns::exceedance_mask(const double thr[METAL_COUNT], uint8_t* out) const {
+    size_t n = size();
+    if (!zone_rows) { exceedance_mask_range(metal, thr, 0, n, out); return; }
+    for (size_t b = 0, begin = 0; begin < n; ++b, begin += zone_rows) {
+        size_t end = std::min(n, begin + zone_rows);
+        bool any = false;
+        for (int k = 0; k < METAL_COUNT && !any; ++k) any = metal_zones[k][b].max > thr[k];
+        if (any) exceedance_mask_range(metal, thr, begin, end, out);
+        else memset(out + begin, 0, end - begin);
+    }
+}
+
+// Returns the session's column store, building it on first use and appending new rows after.
+// With a snapshot attached (--snapshot) the store is its soilsample columns instead.
+SoilColumns* soil_columns(DB &db) {
+    if (!db.soil_columns && db.snapshot) {
+        auto store = std::make_shared<SoilColumns>();
+        string err;
+        if (!store->attach(*db.snapshot, err)) { db.msg() << "Snapshot: " << err << "\n"; return nullptr; }
+        db.soil_columns = store;
+    }
+    if (!db.soil_columns) {
+        auto store = std::make_shared<SoilColumns>();
+        SoilColumns* raw = store.get();
+        db.add_change_listener([raw](int op, const char* table, sqlite3_int64 rowid) {
+            if (strcmp(table, "soilsample") != 0) return;
+            if (op != SQLITE_INSERT || rowid <= raw->max_rowid) raw->needs_reload = true;
+        });
+        db.soil_columns = store;
+    }
+    if (db.soil_columns->refresh(db) < 0) { db.msg() << "Soil column load failed: " << sqlite3_errmsg(db.db) << "\n"; return nullptr; }
+    return db.soil_columns.get();
+}
+
+// Evaluates all eight heavy-metal limits at once over the in-memory store.
+// Limits given as "-" are ignored. With list_rows, prints each exceeding sample.
+bool metal_threshold_sweep(DB &db, const double thr[METAL_COUNT], bool list_rows) {
+    SoilColumns* sc = soil_columns(db);
+    if (!sc) return false;
+    size_t n = sc->size();
+    vector<uint8_t> mask(n);
+    auto t0 = std::chrono::steady_clock::now();
+    sc->exceedance_mask(thr, mask.data());
+    double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count();
+
+    size_t per_metal[METAL_COUNT] = {0};
+    size_t any = 0;
+    std::set<sqlite3_int64> fields;
+    for (size_t i = 0; i < n; ++i) {
+        if (!mask[i]) continue;
+        ++any;
+        fields.insert(sc->fieldkey[i]);
+        for (int k = 0; k < METAL_COUNT; ++k) per_metal[k] += (mask[i] >> k) & 1;
+    }
+
+    if (list_rows) {
+        RowPrinter rp(db, {"ss_samplekey", "ss_fieldkey", "ss_sampledate", "exceeded"});
+        if (!rp) return false;
+        for (size_t i = 0; i < n; ++i) {
+            if (!mask[i]) continue;
+            string which;
+            for (int k = 0; k < METAL_COUNT; ++k) if ((mask[i] >> k) & 1) which += (which.empty() ? "" : ",") + string(METAL_NAMES[k]);
+            rp.set(0, sc->samplekey[i]);
+            rp.set(1, sc->fieldkey[i]);
+            rp.set(2, format_date(sc->sample_day[i]));
+            rp.set(3, which);
+            rp.emit();
+        }
+        rp.end("(no samples over a limit)");
+    }
+
+    RowPrinter rp(db, {"metal", "limit_ppm", "samples_over"});
+    if (!rp) return false;
+    for (int k = 0; k < METAL_COUNT; ++k) {
+        rp.set(0, string(METAL_NAMES[k]));
+        if (std::isinf(thr[k])) rp.set_null(1); else rp.set(1, thr[k]);
+        rp.set(2, (sqlite3_int64)per_metal[k]);
+        rp.emit();
+    }
+    rp.end();
+    std::ostringstream line;
+    line << n << " samples scanned in " << std::fixed << std::setprecision(1) << us << " us; "
+         << any << " exceed at least one limit across " << fields.size() << " field(s)";
+    db.msg() << line.str() << "\n";
+    return true;
+}
+
+void metal_threshold_sweep(DB &db) {
+    cout << endl;
+    cout << "Enter a limit in ppm for each metal ('-' for no limit).\n";
+    double thr[METAL_COUNT];
+    for (int k = 0; k < METAL_COUNT; ++k) {
+        cout << METAL_NAMES[k] << ": ";
+        string in; cin >> in;
+        try { thr[k] = in == "-" ? std::numeric_limits<double>::infinity() : std::stod(in); }
+        catch (...) { cout << "Invalid number.\n"; cin.ignore(); return; }
+    }
+    cin.ignore();
+    if (!metal_threshold_sweep(db, thr, true)) return;
+    promptContinue();
+}
+
+// ---------- Contaminant compliance ----------
+// Evaluates every regulatory limit in contaminant_type (ct_reg_threshold) against every
+// sample in one pass. Readings come from two places: the eight metal columns of soilsample,
+// which belong to the contaminant type of the same name ("lead", "cadmium", ...), and the
+// normalized soilsample_contaminant rows. The metal columns go through the column store's
+// vector compare; soilsample_contaminant is read once in primary-key order and merged
+// against the samples sorted by key. A reading equal to its limit complies, as in the
+// threshold sweep; one below its detection limit or in a unit other than the limit's (ppm
+// and mg/kg are the same) is never an exceedance.
+//
+// The result stays with the session as an index over the samples that exceeded anything,
+// in date order: each one's exceedance set, and per contaminant a sparse bitmap (non-zero
+// 64-bit words only) over those positions. "Which fields exceeded X since D" is a binary
+// search for D plus a walk over set bits. Any change to the three tables, from this
+// connection or another, rebuilds the index on next use.
+//
+//   contaminant-threshold <name> <limit|->   set or clear a limit (adds the type if needed)
+//   compliance                               every limit with samples and fields over it
+//   compliance-samples <since|->             exceedance set of each sample over a limit
+//   compliance-fields <since|-> <name|any>   fields with exceedances, from the bitmaps
+
+struct SparseBitmap {
+    vector<uint32_t> index;   // word numbers, ascending
+    vector<uint64_t> words;   // the non-zero words
+
+    // Positions must arrive in ascending order.
+    void set(size_t pos) {
+        uint32_t w = (uint32_t)(pos / 64);
+        if (index.empty() || index.back() != w) { index.push_back(w); words.push_back(0); }
+        words.back() |= 1ull << (pos % 64);
+    }
+
+    size_t count() const {
+        size_t n = 0;
+        for (uint64_t w : words) n += (size_t)__builtin_popcountll(w);
+        return n;
+    }
+
+    size_t bytes() const { return index.size() * (sizeof(uint32_t) + sizeof(uint64_t)); }
+
+    // Highest set position, or -1.
+    long long last() const {
+        return words.empty() ? -1 : (long long)index.back() * 64 + 63 - __builtin_clzll(words.back());
+    }
+
+    // Calls fn(pos) for every set position >= from, ascending.
+    template <typename F>
+    void for_each_from(size_t from, F fn) const {
+        size_t i = std::lower_bound(index.begin(), index.end(), (uint32_t)(from / 64)) - index.begin();
+        for (; i < index.size(); ++i) {
+            uint64_t w = words[i];
+            if (index[i] == from / 64) w &= ~0ull << (from % 64);
+            for (; w; w &= w - 1) fn((size_t)index[i] * 64 + (size_t)__builtin_ctzll(w));
+        }
+    }
+};
+
+struct ComplianceIndex {
+    struct Limit {
+        sqlite3_int64 key;
+        string name;
+        double threshold;
+        string unit;          // normalized
+        int metal;            // soilsample column measuring it, or -1
+        size_t measured = 0;  // readings compared
+        size_t fields = 0;    // fields with a sample over it
+    };
+    vector<Limit> limits;     // bit c of an exceedance set is limits[c]
+    size_t words = 1;         // 64-bit words per exceedance set
+
+    // Samples over at least one limit, by (date, samplekey).
+    vector<sqlite3_int64> samplekey, fieldkey;
+    vector<int32_t> sample_day;
+    vector<uint64_t> sets;    // words per sample
+    vector<SparseBitmap> bitmaps;   // per limit, over the positions above
+
+    size_t samples = 0, rows_read = 0, unit_mismatches = 0, below_detection = 0;
+    double build_ms = 0;
+    bool stale = true;
+    int data_version = -1;
+
+    bool build(DB &db);
+
+    size_t first_since(int32_t day) const { return std::lower_bound(sample_day.begin(), sample_day.end(), day) - sample_day.begin(); }
+    const uint64_t* set_of(size_t pos) const { return sets.data() + pos * words; }
+    bool has(size_t pos, size_t c) const { return (set_of(pos)[c / 64] >> (c % 64)) & 1; }
+
+    size_t bytes() const {
+        size_t b = samplekey.size() * (2 * sizeof(sqlite3_int64) + sizeof(int32_t)) + sets.size() * sizeof(uint64_t);
+        for (auto &bm : bitmaps) b += bm.bytes();
+        return b;
+    }
+
+    // "lead,cadmium" for the set at pos.
+    string names(size_t pos) const {
+        string s;
+        for (size_t c = 0; c < limits.size(); ++c) if (has(pos, c)) s += (s.empty() ? "" : ",") + limits[c].name;
+        return s;
+    }
+};
+
+static string normalize_unit(std::string_view u) {
+    string s(u);
+    s.erase(std::remove(s.begin(), s.end(), ' '), s.end());
+    std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c) { return (char)tolower(c); });
+    return s.empty() || s == "mg/kg" ? "ppm" : s;
+}
+
+struct LimitRow {
+    sqlite3_int64 key;
+    std::string_view name;
+    double threshold;
+    std::string_view unit;
+};
+static const Query<Columns<&LimitRow::key, &LimitRow::name, &LimitRow::threshold, &LimitRow::unit>> COMPLIANCE_LIMITS_SQL =
+    "SELECT ct_contaminantkey, ct_name, ct_reg_threshold, COALESCE(ct_threshold_unit, ct_typical_unit) "
+    "FROM contaminant_type WHERE ct_reg_threshold IS NOT NULL ORDER BY ct_contaminantkey;";
+
+struct ReadingRow {
+    sqlite3_int64 samplekey, contaminantkey;
+    double concentration;
+    std::optional<double> detection_limit;
+    std::string_view unit;
+};
+static const Query<Columns<&ReadingRow::samplekey, &ReadingRow::contaminantkey, &ReadingRow::concentration,
+                           &ReadingRow::detection_limit, &ReadingRow::unit>> COMPLIANCE_READINGS_SQL =
+    "SELECT ssc_samplekey, ssc_contaminantkey, ssc_concentration, ssc_detection_limit, ssc_unit "
+    "FROM soilsample_contaminant ORDER BY ssc_samplekey, ssc_contaminantkey;";
+
+bool ComplianceIndex::build(DB &db) {
+    auto t0 = std::chrono::steady_clock::now();
+    limits.clear();
+    rows_read = unit_mismatches = below_detection = 0;
+
+    bool listed = COMPLIANCE_LIMITS_SQL.each(db, [&](const LimitRow &row) {
+        Limit l;
+        l.key = row.key;
+        l.name = string(row.name);
+        l.threshold = row.threshold;
+        l.unit = normalize_unit(row.unit);
+        l.metal = -1;
+        string lower = normalize_unit(l.name);
+        for (int k = 0; k < METAL_COUNT; ++k) if (lower == METAL_NAMES[k] && l.unit == "ppm") l.metal = k;
+        limits.push_back(l);
+    });
+    if (!listed) return false;
+    words = std::max<size_t>(1, (limits.size() + 63) / 64);
+
+    SoilColumns* sc = soil_columns(db);
+    if (!sc) return false;
+    size_t n = samples = sc->size();
+    vector<uint64_t> all(n * words, 0);   // exceedance sets in column store order
+
+    // Metal columns (ppm): one vector compare per sample for all eight.
+    double thr[METAL_COUNT];
+    int metal_limit[METAL_COUNT];
+    for (int k = 0; k < METAL_COUNT; ++k) { thr[k] = std::numeric_limits<double>::infinity(); metal_limit[k] = -1; }
+    for (size_t c = 0; c < limits.size(); ++c) {
+        int k = limits[c].metal;
+        if (k < 0) continue;
+        thr[k] = limits[c].threshold;
+        metal_limit[k] = (int)c;
+        for (double v : sc->metal[k]) limits[c].measured += !std::isnan(v);
+    }
+    vector<uint8_t> mask(n);
+    sc->exceedance_mask(thr, mask.data());
+    for (size_t i = 0; i < n; ++i) {
+        for (unsigned m = mask[i]; m; m &= m - 1) {
+            int c = metal_limit[__builtin_ctz(m)];
+            all[i * words + c / 64] |= 1ull << (c % 64);
+        }
+    }
+
+    // soilsample_contaminant in key order, merged with the samples sorted by key.
+    vector<uint32_t> by_key(n);
+    for (size_t i = 0; i < n; ++i) by_key[i] = (uint32_t)i;
+    std::sort(by_key.begin(), by_key.end(), [&](uint32_t a, uint32_t b) { return sc->samplekey[a] < sc->samplekey[b]; });
+    size_t cur = 0;
+    bool read = COMPLIANCE_READINGS_SQL.each(db, [&](const ReadingRow &row) {
+        ++rows_read;
+        sqlite3_int64 key = row.samplekey, ckey = row.contaminantkey;
+        auto it = std::lower_bound(limits.begin(), limits.end(), ckey, [](const Limit &l, sqlite3_int64 k) { return l.key < k; });
+        if (it == limits.end() || it->key != ckey) return;   // no limit set
+        while (cur < n && sc->samplekey[by_key[cur]] < key) ++cur;
+        if (cur == n || sc->samplekey[by_key[cur]] != key) return;
+        size_t c = it - limits.begin();
+        ++it->measured;
+        if (normalize_unit(row.unit) != it->unit) { ++unit_mismatches; return; }
+        double v = row.concentration;
+        if (row.detection_limit && v < *row.detection_limit) { ++below_detection; return; }
+        if (v > it->threshold) all[by_key[cur] * words + c / 64] |= 1ull << (c % 64);
+    });
+    if (!read) return false;
+
+    // Keep the samples with any exceedance, in date order.
+    vector<uint32_t> hits;
+    for (size_t i = 0; i < n; ++i) {
+        for (size_t w = 0; w < words; ++w) if (all[i * words + w]) { hits.push_back((uint32_t)i); break; }
+    }
+    std::sort(hits.begin(), hits.end(), [&](uint32_t a, uint32_t b) {
+        return sc->sample_day[a] != sc->sample_day[b] ? sc->sample_day[a] < sc->sample_day[b] : sc->samplekey[a] < sc->samplekey[b];
+    });
+    samplekey.clear(); fieldkey.clear(); sample_day.clear(); sets.clear();
+    bitmaps.assign(limits.size(), SparseBitmap());
+    vector<vector<sqlite3_int64>> fields(limits.size());
+    for (size_t pos = 0; pos < hits.size(); ++pos) {
+        uint32_t i = hits[pos];
+        samplekey.push_back(sc->samplekey[i]);
+        fieldkey.push_back(sc->fieldkey[i]);
+        sample_day.push_back(sc->sample_day[i]);
+        sets.insert(sets.end(), all.begin() + i * words, all.begin() + (i + 1) * words);
+        for (size_t c = 0; c < limits.size(); ++c) {
+            if (!has(pos, c)) continue;
+            bitmaps[c].set(pos);
+            fields[c].push_back(sc->fieldkey[i]);
+        }
+    }
+    for (size_t c = 0; c < limits.size(); ++c) {
+        std::sort(fields[c].begin(), fields[c].end());
+        limits[c].fields = std::unique(fields[c].begin(), fields[c].end()) - fields[c].begin();
+    }
+    build_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    stale = false;
+    return true;
+}
+
+static int data_version(DB &db) {
+    Stmt stmt = db.prepare("PRAGMA data_version;");
+    if (!stmt || sqlite3_step(stmt) != SQLITE_ROW) return -1;
+    return sqlite3_column_int(stmt, 0);
+}
+
+static bool has_contaminant_tables(DB &db) {
+    if (db.table_exists("contaminant_type") && db.table_exists("soilsample_contaminant")) return true;
+    db.msg() << "No contaminant tables; run 'migrate' first.\n";
+    return false;
+}
+
+// The session's compliance index, (re)built when any of its tables changed.
+ComplianceIndex* compliance_index(DB &db) {
+    if (!has_contaminant_tables(db)) return nullptr;
+    if (!db.compliance) {
+        auto index = std::make_shared<ComplianceIndex>();
+        ComplianceIndex* raw = index.get();
+        db.add_change_listener([raw](int, const char* table, sqlite3_int64) {
+            if (!strcmp(table, "soilsample") || !strcmp(table, "soilsample_contaminant") || !strcmp(table, "contaminant_type")) raw->stale = true;
+        });
+        db.compliance = index;
+    }
+    ComplianceIndex* ci = db.compliance.get();
+    int version = data_version(db);
+    if (ci->stale || version != ci->data_version) {
+        // Another connection committed: the column store only sees its appended rows.
+        if (version != ci->data_version && db.soil_columns) db.soil_columns->needs_reload = true;
+        if (!ci->build(db)) { db.msg() << "Compliance evaluation failed: " << sqlite3_errmsg(db.db) << "\n"; return nullptr; }
+        ci->data_version = version;
+    }
+    return ci;
+}
+
+// limit < 0 clears it.
+bool set_contaminant_threshold(DB &db, const string &name, double limit) {
+    if (!has_contaminant_tables(db)) return false;
+    Stmt upd = db.prepare("UPDATE contaminant_type SET ct_reg_threshold = ?1, "
+                          "ct_threshold_unit = COALESCE(ct_threshold_unit, ct_typical_unit, 'ppm') WHERE lower(ct_name) = lower(?2);");
+    if (!upd) { db.msg() << "Prepare error: " << sqlite3_errmsg(db.db) << "\n"; return false; }
+    if (limit < 0) sqlite3_bind_null(upd, 1);
+    else sqlite3_bind_double(upd, 1, limit);
+    sqlite3_bind_text(upd, 2, name.c_str(), -1, SQLITE_TRANSIENT);
+    if (sqlite3_step(upd) != SQLITE_DONE) { db.msg() << "Update failed: " << sqlite3_errmsg(db.db) << "\n"; return false; }
+    if (sqlite3_changes(db.db) == 0) {
+        if (limit < 0) { db.msg() << "No contaminant type '" << name << "'.\n"; return false; }
+        Stmt ins = db.prepare("INSERT INTO contaminant_type (ct_contaminantkey, ct_name, ct_typical_unit, ct_reg_threshold, ct_threshold_unit) "
+                              "SELECT COALESCE(MAX(ct_contaminantkey), 0) + 1, ?1, 'ppm', ?2, 'ppm' FROM contaminant_type;");
+        if (!ins) { db.msg() << "Prepare error: " << sqlite3_errmsg(db.db) << "\n"; return false; }
+        sqlite3_bind_text(ins, 1, name.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_double(ins, 2, limit);
+        if (sqlite3_step(ins) != SQLITE_DONE) { db.msg() << "Insert failed: " << sqlite3_errmsg(db.db) << "\n"; return false; }
+        db.msg() << "Added contaminant type '" << name << "'.\n";
+    }
+    if (limit < 0) db.msg() << "Cleared the limit for " << name << ".\n";
+    else db.msg() << "Limit for " << name << " set to " << limit << ".\n";
+    return true;
+}
+
+bool compliance_summary(DB &db) {
+    ComplianceIndex* ci = compliance_index(db);
+    if (!ci) return false;
+    RowPrinter rp(db, {"contaminant", "limit", "unit", "source", "readings", "samples_over", "fields_over", "last_exceeded"});
+    if (!rp) return false;
+    for (size_t c = 0; c < ci->limits.size(); ++c) {
+        auto &l = ci->limits[c];
+        rp.set(0, l.name);
+        rp.set(1, l.threshold);
+        rp.set(2, l.unit);
+        rp.set(3, string(l.metal >= 0 ? METAL_COLUMNS[l.metal] : "soilsample_contaminant"));
+        rp.set(4, (sqlite3_int64)l.measured);
+        rp.set(5, (sqlite3_int64)ci->bitmaps[c].count());
+        rp.set(6, (sqlite3_int64)l.fields);
+        long long last = ci->bitmaps[c].last();
+        if (last >= 0) rp.set(7, format_date(ci->sample_day[last]));
+        else rp.set_null(7);
+        rp.emit();
+    }
+    rp.end("(no contaminant limits set; see contaminant-threshold)");
+    std::ostringstream line;
+    line << ci->samples << " samples and " << ci->rows_read << " soilsample_contaminant rows against " << ci->limits.size()
+         << " limits in " << std::fixed << std::setprecision(1) << ci->build_ms << " ms; " << ci->samplekey.size()
+         << " samples over a limit (index " << ci->bytes() << " bytes)";
+    if (ci->unit_mismatches) line << "; " << ci->unit_mismatches << " readings skipped for a unit other than the limit's";
+    if (ci->below_detection) line << "; " << ci->below_detection << " below detection limit";
+    db.msg() << line.str() << "\n";
+    return true;
+}
+
+bool compliance_samples(DB &db, int32_t since_day) {
+    ComplianceIndex* ci = compliance_index(db);
+    if (!ci) return false;
+    RowPrinter rp(db, {"samplekey", "fieldkey", "sampledate", "exceeded"});
+    if (!rp) return false;
+    for (size_t pos = ci->first_since(since_day); pos < ci->samplekey.size(); ++pos) {
+        rp.set(0, ci->samplekey[pos]);
+        rp.set(1, ci->fieldkey[pos]);
+        rp.set(2, format_date(ci->sample_day[pos]));
+        rp.set(3, ci->names(pos));
+        rp.emit();
+    }
+    rp.end("(no exceedances)");
+    return true;
+}
+
+// Fields with a sample over `contaminant` (or any limit) on or after since_day.
+bool compliance_fields(DB &db, int32_t since_day, const string &contaminant) {
+    ComplianceIndex* ci = compliance_index(db);
+    if (!ci) return false;
+    long c = -1;
+    if (contaminant != "any") {
+        string want = normalize_unit(contaminant.c_str());
+        for (size_t i = 0; i < ci->limits.size(); ++i) if (normalize_unit(ci->limits[i].name.c_str()) == want) c = (long)i;
+        if (c < 0) { db.msg() << "No limit set for '" << contaminant << "'.\n"; return false; }
+    }
+    struct FieldHits { size_t samples = 0; int32_t first_day = 0, last_day = 0; vector<uint64_t> set; };
+    std::map<sqlite3_int64, FieldHits> fields;
+    auto add = [&](size_t pos) {
+        FieldHits &f = fields[ci->fieldkey[pos]];
+        if (f.samples++ == 0) { f.first_day = ci->sample_day[pos]; f.set.assign(ci->words, 0); }
+        f.last_day = ci->sample_day[pos];
+        for (size_t w = 0; w < ci->words; ++w) f.set[w] |= ci->set_of(pos)[w];
+    };
+    size_t from = ci->first_since(since_day);
+    if (c < 0) for (size_t pos = from; pos < ci->samplekey.size(); ++pos) add(pos);
+    else ci->bitmaps[c].for_each_from(from, add);
+
+    RowPrinter rp(db, {"fieldkey", "samples_over", "first_exceeded", "last_exceeded", "contaminants"});
+    if (!rp) return false;
+    for (auto &f : fields) {
+        string names;
+        for (size_t i = 0; i < ci->limits.size(); ++i) {
+            if ((f.second.set[i / 64] >> (i % 64)) & 1) names += (names.empty() ? "" : ",") + ci->limits[i].name;
+        }
+        rp.set(0, f.first);
+        rp.set(1, (sqlite3_int64)f.second.samples);
+        rp.set(2, format_date(f.second.first_day));
+        rp.set(3, format_date(f.second.last_day));
+        rp.set(4, names);
+        rp.emit();
+    }
+    rp.end("(no exceedances)");
+    return true;
+}
+
+// "YYYY-MM-DD" or "-" (from the beginning) as a day number.
+static bool parse_since(const string &s, int32_t &day) {
+    if (s == "-") { day = NO_DAY; return true; }
+    int d;
+    if (!parse_date(s, d)) return false;
+    day = d;
+    return true;
+}
+
+void contaminant_compliance(DB &db) {
+    cout << endl;
+    cout << "Show fields with exceedances since (YYYY-MM-DD, or '-' for all history): ";
+    string since; cin >> since; cin.ignore();
+    int32_t day;
+    if (!parse_since(since, day)) { cout << "Invalid date format.\n"; return; }
+    if (!compliance_summary(db)) return;
+    cout << endl;
+    if (!compliance_fields(db, day, "any")) return;
+    promptContinue();
+}
+
+// ---------- SQL scripts ----------
+// Runs sqlite3-shell style scripts such as sql_script/queries.sql on this connection,
+// so they can use the native aggregates. ".print" lines are echoed, other dot-commands
+// (.mode, .headers, .width) are ignored since results use the CLI's own formatting.
+
+struct ScriptItem {
+    bool is_print;
+    string text;    // .print text, or one complete SQL statement
+    string title;   // last non-banner .print before the statement ("QUERY 1: ...")
+};
+
+// Strips the optional double quotes around a .print argument.
+static string print_argument(const string &line) {
+    string arg = line.size() > 6 ? line.substr(6) : "";
+    size_t a = arg.find_first_not_of(" \t");
+    if (a == string::npos) return "";
+    arg = arg.substr(a);
+    while (!arg.empty() && (arg.back() == '\r' || arg.back() == ' ')) arg.pop_back();
+    if (arg.size() >= 2 && arg.front() == '"' && arg.back() == '"') arg = arg.substr(1, arg.size() - 2);
+    return arg;
+}
+
+// True when text holds something besides whitespace and "--" comment lines.
+static bool has_sql_content(const string &text) {
+    std::istringstream in(text);
+    string line;
+    while (getline(in, line)) {
+        size_t a = line.find_first_not_of(" \t\r");
+        if (a != string::npos && line.compare(a, 2, "--") != 0) return true;
+    }
+    return false;
+}
+
+bool load_sql_script(const string &path, vector<ScriptItem> &items) {
+    std::ifstream in(path);
+    if (!in) { cout << "Can't open script: " << path << "\n"; return false; }
+    string line, pending, title;
+    while (getline(in, line)) {
+        size_t start = line.find_first_not_of(" \t");
+        if (start != string::npos && line[start] == '.' && !has_sql_content(pending)) {
+            pending.clear();
+            if (line.compare(start, 6, ".print") == 0) {
+                string text = print_argument(line.substr(start));
+                items.push_back({true, text, ""});
+                if (!text.empty() && text.find_first_not_of("=-") != string::npos) title = text;
+            }
+            continue;
+        }
+        pending += line;
+        pending += "\n";
+        if (sqlite3_complete(pending.c_str())) {
+            items.push_back({false, pending, title});
+            pending.clear();
+        }
+    }
+    return true;
+}
+
+bool run_sql_script(DB &db, const string &path) {
+    vector<ScriptItem> items;
+    if (!load_sql_script(path, items)) return false;
+    bool ok = true;
+    for (auto &it : items) {
+        if (it.is_print) { db.out.note(it.text + "\n"); continue; }
+        if (!db.run_and_print(it.text)) ok = false;
+    }
+    return ok;
+}
+
+static const char* SOIL_STATS_SQL = R"(
+    SELECT ss_fieldkey AS fieldkey, COUNT(*) AS n,
+           ROUND(AVG(ss_sand), 2) AS mean_sand, ROUND(stddev(ss_sand), 2) AS std_dev_sand,
+           ROUND(AVG(ss_silt), 2) AS mean_silt, ROUND(stddev(ss_silt), 2) AS std_dev_silt,
+           ROUND(AVG(ss_clay), 2) AS mean_clay, ROUND(stddev(ss_clay), 2) AS std_dev_clay,
+           ROUND(AVG(ss_ph), 2) AS mean_ph, ROUND(stddev(ss_ph), 2) AS std_dev_ph,
+           ROUND(median(ss_ph), 2) AS median_ph
+    FROM soilsample
+    GROUP BY ss_fieldkey
+    ORDER BY ss_fieldkey;
+    )";
+
+void soil_component_stats(DB &db) {
+    db.out.note("\n-- Soil component statistics by field (mean / sample std dev) --\n");
+    db.run_and_print(SOIL_STATS_SQL);
+}
+
+// ---------- Batch / command mode ----------
+// aims_cli <db> --exec "crops-by-season Winter" --exec avg-yield
+// aims_cli <db> --batch < commands.txt      (one command per line, '#' comments)
+// Runs operations back to back on one connection: no screen clearing, no prompts.
+
+// Splits a command line on whitespace; "double quoted" words may contain spaces.
+vector<string> split_command(const string &line) {
+    vector<string> words;
+    string cur;
+    bool in_word = false, quoted = false;
+    for (char c : line) {
+        if (quoted) {
+            if (c == '"') quoted = false; else cur += c;
+        } else if (c == '"') {
+            quoted = true; in_word = true;
+        } else if (std::isspace((unsigned char)c)) {
+            if (in_word) { words.push_back(cur); cur.clear(); in_word = false; }
+        } else {
+            cur += c; in_word = true;
+        }
+    }
+    if (in_word) words.push_back(cur);
+    return words;
+}
+
+static bool parse_int_arg(const string &s, int &out) {
+    try { size_t n; out = std::stoi(s, &n); return n == s.size(); } catch (...) { return false; }
+}
+
+static bool parse_double_arg(const string &s, double &out) {
+    try { size_t n; out = std::stod(s, &n); return n == s.size(); } catch (...) { return false; }
+}
+
+// Eight metal limits in METAL_NAMES order; "-" means no limit.
+static bool parse_metal_limits(const vector<string> &a, double thr[METAL_COUNT]) {
+    for (int k = 0; k < METAL_COUNT; ++k) {
+        if (a[k] == "-") thr[k] = std::numeric_limits<double>::infinity();
+        else if (!parse_double_arg(a[k], thr[k])) return false;
+    }
+    return true;
+}
+
+// Defined after the parallel reports (rotation analysis uses their connection pool).
+bool rotation_matrix(DB &db);
+bool monocrop_runs(DB &db, int min_run);
+bool planting_inputs(DB &db, int field);
+bool on_field(DB &db, int field, const string &date);
+bool recommend_crops(DB &db, int field, int top);
+// Defined with the columnar snapshot reader.
+bool snapshot_info(DB &db);
+
+struct Command {
+    const char* name;
+    const char* args;   // usage string for help
+    size_t nargs;
+    bool (*run)(DB &db, const vector<string> &a);
+};
+
+static const Command COMMANDS[] = {
+    {"fields", "", 0, [](DB &db, const vector<string> &) { show_all_fields(db); return true; }},
+    {"crops-by-season", "<season name>", 1, [](DB &db, const vector<string> &a) { return crops_by_season(db, a[0]); }},
+    {"avg-yield", "", 0, [](DB &db, const vector<string> &) { avg_yield_per_field(db); return true; }},
+    {"latest-sample", "<field_id>", 1, [](DB &db, const vector<string> &a) {
+        int fid; if (!parse_int_arg(a[0], fid)) return false;
+        return latest_soil_sample_for_field(db, fid);
+    }},
+    {"thresholds", "<lead_ppm> <cadmium_ppm> <arsenic_ppm>", 3, [](DB &db, const vector<string> &a) {
+        double lead, cad, as;
+        if (!parse_double_arg(a[0], lead) || !parse_double_arg(a[1], cad) || !parse_double_arg(a[2], as)) return false;
+        return samples_exceeding_thresholds(db, lead, cad, as);
+    }},
+    {"no-recent-maintenance", "", 0, [](DB &db, const vector<string> &) { fields_no_recent_maintenance(db); return true; }},
+    {"avg-npk", "", 0, [](DB &db, const vector<string> &) { avg_npk_by_soil_texture(db); return true; }},
+    {"yield-per-season", "", 0, [](DB &db, const vector<string> &) { total_yield_per_season(db); return true; }},
+    {"rotation", "<field_id>", 1, [](DB &db, const vector<string> &a) {
+        int fid; if (!parse_int_arg(a[0], fid)) return false;
+        return crop_rotation_history(db, fid);
+    }},
+    {"field-summary", "<field_id>", 1, [](DB &db, const vector<string> &a) {
+        int fid; if (!parse_int_arg(a[0], fid)) return false;
+        return field_dashboard(db, fid);
+    }},
+    {"summary-rebuild", "", 0, [](DB &db, const vector<string> &) { return rebuild_field_summary_command(db); }},
+    {"summary-check", "", 0, [](DB &db, const vector<string> &) { return check_field_summary(db); }},
+    {"trend", "<field_id> <months>", 2, [](DB &db, const vector<string> &a) {
+        int fid, months; if (!parse_int_arg(a[0], fid) || !parse_int_arg(a[1], months)) return false;
+        return field_trend(db, fid, months);
+    }},
+    {"yoy", "<field_id>", 1, [](DB &db, const vector<string> &a) {
+        int fid; if (!parse_int_arg(a[0], fid)) return false;
+        return field_year_over_year(db, fid);
+    }},
+    {"rollup-window", "<field_id> <from_month> <to_month>", 3, [](DB &db, const vector<string> &a) {
+        int fid; if (!parse_int_arg(a[0], fid)) return false;
+        return field_window(db, fid, a[1], a[2]);
+    }},
+    {"maint-vs-yield", "", 0, [](DB &db, const vector<string> &) { return maintenance_vs_yield(db); }},
+    {"rollup-rebuild", "", 0, [](DB &db, const vector<string> &) { return rebuild_field_rollup_command(db); }},
+    {"rollup-check", "", 0, [](DB &db, const vector<string> &) { return check_field_rollup(db); }},
+    {"contaminant-threshold", "<name> <limit|->", 2, [](DB &db, const vector<string> &a) {
+        double limit = -1;
+        if (a[1] != "-" && (!parse_double_arg(a[1], limit) || limit < 0)) return false;
+        return set_contaminant_threshold(db, a[0], limit);
+    }},
+    {"compliance", "", 0, [](DB &db, const vector<string> &) { return compliance_summary(db); }},
+    {"compliance-samples", "<since|->", 1, [](DB &db, const vector<string> &a) {
+        int32_t since; if (!parse_since(a[0], since)) return false;
+        return compliance_samples(db, since);
+    }},
+    {"compliance-fields", "<since|-> <contaminant|any>", 2, [](DB &db, const vector<string> &a) {
+        int32_t since; if (!parse_since(a[0], since)) return false;
+        return compliance_fields(db, since, a[1]);
+    }},
+    {"rotation-matrix", "", 0, [](DB &db, const vector<string> &) { return rotation_matrix(db); }},
+    {"monocrop-runs", "<min_run>", 1, [](DB &db, const vector<string> &a) {
+        int min_run; if (!parse_int_arg(a[0], min_run)) return false;
+        return monocrop_runs(db, min_run);
+    }},
+    {"planting-inputs", "<field_id|all>", 1, [](DB &db, const vector<string> &a) {
+        int fid = -1;
+        if (a[0] != "all" && !parse_int_arg(a[0], fid)) return false;
+        return planting_inputs(db, fid);
+    }},
+    {"on-field", "<field_id> <date>", 2, [](DB &db, const vector<string> &a) {
+        int fid; if (!parse_int_arg(a[0], fid)) return false;
+        return on_field(db, fid, a[1]);
+    }},
+    {"recommend", "<field_id|all> <top_k>", 2, [](DB &db, const vector<string> &a) {
+        int fid = -1, top;
+        if (a[0] != "all" && !parse_int_arg(a[0], fid)) return false;
+        if (!parse_int_arg(a[1], top)) return false;
+        return recommend_crops(db, fid, top);
+    }},
+    {"snapshot-info", "", 0, [](DB &db, const vector<string> &) { return snapshot_info(db); }},
+    {"search", "<all|sample|maintenance|crop|farmer|season> <text>", 2, [](DB &db, const vector<string> &a) { return search_text(db, a[0], a[1]); }},
+    {"search-rebuild", "", 0, [](DB &db, const vector<string> &) { return rebuild_search_index_command(db); }},
+    {"insert-fieldcrop", "<field_id> <crop_id> <begin_date> <end_date|-> <yield> <unit>", 6, [](DB &db, const vector<string> &a) {
+        FieldCropRow r;
+        if (!parse_int_arg(a[0], r.field_id) || !parse_int_arg(a[1], r.crop_id) || !parse_double_arg(a[4], r.yield)) return false;
+        r.bdate = a[2];
+        r.edate = a[3] == "-" ? "" : a[3];
+        r.unit = a[5];
+        return insert_fieldcrop(db, r);
+    }},
+    {"insert-soilsample", "<field_id> <sample_date> <sand_pct> <silt_pct> <clay_pct> <ph> <n_ppm> <p_ppm> <k_ppm> <om_pct> <cec> "
+                          "<lead_ppm> <mercury_ppm> <nickel_ppm> <copper_ppm> <chromium_ppm> <cadmium_ppm> <arsenic_ppm> <zinc_ppm> <comment|->", 20,
+     [](DB &db, const vector<string> &a) {
+        SoilSampleRow r;
+        double* values[] = {&r.sand, &r.silt, &r.clay, &r.ph, &r.nppm, &r.pppm, &r.kppm, &r.om, &r.cec,
+                            &r.lead, &r.mercury, &r.nickel, &r.copper, &r.chromium, &r.cadmium, &r.arsenic, &r.zinc};
+        if (!parse_int_arg(a[0], r.field_id)) return false;
+        for (size_t i = 0; i < 17; ++i) if (!parse_double_arg(a[2 + i], *values[i])) return false;
+        r.sdate = a[1];
+        r.comment = a[19] == "-" ? "" : a[19];
+        return insert_soilsample(db, r);
+    }},
+    {"soil-stats", "", 0, [](DB &db, const vector<string> &) { soil_component_stats(db); return true; }},
+    {"script", "<file.sql>", 1, [](DB &db, const vector<string> &a) { return run_sql_script(db, a[0]); }},
+    {"metal-sweep", "<lead> <mercury> <nickel> <copper> <chromium> <cadmium> <arsenic> <zinc>", 8, [](DB &db, const vector<string> &a) {
+        double thr[METAL_COUNT];
+        return parse_metal_limits(a, thr) && metal_threshold_sweep(db, thr, false);
+    }},
+    {"metal-exceed", "<lead> <mercury> <nickel> <copper> <chromium> <cadmium> <arsenic> <zinc>", 8, [](DB &db, const vector<string> &a) {
+        double thr[METAL_COUNT];
+        return parse_metal_limits(a, thr) && metal_threshold_sweep(db, thr, true);
+    }},
+    {"sql", "<statement>", 1, [](DB &db, const vector<string> &a) { return db.run_and_print(a[0]); }},
+    {"stats", "", 0, [](DB &db, const vector<string> &) {
+        if (!db.stats) { db.msg() << "Statistics are off; run with --stats FILE (or - for stderr).\n"; return false; }
+        db.msg() << stats_registry().json();
+        return true;
+    }},
+    {"format", "<table|csv|tsv|ndjson|json|binary>", 1, [](DB &db, const vector<string> &a) {
+        OutputFormat f;
+        if (!parse_output_format(a[0], f)) { db.msg() << "Unknown format: " << a[0] << "\n"; return false; }
+        db.out.set_format(f);
+        return true;
+    }},
+};
+
+static const Command* find_command(const string &name) {
+    for (auto &c : COMMANDS) if (name == c.name) return &c;
+    return nullptr;
+}
+
+void print_command_help() {
+    cout << "Commands:\n";
+    for (auto &c : COMMANDS) cout << "  " << c.name << (c.args[0] ? " " : "") << c.args << "\n";
+}
+
+// Runs one command line. Returns false on unknown command, bad arguments or a failed operation.
+bool run_command(DB &db, const string &line) {
+    vector<string> words = split_command(line);
+    if (words.empty()) return true;
+    if (words[0] == "help") { print_command_help(); return true; }
+    if (const Command* cmd = find_command(words[0])) {
+        const Command &c = *cmd;
+        vector<string> args(words.begin() + 1, words.end());
+        // The last argument soaks up extra words so unquoted names like "Table Grape" still work.
+        if (c.nargs > 0 && args.size() > c.nargs) {
+            for (size_t i = c.nargs; i < args.size(); ++i) args[c.nargs - 1] += " " + args[i];
+            args.resize(c.nargs);
+        }
+        if (args.size() != c.nargs) {
+            db.msg() << "Usage: " << c.name << " " << c.args << "\n";
+            return false;
+        }
+        auto t0 = std::chrono::steady_clock::now();
+        bool ok = c.run(db, args);
+        if (db.stats) db.stats->record_operation(c.name, (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count());
+        if (!ok) {
+            db.msg() << "Command failed: " << line << "\n";
+            return false;
+        }
+        return true;
+    }
+    db.msg() << "Unknown command: " << words[0] << " (try 'help')\n";
+    return false;
+}
+
+static bool is_write_command(const string &name) { return name == "insert-fieldcrop" || name == "insert-soilsample"; }
+
+// Inserts are queued to a write pipeline and share group commits; any other command first
+// waits for them, so it sees the new rows and their messages come out in order.
+int run_batch(DB &db, const vector<string> &execs, bool read_stdin, const WriteOptions &write_opts) {
+    std::ios::sync_with_stdio(false);
+    WritePipeline pipeline;
+    vector<WriteTicket> deferred;
+    const char* path = sqlite3_db_filename(db.db, "main");
+    if (path && *path && pipeline.start(path, write_opts)) {
+        db.writes = &pipeline;
+        db.deferred_writes = &deferred;
+    }
+    int failures = 0;
+    auto run = [&](const string &line) {
+        vector<string> words = split_command(line);
+        if (words.empty() || !is_write_command(words[0])) failures += drain_writes(db);
+        if (!run_command(db, line)) ++failures;
+    };
+    for (auto &e : execs) run(e);
+    if (read_stdin) {
+        string line;
+        while (getline(cin, line)) {
+            size_t start = line.find_first_not_of(" \t\r");
+            if (start == string::npos || line[start] == '#') continue;
+            run(line);
+        }
+    }
+    failures += drain_writes(db);
+    pipeline.stop();
+    db.writes = nullptr;
+    db.deferred_writes = nullptr;
+    cout.flush();
+    if (pipeline.rows_written() > 0) pipeline.print_stats(std::cerr);
+    return failures ? 1 : 0;
+}
+
+// ---------- Schema migrations ----------
+// The schema version lives in PRAGMA user_version. Version 0 is the unversioned schema of
+// database/aims.sqlite (create_schema_aims.sql plus c_water); each migration below runs in
+// its own transaction together with the user_version bump, so a failed step leaves the
+// database at the previous version.
+//
+//   aims_cli <db> migrate [--to N]        apply pending migrations (or list them with --status)
+//   aims_cli <db> schema-diff <file.sql>  compare a schema script with the live database
+//   aims_cli <db> check-plans             EXPLAIN QUERY PLAN every built-in query
+
+// Version 0: creates the AIMS tables in an empty database (ingest, generate, migrate).
+static const char* AIMS_SCHEMA_SQL = R"(
+CREATE TABLE IF NOT EXISTS season (
+    s_seasonkey     DECIMAL(2,0) PRIMARY KEY,
+    s_name          VARCHAR(8) NOT NULL,
+    s_startdate     DATE NOT NULL,
+    s_enddate       DATE NOT NULL
+);
+CREATE TABLE IF NOT EXISTS soiltype (
+    st_soilkey      DECIMAL(3,0) PRIMARY KEY,
+    st_soil_texture VARCHAR(16) NOT NULL,
+    st_sand_pct     DECIMAL(5,2) NOT NULL,
+    st_silt_pct     DECIMAL(5,2) NOT NULL,
+    st_clay_pct     DECIMAL(5,2) NOT NULL
+);
+CREATE TABLE IF NOT EXISTS farmer (
+    f_farmerkey     DECIMAL(9,0) PRIMARY KEY,
+    f_fieldkey      DECIMAL(12,0) NOT NULL,
+    f_name          VARCHAR(25) NOT NULL,
+    f_surname       VARCHAR(25) NOT NULL
+);
+CREATE TABLE IF NOT EXISTS maintenance (
+    m_maintenancekey    DECIMAL(4,0) PRIMARY KEY,
+    m_category          VARCHAR(30) NOT NULL,
+    m_name              VARCHAR(30) NOT NULL,
+    m_activeingredient  VARCHAR(80) NOT NULL,
+    m_notes             VARCHAR(250)
+);
+CREATE TABLE IF NOT EXISTS field (
+    fld_fieldkey    DECIMAL(12,0) PRIMARY KEY,
+    fld_farmerkey   DECIMAL(9,0) NOT NULL,
+    fld_soilkey     DECIMAL(3,0),
+    FOREIGN KEY (fld_farmerkey) REFERENCES farmer(f_farmerkey),
+    FOREIGN KEY (fld_soilkey) REFERENCES soiltype(st_soilkey)
+);
+CREATE TABLE IF NOT EXISTS crop (
+    c_cropkey           DECIMAL(4,0) PRIMARY KEY,
+    c_name              VARCHAR(100) NOT NULL,
+    c_scientific        VARCHAR(128),
+    c_daystomature      DECIMAL(5,0) NOT NULL,
+    c_preferredseason   DECIMAL(2,0) NOT NULL,
+    c_preferredsoil     DECIMAL(3,0) NOT NULL,
+    c_ph                DECIMAL (4,2) NOT NULL,
+    c_germ              DECIMAL (5,2) NOT NULL,
+    c_water             DECIMAL(5,0),
+    c_nutrientuse       VARCHAR(125),
+    FOREIGN KEY (c_preferredseason) REFERENCES season(s_seasonkey)
+);
+CREATE TABLE IF NOT EXISTS soilsample (
+    ss_samplekey DECIMAL(12,0) PRIMARY KEY,
+    ss_fieldkey DECIMAL(12,0) NOT NULL,
+    ss_sampledate DATE NOT NULL,
+    ss_sand DECIMAL(3,2) NOT NULL,
+    ss_silt DECIMAL(3,2) NOT NULL,
+    ss_clay DECIMAL(3,2) NOT NULL,
+    ss_ph DECIMAL(4,2) NOT NULL,
+    ss_nitrogen_ppm DECIMAL(7,2) NOT NULL,
+    ss_phosphorus_ppm DECIMAL(7,2) NOT NULL,
+    ss_potassium_ppm DECIMAL(7,2) NOT NULL,
+    ss_organicmatter_pct DECIMAL(5,2) NOT NULL,
+    ss_cec DECIMAL(6,2) NOT NULL,
+    ss_lead_ppm DECIMAL(8,3) NOT NULL,
+    ss_mercury_ppm DECIMAL(8,3) NOT NULL,
+    ss_nickel_ppm DECIMAL(8,3) NOT NULL,
+    ss_copper_ppm DECIMAL(8,3) NOT NULL,
+    ss_chromium_ppm DECIMAL(8,3) NOT NULL,
+    ss_cadmium_ppm DECIMAL(8,3) NOT NULL,
+    ss_arsenic_ppm DECIMAL(8,3) NOT NULL,
+    ss_zinc_ppm DECIMAL(8,3) NOT NULL,
+    ss_comment VARCHAR(500),
+    FOREIGN KEY (ss_fieldkey) REFERENCES field(fld_fieldkey)
+);
+CREATE TABLE IF NOT EXISTS fieldcrop (
+    fldc_fieldkey   DECIMAL(12,0) NOT NULL,
+    fldc_cropkey    DECIMAL(4,0) NOT NULL,
+    fldc_begindate  DATE NOT NULL,
+    fldc_enddate    DATE NOT NULL,
+    fldc_yield      DECIMAL(6,2) NOT NULL,
+    fldc_yield_unit VARCHAR(16) NOT NULL,
+    FOREIGN KEY (fldc_fieldkey) REFERENCES field(fld_fieldkey),
+    FOREIGN KEY (fldc_cropkey) REFERENCES crop(c_cropkey)
+);
+CREATE TABLE IF NOT EXISTS fieldmaintenance (
+    fldm_fieldkey           DECIMAL(12,0) NOT NULL,
+    fldm_maintenancekey     DECIMAL(4,0) NOT NULL,
+    fldm_concentration      DECIMAL(5,2) NOT NULL,
+    fldm_concentration_unit VARCHAR(16) NOT NULL,
+    fldm_amount             DECIMAL(5,2),
+    fldm_amount_unit        VARCHAR(16),
+    fldm_begindate          DATE NOT NULL,
+    fldm_enddate            DATE,
+    FOREIGN KEY (fldm_fieldkey) REFERENCES field(fld_fieldkey),
+    FOREIGN KEY (fldm_maintenancekey) REFERENCES maintenance(m_maintenancekey)
+);
+)";
+
+// Day-number twins of the planting and maintenance dates (see "Dates") for on-field's
+// "was this running on day D" range probes. They are VIRTUAL generated columns so ingest,
+// the triggers, queries.sql and plain sqlite3 clients keep writing the TEXT dates
+// unchanged; the values are stored in the indexes below, which is where the probes read
+// them. A non-canonical or impossible date yields NULL. Sample and season dates get no
+// twin: latest-sample orders ISO text, which sorts like the day number, and the trend and
+// maintenance reads go through field_summary / field_rollup, cut by the triggers.
+static const int DAY_COLUMNS_VERSION = 5;   // migration that adds them
+
+static const char* DAY_COLUMNS_SQL = R"(
+ALTER TABLE fieldcrop ADD COLUMN fldc_beginday INTEGER GENERATED ALWAYS AS
+    (CASE WHEN date(fldc_begindate) = fldc_begindate THEN CAST(julianday(fldc_begindate) - 2440587.5 AS INTEGER) END) VIRTUAL;
+ALTER TABLE fieldcrop ADD COLUMN fldc_endday INTEGER GENERATED ALWAYS AS
+    (CASE WHEN date(fldc_enddate) = fldc_enddate THEN CAST(julianday(fldc_enddate) - 2440587.5 AS INTEGER) END) VIRTUAL;
+ALTER TABLE fieldmaintenance ADD COLUMN fldm_beginday INTEGER GENERATED ALWAYS AS
+    (CASE WHEN date(fldm_begindate) = fldm_begindate THEN CAST(julianday(fldm_begindate) - 2440587.5 AS INTEGER) END) VIRTUAL;
+ALTER TABLE fieldmaintenance ADD COLUMN fldm_endday INTEGER GENERATED ALWAYS AS
+    (CASE WHEN date(fldm_enddate) = fldm_enddate THEN CAST(julianday(fldm_enddate) - 2440587.5 AS INTEGER) END) VIRTUAL;
+CREATE INDEX IF NOT EXISTS idx_fieldcrop_field_day ON fieldcrop (fldc_fieldkey, fldc_beginday, fldc_endday);
+CREATE INDEX IF NOT EXISTS idx_fieldmaintenance_field_day ON fieldmaintenance (fldm_fieldkey, fldm_beginday, fldm_endday);
+)";
+
+struct Migration {
+    int version;
+    const char* name;
+    const char* sql;
+    bool (*apply)(DB &db) = nullptr;   // optional step run after sql, in the same transaction
+};
+
+static const Migration MIGRATIONS[] = {
+    // Point lookups and per-field ordering for latest-sample, rotation, no-recent-maintenance,
+    // crops-by-season and the yield aggregates (see check-plans).
+    {1, "indexes for the built-in queries", R"(
+CREATE INDEX IF NOT EXISTS idx_soilsample_field_date ON soilsample (ss_fieldkey, ss_sampledate);
+CREATE INDEX IF NOT EXISTS idx_fieldcrop_field_end ON fieldcrop (fldc_fieldkey, fldc_enddate, fldc_cropkey, fldc_yield);
+CREATE INDEX IF NOT EXISTS idx_fieldcrop_crop ON fieldcrop (fldc_cropkey, fldc_fieldkey, fldc_yield);
+CREATE INDEX IF NOT EXISTS idx_fieldmaintenance_field_begin ON fieldmaintenance (fldm_fieldkey, fldm_begindate);
+CREATE INDEX IF NOT EXISTS idx_crop_season ON crop (c_preferredseason, c_cropkey);
+CREATE INDEX IF NOT EXISTS idx_season_name ON season (s_name);
+)"},
+    // The normalized contaminant tables from aims_soil_schema.sql. The rest of that file
+    // renames or drops columns the live schema relies on (st_soil_texture, c_ph, ss_sand...),
+    // so only these additive parts are adopted; `schema-diff` lists the remaining drift.
+    {2, "contaminant tables from aims_soil_schema.sql", R"(
+CREATE TABLE IF NOT EXISTS contaminant_type (
+    ct_contaminantkey DECIMAL(6,0) PRIMARY KEY,
+    ct_name           VARCHAR(100) NOT NULL UNIQUE,
+    ct_typical_unit   VARCHAR(20) DEFAULT 'ppm',
+    ct_reg_threshold  DECIMAL(12,4),
+    ct_threshold_unit VARCHAR(20),
+    ct_notes          TEXT
+);
+CREATE TABLE IF NOT EXISTS soilsample_contaminant (
+    ssc_samplekey       DECIMAL(12,0) NOT NULL,
+    ssc_contaminantkey  DECIMAL(6,0) NOT NULL,
+    ssc_concentration   DECIMAL(12,4) NOT NULL,
+    ssc_detection_limit DECIMAL(12,4),
+    ssc_method          VARCHAR(100),
+    ssc_unit            VARCHAR(20) DEFAULT 'ppm',
+    PRIMARY KEY (ssc_samplekey, ssc_contaminantkey),
+    FOREIGN KEY (ssc_samplekey) REFERENCES soilsample(ss_samplekey) ON DELETE CASCADE,
+    FOREIGN KEY (ssc_contaminantkey) REFERENCES contaminant_type(ct_contaminantkey)
+);
+CREATE INDEX IF NOT EXISTS idx_ssc_contaminant ON soilsample_contaminant (ssc_contaminantkey, ssc_samplekey);
+)"},
+    // Per-field summary kept by triggers (see "Field summary"); the SQL is generated from
+    // SUMMARY_SOURCES, so it is installed by the hook rather than listed here.
+    {FIELD_SUMMARY_VERSION, "field_summary table and triggers", "", install_field_summary},
+    // Monthly and yearly per-field buckets kept by triggers (see "Field rollups").
+    {FIELD_ROLLUP_VERSION, "field_rollup table and triggers", "", install_field_rollup},
+    {DAY_COLUMNS_VERSION, "integer day-number date columns", DAY_COLUMNS_SQL},
+    // FTS5 index over comments, notes and names, kept by triggers (see "Full-text search").
+    {SEARCH_INDEX_VERSION, "full-text search index and triggers", "", install_search_index},
+};
+
+static const int SCHEMA_VERSION = (int)(sizeof(MIGRATIONS) / sizeof(MIGRATIONS[0]));
+
+static bool has_day_columns(DB &db) { return db.schema_version() >= DAY_COLUMNS_VERSION; }
+
+// Applies every migration above the current version up to `target`. An empty database
+// gets the version 0 tables first.
+bool migrate(DB &db, int target = SCHEMA_VERSION, bool verbose = true) {
+    int current = db.schema_version();
+    if (current < 0) { db.msg() << "Can't read schema version: " << sqlite3_errmsg(db.db) << "\n"; return false; }
+    if (current > SCHEMA_VERSION) {
+        db.msg() << "Database schema version " << current << " is newer than this aims_cli supports (" << SCHEMA_VERSION << ").\n";
+        return false;
+    }
+    if (target < current) { db.msg() << "Downgrading from version " << current << " to " << target << " is not supported.\n"; return false; }
+    if (current == 0 && !db.table_exists("field") && sqlite3_exec(db.db, AIMS_SCHEMA_SQL, nullptr, nullptr, nullptr) != SQLITE_OK) {
+        db.msg() << "Schema error: " << sqlite3_errmsg(db.db) << "\n"; return false;
+    }
+    for (auto &m : MIGRATIONS) {
+        if (m.version <= current || m.version > target) continue;
+        auto t0 = std::chrono::steady_clock::now();
+        string sql = string("BEGIN IMMEDIATE;\n") + m.sql;
+        string bump = "PRAGMA user_version = " + std::to_string(m.version) + ";\nCOMMIT;";
+        char* err = nullptr;
+        bool ok = sqlite3_exec(db.db, sql.c_str(), nullptr, nullptr, &err) == SQLITE_OK &&
+                  (!m.apply || m.apply(db)) &&
+                  sqlite3_exec(db.db, bump.c_str(), nullptr, nullptr, &err) == SQLITE_OK;
+        db.forget_schema_version();
+        if (!ok) {
+            db.msg() << "Migration " << m.version << " (" << m.name << ") failed: " << (err ? err : sqlite3_errmsg(db.db)) << "\n";
+            sqlite3_free(err);
+            if (!sqlite3_get_autocommit(db.db)) sqlite3_exec(db.db, "ROLLBACK;", nullptr, nullptr, nullptr);
+            return false;
+        }
+        if (verbose) {
+            double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+            std::ostringstream line;
+            line << "Applied migration " << m.version << ": " << m.name << " (" << std::fixed << std::setprecision(2) << secs << " s)\n";
+            db.msg() << line.str();
+        }
+    }
+    return true;
+}
+
+// aims_cli <db> migrate [--to N | --status]
+int run_migrate(DB &db, int target, bool status_only) {
+    int current = db.schema_version();
+    if (status_only) {
+        std::ostringstream table;
+        table << "schema version " << current << " (latest " << SCHEMA_VERSION << ")\n";
+        for (auto &m : MIGRATIONS) {
+            table << std::left << std::setw(4) << m.version << std::setw(10) << (m.version <= current ? "applied" : "pending") << m.name << "\n";
+        }
+        db.msg() << table.str();
+        return 0;
+    }
+    if (!migrate(db, target)) return 1;
+    int now = db.schema_version();
+    if (now == current) db.msg() << "Schema already at version " << now << ".\n";
+    else db.msg() << "Schema now at version " << now << ".\n";
+    return 0;
+}
+
+// table -> column -> "TYPE[ NOT NULL][ PK]", as sqlite reports them (types upper-cased, spaces dropped).
+using SchemaColumns = std::map<string, std::map<string, string>>;
+
+static bool load_schema_columns(DB &db, SchemaColumns &out) {
+    Stmt stmt = db.prepare(
+        "SELECT m.name, p.name, p.type, p.\"notnull\", p.pk FROM sqlite_master m, pragma_table_info(m.name) p "
+        "WHERE m.type = 'table' AND m.name NOT LIKE 'sqlite_%' ORDER BY m.name, p.cid;");
+    if (!stmt) return false;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        string type;
+        for (const char* c = (const char*)sqlite3_column_text(stmt, 2); c && *c; ++c) {
+            if (*c != ' ') type += (char)toupper((unsigned char)*c);
+        }
+        if (sqlite3_column_int(stmt, 3)) type += " NOT NULL";
+        if (sqlite3_column_int(stmt, 4)) type += " PK";
+        out[(const char*)sqlite3_column_text(stmt, 0)][(const char*)sqlite3_column_text(stmt, 1)] = type;
+    }
+    return true;
+}
+
+// aims_cli <db> schema-diff <file.sql>: loads the script into an in-memory database and
+// lists tables and columns that differ from the live one. Exit code 1 when they differ.
+int run_schema_diff(DB &db, const string &path) {
+    std::ifstream in(path);
+    if (!in) { cout << "Can't open schema file: " << path << "\n"; return 2; }
+    std::stringstream text;
+    text << in.rdbuf();
+    DB ref;
+    if (!ref.open(":memory:")) return 2;
+    char* err = nullptr;
+    if (sqlite3_exec(ref.db, text.str().c_str(), nullptr, nullptr, &err) != SQLITE_OK) {
+        cout << path << " does not load: " << (err ? err : "") << "\n";
+        sqlite3_free(err);
+        return 2;
+    }
+    SchemaColumns live, file;
+    if (!load_schema_columns(db, live) || !load_schema_columns(ref, file)) { cout << "Schema read error: " << sqlite3_errmsg(db.db) << "\n"; return 2; }
+
+    int diffs = 0;
+    auto row = [&](const string &table, const string &col, const string &a, const string &b) {
+        if (!diffs++) cout << std::left << std::setw(26) << "table" << std::setw(26) << "column" << std::setw(26) << "database" << "file\n";
+        cout << std::left << std::setw(26) << table << std::setw(26) << col << std::setw(26) << a << b << "\n";
+    };
+    std::set<string> tables;
+    for (auto &t : live) tables.insert(t.first);
+    for (auto &t : file) tables.insert(t.first);
+    for (auto &t : tables) {
+        auto l = live.find(t), f = file.find(t);
+        if (l == live.end()) { row(t, "", "(missing)", "table"); continue; }
+        if (f == file.end()) { row(t, "", "table", "(missing)"); continue; }
+        std::set<string> cols;
+        for (auto &c : l->second) cols.insert(c.first);
+        for (auto &c : f->second) cols.insert(c.first);
+        for (auto &c : cols) {
+            auto lc = l->second.find(c), fc = f->second.find(c);
+            string a = lc == l->second.end() ? "(missing)" : lc->second;
+            string b = fc == f->second.end() ? "(missing)" : fc->second;
+            if (a != b) row(t, c, a, b);
+        }
+    }
+    if (!diffs) cout << "No differences.\n";
+    else cout << diffs << " difference(s)\n";
+    return diffs ? 1 : 0;
+}
+
+// ---------- Query plan checks ----------
+// Runs EXPLAIN QUERY PLAN on every built-in query and fails on a full table scan, an
+// automatic (transient) index or a temp B-tree sort that is not explicitly expected.
+// Whole-table reports list the scans they need; those must still go through an index
+// where one applies, so dropping it shows up as a bare "SCAN <table>".
+
+struct PlanCheck {
+    const char* name;
+    const char* sql;
+    vector<string> expected;   // plan steps allowed to scan or sort (prefix match)
+};
+
+static const PlanCheck PLAN_CHECKS[] = {
+    {"fields", ALL_FIELDS_SQL, {"SCAN field USING INDEX"}},
+    {"season-by-name", SEASON_BY_NAME_SQL.sql(), {}},
+    {"crops-by-season", CROPS_BY_SEASON_SQL.sql(), {}},
+    {"avg-yield", AVG_YIELD_SQL, {"SCAN fieldcrop USING COVERING INDEX"}},
+    {"latest-sample (key)", LATEST_SAMPLE_KEY_SQL.sql(), {}},
+    {"latest-sample (soil)", LATEST_SAMPLE_SQL[0].sql(), {}},
+    {"latest-sample (metals)", LATEST_SAMPLE_SQL[1].sql(), {}},
+    {"latest-sample (comment)", LATEST_SAMPLE_SQL[2].sql(), {}},
+    // Value predicates on three metal columns: a scan by nature (metal-sweep is the fast path).
+    {"thresholds", THRESHOLDS_SQL.sql(), {"SCAN ss", "USE TEMP B-TREE FOR ORDER BY"}},
+    {"no-recent-maintenance", NO_RECENT_MAINTENANCE_SQL.sql(), {"SCAN fld", "USE TEMP B-TREE FOR ORDER BY"}},
+    {"avg-npk", AVG_NPK_SQL, {"SCAN ss", "USE TEMP B-TREE FOR GROUP BY", "USE TEMP B-TREE FOR ORDER BY"}},
+    {"yield-per-season", YIELD_PER_SEASON_SQL, {"SCAN fieldcrop USING COVERING INDEX", "SCAN pc", "USE TEMP B-TREE FOR GROUP BY", "USE TEMP B-TREE FOR ORDER BY"}},
+    {"rotation", ROTATION_SQL.sql(), {"SCAN cur", "SCAN prev"}},
+    // field_summary reads (schema version 3)
+    {"latest-sample (summary)", LATEST_SAMPLE_SUMMARY_SQL.sql(), {}},
+    {"avg-yield (summary)", AVG_YIELD_SUMMARY_SQL, {"SCAN field_summary"}},
+    {"no-recent-maintenance (summary)", NO_RECENT_MAINTENANCE_SUMMARY_SQL.sql(), {"SCAN fld", "USE TEMP B-TREE FOR ORDER BY"}},
+    {"rotation (summary)", ROTATION_SUMMARY_SQL.sql(), {}},
+    {"field-soil-scan (summary)", FIELD_SOIL_SCAN_SUMMARY_SQL.sql(), {}},
+    {"rotation-scan", ROTATION_SCAN_SQL.sql(), {}},
+    {"planting-scan", PLANTING_SCAN_SQL, {}},
+    {"application-scan", APPLICATION_SCAN_SQL, {}},
+    {"field-soil-scan", FIELD_SOIL_SCAN_SQL.sql(), {}},
+    {"on-field", ON_FIELD_SQL, {"USE TEMP B-TREE FOR ORDER BY"}},
+    {"field-summary", FIELD_DASHBOARD_SQL.sql(), {}},
+    {"soil-stats", SOIL_STATS_SQL, {"SCAN soilsample USING INDEX"}},
+    // field_rollup reads (schema version 4)
+    {"trend", FIELD_TREND_SQL.sql(), {}},
+    {"yoy", FIELD_YOY_SQL.sql(), {}},
+    {"rollup-window", FIELD_WINDOW_SQL.sql(), {}},
+    {"maint-vs-yield", MAINT_VS_YIELD_SQL.sql(), {"SCAN field_rollup"}},
+    // day-number columns (schema version 5)
+    {"on-field (days)", ON_FIELD_DAY_SQL, {"USE TEMP B-TREE FOR ORDER BY"}},
+    // search index (schema version 6): matches come from the FTS5 index, ranked by it
+    {"search", SEARCH_SQL.sql(), {"SCAN search_index VIRTUAL TABLE"}},
+    // as built by DB::id_exists
+    {"field-exists", "SELECT 1 FROM field WHERE fld_fieldkey = ? LIMIT 1;", {}},
+    {"crop-exists", "SELECT 1 FROM crop WHERE c_cropkey = ? LIMIT 1;", {}},
+    {"season-exists", "SELECT 1 FROM season WHERE s_seasonkey = ? LIMIT 1;", {}},
+};
+
+static bool plan_step_suspect(const string &d) {
+    if (d.compare(0, 5, "SCAN ") == 0) return d.compare(0, 17, "SCAN CONSTANT ROW") != 0 && d.compare(0, 15, "SCAN (subquery-") != 0;
+    return d.find("AUTOMATIC") != string::npos || d.compare(0, 15, "USE TEMP B-TREE") == 0;
+}
+
+// aims_cli <db> check-plans [--verbose]: exit code 1 if any query regressed.
+int run_check_plans(DB &db, bool verbose) {
+    int version = db.schema_version();
+    if (version < SCHEMA_VERSION) cout << "Note: schema is at version " << version << " of " << SCHEMA_VERSION << "; run 'migrate' first.\n";
+    int failed = 0;
+    for (auto &c : PLAN_CHECKS) {
+        Stmt stmt = db.prepare(string("EXPLAIN QUERY PLAN ") + c.sql);
+        if (!stmt) { cout << std::left << std::setw(34) << c.name << "ERROR " << sqlite3_errmsg(db.db) << "\n"; ++failed; continue; }
+        vector<std::pair<string, bool>> steps;
+        bool ok = true;
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            string d = (const char*)sqlite3_column_text(stmt, 3);
+            bool bad = plan_step_suspect(d);
+            for (auto &e : c.expected) if (bad && d.compare(0, e.size(), e) == 0) bad = false;
+            if (bad) ok = false;
+            steps.push_back({d, bad});
+        }
+        if (!ok) ++failed;
+        cout << std::left << std::setw(34) << c.name << (ok ? "ok" : "FAIL") << "\n";
+        if (!ok || verbose) {
+            for (auto &s : steps) cout << (s.second ? "    !! " : "       ") << s.first << "\n";
+        }
+    }
+    cout << (sizeof(PLAN_CHECKS) / sizeof(PLAN_CHECKS[0]) - failed) << " ok, " << failed << " failed\n";
+    return failed ? 1 : 0;
+}
+
+// ---------- Bulk CSV ingest ----------
+
+// Read-only view of a whole file. Uses mmap where available so multi-GB dumps
+// are paged in by the kernel instead of copied through stdio.
+struct MappedFile {
+    const char* data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    string buffer;
+#else
+    int fd = -1;
+#endif
+
+    bool open(const string &path) {
+#ifdef _WIN32
+        std::ifstream in(path, std::ios::binary);
+        if (!in) return false;
+        std::ostringstream ss; ss << in.rdbuf();
+        buffer = ss.str();
+        data = buffer.data(); size = buffer.size();
+        return true;
+#else
+        fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0) { close(); return false; }
+        size = (size_t)st.st_size;
+        if (size == 0) return true;
+        void* p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) { size = 0; close(); return false; }
+        madvise(p, size, MADV_SEQUENTIAL);
+        data = (const char*)p;
+        return true;
+#endif
+    }
+    void close() {
+#ifndef _WIN32
+        if (data && size) munmap((void*)data, size);
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+#endif
+        data = nullptr; size = 0;
+    }
+    ~MappedFile() { close(); }
+};
+
+// One parsed CSV field. Points into the mapped file unless the field contained
+// escaped quotes, in which case it points into the parser's scratch buffer.
+struct CsvField {
+    const char* ptr;
+    size_t len;
+    bool quoted;
+};
+
+// Streaming RFC 4180 style reader: quoted fields may hold commas, newlines and "" escapes.
+struct CsvReader {
+    const char* cur;
+    const char* end;
+    size_t line = 1;
+    vector<CsvField> fields;
+    string scratch;
+
+    CsvReader(const char* data, size_t size) : cur(data), end(data + size) {}
+
+    bool next_record() {
+        fields.clear();
+        scratch.clear();
+        // skip blank lines
+        while (cur < end && (*cur == '\n' || *cur == '\r')) { if (*cur == '\n') ++line; ++cur; }
+        if (cur >= end) return false;
+        // Escaped fields are unescaped into scratch; reserve so pointers stay valid for the record.
+        vector<std::pair<size_t, size_t>> scratch_spans;
+        while (true) {
+            CsvField f{cur, 0, false};
+            if (cur < end && *cur == '"') {
+                f.quoted = true;
+                const char* start = ++cur;
+                bool escaped = false;
+                while (cur < end) {
+                    if (*cur == '"') {
+                        if (cur + 1 < end && cur[1] == '"') { escaped = true; cur += 2; continue; }
+                        break;
+                    }
+                    if (*cur == '\n') ++line;
+                    ++cur;
+                }
+                if (!escaped) {
+                    f.ptr = start; f.len = (size_t)(cur - start);
+                } else {
+                    size_t off = scratch.size();
+                    for (const char* p = start; p < cur; ++p) {
+                        scratch.push_back(*p);
+                        if (*p == '"') ++p;
+                    }
+                    scratch_spans.push_back({fields.size(), off});
+                    f.ptr = nullptr; f.len = scratch.size() - off;
+                }
+                if (cur < end) ++cur; // closing quote
+                while (cur < end && *cur != ',' && *cur != '\n' && *cur != '\r') ++cur; // stray chars
+            } else {
+                while (cur < end && *cur != ',' && *cur != '\n' && *cur != '\r') ++cur;
+                f.len = (size_t)(cur - f.ptr);
+            }
+            fields.push_back(f);
+            if (cur < end && *cur == ',') { ++cur; continue; }
+            if (cur < end && *cur == '\r') ++cur;
+            if (cur < end && *cur == '\n') { ++cur; ++line; }
+            break;
+        }
+        for (auto &sp : scratch_spans) fields[sp.first].ptr = scratch.data() + sp.second;
+        return true;
+    }
+};
+
+// Parse an unquoted numeric literal without NUL termination. Returns 0 = not a number,
+// 1 = integer (in i), 2 = decimal (in d). A leading zero before another digit ("007") keeps
+// the field as text, since those are codes rather than quantities.
+static int parse_csv_number(const char* p, size_t n, sqlite3_int64 &i, double &d) {
+    if (n == 0 || n > 40) return 0;
+    size_t k = 0;
+    bool neg = false;
+    if (p[0] == '-' || p[0] == '+') { neg = (p[0] == '-'); k = 1; if (n == 1) return 0; }
+    if (p[k] == '0' && k + 1 < n && p[k + 1] >= '0' && p[k + 1] <= '9') return 0;
+    sqlite3_int64 mant = 0;
+    int digits = 0, frac_digits = -1;
+    for (; k < n; ++k) {
+        char c = p[k];
+        if (c >= '0' && c <= '9') {
+            if (digits++ < 18) mant = mant * 10 + (c - '0');
+            if (frac_digits >= 0) ++frac_digits;
+        } else if (c == '.' && frac_digits < 0) {
+            frac_digits = 0;
+        } else return 0;
+    }
+    if (frac_digits < 0) {
+        if (digits > 18) return 0;
+        i = neg ? -mant : mant;
+        return 1;
+    }
+    if (frac_digits == 0) return 0;
+    if (digits > 15) {
+        // past 15 digits the mantissa may not be exact: let strtod round it
+        char buf[48];
+        memcpy(buf, p, n);
+        buf[n] = '\0';
+        d = strtod(buf, nullptr);
+        return 2;
+    }
+    static const double pow10[] = {1e0,1e1,1e2,1e3,1e4,1e5,1e6,1e7,1e8,1e9,1e10,1e11,1e12,1e13,1e14,1e15};
+    // mantissa < 10^15 < 2^53 and an exact power of ten: the quotient is correctly rounded
+    d = (double)mant / pow10[frac_digits];
+    if (neg) d = -d;
+    return 2;
+}
+
+static void bind_csv_field(sqlite3_stmt* stmt, int idx, const CsvField &f) {
+    if (f.quoted) { sqlite3_bind_text(stmt, idx, f.ptr, (int)f.len, SQLITE_STATIC); return; }
+    if (f.len == 0) { sqlite3_bind_null(stmt, idx); return; }
+    sqlite3_int64 i; double d;
+    switch (parse_csv_number(f.ptr, f.len, i, d)) {
+        case 1: sqlite3_bind_int64(stmt, idx, i); break;
+        case 2: sqlite3_bind_double(stmt, idx, d); break;
+        default: sqlite3_bind_text(stmt, idx, f.ptr, (int)f.len, SQLITE_STATIC);
+    }
+}
+
+// Order tables so every FK target is loaded before the tables that reference it
+// (same result as the manual order in data/README.md, but derived from the schema).
+static vector<string> fk_load_order(DB &db, const vector<string> &tables) {
+    std::set<string> wanted(tables.begin(), tables.end());
+    std::map<string, std::set<string>> deps;
+    for (auto &t : tables) {
+        deps[t];
+        Stmt stmt = db.prepare("PRAGMA foreign_key_list(" + t + ");");
+        if (!stmt) { db.msg() << "Prepare error: " << sqlite3_errmsg(db.db) << "\n"; continue; }
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            string target = (const char*)sqlite3_column_text(stmt, 2);
+            if (target != t && wanted.count(target)) deps[t].insert(target);
+        }
+    }
+    vector<string> order;
+    std::set<string> done;
+    while (order.size() < tables.size()) {
+        bool progressed = false;
+        for (auto &d : deps) {
+            if (done.count(d.first)) continue;
+            bool ready = true;
+            for (auto &dep : d.second) if (!done.count(dep)) { ready = false; break; }
+            if (ready) { order.push_back(d.first); done.insert(d.first); progressed = true; }
+        }
+        if (!progressed) { // FK cycle: load the rest alphabetically
+            for (auto &d : deps) if (!done.count(d.first)) { order.push_back(d.first); done.insert(d.first); }
+        }
+    }
+    return order;
+}
+
+struct IngestStats {
+    string table;
+    sqlite3_int64 rows = 0;
+    sqlite3_int64 rejected = 0;
+    double seconds = 0.0;
+};
+
+static bool ingest_csv_file(DB &db, const string &table, const string &path, sqlite3_int64 batch_rows, IngestStats &st) {
+    st.table = table;
+    MappedFile file;
+    if (!file.open(path)) { db.msg() << "Can't open " << path << "\n"; return false; }
+
+    vector<string> cols;
+    {
+        Stmt stmt = db.prepare("PRAGMA table_info(" + table + ");");
+        if (!stmt) { db.msg() << "Prepare error: " << sqlite3_errmsg(db.db) << "\n"; return false; }
+        while (sqlite3_step(stmt) == SQLITE_ROW) cols.push_back((const char*)sqlite3_column_text(stmt, 1));
+    }
+
+    auto t0 = std::chrono::steady_clock::now();
+    CsvReader rd(file.data, file.size);
+    Stmt ins;
+    size_t ncols = 0;
+    sqlite3_int64 in_batch = 0;
+    if (sqlite3_exec(db.db, "BEGIN;", nullptr, nullptr, nullptr) != SQLITE_OK) {
+        db.msg() << "Begin failed: " << sqlite3_errmsg(db.db) << "\n";
+        return false;
+    }
+    while (true) {
+        size_t rec_line = rd.line;
+        if (!rd.next_record()) break;
+        if (!ins) {
+            // The CSV dumps have no header: columns map positionally onto the table definition.
+            ncols = rd.fields.size();
+            if (ncols > cols.size()) {
+                db.msg() << path << ": " << ncols << " fields but table " << table << " has " << cols.size() << " columns\n";
+                sqlite3_exec(db.db, "ROLLBACK;", nullptr, nullptr, nullptr);
+                return false;
+            }
+            string sql = "INSERT INTO " + table + " (";
+            for (size_t i = 0; i < ncols; ++i) sql += (i ? ", " : "") + cols[i];
+            sql += ") VALUES (";
+            for (size_t i = 0; i < ncols; ++i) sql += (i ? ", ?" : "?");
+            sql += ");";
+            ins = db.prepare(sql);
+            if (!ins) {
+                db.msg() << "Prepare error: " << sqlite3_errmsg(db.db) << "\n";
+                sqlite3_exec(db.db, "ROLLBACK;", nullptr, nullptr, nullptr);
+                return false;
+            }
+        }
+        if (rd.fields.size() != ncols) {
+            if (st.rejected++ < 5) db.msg() << path << ":" << rec_line << ": expected " << ncols << " fields, got " << rd.fields.size() << "\n";
+            continue;
+        }
+        for (size_t i = 0; i < ncols; ++i) bind_csv_field(ins, (int)i + 1, rd.fields[i]);
+        if (sqlite3_step(ins) != SQLITE_DONE) {
+            if (st.rejected++ < 5) db.msg() << path << ":" << rec_line << ": " << sqlite3_errmsg(db.db) << "\n";
+        } else {
+            ++st.rows;
+        }
+        sqlite3_reset(ins);
+        if (++in_batch >= batch_rows) {
+            if (sqlite3_exec(db.db, "COMMIT; BEGIN;", nullptr, nullptr, nullptr) != SQLITE_OK) {
+                db.msg() << "Commit failed: " << sqlite3_errmsg(db.db) << "\n";
+                if (!sqlite3_get_autocommit(db.db)) sqlite3_exec(db.db, "ROLLBACK;", nullptr, nullptr, nullptr);
+                return false;
+            }
+            in_batch = 0;
+        }
+    }
+    if (sqlite3_exec(db.db, "COMMIT;", nullptr, nullptr, nullptr) != SQLITE_OK) {
+        db.msg() << "Commit failed: " << sqlite3_errmsg(db.db) << "\n";
+        return false;
+    }
+    st.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    return true;
+}
+
+// aims_cli <db> ingest <dir> : load every <table>.csv found in <dir>.
+int run_ingest(DB &db, const string &dir, sqlite3_int64 batch_rows) {
+    namespace fs = std::filesystem;
+    std::error_code ec;
+    if (!fs::is_directory(dir, ec)) { db.msg() << "Not a directory: " << dir << "\n"; return 1; }
+
+    if (sqlite3_exec(db.db, AIMS_SCHEMA_SQL, nullptr, nullptr, nullptr) != SQLITE_OK) {
+        db.msg() << "Schema error: " << sqlite3_errmsg(db.db) << "\n"; return 1;
+    }
+    // Bulk-load settings: larger page cache, in-memory temp space; durability still comes
+    // from the batched COMMITs.
+    sqlite3_exec(db.db, "PRAGMA cache_size = -262144; PRAGMA temp_store = MEMORY;", nullptr, nullptr, nullptr);
+
+    std::map<string, string> files;
+    for (auto &entry : fs::directory_iterator(dir, ec)) {
+        if (entry.path().extension() != ".csv") continue;
+        string table = entry.path().stem().string();
+        if (db.table_exists(table)) files[table] = entry.path().string();
+        else db.msg() << "Skipping " << entry.path().filename().string() << " (no table '" << table << "')\n";
+    }
+    if (files.empty()) { db.msg() << "No CSV files matching AIMS tables in " << dir << "\n"; return 1; }
+
+    vector<string> tables;
+    for (auto &f : files) tables.push_back(f.first);
+
+    vector<IngestStats> stats;
+    bool ok = true;
+    bool summary = has_field_summary(db) && drop_field_summary_triggers(db);
+    bool rollup = has_field_rollup(db) && drop_field_rollup_triggers(db);
+    bool search = has_search_index(db) && drop_search_triggers(db);
+    for (auto &t : fk_load_order(db, tables)) {
+        IngestStats st;
+        if (!ingest_csv_file(db, t, files[t], batch_rows, st)) { ok = false; break; }
+        stats.push_back(st);
+    }
+    if (summary) {
+        sqlite3_exec(db.db, "BEGIN;", nullptr, nullptr, nullptr);
+        bool installed = install_field_summary(db);
+        sqlite3_exec(db.db, installed ? "COMMIT;" : "ROLLBACK;", nullptr, nullptr, nullptr);
+        if (!installed) ok = false;
+    }
+    if (rollup) {
+        sqlite3_exec(db.db, "BEGIN;", nullptr, nullptr, nullptr);
+        bool installed = install_field_rollup(db);
+        sqlite3_exec(db.db, installed ? "COMMIT;" : "ROLLBACK;", nullptr, nullptr, nullptr);
+        if (!installed) ok = false;
+    }
+    if (search) {
+        sqlite3_exec(db.db, "BEGIN;", nullptr, nullptr, nullptr);
+        bool installed = install_search_index(db);
+        sqlite3_exec(db.db, installed ? "COMMIT;" : "ROLLBACK;", nullptr, nullptr, nullptr);
+        if (!installed) ok = false;
+    }
+
+    std::ostringstream table;
+    table << "\n" << std::left << std::setw(18) << "table" << std::setw(14) << "rows" << std::setw(10) << "rejected"
+         << std::setw(12) << "seconds" << "rows/s\n";
+    sqlite3_int64 total = 0; double secs = 0;
+    for (auto &st : stats) {
+        double rate = st.seconds > 0 ? st.rows / st.seconds : 0.0;
+        table << std::left << std::setw(18) << st.table << std::setw(14) << st.rows << std::setw(10) << st.rejected
+             << std::setw(12) << std::fixed << std::setprecision(3) << st.seconds
+             << std::setprecision(0) << rate << "\n";
+        total += st.rows; secs += st.seconds;
+    }
+    table << std::left << std::setw(18) << "total" << std::setw(14) << total << std::setw(10) << ""
+         << std::setw(12) << std::fixed << std::setprecision(3) << secs
+         << std::setprecision(0) << (secs > 0 ? total / secs : 0.0) << "\n";
+    cout << table.str();
+    if (ok && !migrate(db)) ok = false;
+    return ok ? 0 : 1;
+}
+
+// ---------- Columnar snapshot ----------
+// `aims_cli <db> snapshot <file>` writes the analytics tables to one file that later runs
+// map read-only and use in place (`--snapshot <file>`), so a short-lived process skips the
+// B-tree walk and per-row text conversion that loading soilsample or fieldcrop costs.
+//
+// Layout, little-endian, every section 64-byte aligned so columns can be vector-loaded:
+//   SnapshotHeader                  magic, format version, table count, directory offset
+//   per column: values              one fixed-width array, rows in the table's snapshot order
+//               zone map            min and max of the non-NULL values of each ZONE_ROWS block
+//               dictionary          text columns: u32 offsets[count + 1], then the bytes
+//   SnapshotTableEntry[tables], then each table's SnapshotColumnEntry[columns]
+//
+// Encodings follow the declared type: integer keys (INTEGER, DECIMAL(n,0)) as int64 with
+// INT64_MIN for NULL, other numbers as double with NaN, DATE as int32 day numbers with
+// NO_DAY, and text as u32 codes into a sorted dictionary (UINT32_MAX for NULL), so code
+// order is string order and a yield unit or crop name costs four bytes a row. The file is
+// written under a temporary name and renamed, so processes still mapping the previous
+// snapshot keep a consistent view.
+//
+//   snapshot-info    tables, columns, encodings and value ranges of the attached snapshot
+
+static const char SNAPSHOT_MAGIC[8] = {'A', 'I', 'M', 'S', 'C', 'O', 'L', '\0'};
+static const uint32_t SNAPSHOT_FORMAT_VERSION = 1;
+static const uint32_t SNAPSHOT_ZONE_ROWS = 16384;
+static const uint64_t SNAPSHOT_ALIGN = 64;
+static const uint32_t SNAPSHOT_NULL_CODE = std::numeric_limits<uint32_t>::max();
+static const sqlite3_int64 SNAPSHOT_NULL_INT = std::numeric_limits<sqlite3_int64>::min();
+
+enum class SnapshotType : uint32_t { Int64 = 1, Float64 = 2, Day = 3, Dict = 4 };
+
+static const uint32_t SNAPSHOT_SORTED = 1;   // column flag: values ascend (leading sort key)
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t table_count;
+    uint64_t directory_offset;
+    uint64_t file_size;
+    int64_t created;           // unix time
+    int32_t schema_version;    // of the source database
+    uint32_t zone_rows;
+    char reserved[16];
+};
+
+struct SnapshotTableEntry {
+    char name[48];
+    uint64_t rows;
+    int64_t max_rowid;         // of the source table when written, to notice later inserts
+    uint32_t column_count;
+    uint32_t reserved;
+    uint64_t columns_offset;
+};
+
+struct SnapshotColumnEntry {
+    char name[48];
+    uint32_t type;             // SnapshotType
+    uint32_t flags;
+    uint64_t data_offset;
+    uint64_t zone_offset;      // zone_count pairs of (min, max), double or int64 by type
+    uint64_t zone_count;
+    uint64_t dict_offset;
+    uint64_t dict_count;
+    uint64_t dict_bytes;
+};
+
+static_assert(sizeof(SnapshotHeader) == 64, "snapshot header layout");
+static_assert(sizeof(SnapshotTableEntry) == 80, "snapshot table entry layout");
+static_assert(sizeof(SnapshotColumnEntry) == 104, "snapshot column entry layout");
+
+struct SnapshotZoneI { int64_t min, max; };
+
+static size_t snapshot_value_bytes(SnapshotType t) {
+    return t == SnapshotType::Day || t == SnapshotType::Dict ? 4 : 8;
+}
+
+static const char* snapshot_type_name(SnapshotType t) {
+    switch (t) {
+        case SnapshotType::Int64: return "int64";
+        case SnapshotType::Float64: return "double";
+        case SnapshotType::Day: return "day";
+        case SnapshotType::Dict: return "dict";
+    }
+    return "?";
+}
+
+// Tables in the snapshot and the row order each is written in. fieldcrop follows
+// ROTATION_SCAN_SQL and fieldmaintenance APPLICATION_SCAN_SQL, so the readers can walk
+// them field by field without sorting.
+struct SnapshotTableSpec {
+    const char* table;
+    const char* order;
+};
+
+static const SnapshotTableSpec SNAPSHOT_TABLES[] = {
+    {"soilsample", "rowid"},
+    {"fieldcrop", "fldc_fieldkey, fldc_enddate, fldc_cropkey"},
+    {"fieldmaintenance", "fldm_fieldkey, fldm_begindate"},
+    {"field", "fld_fieldkey"},
+    {"crop", "c_cropkey"},
+    {"maintenance", "m_maintenancekey"},
+};
+
+static SnapshotType snapshot_type_for(const string &declared) {
+    string t;
+    for (char c : declared) if (c != ' ') t += (char)toupper((unsigned char)c);
+    if (t == "DATE") return SnapshotType::Day;
+    if (t.find("INT") != string::npos) return SnapshotType::Int64;
+    if (t.compare(0, 7, "DECIMAL") == 0 || t.compare(0, 7, "NUMERIC") == 0) {
+        size_t comma = t.find(',');
+        return comma == string::npos || t.compare(comma, 3, ",0)") == 0 ? SnapshotType::Int64 : SnapshotType::Float64;
+    }
+    if (t.find("REAL") != string::npos || t.find("FLOA") != string::npos || t.find("DOUB") != string::npos) return SnapshotType::Float64;
+    return SnapshotType::Dict;
+}
+
+// One column being written: values go to a buffer that spills to a temporary file, so a
+// table larger than memory still becomes contiguous columns. Text gets provisional codes
+// in order of first appearance; finish() sorts the dictionary and remaps while copying.
+class SnapshotColumnBuilder {
+public:
+    static const size_t SPILL_BYTES = 1 << 22;
+
+    SnapshotColumnBuilder(const string &name, SnapshotType type) : name_(name), type_(type) {}
+    ~SnapshotColumnBuilder() { if (spill_) fclose(spill_); }
+    SnapshotColumnBuilder(const SnapshotColumnBuilder &) = delete;
+    SnapshotColumnBuilder &operator=(const SnapshotColumnBuilder &) = delete;
+
+    const string &name() const { return name_; }
+    SnapshotType type() const { return type_; }
+    uint64_t rows() const { return rows_; }
+
+    bool add(sqlite3_stmt* stmt, int col) {
+        bool null = sqlite3_column_type(stmt, col) == SQLITE_NULL;
+        switch (type_) {
+            case SnapshotType::Int64: { sqlite3_int64 v = null ? SNAPSHOT_NULL_INT : sqlite3_column_int64(stmt, col); put(&v, 8); break; }
+            case SnapshotType::Float64: { double v = null ? std::numeric_limits<double>::quiet_NaN() : sqlite3_column_double(stmt, col); put(&v, 8); break; }
+            case SnapshotType::Day: {
+                const char* t = (const char*)sqlite3_column_text(stmt, col);
+                int day;
+                int32_t v = t && parse_date(t, (size_t)sqlite3_column_bytes(stmt, col), day) ? day : NO_DAY;
+                put(&v, 4);
+                break;
+            }
+            case SnapshotType::Dict: {
+                uint32_t v = SNAPSHOT_NULL_CODE;
+                if (!null) {
+                    string t((const char*)sqlite3_column_text(stmt, col), (size_t)sqlite3_column_bytes(stmt, col));
+                    auto it = codes_.find(t);
+                    if (it == codes_.end()) {
+                        if (values_.size() >= SNAPSHOT_NULL_CODE) return false;
+                        it = codes_.emplace(t, (uint32_t)values_.size()).first;
+                        values_.push_back(t);
+                    }
+                    v = it->second;
+                }
+                put(&v, 4);
+                break;
+            }
+        }
+        ++rows_;
+        return !failed_;
+    }
+
+    // Appends values, zone map and dictionary to out at 64-byte aligned offsets.
+    bool finish(FILE* out, uint64_t &pos, SnapshotColumnEntry &e) {
+        memset(&e, 0, sizeof e);
+        snprintf(e.name, sizeof e.name, "%s", name_.c_str());
+        e.type = (uint32_t)type_;
+
+        vector<uint32_t> remap;
+        vector<size_t> order(values_.size());
+        if (type_ == SnapshotType::Dict) {
+            for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+            std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return values_[a] < values_[b]; });
+            remap.resize(values_.size());
+            for (size_t rank = 0; rank < order.size(); ++rank) remap[order[rank]] = (uint32_t)rank;
+        }
+
+        // Values, remapped and folded into the zone map on the way out.
+        vector<SnapshotZoneI> zi;
+        vector<SnapshotZoneF> zf;
+        uint64_t row = 0;
+        bool sorted = true;
+        double last_f = 0; int64_t last_i = 0;
+        auto fold = [&](char* p, size_t n) {
+            size_t w = snapshot_value_bytes(type_);
+            for (size_t off = 0; off < n; off += w, ++row) {
+                if (row % SNAPSHOT_ZONE_ROWS == 0) {
+                    zi.push_back({std::numeric_limits<int64_t>::max(), std::numeric_limits<int64_t>::min()});
+                    zf.push_back({std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity()});
+                }
+                if (type_ == SnapshotType::Float64) {
+                    double v; memcpy(&v, p + off, 8);
+                    if (std::isnan(v)) { sorted = false; continue; }
+                    zf.back().min = std::min(zf.back().min, v); zf.back().max = std::max(zf.back().max, v);
+                    if (row && v < last_f) sorted = false;
+                    last_f = v;
+                    continue;
+                }
+                int64_t v;
+                if (type_ == SnapshotType::Int64) { sqlite3_int64 x; memcpy(&x, p + off, 8); v = x; if (x == SNAPSHOT_NULL_INT) { sorted = false; continue; } }
+                else if (type_ == SnapshotType::Day) { int32_t x; memcpy(&x, p + off, 4); v = x; if (x == NO_DAY) { sorted = false; continue; } }
+                else {
+                    uint32_t x; memcpy(&x, p + off, 4);
+                    if (x == SNAPSHOT_NULL_CODE) { sorted = false; continue; }
+                    x = remap[x]; memcpy(p + off, &x, 4); v = x;
+                }
+                zi.back().min = std::min(zi.back().min, v); zi.back().max = std::max(zi.back().max, v);
+                if (row && v < last_i) sorted = false;
+                last_i = v;
+            }
+        };
+        if (!align(out, pos)) return false;
+        e.data_offset = pos;
+        if (spill_) {
+            if (fflush(spill_) != 0 || fseek(spill_, 0, SEEK_SET) != 0) return false;
+            vector<char> chunk(SPILL_BYTES);
+            size_t n;
+            while ((n = fread(chunk.data(), 1, chunk.size(), spill_)) > 0) {
+                fold(chunk.data(), n);
+                if (!write(out, pos, chunk.data(), n)) return false;
+            }
+            if (ferror(spill_)) return false;
+        }
+        fold(&buf_[0], buf_.size());
+        if (!write(out, pos, buf_.data(), buf_.size())) return false;
+        if (sorted && type_ != SnapshotType::Float64) e.flags |= SNAPSHOT_SORTED;
+
+        if (!align(out, pos)) return false;
+        e.zone_offset = pos;
+        e.zone_count = type_ == SnapshotType::Float64 ? zf.size() : zi.size();
+        if (type_ == SnapshotType::Float64 ? !write(out, pos, zf.data(), zf.size() * sizeof(SnapshotZoneF))
+                                           : !write(out, pos, zi.data(), zi.size() * sizeof(SnapshotZoneI))) return false;
+
+        if (type_ == SnapshotType::Dict) {
+            if (!align(out, pos)) return false;
+            e.dict_offset = pos;
+            e.dict_count = values_.size();
+            vector<uint32_t> offsets;
+            uint64_t bytes = 0;
+            for (size_t i : order) { offsets.push_back((uint32_t)bytes); bytes += values_[i].size(); }
+            offsets.push_back((uint32_t)bytes);
+            if (bytes > std::numeric_limits<uint32_t>::max()) return false;
+            e.dict_bytes = bytes;
+            if (!write(out, pos, offsets.data(), offsets.size() * 4)) return false;
+            for (size_t i : order) if (!write(out, pos, values_[i].data(), values_[i].size())) return false;
+        }
+        return true;
+    }
+
+    static bool write(FILE* out, uint64_t &pos, const void* p, size_t n) {
+        if (n && fwrite(p, 1, n, out) != n) return false;
+        pos += n;
+        return true;
+    }
+
+    static bool align(FILE* out, uint64_t &pos) {
+        static const char zeros[SNAPSHOT_ALIGN] = {};
+        size_t pad = (size_t)((SNAPSHOT_ALIGN - pos % SNAPSHOT_ALIGN) % SNAPSHOT_ALIGN);
+        return write(out, pos, zeros, pad);
+    }
+
+private:
+    void put(const void* p, size_t n) {
+        buf_.append((const char*)p, n);
+        if (buf_.size() < SPILL_BYTES) return;
+        if (!spill_ && !(spill_ = tmpfile())) { failed_ = true; return; }
+        if (fwrite(buf_.data(), 1, buf_.size(), spill_) != buf_.size()) failed_ = true;
+        buf_.clear();
+    }
+
+    string name_;
+    SnapshotType type_;
+    string buf_;
+    FILE* spill_ = nullptr;
+    bool failed_ = false;
+    uint64_t rows_ = 0;
+    std::unordered_map<string, uint32_t> codes_;
+    vector<string> values_;
+};
+
+// aims_cli <db> snapshot <file>
+int run_snapshot(DB &db, const string &path) {
+    auto t0 = std::chrono::steady_clock::now();
+    string tmp = path + ".tmp";
+    FILE* out = fopen(tmp.c_str(), "wb");
+    if (!out) { db.msg() << "Can't create " << tmp << "\n"; return 1; }
+    vector<char> iobuf(1 << 20);
+    setvbuf(out, iobuf.data(), _IOFBF, iobuf.size());
+    auto fail = [&](const string &what) {
+        db.msg() << "Snapshot failed: " << what << "\n";
+        fclose(out);
+        remove(tmp.c_str());
+        return 1;
+    };
+
+    SnapshotHeader h;
+    memset(&h, 0, sizeof h);
+    uint64_t pos = 0;
+    if (!SnapshotColumnBuilder::write(out, pos, &h, sizeof h)) return fail("write error");
+
+    // One read transaction, so every table comes from the same state of the database.
+    if (sqlite3_exec(db.db, "BEGIN;", nullptr, nullptr, nullptr) != SQLITE_OK) return fail(string("can't start read transaction: ") + sqlite3_errmsg(db.db));
+    vector<SnapshotTableEntry> tables;
+    vector<vector<SnapshotColumnEntry>> columns;
+    std::ostringstream table;
+    table << std::left << std::setw(18) << "table" << std::setw(12) << "rows" << std::setw(10) << "columns" << "bytes\n";
+    for (auto &spec : SNAPSHOT_TABLES) {
+        if (!db.table_exists(spec.table)) continue;
+        vector<std::unique_ptr<SnapshotColumnBuilder>> builders;
+        {
+            Stmt info = db.prepare(string("PRAGMA table_info(") + spec.table + ");");
+            while (info && sqlite3_step(info) == SQLITE_ROW) {
+                const char* type = (const char*)sqlite3_column_text(info, 2);
+                builders.push_back(std::make_unique<SnapshotColumnBuilder>((const char*)sqlite3_column_text(info, 1), snapshot_type_for(type ? type : "")));
+            }
+        }
+        string sql = "SELECT ";
+        for (size_t c = 0; c < builders.size(); ++c) sql += (c ? ", " : "") + builders[c]->name();
+        sql += string(" FROM ") + spec.table + " ORDER BY " + spec.order + ";";
+        Stmt stmt = db.prepare(sql);
+        if (!stmt) { sqlite3_exec(db.db, "ROLLBACK;", nullptr, nullptr, nullptr); return fail(sqlite3_errmsg(db.db)); }
+        int rc;
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+            for (size_t c = 0; c < builders.size(); ++c) {
+                if (!builders[c]->add(stmt, (int)c)) { sqlite3_exec(db.db, "ROLLBACK;", nullptr, nullptr, nullptr); return fail("column " + builders[c]->name()); }
+            }
+        }
+        if (rc != SQLITE_DONE) { sqlite3_exec(db.db, "ROLLBACK;", nullptr, nullptr, nullptr); return fail(sqlite3_errmsg(db.db)); }
+
+        SnapshotTableEntry t;
+        memset(&t, 0, sizeof t);
+        snprintf(t.name, sizeof t.name, "%s", spec.table);
+        t.rows = builders.empty() ? 0 : builders[0]->rows();
+        t.column_count = (uint32_t)builders.size();
+        Stmt maxrow = db.prepare(string("SELECT MAX(rowid) FROM ") + spec.table + ";");
+        if (maxrow && sqlite3_step(maxrow) == SQLITE_ROW) t.max_rowid = sqlite3_column_int64(maxrow, 0);
+        uint64_t start = pos;
+        columns.emplace_back();
+        for (auto &b : builders) {
+            columns.back().emplace_back();
+            if (!b->finish(out, pos, columns.back().back())) { sqlite3_exec(db.db, "ROLLBACK;", nullptr, nullptr, nullptr); return fail("write error"); }
+        }
+        tables.push_back(t);
+        table << std::setw(18) << spec.table << std::setw(12) << t.rows << std::setw(10) << t.column_count << (pos - start) << "\n";
+    }
+    sqlite3_exec(db.db, "COMMIT;", nullptr, nullptr, nullptr);
+    db.msg() << table.str();
+
+    if (!SnapshotColumnBuilder::align(out, pos)) return fail("write error");
+    uint64_t dir = pos, col_pos = dir + tables.size() * sizeof(SnapshotTableEntry);
+    for (size_t i = 0; i < tables.size(); ++i) {
+        tables[i].columns_offset = col_pos;
+        col_pos += columns[i].size() * sizeof(SnapshotColumnEntry);
+    }
+    if (!SnapshotColumnBuilder::write(out, pos, tables.data(), tables.size() * sizeof(SnapshotTableEntry))) return fail("write error");
+    for (auto &c : columns) if (!SnapshotColumnBuilder::write(out, pos, c.data(), c.size() * sizeof(SnapshotColumnEntry))) return fail("write error");
+
+    memcpy(h.magic, SNAPSHOT_MAGIC, sizeof h.magic);
+    h.version = SNAPSHOT_FORMAT_VERSION;
+    h.table_count = (uint32_t)tables.size();
+    h.directory_offset = dir;
+    h.file_size = pos;
+    h.created = (int64_t)time(nullptr);
+    h.schema_version = db.schema_version();
+    h.zone_rows = SNAPSHOT_ZONE_ROWS;
+    if (fseek(out, 0, SEEK_SET) != 0 || fwrite(&h, 1, sizeof h, out) != sizeof h) return fail("write error");
+    if (fclose(out) != 0) { remove(tmp.c_str()); db.msg() << "Snapshot failed: write error\n"; return 1; }
+    if (rename(tmp.c_str(), path.c_str()) != 0) { remove(tmp.c_str()); db.msg() << "Can't rename " << tmp << " to " << path << "\n"; return 1; }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    std::ostringstream line;
+    line << "Wrote " << path << " (" << pos << " bytes, " << tables.size() << " tables) in " << std::fixed << std::setprecision(2) << secs << " s\n";
+    db.msg() << line.str();
+    return 0;
+}
+
+// Read side: the whole file is mapped once, checked, and columns are handed out as
+// pointers into the mapping.
+class ColumnSnapshot {
+public:
+    struct Column {
+        string name;
+        SnapshotType type;
+        uint32_t flags;
+        const void* data;
+        const void* zones;
+        size_t zone_count;
+        const uint32_t* dict_offsets;
+        const char* dict_bytes;
+        size_t dict_count;
+
+        template <typename T> const T* values() const { return static_cast<const T*>(data); }
+        bool sorted() const { return flags & SNAPSHOT_SORTED; }
+        std::string_view dict_value(uint32_t code) const {
+            if (code >= dict_count) return {};
+            return std::string_view(dict_bytes + dict_offsets[code], dict_offsets[code + 1] - dict_offsets[code]);
+        }
+    };
+
+    struct Table {
+        string name;
+        size_t rows;
+        sqlite3_int64 max_rowid;
+        vector<Column> columns;
+
+        const Column* column(const string &name) const {
+            for (auto &c : columns) if (c.name == name) return &c;
+            return nullptr;
+        }
+    };
+
+    bool open(const string &path, string &err) {
+        path_ = path;
+        if (!file_.open(path)) { err = "can't open " + path; return false; }
+        if (file_.size < sizeof(SnapshotHeader)) { err = path + " is not a snapshot"; return false; }
+        memcpy(&header_, file_.data, sizeof header_);
+        if (memcmp(header_.magic, SNAPSHOT_MAGIC, sizeof header_.magic) != 0) { err = path + " is not a snapshot"; return false; }
+        if (header_.version != SNAPSHOT_FORMAT_VERSION) {
+            err = path + " has snapshot format " + std::to_string(header_.version) + "; this aims_cli reads " + std::to_string(SNAPSHOT_FORMAT_VERSION);
+            return false;
+        }
+        if (header_.file_size != file_.size || header_.zone_rows == 0) { err = path + " is truncated or damaged"; return false; }
+        // exceedance_mask_range() starts every zone block with aligned 4-row loads
+        if (header_.zone_rows % 4 != 0) { err = path + " has zone maps every " + std::to_string(header_.zone_rows) + " rows, not a multiple of 4"; return false; }
+        const SnapshotTableEntry* te = (const SnapshotTableEntry*)section(header_.directory_offset, header_.table_count * sizeof(SnapshotTableEntry));
+        if (!te) { err = path + " is truncated or damaged"; return false; }
+        for (uint32_t i = 0; i < header_.table_count; ++i) {
+            Table t;
+            t.name = string(te[i].name, strnlen(te[i].name, sizeof te[i].name));
+            t.rows = (size_t)te[i].rows;
+            t.max_rowid = te[i].max_rowid;
+            const SnapshotColumnEntry* ce = (const SnapshotColumnEntry*)section(te[i].columns_offset, te[i].column_count * sizeof(SnapshotColumnEntry));
+            if (!ce) { err = path + ": bad directory for " + t.name; return false; }
+            for (uint32_t c = 0; c < te[i].column_count; ++c) {
+                Column col;
+                if (!load_column(ce[c], t.rows, col)) { err = path + ": bad column " + t.name + "." + string(ce[c].name, strnlen(ce[c].name, sizeof ce[c].name)); return false; }
+                t.columns.push_back(col);
+            }
+            tables_.push_back(std::move(t));
+        }
+        return true;
+    }
+
+    const Table* table(const string &name) const {
+        for (auto &t : tables_) if (t.name == name) return &t;
+        return nullptr;
+    }
+
+    // Column `table.name` of the given encoding, or nullptr with err set.
+    const Column* column(const string &table_name, const string &name, SnapshotType type, string &err) const {
+        const Table* t = table(table_name);
+        const Column* c = t ? t->column(name) : nullptr;
+        if (!c) { err = path_ + " has no column " + table_name + "." + name; return nullptr; }
+        if (c->type != type) { err = path_ + ": " + table_name + "." + name + " is " + snapshot_type_name(c->type) + ", expected " + snapshot_type_name(type); return nullptr; }
+        return c;
+    }
+
+    const vector<Table> &tables() const { return tables_; }
+    const SnapshotHeader &header() const { return header_; }
+    const string &path() const { return path_; }
+    size_t bytes() const { return file_.size; }
+
+private:
+    // Pointer to [offset, offset + n) if it lies inside the file and is aligned.
+    const void* section(uint64_t offset, uint64_t n) const {
+        if (offset % 8 != 0 || offset > file_.size || n > file_.size - offset) return nullptr;
+        return file_.data + offset;
+    }
+
+    bool load_column(const SnapshotColumnEntry &e, size_t rows, Column &c) const {
+        c.name = string(e.name, strnlen(e.name, sizeof e.name));
+        c.type = (SnapshotType)e.type;
+        if (e.type < (uint32_t)SnapshotType::Int64 || e.type > (uint32_t)SnapshotType::Dict) return false;
+        c.flags = e.flags;
+        if (e.data_offset % SNAPSHOT_ALIGN != 0) return false;
+        c.data = section(e.data_offset, (uint64_t)rows * snapshot_value_bytes(c.type));
+        c.zone_count = (size_t)e.zone_count;
+        c.zones = section(e.zone_offset, e.zone_count * 16);
+        if (!c.data || !c.zones || e.zone_count != (rows + header_.zone_rows - 1) / header_.zone_rows) return false;
+        c.dict_offsets = nullptr; c.dict_bytes = nullptr; c.dict_count = 0;
+        if (c.type != SnapshotType::Dict) return true;
+        c.dict_offsets = (const uint32_t*)section(e.dict_offset, (e.dict_count + 1) * 4);
+        if (!c.dict_offsets) return false;
+        c.dict_bytes = (const char*)file_.data + e.dict_offset + (e.dict_count + 1) * 4;
+        if (!section(e.dict_offset, (e.dict_count + 1) * 4 + e.dict_bytes)) return false;
+        for (uint64_t i = 0; i < e.dict_count; ++i) if (c.dict_offsets[i] > c.dict_offsets[i + 1]) return false;
+        if (c.dict_offsets[e.dict_count] != e.dict_bytes) return false;
+        c.dict_count = (size_t)e.dict_count;
+        // Codes outside the dictionary would read past it; one pass keeps dict_value safe.
+        const uint32_t* codes = c.values<uint32_t>();
+        for (size_t i = 0; i < rows; ++i) if (codes[i] >= c.dict_count && codes[i] != SNAPSHOT_NULL_CODE) return false;
+        return true;
+    }
+
+    string path_;
+    MappedFile file_;
+    SnapshotHeader header_;
+    vector<Table> tables_;
+};
+
+// fieldcrop of a snapshot, ordered by field (then end date) for the rotation and
+// planting-input passes.
+struct SnapshotPlantings {
+    size_t rows = 0;
+    const sqlite3_int64* field = nullptr;
+    const sqlite3_int64* crop = nullptr;
+    const int32_t* begin = nullptr;
+    const int32_t* end = nullptr;
+    const double* yield = nullptr;
+    const ColumnSnapshot::Column* unit = nullptr;
+
+    bool resolve(const ColumnSnapshot &s, string &err) {
+        const ColumnSnapshot::Column *f, *c, *b, *e, *y;
+        if (!(f = s.column("fieldcrop", "fldc_fieldkey", SnapshotType::Int64, err)) ||
+            !(c = s.column("fieldcrop", "fldc_cropkey", SnapshotType::Int64, err)) ||
+            !(b = s.column("fieldcrop", "fldc_begindate", SnapshotType::Day, err)) ||
+            !(e = s.column("fieldcrop", "fldc_enddate", SnapshotType::Day, err)) ||
+            !(y = s.column("fieldcrop", "fldc_yield", SnapshotType::Float64, err)) ||
+            !(unit = s.column("fieldcrop", "fldc_yield_unit", SnapshotType::Dict, err))) return false;
+        rows = s.table("fieldcrop")->rows;
+        if (rows && !f->sorted()) { err = s.path() + ": fieldcrop is not ordered by field"; return false; }
+        field = f->values<sqlite3_int64>(); crop = c->values<sqlite3_int64>();
+        begin = b->values<int32_t>(); end = e->values<int32_t>(); yield = y->values<double>();
+        return true;
+    }
+
+    // Rows of fields lo..hi.
+    std::pair<size_t, size_t> range(sqlite3_int64 lo, sqlite3_int64 hi) const {
+        return {(size_t)(std::lower_bound(field, field + rows, lo) - field), (size_t)(std::upper_bound(field, field + rows, hi) - field)};
+    }
+};
+
+// fieldmaintenance of a snapshot, ordered by field and begin date.
+struct SnapshotApplications {
+    size_t rows = 0;
+    const sqlite3_int64* field = nullptr;
+    const double* amount = nullptr;
+    const int32_t* begin = nullptr;
+    const int32_t* end = nullptr;
+    const ColumnSnapshot::Column* unit = nullptr;
+
+    bool resolve(const ColumnSnapshot &s, string &err) {
+        const ColumnSnapshot::Column *f, *a, *b, *e;
+        if (!(f = s.column("fieldmaintenance", "fldm_fieldkey", SnapshotType::Int64, err)) ||
+            !(a = s.column("fieldmaintenance", "fldm_amount", SnapshotType::Float64, err)) ||
+            !(b = s.column("fieldmaintenance", "fldm_begindate", SnapshotType::Day, err)) ||
+            !(e = s.column("fieldmaintenance", "fldm_enddate", SnapshotType::Day, err)) ||
+            !(unit = s.column("fieldmaintenance", "fldm_amount_unit", SnapshotType::Dict, err))) return false;
+        rows = s.table("fieldmaintenance")->rows;
+        if (rows && !f->sorted()) { err = s.path() + ": fieldmaintenance is not ordered by field"; return false; }
+        field = f->values<sqlite3_int64>(); amount = a->values<double>();
+        begin = b->values<int32_t>(); end = e->values<int32_t>();
+        return true;
+    }
+
+    std::pair<size_t, size_t> range(sqlite3_int64 lo, sqlite3_int64 hi) const {
+        return {(size_t)(std::lower_bound(field, field + rows, lo) - field), (size_t)(std::upper_bound(field, field + rows, hi) - field)};
+    }
+};
+
+bool SoilColumns::attach(const ColumnSnapshot &snap, string &err) {
+    const ColumnSnapshot::Column* key = snap.column("soilsample", "ss_samplekey", SnapshotType::Int64, err);
+    const ColumnSnapshot::Column* field = key ? snap.column("soilsample", "ss_fieldkey", SnapshotType::Int64, err) : nullptr;
+    const ColumnSnapshot::Column* date = field ? snap.column("soilsample", "ss_sampledate", SnapshotType::Day, err) : nullptr;
+    if (!date) return false;
+    size_t n = snap.table("soilsample")->rows;
+    const ColumnSnapshot::Column* m[METAL_COUNT];
+    const ColumnSnapshot::Column* u[NUTRIENT_COUNT];
+    for (int k = 0; k < METAL_COUNT; ++k) if (!(m[k] = snap.column("soilsample", METAL_COLUMNS[k], SnapshotType::Float64, err))) return false;
+    for (int k = 0; k < NUTRIENT_COUNT; ++k) if (!(u[k] = snap.column("soilsample", NUTRIENT_COLUMNS[k], SnapshotType::Float64, err))) return false;
+    clear();
+    samplekey = {key->values<sqlite3_int64>(), n};
+    fieldkey = {field->values<sqlite3_int64>(), n};
+    sample_day = {date->values<int32_t>(), n};
+    for (int k = 0; k < METAL_COUNT; ++k) {
+        metal[k] = {m[k]->values<double>(), n};
+        metal_zones[k] = (const SnapshotZoneF*)m[k]->zones;
+    }
+    for (int k = 0; k < NUTRIENT_COUNT; ++k) nutrient[k] = {u[k]->values<double>(), n};
+    zone_rows = snap.header().zone_rows;
+    snapshot = &snap;
+    return true;
+}
+
+// --snapshot: maps the file for this session and notes tables changed since it was taken
+// (inserts only; rewrite the snapshot after updates or deletes).
+static bool attach_snapshot(DB &db, const string &path) {
+    auto snap = std::make_shared<ColumnSnapshot>();
+    string err;
+    if (!snap->open(path, err)) { db.msg() << "Snapshot: " << err << "\n"; return false; }
+    for (auto &t : snap->tables()) {
+        Stmt stmt = db.prepare("SELECT MAX(rowid) FROM " + t.name + ";");
+        if (!stmt || sqlite3_step(stmt) != SQLITE_ROW) continue;
+        if (sqlite3_column_int64(stmt, 0) != t.max_rowid) db.msg() << "Note: " << t.name << " has rows added since snapshot " << path << " was written.\n";
+    }
+    db.snapshot = snap;
+    return true;
+}
+
+bool snapshot_info(DB &db) {
+    if (!db.snapshot) { db.msg() << "No snapshot attached; start with --snapshot <file>.\n"; return false; }
+    const ColumnSnapshot &s = *db.snapshot;
+    std::ostringstream line;
+    time_t created = (time_t)s.header().created;
+    char when[32] = "";
+    strftime(when, sizeof when, "%Y-%m-%d %H:%M:%S", localtime(&created));
+    line << s.path() << ": format " << s.header().version << ", written " << when << " from schema version "
+         << s.header().schema_version << ", " << s.bytes() << " bytes, zone maps every " << s.header().zone_rows << " rows";
+    db.out.note(line.str() + "\n");
+    RowPrinter rp(db, {"table", "column", "encoding", "sorted", "rows", "min", "max", "dictionary"});
+    if (!rp) return false;
+    for (auto &t : s.tables()) {
+        for (auto &c : t.columns) {
+            rp.set(0, t.name);
+            rp.set(1, c.name);
+            rp.set(2, string(snapshot_type_name(c.type)));
+            rp.set(3, (sqlite3_int64)c.sorted());
+            rp.set(4, (sqlite3_int64)t.rows);
+            // Whole-column range from the zone maps; NULL when every value is NULL.
+            rp.set_null(5); rp.set_null(6);
+            if (c.type == SnapshotType::Float64) {
+                double lo = std::numeric_limits<double>::infinity(), hi = -lo;
+                for (size_t z = 0; z < c.zone_count; ++z) { lo = std::min(lo, ((const SnapshotZoneF*)c.zones)[z].min); hi = std::max(hi, ((const SnapshotZoneF*)c.zones)[z].max); }
+                if (lo <= hi) { rp.set(5, lo); rp.set(6, hi); }
+            } else {
+                int64_t lo = std::numeric_limits<int64_t>::max(), hi = std::numeric_limits<int64_t>::min();
+                for (size_t z = 0; z < c.zone_count; ++z) { lo = std::min(lo, ((const SnapshotZoneI*)c.zones)[z].min); hi = std::max(hi, ((const SnapshotZoneI*)c.zones)[z].max); }
+                if (lo <= hi) {
+                    if (c.type == SnapshotType::Day) { rp.set(5, format_date((int)lo)); rp.set(6, format_date((int)hi)); }
+                    else if (c.type == SnapshotType::Dict) { rp.set(5, string(c.dict_value((uint32_t)lo))); rp.set(6, string(c.dict_value((uint32_t)hi))); }
+                    else { rp.set(5, (sqlite3_int64)lo); rp.set(6, (sqlite3_int64)hi); }
+                }
+            }
+            if (c.type == SnapshotType::Dict) rp.set(7, (sqlite3_int64)c.dict_count);
+            else rp.set_null(7);
+            rp.emit();
+        }
+    }
+    rp.end("(empty snapshot)");
+    return true;
+}
+
+// ---------- Synthetic data generator ----------
+// aims_cli <db> generate [--farmers N] [--fields N] [--samples N] [--plantings N] [--applications N] [--seed S]
+// Writes a schema-consistent database at any scale for benchmarking. Dates follow the
+// seasonal rhythm of the real data: samples cluster before spring planting and after
+// autumn harvest, plantings start in their crop's preferred season and run for the
+// crop's days-to-maturity, and maintenance is applied around planting time.
+
+struct GenerateOptions {
+    sqlite3_int64 farmers = 1000;
+    sqlite3_int64 fields = 10000;
+    sqlite3_int64 samples = 500000;
+    sqlite3_int64 plantings = 100000;
+    sqlite3_int64 applications = 200000;
+    uint64_t seed = 42;
+};
+
+int run_generate(DB &db, const GenerateOptions &o) {
+    if (sqlite3_exec(db.db, AIMS_SCHEMA_SQL, nullptr, nullptr, nullptr) != SQLITE_OK) {
+        db.msg() << "Schema error: " << sqlite3_errmsg(db.db) << "\n"; return 1;
+    }
+    {
+        Stmt stmt = db.prepare("SELECT (SELECT COUNT(*) FROM field) + (SELECT COUNT(*) FROM season);");
+        if (stmt && sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_int64(stmt, 0) > 0) {
+            db.msg() << "Refusing to generate into a database that already has data.\n"; return 1;
+        }
+    }
+    // Throwaway benchmark data: trade durability for load speed.
+    sqlite3_exec(db.db, "PRAGMA synchronous = OFF; PRAGMA journal_mode = MEMORY; PRAGMA cache_size = -262144;", nullptr, nullptr, nullptr);
+
+    std::mt19937_64 rng(o.seed);
+    auto uni = [&](double a, double b) { return std::uniform_real_distribution<double>(a, b)(rng); };
+    auto pick = [&](sqlite3_int64 a, sqlite3_int64 b) { return std::uniform_int_distribution<sqlite3_int64>(a, b)(rng); };
+    std::normal_distribution<double> gauss(0.0, 1.0);
+
+    auto t0 = std::chrono::steady_clock::now();
+    sqlite3_exec(db.db, "BEGIN;", nullptr, nullptr, nullptr);
+    sqlite3_int64 pending = 0, apps_written = 0;
+    auto tick = [&]() {
+        if (++pending >= 200000) { sqlite3_exec(db.db, "COMMIT; BEGIN;", nullptr, nullptr, nullptr); pending = 0; }
+    };
+    auto step = [&](sqlite3_stmt* s) {
+        if (sqlite3_step(s) != SQLITE_DONE) db.msg() << "Insert failed: " << sqlite3_errmsg(db.db) << "\n";
+        sqlite3_reset(s);
+        tick();
+    };
+
+    // Dimension tables: the reference seasons, textures and catalogues of the sample data.
+    static const char* SEASONS[4][3] = {
+        {"Spring", "2000-03-20", "2000-06-20"}, {"Summer", "2000-06-21", "2000-09-22"},
+        {"Autumn", "2000-09-23", "2000-12-20"}, {"Winter", "2000-12-21", "2001-03-19"}};
+    static const int SEASON_START_MONTH[4] = {3, 6, 9, 12};
+    {
+        Stmt s = db.prepare("INSERT INTO season VALUES (?, ?, ?, ?);");
+        for (int i = 0; i < 4; ++i) {
+            sqlite3_bind_int(s, 1, i + 1);
+            for (int c = 0; c < 3; ++c) sqlite3_bind_text(s, c + 2, SEASONS[i][c], -1, SQLITE_STATIC);
+            step(s);
+        }
+    }
+    struct Texture { const char* name; double sand, silt, clay; };
+    static const Texture TEXTURES[12] = {
+        {"Sand", 92, 5, 3}, {"Loamy Sand", 82, 12, 6}, {"Sandy Loam", 65, 25, 10}, {"Loam", 40, 40, 20},
+        {"Silt Loam", 20, 65, 15}, {"Silt", 8, 88, 4}, {"Sandy Clay Loam", 60, 15, 25}, {"Clay Loam", 35, 32, 33},
+        {"Silty Clay Loam", 20, 40, 40}, {"Sandy Clay", 55, 5, 40}, {"Silty Clay", 10, 45, 45}, {"Clay", 20, 20, 60}};
+    {
+        Stmt s = db.prepare("INSERT INTO soiltype VALUES (?, ?, ?, ?, ?);");
+        for (int i = 0; i < 12; ++i) {
+            sqlite3_bind_int(s, 1, i + 1);
+            sqlite3_bind_text(s, 2, TEXTURES[i].name, -1, SQLITE_STATIC);
+            sqlite3_bind_double(s, 3, TEXTURES[i].sand);
+            sqlite3_bind_double(s, 4, TEXTURES[i].silt);
+            sqlite3_bind_double(s, 5, TEXTURES[i].clay);
+            step(s);
+        }
+    }
+    struct CropSpec { const char* name; int days; int season; int soil; double ph; };
+    static const CropSpec CROPS[] = {
+        {"Almond", 365, 4, 4, 6.5}, {"Pistachio", 365, 4, 3, 7.0}, {"Tomato", 90, 2, 3, 6.2}, {"Alfalfa", 120, 1, 4, 6.8},
+        {"Rice", 150, 2, 11, 6.0}, {"Table Grape", 180, 1, 3, 6.5}, {"Walnut", 365, 4, 4, 6.5}, {"Orange", 300, 4, 3, 6.5},
+        {"Lemon", 300, 4, 3, 6.3}, {"Wheat", 120, 4, 4, 6.4}, {"Barley", 90, 4, 4, 6.5}, {"Oats", 100, 4, 4, 6.2},
+        {"Corn", 110, 2, 4, 6.2}, {"Cotton", 160, 2, 8, 6.5}, {"Lettuce", 60, 1, 3, 6.5}, {"Broccoli", 80, 3, 4, 6.5},
+        {"Cauliflower", 85, 3, 4, 6.5}, {"Carrot", 75, 3, 3, 6.3}, {"Garlic", 240, 3, 3, 6.5}, {"Onion", 110, 1, 3, 6.5}};
+    const int ncrops = (int)(sizeof(CROPS) / sizeof(CROPS[0]));
+    {
+        Stmt s = db.prepare("INSERT INTO crop VALUES (?, ?, NULL, ?, ?, ?, ?, ?, ?, ?);");
+        for (int i = 0; i < ncrops; ++i) {
+            sqlite3_bind_int(s, 1, i + 1);
+            sqlite3_bind_text(s, 2, CROPS[i].name, -1, SQLITE_STATIC);
+            sqlite3_bind_int(s, 3, CROPS[i].days);
+            sqlite3_bind_int(s, 4, CROPS[i].season);
+            sqlite3_bind_int(s, 5, CROPS[i].soil);
+            sqlite3_bind_double(s, 6, CROPS[i].ph);
+            sqlite3_bind_double(s, 7, 80 + (i * 7) % 15);
+            sqlite3_bind_int(s, 8, 400 + (i * 37) % 600);
+            sqlite3_bind_text(s, 9, "Synthetic benchmark crop", -1, SQLITE_STATIC);
+            step(s);
+        }
+    }
+    static const char* MAINT_CATEGORIES[] = {"Fertilizer", "Herbicide", "Pesticide", "Fungicide", "Top Dressing"};
+    const int nmaint = 30;
+    {
+        Stmt s = db.prepare("INSERT INTO maintenance VALUES (?, ?, ?, ?, ?);");
+        for (int i = 0; i < nmaint; ++i) {
+            string name = string(MAINT_CATEGORIES[i % 5]) + " " + std::to_string(i + 1);
+            sqlite3_bind_int(s, 1, i + 1);
+            sqlite3_bind_text(s, 2, MAINT_CATEGORIES[i % 5], -1, SQLITE_STATIC);
+            sqlite3_bind_text(s, 3, name.c_str(), -1, SQLITE_TRANSIENT);
+            sqlite3_bind_text(s, 4, "Synthetic active ingredient", -1, SQLITE_STATIC);
+            sqlite3_bind_text(s, 5, "Generated for benchmarking; apply per label.", -1, SQLITE_STATIC);
+            step(s);
+        }
+    }
+
+    static const char* FIRST[] = {"James", "Sofia", "Noah", "Olivia", "Liam", "Ava", "Mateo", "Mia", "Ethan", "Lucia", "Arjun", "Mei"};
+    static const char* LAST[] = {"Holloway", "Ramirez", "Patel", "Nguyen", "Okafor", "Schmidt", "Rossi", "Kowalski", "Tanaka", "Silva"};
+    vector<int> field_soil(o.fields + 1);
+    {
+        Stmt s = db.prepare("INSERT INTO farmer VALUES (?, ?, ?, ?);");
+        for (sqlite3_int64 f = 1; f <= o.farmers; ++f) {
+            sqlite3_bind_int64(s, 1, f);
+            sqlite3_bind_int64(s, 2, (f - 1) % std::max<sqlite3_int64>(o.fields, 1) + 1); // the farmer's first field
+            sqlite3_bind_text(s, 3, FIRST[pick(0, 11)], -1, SQLITE_STATIC);
+            sqlite3_bind_text(s, 4, LAST[pick(0, 9)], -1, SQLITE_STATIC);
+            step(s);
+        }
+        Stmt fs = db.prepare("INSERT INTO field VALUES (?, ?, ?);");
+        for (sqlite3_int64 f = 1; f <= o.fields; ++f) {
+            // every farmer gets at least one field, the rest are spread at random
+            sqlite3_int64 farmer = f <= o.farmers ? f : pick(1, o.farmers);
+            field_soil[f] = (int)pick(1, 12);
+            sqlite3_bind_int64(fs, 1, f);
+            sqlite3_bind_int64(fs, 2, farmer);
+            sqlite3_bind_int(fs, 3, field_soil[f]);
+            step(fs);
+        }
+    }
+
+    const int first_day = days_from_civil(2000, 1, 1), last_day = days_from_civil(2025, 12, 31);
+    // Sampling months: peaks in March-April (pre-planting) and September-October (post-harvest).
+    std::discrete_distribution<int> sample_month({2, 3, 9, 8, 3, 4, 3, 3, 8, 7, 3, 2});
+    {
+        Stmt s = db.prepare("INSERT INTO soilsample VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);");
+        char date[11];
+        for (sqlite3_int64 k = 1; k <= o.samples; ++k) {
+            sqlite3_int64 f = pick(1, o.fields);
+            const Texture &t = TEXTURES[field_soil[f] - 1];
+            int y = (int)pick(2000, 2025), m = sample_month(rng) + 1, d = (int)pick(1, 28);
+            format_date(days_from_civil(y, m, d), date);
+            double sand = std::max(0.0, t.sand + gauss(rng) * 0.5), silt = std::max(0.0, t.silt + gauss(rng) * 0.5);
+            double clay = std::max(0.0, 100.0 - sand - silt);
+            sqlite3_bind_int64(s, 1, k);
+            sqlite3_bind_int64(s, 2, f);
+            sqlite3_bind_text(s, 3, date, 10, SQLITE_TRANSIENT);
+            sqlite3_bind_double(s, 4, std::round(sand * 100) / 100);
+            sqlite3_bind_double(s, 5, std::round(silt * 100) / 100);
+            sqlite3_bind_double(s, 6, std::round(clay * 100) / 100);
+            sqlite3_bind_double(s, 7, std::round((6.5 + gauss(rng) * 0.4) * 100) / 100);
+            sqlite3_bind_double(s, 8, std::round(uni(10, 45) * 100) / 100);
+            sqlite3_bind_double(s, 9, std::round(uni(5, 30) * 100) / 100);
+            sqlite3_bind_double(s, 10, std::round(uni(15, 60) * 100) / 100);
+            sqlite3_bind_double(s, 11, std::round(uni(1, 6) * 100) / 100);
+            sqlite3_bind_double(s, 12, std::round(uni(5, 30) * 100) / 100);
+            // Trace metals; about 1 in 200 samples carries a contamination spike.
+            bool spike = pick(0, 199) == 0;
+            for (int c = 0; c < 8; ++c) {
+                double v = std::exp(gauss(rng) - 6.0) * (spike ? uni(500, 50000) : 1.0);
+                sqlite3_bind_double(s, 13 + c, std::round(v * 1000) / 1000);
+            }
+            if (pick(0, 3) == 0) sqlite3_bind_text(s, 21, "Routine sample; no anomalies noted.", -1, SQLITE_STATIC);
+            else sqlite3_bind_null(s, 21);
+            step(s);
+        }
+    }
+    {
+        Stmt s = db.prepare("INSERT INTO fieldcrop VALUES (?, ?, ?, ?, ?, 'kg/ha');");
+        Stmt m = db.prepare("INSERT INTO fieldmaintenance VALUES (?, ?, ?, ?, ?, ?, ?, ?);");
+        char bdate[11], edate[11];
+        sqlite3_int64 apps_left = o.applications;
+        double apps_per_planting = o.plantings > 0 ? (double)o.applications / o.plantings : 0.0;
+        // Plantings are handed out round-robin so every field gets a rotation history.
+        vector<int> next_free(o.fields + 1, first_day);
+        for (sqlite3_int64 p = 0; p < o.plantings; ++p) {
+            sqlite3_int64 f = p % o.fields + 1;
+            int c = (int)pick(0, ncrops - 1);
+            const CropSpec &cs = CROPS[c];
+            // start at the first preferred-season month after the field is free
+            CivilDate free = civil_from_days(next_free[f]);
+            int y = free.y, mo = free.m;
+            int start_month = SEASON_START_MONTH[cs.season - 1];
+            if (mo > start_month) ++y;
+            int begin = days_from_civil(y, start_month, (int)pick(1, 28));
+            if (begin > last_day) begin = first_day + (int)pick(0, 365 * 20);
+            int end = begin + cs.days + (int)(gauss(rng) * 7);
+            next_free[f] = end + (int)pick(7, 60);
+            format_date(begin, bdate);
+            format_date(end, edate);
+            sqlite3_bind_int64(s, 1, f);
+            sqlite3_bind_int(s, 2, c + 1);
+            sqlite3_bind_text(s, 3, bdate, 10, SQLITE_TRANSIENT);
+            sqlite3_bind_text(s, 4, edate, 10, SQLITE_TRANSIENT);
+            sqlite3_bind_double(s, 5, std::round(std::max(0.0, 4000 + gauss(rng) * 1500)));
+            step(s);
+
+            int napps = (int)apps_per_planting + (uni(0, 1) < apps_per_planting - (int)apps_per_planting ? 1 : 0);
+            for (int a = 0; a < napps && apps_left > 0; ++a, --apps_left) {
+                int day = begin - 10 + (int)pick(0, std::max(10, cs.days / 2));
+                format_date(day, bdate);
+                format_date(day + (int)pick(0, 2), edate);
+                sqlite3_bind_int64(m, 1, f);
+                sqlite3_bind_int(m, 2, (int)pick(1, nmaint));
+                sqlite3_bind_double(m, 3, std::round(uni(0.5, 50) * 100) / 100);
+                sqlite3_bind_text(m, 4, "kg/ha", -1, SQLITE_STATIC);
+                sqlite3_bind_double(m, 5, std::round(uni(1, 500) * 100) / 100);
+                sqlite3_bind_text(m, 6, "kg", -1, SQLITE_STATIC);
+                sqlite3_bind_text(m, 7, bdate, 10, SQLITE_TRANSIENT);
+                sqlite3_bind_text(m, 8, edate, 10, SQLITE_TRANSIENT);
+                step(m);
+                ++apps_written;
+            }
+        }
+    }
+    if (sqlite3_exec(db.db, "COMMIT;", nullptr, nullptr, nullptr) != SQLITE_OK) {
+        db.msg() << "Commit failed: " << sqlite3_errmsg(db.db) << "\n"; return 1;
+    }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    std::ostringstream line;
+    line << "Generated " << o.farmers << " farmers, " << o.fields << " fields, " << o.samples << " soil samples, "
+         << o.plantings << " plantings, " << apps_written << " maintenance applications in "
+         << std::fixed << std::setprecision(1) << secs << " s\n";
+    db.msg() << line.str();
+    // Indexes are built once over the finished tables rather than maintained row by row.
+    return migrate(db) ? 0 : 1;
+}
+
+// ---------- Benchmark harness ----------
+// aims_cli <db> bench [--iterations N] [--queries sql_script/queries.sql] [--out bench.json]
+// Times every menu operation (through the same command table as --exec) and every
+// statement of queries.sql, then writes p50/p99/max latency and throughput as JSON. p99 is
+// null below 100 iterations, where it would only be the maximum again, so that is the
+// default. The insert
+// operations run inside a savepoint that is rolled back, so the database is left as it was
+// (and their timings leave out the commit).
+
+struct BenchResult {
+    string name;
+    string kind;
+    vector<double> ms;
+    int errors = 0;
+    sqlite3_int64 rows = 0;
+};
+
+// Discards everything written to it; used to silence operation output while timing.
+struct NullBuffer : std::streambuf {
+    int overflow(int c) override { return c; }
+    std::streamsize xsputn(const char*, std::streamsize n) override { return n; }
+};
+
+int run_bench(DB &db, int iterations, const string &queries_path, const string &out_path) {
+    // Arguments for the parameterized operations come from the data itself.
+    vector<int> field_ids, crop_ids;
+    vector<string> seasons;
+    {
+        Stmt s = db.prepare("SELECT fld_fieldkey FROM field ORDER BY random() LIMIT 1000;");
+        while (s && sqlite3_step(s) == SQLITE_ROW) field_ids.push_back(sqlite3_column_int(s, 0));
+        Stmt c = db.prepare("SELECT c_cropkey FROM crop;");
+        while (c && sqlite3_step(c) == SQLITE_ROW) crop_ids.push_back(sqlite3_column_int(c, 0));
+        Stmt se = db.prepare("SELECT s_name FROM season;");
+        while (se && sqlite3_step(se) == SQLITE_ROW) seasons.push_back((const char*)sqlite3_column_text(se, 0));
+    }
+    if (field_ids.empty() || crop_ids.empty() || seasons.empty()) { cout << "Benchmark needs fields, crops and seasons.\n"; return 1; }
+
+    std::mt19937 rng(7);
+    auto field = [&]() { return std::to_string(field_ids[rng() % field_ids.size()]); };
+    struct BenchOp { const char* name; std::function<string()> line; };
+    vector<BenchOp> ops = {
+        {"fields", [] { return string("fields"); }},
+        {"crops-by-season", [&] { return "crops-by-season " + seasons[rng() % seasons.size()]; }},
+        {"avg-yield", [] { return string("avg-yield"); }},
+        {"latest-sample", [&] { return "latest-sample " + field(); }},
+        {"thresholds", [] { return string("thresholds 100 0.48 10"); }},
+        {"no-recent-maintenance", [] { return string("no-recent-maintenance"); }},
+        {"avg-npk", [] { return string("avg-npk"); }},
+        {"yield-per-season", [] { return string("yield-per-season"); }},
+        {"rotation", [&] { return "rotation " + field(); }},
+        {"insert-fieldcrop", [&] {
+            return "insert-fieldcrop " + field() + " " + std::to_string(crop_ids[rng() % crop_ids.size()]) + " 2030-03-01 2030-09-01 4200 kg/ha";
+        }},
+        {"insert-soilsample", [&] {
+            return "insert-soilsample " + field() + " 2030-03-01 40 40 20 6.5 20 10 150 3 15 12 0.1 15 20 30 0.3 5 50 -";
+        }},
+    };
+
+    vector<BenchResult> results;
+    NullBuffer null_buf;
+    bool writes_failed = false;
+    auto timed = [&](const std::function<bool()> &fn, BenchResult &r) {
+        for (int i = -1; i < iterations; ++i) { // iteration -1 warms caches and is not recorded
+            auto t0 = std::chrono::steady_clock::now();
+            bool ok = fn();
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+            if (i < 0) continue;
+            r.ms.push_back(ms);
+            if (!ok) ++r.errors;
+        }
+    };
+
+    for (auto &op : ops) {
+        BenchResult r; r.name = op.name; r.kind = "operation";
+        bool write = is_write_command(op.name);
+        if (write && sqlite3_exec(db.db, "SAVEPOINT bench;", nullptr, nullptr, nullptr) != SQLITE_OK) {
+            cout << "Savepoint failed: " << sqlite3_errmsg(db.db) << "\n"; return 1;
+        }
+        std::streambuf* saved = cout.rdbuf(&null_buf);
+        timed([&] { return run_command(db, op.line()); }, r);
+        cout.rdbuf(saved);
+        if (write) sqlite3_exec(db.db, "ROLLBACK TO bench; RELEASE bench;", nullptr, nullptr, nullptr);
+        // A failing insert only times its usage message, so its numbers would mean nothing.
+        if (write && r.errors > 0) {
+            std::cerr << "bench: " << r.name << " failed " << r.errors << " of " << r.ms.size() << " iterations: " << op.line() << "\n";
+            writes_failed = true;
+        }
+        results.push_back(r);
+        std::cerr << "bench: " << r.name << "\n";
+    }
+
+    vector<ScriptItem> items;
+    if (!queries_path.empty() && load_sql_script(queries_path, items)) {
+        int n = 0;
+        for (auto &it : items) {
+            if (it.is_print) continue;
+            BenchResult r;
+            r.name = it.title.empty() ? "statement " + std::to_string(n + 1) : it.title;
+            r.kind = "query";
+            ++n;
+            timed([&] {
+                Stmt s = db.prepare(it.text);
+                if (!s) return false;
+                sqlite3_int64 rows = 0;
+                int rc;
+                while ((rc = sqlite3_step(s)) == SQLITE_ROW) ++rows;
+                r.rows = rows;
+                return rc == SQLITE_DONE;
+            }, r);
+            results.push_back(r);
+            std::cerr << "bench: " << r.name << "\n";
+        }
+    }
+
+    std::ostringstream js;
+    js << std::setprecision(6) << "{\n  \"database\": \"" << json_escape(sqlite3_db_filename(db.db, "main")) << "\",\n"
+       << "  \"sqlite_version\": \"" << sqlite3_libversion() << "\",\n"
+       << "  \"iterations\": " << iterations << ",\n  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        auto &r = results[i];
+        double total = 0; for (double m : r.ms) total += m;
+        double mean = r.ms.empty() ? 0 : total / r.ms.size();
+        js << "    {\"name\": \"" << json_escape(r.name) << "\", \"kind\": \"" << r.kind << "\""
+           << ", \"iterations\": " << r.ms.size() << ", \"errors\": " << r.errors;
+        if (r.kind == "query") js << ", \"rows\": " << r.rows;
+        js << ", \"p50_ms\": " << percentile_of(r.ms, 0.50) << ", \"p99_ms\": ";
+        if (r.ms.size() >= 100) js << percentile_of(r.ms, 0.99); else js << "null";
+        js << ", \"max_ms\": " << percentile_of(r.ms, 1.0)
+           << ", \"mean_ms\": " << mean << ", \"ops_per_sec\": " << (total > 0 ? r.ms.size() * 1000.0 / total : 0.0)
+           << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    js << "  ]\n}\n";
+
+    if (out_path.empty() || out_path == "-") {
+        cout << js.str();
+    } else {
+        std::ofstream out(out_path);
+        if (!out) { cout << "Can't write " << out_path << "\n"; return 1; }
+        out << js.str();
+        cout << "Wrote " << out_path << "\n";
+    }
+    return writes_failed ? 1 : 0;
+}
+
+// ---------- Parallel reports ----------
+// aims_cli <db> report [--script sql_script/queries.sql] [--jobs N] [--out-dir DIR] [--format F]
+// Runs every statement of a report script at once on a pool of read-only connections.
+// The database is switched to WAL first, so each reader works on its own committed
+// snapshot and inserts from another connection (menu, --exec, ingest) carry on meanwhile.
+// Each report is buffered and printed in script order as soon as it and every report
+// before it are done, so stdout matches `--exec "script ..."`; with --out-dir every
+// report is written to its own file instead.
+
+struct ReportJob {
+    string heading;   // .print lines before the statement
+    string title;
+    string sql;
+    string output;
+    bool ok = false;
+    sqlite3_int64 rows = 0;
+    double seconds = 0.0;
+};
+
+// Read-only connections shared by worker threads; acquire() blocks until one is free.
+class ReadPool {
+public:
+    bool open(const string &path, size_t size) {
+        for (size_t i = 0; i < size; ++i) {
+            auto conn = std::make_unique<DB>();
+            if (!conn->open_readonly(path)) return false;
+            free_.push_back(conn.get());
+            conns_.push_back(std::move(conn));
+        }
+        return true;
+    }
+
+    DB* acquire() {
+        std::unique_lock<std::mutex> lock(mu_);
+        cv_.wait(lock, [&] { return !free_.empty(); });
+        DB* conn = free_.back();
+        free_.pop_back();
+        return conn;
+    }
+
+    void release(DB* conn) {
+        {
+            std::lock_guard<std::mutex> lock(mu_);
+            free_.push_back(conn);
+        }
+        cv_.notify_one();
+    }
+
+    size_t size() const { return conns_.size(); }
+
+private:
+    vector<std::unique_ptr<DB>> conns_;
+    vector<DB*> free_;
+    std::mutex mu_;
+    std::condition_variable cv_;
+};
+
+// Whole-table passes (rotations, recommendations) split the key range lo..hi into chunks
+// and hand them out in key order to `jobs` threads, each on its own read-only connection;
+// with `shared` the threads read something other than sqlite (a snapshot) and are all
+// handed db. With one job, a single key, an in-memory database or a pool that won't open,
+// every chunk runs on db on the calling thread. More chunks than threads, so a dense key
+// range doesn't leave one thread behind; max_keys caps a chunk for callers that hold its
+// results.
+class KeyChunks {
+public:
+    // scan(conn, c, a, b): chunk c is keys a..b, never empty. False fails the pass.
+    using Scan = std::function<bool(DB &conn, size_t chunk, sqlite3_int64 a, sqlite3_int64 b)>;
+
+    KeyChunks(DB &db, sqlite3_int64 lo, sqlite3_int64 hi, int jobs, sqlite3_int64 max_keys = 0, bool shared = false)
+        : db_(db), lo_(lo), hi_(hi), shared_(shared) {
+        const char* path = sqlite3_db_filename(db.db, "main");
+        path_ = path ? path : "";
+        workers_ = lo < hi && (shared || !path_.empty()) ? (size_t)std::max(1, jobs) : 1;
+        chunks_ = workers_ == 1 ? 1 : workers_ * 8;
+        if (max_keys > 0 && hi > lo) chunks_ = std::max(chunks_, (size_t)((hi - lo) / max_keys + 1));
+        width_ = hi < lo ? 1 : (hi - lo) / (sqlite3_int64)chunks_ + 1;
+    }
+
+    size_t count() const { return chunks_; }
+    size_t workers() const { return workers_; }
+
+    // Runs scan over every chunk; done(c), if set, runs on the calling thread for each chunk
+    // in key order, as soon as it and every chunk before it are scanned.
+    bool run(const Scan &scan, const std::function<void(size_t)> &done = nullptr) {
+        ReadPool pool;
+        if (!shared_ && workers_ > 1 && !pool.open(path_, workers_)) workers_ = 1;
+        std::atomic<size_t> next{0};
+        std::atomic<bool> ok{true};
+        vector<uint8_t> finished(chunks_, 0);
+        std::mutex mu;
+        std::condition_variable cv;
+        auto scan_chunk = [&](DB &conn, size_t c) {
+            sqlite3_int64 a = lo_ + (sqlite3_int64)c * width_, b = std::min(hi_, a + width_ - 1);
+            if (a <= b && ok && !scan(conn, c, a, b)) ok = false;
+        };
+        if (workers_ == 1) {
+            for (size_t c = 0; c < chunks_; ++c) {
+                scan_chunk(db_, c);
+                if (done) done(c);
+            }
+            return ok;
+        }
+        vector<std::thread> threads;
+        for (size_t w = 0; w < workers_; ++w) {
+            threads.emplace_back([&] {
+                DB* conn = shared_ ? &db_ : pool.acquire();
+                for (size_t c; (c = next++) < chunks_;) {
+                    scan_chunk(*conn, c);
+                    { std::lock_guard<std::mutex> lock(mu); finished[c] = 1; }
+                    cv.notify_one();
+                }
+                if (!shared_) pool.release(conn);
+            });
+        }
+        for (size_t c = 0; done && c < chunks_; ++c) {
+            { std::unique_lock<std::mutex> lock(mu); cv.wait(lock, [&] { return finished[c] != 0; }); }
+            done(c);
+        }
+        for (auto &t : threads) t.join();
+        return ok;
+    }
+
+private:
+    DB &db_;
+    string path_;
+    sqlite3_int64 lo_, hi_, width_;
+    bool shared_;
+    size_t workers_, chunks_;
+};
+
+// One statement per job; leading .print lines become its heading, trailing ones the trailer.
+static vector<ReportJob> report_jobs(const vector<ScriptItem> &items, string &trailer) {
+    vector<ReportJob> jobs;
+    string heading;
+    for (auto &it : items) {
+        if (it.is_print) { heading += it.text + "\n"; continue; }
+        ReportJob j;
+        j.heading = heading;
+        j.title = it.title;
+        j.sql = it.text;
+        jobs.push_back(std::move(j));
+        heading.clear();
+    }
+    trailer = heading;
+    return jobs;
+}
+
+// Runs on a worker thread: everything, errors included, goes to j.output, never to cout.
+static void run_report_job(DB &conn, OutputFormat format, ReportJob &j) {
+    auto t0 = std::chrono::steady_clock::now();
+    conn.out.set_format(format);
+    conn.out.set_target(&j.output);
+    conn.out.note(j.heading);
+    {
+        Stmt stmt = conn.prepare(j.sql);
+        if (stmt) {
+            conn.out.begin(stmt);
+            int rc;
+            while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) conn.out.row(stmt);
+            j.rows = conn.out.end();
+            j.ok = rc == SQLITE_DONE;
+        }
+        if (!j.ok) j.output += string(stmt ? "Query error: " : "Query prepare error: ") + sqlite3_errmsg(conn.db) + "\n";
+    }
+    conn.out.set_target((std::streambuf*)nullptr);
+    j.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+static const char* report_extension(OutputFormat f) {
+    switch (f) {
+        case OutputFormat::Csv: return "csv";
+        case OutputFormat::Tsv: return "tsv";
+        case OutputFormat::Ndjson: return "ndjson";
+        case OutputFormat::Json: return "json";
+        case OutputFormat::Binary: return "bin";
+        default: return "txt";
+    }
+}
+
+int run_report(DB &db, const string &script, int jobs_wanted, const string &out_dir, OutputFormat format) {
+    vector<ScriptItem> items;
+    if (!load_sql_script(script, items)) return 1;
+    string trailer;
+    vector<ReportJob> jobs = report_jobs(items, trailer);
+    if (jobs.empty()) { cout << "No statements in " << script << "\n"; return 1; }
+
+    // journal_mode is stored in the database file, so WAL stays on for later writers too.
+    string journal;
+    {
+        Stmt stmt = db.prepare("PRAGMA journal_mode = WAL;");
+        if (stmt && sqlite3_step(stmt) == SQLITE_ROW) journal = (const char*)sqlite3_column_text(stmt, 0);
+    }
+    if (journal != "wal") cout << "Note: journal mode is '" << journal << "', not WAL; reports will block writers.\n";
+
+    if (!out_dir.empty()) {
+        std::error_code ec;
+        std::filesystem::create_directories(out_dir, ec);
+        if (ec) { cout << "Can't create " << out_dir << ": " << ec.message() << "\n"; return 1; }
+    }
+
+    size_t workers = std::min(jobs.size(), (size_t)std::max(1, jobs_wanted));
+    ReadPool pool;
+    if (!pool.open(sqlite3_db_filename(db.db, "main"), workers)) return 1;
+
+    auto t0 = std::chrono::steady_clock::now();
+    std::mutex done_mu;
+    std::condition_variable done_cv;
+    vector<char> done(jobs.size(), 0);
+    std::atomic<size_t> next{0};
+    vector<std::thread> threads;
+    for (size_t w = 0; w < workers; ++w) {
+        threads.emplace_back([&] {
+            for (size_t i; (i = next++) < jobs.size();) {
+                DB* conn = pool.acquire();
+                run_report_job(*conn, format, jobs[i]);
+                pool.release(conn);
+                {
+                    std::lock_guard<std::mutex> lock(done_mu);
+                    done[i] = 1;
+                }
+                done_cv.notify_all();
+            }
+        });
+    }
+
+    int failed = 0;
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        {
+            std::unique_lock<std::mutex> lock(done_mu);
+            done_cv.wait(lock, [&] { return done[i] != 0; });
+        }
+        ReportJob &j = jobs[i];
+        if (!j.ok) ++failed;
+        if (out_dir.empty()) {
+            cout.write(j.output.data(), (std::streamsize)j.output.size());
+            cout.flush();
+        } else {
+            string name = (i + 1 < 10 ? "report_0" : "report_") + std::to_string(i + 1) + "." + report_extension(format);
+            std::ofstream out(std::filesystem::path(out_dir) / name, std::ios::binary);
+            out.write(j.output.data(), (std::streamsize)j.output.size());
+            if (!out) { cout << "Can't write " << out_dir << "/" << name << "\n"; ++failed; }
+        }
+        string().swap(j.output);
+    }
+    for (auto &t : threads) t.join();
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    if (out_dir.empty() && format == OutputFormat::Table) cout << trailer;
+
+    // Timings go to stderr when stdout carries the reports.
+    std::ostringstream log;
+    double busy = 0;
+    log << std::left << std::setw(8) << "report" << std::setw(10) << "rows" << std::setw(10) << "seconds" << "title\n";
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        auto &j = jobs[i];
+        busy += j.seconds;
+        log << std::left << std::setw(8) << i + 1 << std::setw(10) << (j.ok ? std::to_string(j.rows) : "FAILED")
+            << std::setw(10) << std::fixed << std::setprecision(3) << j.seconds << j.title << "\n";
+    }
+    log << jobs.size() << " reports on " << workers << " connection(s): " << std::fixed << std::setprecision(3) << wall
+        << " s wall, " << busy << " s of queries\n";
+    (out_dir.empty() ? std::cerr : cout) << log.str();
+    return failed ? 1 : 0;
+}
+
+// ---------- Rotation analysis ----------
+// Whole-farm rotation figures from one ordered pass over fieldcrop instead of the per-field
+// `rotation` query: each field's harvests in end-date order give its rotation sequence, every
+// consecutive pair one crop-to-crop transition (with the yield before and after), and every
+// stretch of the same crop a monocropping run. idx_fieldcrop_field_end covers the scan in
+// that order, so nothing is sorted. The key range of fieldcrop is cut into chunks that
+// worker threads take in turn, each on its own read-only connection; a field never spans
+// two chunks, so partial results just add up.
+//
+//   aims_cli <db> rotations [--jobs N] [--min-run N] [--sequences] [--format F]
+//   rotation-matrix             transitions between crops with yield change (batch/serve)
+//   monocrop-runs <min_run>     runs of at least min_run harvests of the same crop
+
+struct RotationOptions {
+    int jobs = (int)std::max(1u, std::thread::hardware_concurrency());
+    int min_run = 3;
+    bool sequences = false;
+};
+
+struct TransitionStats {
+    sqlite3_int64 count = 0;
+    sqlite3_int64 fields = 0;    // fields where it happens at least once
+    double from_yield = 0, to_yield = 0;
+};
+
+struct MonocropRun {
+    sqlite3_int64 field, crop;
+    int harvests;
+    string first, last;   // end dates
+};
+
+struct RotationResult {
+    std::map<std::pair<sqlite3_int64, sqlite3_int64>, TransitionStats> transitions;
+    vector<MonocropRun> runs;
+    vector<std::pair<sqlite3_int64, vector<sqlite3_int64>>> sequences;
+    sqlite3_int64 fields = 0, plantings = 0;
+
+    void merge(RotationResult &&o) {
+        for (auto &t : o.transitions) {
+            TransitionStats &s = transitions[t.first];
+            s.count += t.second.count;
+            s.fields += t.second.fields;
+            s.from_yield += t.second.from_yield;
+            s.to_yield += t.second.to_yield;
+        }
+        runs.insert(runs.end(), std::make_move_iterator(o.runs.begin()), std::make_move_iterator(o.runs.end()));
+        sequences.insert(sequences.end(), std::make_move_iterator(o.sequences.begin()), std::make_move_iterator(o.sequences.end()));
+        fields += o.fields;
+        plantings += o.plantings;
+    }
+};
+
+struct Harvest {
+    sqlite3_int64 crop;
+    string enddate;
+    double yield;
+};
+
+// Adds one field's harvests, already in end-date order.
+static void add_field_rotation(sqlite3_int64 field, const vector<Harvest> &h, const RotationOptions &o, RotationResult &r) {
+    ++r.fields;
+    r.plantings += (sqlite3_int64)h.size();
+    vector<std::pair<sqlite3_int64, sqlite3_int64>> seen;
+    for (size_t i = 1; i < h.size(); ++i) {
+        auto key = std::make_pair(h[i - 1].crop, h[i].crop);
+        TransitionStats &s = r.transitions[key];
+        ++s.count;
+        s.from_yield += h[i - 1].yield;
+        s.to_yield += h[i].yield;
+        if (std::find(seen.begin(), seen.end(), key) == seen.end()) { seen.push_back(key); ++s.fields; }
+    }
+    for (size_t i = 0, j; i < h.size(); i = j) {
+        for (j = i + 1; j < h.size() && h[j].crop == h[i].crop; ++j) {}
+        if ((int)(j - i) >= o.min_run) r.runs.push_back({field, h[i].crop, (int)(j - i), h[i].enddate, h[j - 1].enddate});
+    }
+    if (o.sequences) {
+        vector<sqlite3_int64> crops;
+        for (auto &p : h) crops.push_back(p.crop);
+        r.sequences.emplace_back(field, std::move(crops));
+    }
+}
+
+// Scans fields lo..hi on one connection.
+static bool scan_rotations(DB &conn, sqlite3_int64 lo, sqlite3_int64 hi, const RotationOptions &o, RotationResult &r) {
+    vector<Harvest> harvests;
+    sqlite3_int64 field = 0;
+    bool ok = ROTATION_SCAN_SQL.each(conn, lo, hi, [&](const HarvestRow &h) {
+        if (h.field != field && !harvests.empty()) { add_field_rotation(field, harvests, o, r); harvests.clear(); }
+        field = h.field;
+        harvests.push_back({h.crop, string(h.enddate), h.yield});
+    });
+    if (!harvests.empty()) add_field_rotation(field, harvests, o, r);
+    return ok;
+}
+
+// The same over a snapshot's fieldcrop, which is stored in that order.
+static void scan_rotations(const SnapshotPlantings &sp, sqlite3_int64 lo, sqlite3_int64 hi, const RotationOptions &o, RotationResult &r) {
+    vector<Harvest> harvests;
+    auto rows = sp.range(lo, hi);
+    for (size_t i = rows.first; i < rows.second;) {
+        sqlite3_int64 field = sp.field[i];
+        harvests.clear();
+        for (; i < rows.second && sp.field[i] == field; ++i) {
+            harvests.push_back({sp.crop[i], format_date(sp.end[i]), std::isnan(sp.yield[i]) ? 0.0 : sp.yield[i]});
+        }
+        add_field_rotation(field, harvests, o, r);
+    }
+}
+
+// Runs the pass, in parallel when the database is a file or a snapshot is attached;
+// prints timing to `log`.
+static bool analyze_rotations(DB &db, const RotationOptions &o, RotationResult &result, std::ostream &log) {
+    auto t0 = std::chrono::steady_clock::now();
+    sqlite3_int64 lo = 0, hi = -1;
+    SnapshotPlantings sp;
+    bool snap = db.snapshot != nullptr;
+    if (snap) {
+        string err;
+        if (!sp.resolve(*db.snapshot, err)) { db.msg() << "Snapshot: " << err << "\n"; return false; }
+        if (sp.rows) { lo = sp.field[0]; hi = sp.field[sp.rows - 1]; }
+    } else {
+        Stmt stmt = db.prepare("SELECT MIN(fldc_fieldkey), MAX(fldc_fieldkey) FROM fieldcrop;");
+        if (!stmt || sqlite3_step(stmt) != SQLITE_ROW) { db.msg() << "Query error: " << sqlite3_errmsg(db.db) << "\n"; return false; }
+        if (sqlite3_column_type(stmt, 0) != SQLITE_NULL) { lo = sqlite3_column_int64(stmt, 0); hi = sqlite3_column_int64(stmt, 1); }
+    }
+    KeyChunks chunks(db, lo, hi, o.jobs, 0, snap);
+    vector<RotationResult> partial(chunks.count());
+    bool ok = chunks.run([&](DB &conn, size_t c, sqlite3_int64 a, sqlite3_int64 b) {
+        if (snap) { scan_rotations(sp, a, b, o, partial[c]); return true; }
+        return scan_rotations(conn, a, b, o, partial[c]);
+    }, [&](size_t c) { result.merge(std::move(partial[c])); });
+    if (!ok) { db.msg() << "Rotation scan failed.\n"; return false; }
+    size_t workers = chunks.workers();
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    std::ostringstream line;
+    line << result.plantings << " plantings on " << result.fields << " fields in " << std::fixed << std::setprecision(3) << secs
+         << " s on " << workers << (snap ? " thread(s) from " + db.snapshot->path() : string(" connection(s)")) << ": "
+         << result.transitions.size() << " distinct transitions, "
+         << result.runs.size() << " monocropping runs of " << o.min_run << "+ harvests\n";
+    log << line.str();
+    return true;
+}
+
+static std::map<sqlite3_int64, string> crop_names(DB &db) {
+    std::map<sqlite3_int64, string> names;
+    string err;
+    const ColumnSnapshot::Column *key = nullptr, *name = nullptr;
+    if (db.snapshot && (key = db.snapshot->column("crop", "c_cropkey", SnapshotType::Int64, err)) &&
+        (name = db.snapshot->column("crop", "c_name", SnapshotType::Dict, err))) {
+        for (size_t i = 0, n = db.snapshot->table("crop")->rows; i < n; ++i) {
+            names[key->values<sqlite3_int64>()[i]] = string(name->dict_value(name->values<uint32_t>()[i]));
+        }
+        return names;
+    }
+    Stmt stmt = db.prepare("SELECT c_cropkey, c_name FROM crop;");
+    while (stmt && sqlite3_step(stmt) == SQLITE_ROW) names[sqlite3_column_int64(stmt, 0)] = (const char*)sqlite3_column_text(stmt, 1);
+    return names;
+}
+
+static void print_transition_matrix(DB &db, const RotationResult &r, const std::map<sqlite3_int64, string> &names) {
+    vector<const std::pair<const std::pair<sqlite3_int64, sqlite3_int64>, TransitionStats>*> rows;
+    for (auto &t : r.transitions) rows.push_back(&t);
+    std::stable_sort(rows.begin(), rows.end(), [](auto a, auto b) { return a->second.count > b->second.count; });
+    RowPrinter rp(db, {"from_cropkey", "from_crop", "to_cropkey", "to_crop", "transitions", "fields", "avg_from_yield", "avg_to_yield", "avg_yield_change", "yield_change_pct"});
+    if (!rp) return;
+    auto name = [&](sqlite3_int64 k) { auto it = names.find(k); return it == names.end() ? string() : it->second; };
+    for (auto t : rows) {
+        const TransitionStats &s = t->second;
+        double from = s.from_yield / s.count, to = s.to_yield / s.count;
+        rp.set(0, t->first.first);
+        rp.set(1, name(t->first.first));
+        rp.set(2, t->first.second);
+        rp.set(3, name(t->first.second));
+        rp.set(4, s.count);
+        rp.set(5, s.fields);
+        rp.set(6, std::round(from * 100) / 100);
+        rp.set(7, std::round(to * 100) / 100);
+        rp.set(8, std::round((to - from) * 100) / 100);
+        if (s.from_yield != 0) rp.set(9, std::round(1000 * (s.to_yield - s.from_yield) / s.from_yield) / 10);
+        else rp.set_null(9);
+        rp.emit();
+    }
+    rp.end("(no field has two harvests)");
+}
+
+static void print_monocrop_runs(DB &db, const RotationResult &r, const std::map<sqlite3_int64, string> &names) {
+    RowPrinter rp(db, {"fieldkey", "cropkey", "crop", "harvests", "first_harvest", "last_harvest"});
+    if (!rp) return;
+    for (auto &run : r.runs) {
+        auto it = names.find(run.crop);
+        rp.set(0, run.field);
+        rp.set(1, run.crop);
+        rp.set(2, it == names.end() ? string() : it->second);
+        rp.set(3, (sqlite3_int64)run.harvests);
+        rp.set(4, run.first);
+        rp.set(5, run.last);
+        rp.emit();
+    }
+    rp.end("(no monocropping runs)");
+}
+
+static void print_rotation_sequences(DB &db, const RotationResult &r, const std::map<sqlite3_int64, string> &names) {
+    RowPrinter rp(db, {"fieldkey", "harvests", "sequence"});
+    if (!rp) return;
+    for (auto &s : r.sequences) {
+        string seq;
+        for (auto crop : s.second) {
+            auto it = names.find(crop);
+            seq += (seq.empty() ? "" : " > ") + (it == names.end() ? std::to_string(crop) : it->second);
+        }
+        rp.set(0, s.first);
+        rp.set(1, (sqlite3_int64)s.second.size());
+        rp.set(2, seq);
+        rp.emit();
+    }
+    rp.end("(no plantings)");
+}
+
+bool rotation_matrix(DB &db) {
+    RotationOptions o;
+    o.jobs = db.scan_jobs;
+    RotationResult r;
+    if (!analyze_rotations(db, o, r, db.msg())) return false;
+    print_transition_matrix(db, r, crop_names(db));
+    return true;
+}
+
+bool monocrop_runs(DB &db, int min_run) {
+    if (min_run < 2) { db.msg() << "A run needs at least 2 harvests.\n"; return false; }
+    RotationOptions o;
+    o.jobs = db.scan_jobs;
+    o.min_run = min_run;
+    RotationResult r;
+    if (!analyze_rotations(db, o, r, db.msg())) return false;
+    print_monocrop_runs(db, r, crop_names(db));
+    return true;
+}
+
+void rotation_analysis(DB &db) {
+    cout << endl;
+    cout << "Flag monocropping runs of at least how many harvests? ";
+    int min_run; cin >> min_run; cin.ignore();
+    if (min_run < 2) { cout << "A run needs at least 2 harvests.\n"; return; }
+    RotationOptions o;
+    o.min_run = min_run;
+    RotationResult r;
+    if (!analyze_rotations(db, o, r, cout)) return;
+    auto names = crop_names(db);
+    print_transition_matrix(db, r, names);
+    cout << endl;
+    print_monocrop_runs(db, r, names);
+    promptContinue();
+}
+
+// The `rotations` mode: matrix, runs and optionally every sequence; timing on stderr.
+int run_rotations(DB &db, const RotationOptions &o) {
+    RotationResult r;
+    if (!analyze_rotations(db, o, r, std::cerr)) return 1;
+    auto names = crop_names(db);
+    db.out.note("Crop-to-crop transitions\n");
+    print_transition_matrix(db, r, names);
+    db.out.note("\nMonocropping runs (" + std::to_string(o.min_run) + "+ harvests of one crop)\n");
+    print_monocrop_runs(db, r, names);
+    if (o.sequences) {
+        db.out.note("\nRotation sequences\n");
+        print_rotation_sequences(db, r, names);
+    }
+    return 0;
+}
+
+// ---------- Planting inputs ----------
+// Attributes every maintenance application to the plantings whose [begin, end] window it
+// overlaps, rather than to the calendar year as QUERY 8 does. Both tables are read once in
+// field order and joined per field with a sweep line: plantings sorted by begin date enter
+// the active set as the sweep reaches them and leave once they have ended, so each
+// application only looks at the plantings actually around it. Cost is the sort per field
+// plus the overlaps found, not plantings x applications.
+//
+// An application spread over several plantings (intercropping, or a window crossing a
+// harvest) is shared by days of overlap; the part that falls outside every planting, and
+// applications on fallow ground, stay unattributed. Amounts are kept per amount unit.
+// Plantings with an unreadable date, or that end before they begin, are left out.
+//
+//   planting-inputs <field_id|all>   input amount and amount per yield unit for each planting
+//   on-field <field_id> <date>       plantings and applications on a field on that date
+
+struct PlantingWindow {
+    sqlite3_int64 crop;
+    string begin, end, yield_unit;
+    int b, e;   // day numbers
+    double yield;
+    std::map<string, std::pair<int, double>> inputs;   // unit -> applications, attributed amount
+};
+
+struct Application {
+    double amount;
+    string unit;
+    int b, e;
+};
+
+struct AttributionTotals {
+    sqlite3_int64 applications = 0, attributed = 0, fallow = 0, plantings = 0;
+};
+
+// Sweep over one field's plantings and its applications (already by begin date).
+static void attribute_inputs(vector<PlantingWindow> &p, const vector<Application> &apps, AttributionTotals &t) {
+    std::sort(p.begin(), p.end(), [](const PlantingWindow &a, const PlantingWindow &b) { return a.b != b.b ? a.b < b.b : a.e < b.e; });
+    vector<size_t> active;
+    vector<std::pair<size_t, int>> overlap;
+    size_t next = 0;
+    for (auto &a : apps) {
+        ++t.applications;
+        while (next < p.size() && p[next].b <= a.b) active.push_back(next++);
+        active.erase(std::remove_if(active.begin(), active.end(), [&](size_t i) { return p[i].e < a.b; }), active.end());
+        overlap.clear();
+        int total = 0;
+        for (size_t i : active) overlap.push_back({i, std::min(p[i].e, a.e) - a.b + 1});
+        for (size_t j = next; j < p.size() && p[j].b <= a.e; ++j) overlap.push_back({j, std::min(p[j].e, a.e) - p[j].b + 1});
+        for (auto &o : overlap) total += o.second;
+        if (total == 0) { ++t.fallow; continue; }
+        ++t.attributed;
+        double denom = std::max(a.e - a.b + 1, total);
+        for (auto &o : overlap) {
+            auto &in = p[o.first].inputs[a.unit];
+            ++in.first;
+            in.second += a.amount * o.second / denom;
+        }
+    }
+}
+
+// One row per planting and amount unit of one field.
+static void print_planting_inputs(RowPrinter &rp, sqlite3_int64 field, const vector<PlantingWindow> &plantings,
+                                  const std::map<sqlite3_int64, string> &names) {
+    for (auto &p : plantings) {
+        auto crop = names.find(p.crop);
+        auto row = [&](const string* unit, int applications, double amount) {
+            rp.set(0, field);
+            rp.set(1, crop == names.end() ? std::to_string(p.crop) : crop->second);
+            rp.set(2, p.begin);
+            rp.set(3, p.end);
+            rp.set(4, p.yield);
+            rp.set(5, p.yield_unit);
+            if (unit) rp.set(6, *unit); else rp.set_null(6);
+            rp.set(7, (sqlite3_int64)applications);
+            rp.set(8, std::round(amount * 1000) / 1000);
+            if (unit && p.yield != 0) rp.set(9, std::round(amount / p.yield * 1e6) / 1e6);
+            else rp.set_null(9);
+            rp.emit();
+        };
+        if (p.inputs.empty()) row(nullptr, 0, 0.0);
+        for (auto &in : p.inputs) row(&in.first, in.second.first, in.second.second);
+    }
+}
+
+static const vector<string> PLANTING_INPUT_COLUMNS = {"fieldkey", "crop", "begins", "ends", "yield", "yield_unit", "amount_unit", "applications", "amount", "amount_per_yield"};
+
+// Streams both tables for fields lo..hi and prints one row per planting and amount unit.
+static bool planting_inputs_range(DB &db, sqlite3_int64 lo, sqlite3_int64 hi, AttributionTotals &t) {
+    Stmt ps = db.prepare(PLANTING_SCAN_SQL), as = db.prepare(APPLICATION_SCAN_SQL);
+    if (!ps || !as) { db.msg() << "Prepare error: " << sqlite3_errmsg(db.db) << "\n"; return false; }
+    for (sqlite3_stmt* s : {ps.get(), as.get()}) { sqlite3_bind_int64(s, 1, lo); sqlite3_bind_int64(s, 2, hi); }
+    auto names = crop_names(db);
+    RowPrinter rp(db, PLANTING_INPUT_COLUMNS);
+    if (!rp) return false;
+
+    auto text = [](sqlite3_stmt* s, int col) { const char* t = (const char*)sqlite3_column_text(s, col); return string(t ? t : ""); };
+    int prc = sqlite3_step(ps), arc = sqlite3_step(as);
+    vector<PlantingWindow> plantings;
+    vector<Application> apps;
+    while (prc == SQLITE_ROW || arc == SQLITE_ROW) {
+        // Next field: the smaller key of the two streams.
+        sqlite3_int64 field = prc == SQLITE_ROW ? sqlite3_column_int64(ps, 0) : sqlite3_column_int64(as, 0);
+        if (arc == SQLITE_ROW) field = std::min(field, sqlite3_column_int64(as, 0));
+        plantings.clear();
+        apps.clear();
+        for (; prc == SQLITE_ROW && sqlite3_column_int64(ps, 0) == field; prc = sqlite3_step(ps)) {
+            string begin = text(ps, 2), end = text(ps, 3);
+            int b, e;
+            if (!parse_date(begin, b) || !parse_date(end, e) || e < b) continue;
+            plantings.push_back({sqlite3_column_int64(ps, 1), begin, end, text(ps, 5), b, e, sqlite3_column_double(ps, 4), {}});
+        }
+        for (; arc == SQLITE_ROW && sqlite3_column_int64(as, 0) == field; arc = sqlite3_step(as)) {
+            int b, e;
+            if (!parse_date(text(as, 3), b)) continue;
+            e = parse_date(text(as, 4), e) ? std::max(b, e) : b;
+            apps.push_back({sqlite3_column_double(as, 1), text(as, 2), b, e});
+        }
+        attribute_inputs(plantings, apps, t);
+        t.plantings += (sqlite3_int64)plantings.size();
+        print_planting_inputs(rp, field, plantings, names);
+    }
+    rp.end("(no plantings)");
+    if (prc != SQLITE_DONE || arc != SQLITE_DONE) { db.msg() << "Query error: " << sqlite3_errmsg(db.db) << "\n"; return false; }
+    return true;
+}
+
+// The same pass over an attached snapshot: both tables are already in field order, so the
+// two streams are index ranges into the mapped columns.
+static bool planting_inputs_snapshot(DB &db, sqlite3_int64 lo, sqlite3_int64 hi, AttributionTotals &t) {
+    SnapshotPlantings sp;
+    SnapshotApplications sa;
+    string err;
+    if (!sp.resolve(*db.snapshot, err) || !sa.resolve(*db.snapshot, err)) { db.msg() << "Snapshot: " << err << "\n"; return false; }
+    auto names = crop_names(db);
+    RowPrinter rp(db, PLANTING_INPUT_COLUMNS);
+    if (!rp) return false;
+
+    auto dict = [](const ColumnSnapshot::Column* c, size_t row) { return string(c->dict_value(c->values<uint32_t>()[row])); };
+    auto pr = sp.range(lo, hi), ar = sa.range(lo, hi);
+    size_t pi = pr.first, ai = ar.first;
+    vector<PlantingWindow> plantings;
+    vector<Application> apps;
+    while (pi < pr.second || ai < ar.second) {
+        sqlite3_int64 field = pi < pr.second ? sp.field[pi] : sa.field[ai];
+        if (ai < ar.second) field = std::min(field, sa.field[ai]);
+        plantings.clear();
+        apps.clear();
+        for (; pi < pr.second && sp.field[pi] == field; ++pi) {
+            if (sp.begin[pi] == NO_DAY || sp.end[pi] == NO_DAY || sp.end[pi] < sp.begin[pi]) continue;
+            plantings.push_back({sp.crop[pi], format_date(sp.begin[pi]), format_date(sp.end[pi]), dict(sp.unit, pi),
+                                 sp.begin[pi], sp.end[pi], std::isnan(sp.yield[pi]) ? 0.0 : sp.yield[pi], {}});
+        }
+        for (; ai < ar.second && sa.field[ai] == field; ++ai) {
+            int b = sa.begin[ai];
+            if (b == NO_DAY) continue;
+            int e = sa.end[ai] == NO_DAY ? b : std::max(b, (int)sa.end[ai]);
+            apps.push_back({std::isnan(sa.amount[ai]) ? 0.0 : sa.amount[ai], dict(sa.unit, ai), b, e});
+        }
+        attribute_inputs(plantings, apps, t);
+        t.plantings += (sqlite3_int64)plantings.size();
+        print_planting_inputs(rp, field, plantings, names);
+    }
+    rp.end("(no plantings)");
+    return true;
+}
+
+// field < 0: every field.
+bool planting_inputs(DB &db, int field) {
+    if (field >= 0 && !db.id_exists("field", "fld_fieldkey", field)) { db.msg() << "Field not found.\n"; return false; }
+    auto t0 = std::chrono::steady_clock::now();
+    AttributionTotals t;
+    sqlite3_int64 lo = field < 0 ? std::numeric_limits<sqlite3_int64>::min() : field;
+    sqlite3_int64 hi = field < 0 ? std::numeric_limits<sqlite3_int64>::max() : field;
+    if (!(db.snapshot ? planting_inputs_snapshot(db, lo, hi, t) : planting_inputs_range(db, lo, hi, t))) return false;
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    std::ostringstream line;
+    line << t.applications << " applications over " << t.plantings << " plantings in " << std::fixed << std::setprecision(3) << secs
+         << " s; " << t.attributed << " attributed, " << t.fallow << " outside every planting window";
+    db.msg() << line.str() << "\n";
+    return true;
+}
+
+bool on_field(DB &db, int field, const string &date) {
+    int day;
+    if (!parse_date(date, day)) { db.msg() << "Invalid date format.\n"; return false; }
+    if (!db.id_exists("field", "fld_fieldkey", field)) { db.msg() << "Field not found.\n"; return false; }
+    bool days = has_day_columns(db);
+    Stmt stmt = db.prepare(days ? ON_FIELD_DAY_SQL : ON_FIELD_SQL);
+    if (!stmt) { db.msg() << "Prepare error\n"; return false; }
+    sqlite3_bind_int(stmt, 1, field);
+    if (days) sqlite3_bind_int(stmt, 2, day);
+    else sqlite3_bind_text(stmt, 2, date.c_str(), -1, SQLITE_TRANSIENT);
+    return db.print_result(stmt, "(nothing on the field that day)");
+}
+
+void planting_inputs(DB &db) {
+    cout << endl;
+    cout << "Enter field_id: ";
+    int fid; cin >> fid; cin.ignore();
+    if (!planting_inputs(db, fid)) return;
+    cout << endl;
+    cout << "Show what was on the field on date (YYYY-MM-DD, or blank to skip): ";
+    string date; getline(cin, date);
+    if (!date.empty() && !on_field(db, fid, date)) return;
+    promptContinue();
+}
+
+// ---------- Crop recommendations ----------
+// Scores every field against every crop for the next season to start (or a named one) and
+// keeps each field's top k, where QUERY 9 and QUERY 15 only list the mismatches. Four fits,
+// each 0..1, combine into a 0..100 score:
+//
+//   pH         1 at the crop's c_ph, 0 at PH_TOLERANCE units away (latest sample)
+//   texture    1 at the crop's preferred soil type, 0 at TEXTURE_TOLERANCE points of sand/
+//              silt/clay distance (latest sample's texture, else the field's soil type)
+//   season     share of the crop's preferred season its c_daystomature growing window
+//              covers, planting at the start of the target season (same for every field)
+//   nutrients  1 - the mean relative N/P/K shortfall against the crop's targets
+//
+// A field with no sample is scored on texture and season alone, with NULL pH and deficits.
+// Targets are soil-test sufficiency levels (nitrate N 25 ppm, P 20 ppm, K 75 + 2.5 x CEC
+// ppm) scaled by the crop's demand, which is read from the keywords of its c_nutrientuse
+// note ("high N", "heavy feeder", "low P and K", "nitrogen-fixing"): the catalog has no
+// numeric uptake figures.
+//
+// Crop-level terms are worked out once. Fields are read in key order, key range chunks
+// spread over read-only connections as in rotation analysis, and scored a batch at a time
+// from flat per-column arrays, crop by crop, so the crop's constants stay in registers
+// and the batch stays in cache. Chunks are printed in key order as they complete.
+//
+//   aims_cli <db> recommend [--top K] [--jobs N] [--season NAME] [--format F]
+//   recommend <field_id|all> <top_k>    batch/serve
+
+static const double PH_TOLERANCE = 1.5;
+static const double TEXTURE_TOLERANCE = 60.0;
+static const double N_SUFFICIENT_PPM = 25.0, P_SUFFICIENT_PPM = 20.0;
+static const double W_PH = 0.30, W_TEXTURE = 0.25, W_SEASON = 0.25, W_NUTRIENTS = 0.20;
+static const size_t RECOMMEND_BATCH = 256;
+static const sqlite3_int64 RECOMMEND_CHUNK_KEYS = 65536;   // field keys per chunk, at most
+
+static double k_sufficient_ppm(double cec) { return 75.0 + 2.5 * cec; }
+
+struct RecommendOptions {
+    int jobs = (int)std::max(1u, std::thread::hardware_concurrency());
+    int top = 3;
+    string season;   // empty: the next season to start
+};
+
+// Demand multipliers (N, P, K) from a c_nutrientuse note. A level word applies to the
+// nutrients named after it in the same clause; a general word ("feeder", "nutrient") to
+// those the note never names.
+static void nutrient_demand(const string &note, double demand[3]) {
+    double named[3] = {0, 0, 0}, general = 0, level = 0, scale = 1;
+    bool after_nutrient = false;
+    auto set = [&](int n) { if (level > 0 && named[n] == 0) named[n] = level; };
+    string word;
+    for (size_t i = 0; i <= note.size(); ++i) {
+        char ch = i < note.size() ? (char)tolower((unsigned char)note[i]) : ';';
+        if (isalnum((unsigned char)ch) || ch == '-') { word += ch; continue; }
+        if (!word.empty()) {
+            double l = 0;
+            if (word == "very") scale = 1.5;
+            else if (word == "slightly") scale = 0.5;
+            else if (word == "heavy" || word == "high" || word == "higher" || word == "strong") l = 1.4;
+            else if (word == "moderate" || word == "steady" || word == "balanced" || word == "good" || word == "adequate" ||
+                     word == "consistent") l = 1.0;
+            else if (word == "light" || word == "low" || word == "lower") l = 0.7;
+            if (l > 0) { level = 1 + (l - 1) * scale; scale = 1; }
+            bool nutrient = true;
+            if (word == "n" || word == "nitrogen") set(0);
+            else if (word == "p" || word == "phosphorus") set(1);
+            else if (word == "k" || word == "potassium") set(2);
+            else if (word == "npk") { set(0); set(1); set(2); }
+            else if (word == "nitrogen-fixing") named[0] = 0.3;
+            else {
+                nutrient = false;
+                bool generic = word == "nutrient" || word == "nutrients" || word == "feeder" || word == "feeding" || word == "fertility";
+                if (generic && !after_nutrient && level > 0) general = level;
+            }
+            after_nutrient = nutrient;
+            word.clear();
+        }
+        if (ch == ';') { level = 0; scale = 1; after_nutrient = false; }
+    }
+    for (int n = 0; n < 3; ++n) demand[n] = named[n] > 0 ? named[n] : general > 0 ? general : 1.0;
+}
+
+// One season's next occurrence on or after `from` (day numbers, end inclusive).
+struct SeasonWindow {
+    sqlite3_int64 key = 0;
+    string name;
+    int start_m = 0, start_d = 0, end_m = 0, end_d = 0;
+
+    int start_in(int year) const { return days_from_civil(year, start_m, std::min(start_d, days_in_month(year, start_m))); }
+    int end_after(int start) const {
+        CivilDate c = civil_from_days(start);
+        int y = (end_m < start_m || (end_m == start_m && end_d < start_d)) ? c.y + 1 : c.y;
+        return days_from_civil(y, end_m, std::min(end_d, days_in_month(y, end_m)));
+    }
+    int next_start(int from) const {
+        int y = civil_from_days(from).y, s = start_in(y);
+        return s >= from ? s : start_in(y + 1);
+    }
+};
+
+// Share of season `pref` covered by growing days [plant, plant + days), against the
+// occurrence of it the window overlaps most (or the whole window, if shorter).
+static double season_coverage(const SeasonWindow &pref, int plant, int days) {
+    if (days <= 0) return 0;
+    int y = civil_from_days(plant).y, covered = 0, most = 0, length = 0;
+    for (int yy = y - 1; yy <= y + days / 365 + 1; ++yy) {
+        int s = pref.start_in(yy), e = pref.end_after(s) + 1;
+        int overlap = std::max(0, std::min(e, plant + days) - std::max(s, plant));
+        covered += overlap;
+        if (overlap > most) { most = overlap; length = e - s; }
+    }
+    return covered > 0 ? std::min(1.0, (double)covered / std::min(days, length)) : 0;
+}
+
+// The crop catalog as flat columns, with everything that doesn't depend on the field.
+struct CropTable {
+    vector<sqlite3_int64> key;
+    vector<string> name;
+    vector<double> ph, sand, silt, clay, season_fit;
+    vector<double> n_demand, p_demand, k_demand;
+    vector<int> days;
+    vector<uint8_t> has_texture;
+    size_t size() const { return key.size(); }
+};
+
+struct CropRow {
+    sqlite3_int64 key;
+    std::string_view name;
+    double ph;
+    int days;
+    sqlite3_int64 season;
+    std::optional<double> sand, silt, clay;
+    std::optional<string> note;
+};
+static const Query<Columns<&CropRow::key, &CropRow::name, &CropRow::ph, &CropRow::days, &CropRow::season,
+                           &CropRow::sand, &CropRow::silt, &CropRow::clay, &CropRow::note>> CROP_PROFILE_SQL = R"(
+    SELECT c.c_cropkey, c.c_name, c.c_ph, c.c_daystomature, c.c_preferredseason,
+           st.st_sand_pct, st.st_silt_pct, st.st_clay_pct, c.c_nutrientuse
+    FROM crop c
+    LEFT JOIN soiltype st ON st.st_soilkey = c.c_preferredsoil
+    ORDER BY c.c_cropkey;
+    )";
+
+struct SeasonRow {
+    sqlite3_int64 key;
+    std::string_view name, start, end;
+};
+static const Query<Columns<&SeasonRow::key, &SeasonRow::name, &SeasonRow::start, &SeasonRow::end>> SEASON_WINDOWS_SQL =
+    "SELECT s_seasonkey, s_name, s_startdate, s_enddate FROM season ORDER BY s_seasonkey;";
+
+// Seasons with usable dates, then the target one: `name`, or the next to start after today.
+static bool load_target_season(DB &db, const string &name, std::map<sqlite3_int64, SeasonWindow> &seasons, SeasonWindow &target, int &plant) {
+    bool ok = SEASON_WINDOWS_SQL.each(db, [&](const SeasonRow &row) {
+        int s, e;
+        if (!parse_date(row.start.data(), row.start.size(), s) || !parse_date(row.end.data(), row.end.size(), e)) return;
+        CivilDate cs = civil_from_days(s), ce = civil_from_days(e);
+        seasons[row.key] = {row.key, string(row.name), cs.m, cs.d, ce.m, ce.d};
+    });
+    if (!ok) return false;
+    int today = today_day();
+    plant = NO_DAY;
+    for (auto &s : seasons) {
+        const SeasonWindow &w = s.second;
+        bool named = !name.empty() && (w.name == name || (name == "Fall" && w.name == "Autumn"));
+        if (!name.empty() && !named) continue;
+        int start = w.next_start(today + 1);
+        if (plant == NO_DAY || start < plant) { plant = start; target = w; }
+    }
+    if (plant == NO_DAY) { db.msg() << (name.empty() ? "No seasons with valid dates.\n" : "Season not found.\n"); return false; }
+    return true;
+}
+
+static bool load_crop_table(DB &db, const std::map<sqlite3_int64, SeasonWindow> &seasons, int plant, CropTable &ct) {
+    return CROP_PROFILE_SQL.each(db, [&](const CropRow &row) {
+        double demand[3];
+        nutrient_demand(row.note.value_or(""), demand);
+        auto season = seasons.find(row.season);
+        bool texture = row.sand && row.silt && row.clay;
+        ct.key.push_back(row.key);
+        ct.name.emplace_back(row.name);
+        ct.ph.push_back(row.ph);
+        ct.days.push_back(row.days);
+        ct.season_fit.push_back(season == seasons.end() ? 0.0 : season_coverage(season->second, plant, row.days));
+        ct.has_texture.push_back(texture);
+        ct.sand.push_back(row.sand.value_or(0));
+        ct.silt.push_back(row.silt.value_or(0));
+        ct.clay.push_back(row.clay.value_or(0));
+        ct.n_demand.push_back(demand[0]);
+        ct.p_demand.push_back(demand[1]);
+        ct.k_demand.push_back(demand[2]);
+    });
+}
+
+// One batch of fields as flat columns. Missing values are 0 with the flag cleared, so the
+// scoring loop needs no branches and never meets a NaN.
+struct FieldBatch {
+    size_t n = 0;
+    sqlite3_int64 field[RECOMMEND_BATCH];
+    double ph[RECOMMEND_BATCH], n_ppm[RECOMMEND_BATCH], p_ppm[RECOMMEND_BATCH], k_ppm[RECOMMEND_BATCH], cec[RECOMMEND_BATCH];
+    double sand[RECOMMEND_BATCH], silt[RECOMMEND_BATCH], clay[RECOMMEND_BATCH];
+    double sampled[RECOMMEND_BATCH], textured[RECOMMEND_BATCH];
+
+    void add(const FieldSoilRow &r) {
+        size_t i = n++;
+        field[i] = r.field;
+        bool sample = r.ph && r.n && r.p && r.k;
+        sampled[i] = sample;
+        ph[i] = sample ? *r.ph : 0;
+        n_ppm[i] = sample ? *r.n : 0;
+        p_ppm[i] = sample ? *r.p : 0;
+        k_ppm[i] = sample ? *r.k : 0;
+        cec[i] = r.cec.value_or(10.0);
+        bool own = r.sand && r.silt && r.clay, typed = r.type_sand && r.type_silt && r.type_clay;
+        textured[i] = own || typed;
+        sand[i] = own ? *r.sand : r.type_sand.value_or(0);
+        silt[i] = own ? *r.silt : r.type_silt.value_or(0);
+        clay[i] = own ? *r.clay : r.type_clay.value_or(0);
+    }
+};
+
+struct PairFit {
+    double ph, texture, nutrients, n_deficit, p_deficit, k_deficit;
+};
+
+// Score of field i for crop c; fills `fit` when asked. The same code serves the batch loop
+// and the detail of the picks.
+static inline double pair_score(const CropTable &ct, size_t c, const FieldBatch &b, size_t i, PairFit* fit) {
+    double ph_fit = std::max(0.0, 1.0 - std::fabs(b.ph[i] - ct.ph[c]) * (1.0 / PH_TOLERANCE));
+    double ds = b.sand[i] - ct.sand[c], dl = b.silt[i] - ct.silt[c], dc = b.clay[i] - ct.clay[c];
+    double texture_fit = std::max(0.0, 1.0 - std::sqrt(ds * ds + dl * dl + dc * dc) * (1.0 / TEXTURE_TOLERANCE));
+    double n_target = N_SUFFICIENT_PPM * ct.n_demand[c], p_target = P_SUFFICIENT_PPM * ct.p_demand[c];
+    double k_target = k_sufficient_ppm(b.cec[i]) * ct.k_demand[c];
+    double n_def = std::max(0.0, n_target - b.n_ppm[i]), p_def = std::max(0.0, p_target - b.p_ppm[i]);
+    double k_def = std::max(0.0, k_target - b.k_ppm[i]);
+    double nutrient_fit = 1.0 - (n_def / n_target + p_def / p_target + k_def / k_target) * (1.0 / 3);
+    double textured = b.textured[i] * ct.has_texture[c];
+    double num = W_SEASON * ct.season_fit[c] + W_TEXTURE * textured * texture_fit + b.sampled[i] * (W_PH * ph_fit + W_NUTRIENTS * nutrient_fit);
+    double den = W_SEASON + W_TEXTURE * textured + b.sampled[i] * (W_PH + W_NUTRIENTS);
+    if (fit) *fit = {ph_fit, texture_fit, nutrient_fit, n_def, p_def, k_def};
+    return 100.0 * num / den;
+}
+
+struct CropPick {
+    sqlite3_int64 field;
+    uint32_t crop;   // index into the CropTable
+    double score;
+    bool sampled, textured;
+    PairFit fit;
+};
+
+// Scores a full batch crop by crop and appends each field's top k, best first.
+static void score_batch(const CropTable &ct, const FieldBatch &b, size_t top, vector<CropPick> &out) {
+    vector<double> score(b.n);
+    vector<double> best(b.n * top, -1.0);
+    vector<uint32_t> best_crop(b.n * top, 0);
+    for (size_t c = 0; c < ct.size(); ++c) {
+        for (size_t i = 0; i < b.n; ++i) score[i] = pair_score(ct, c, b, i, nullptr);
+        for (size_t i = 0; i < b.n; ++i) {
+            double* s = &best[i * top];
+            uint32_t* k = &best_crop[i * top];
+            if (score[i] <= s[top - 1]) continue;   // ties keep the lower crop key
+            size_t j = top - 1;
+            for (; j > 0 && score[i] > s[j - 1]; --j) { s[j] = s[j - 1]; k[j] = k[j - 1]; }
+            s[j] = score[i];
+            k[j] = (uint32_t)c;
+        }
+    }
+    for (size_t i = 0; i < b.n; ++i) {
+        for (size_t j = 0; j < top && best[i * top + j] >= 0; ++j) {
+            CropPick p{b.field[i], best_crop[i * top + j], 0, b.sampled[i] != 0, b.textured[i] != 0, {}};
+            p.score = pair_score(ct, p.crop, b, i, &p.fit);
+            out.push_back(p);
+        }
+    }
+}
+
+// Fields lo..hi on one connection, a batch at a time.
+static bool recommend_range(DB &conn, const CropTable &ct, sqlite3_int64 lo, sqlite3_int64 hi, size_t top,
+                            vector<CropPick> &out, sqlite3_int64 &fields) {
+    auto batch = std::make_unique<FieldBatch>();
+    bool ok = (has_field_summary(conn) ? FIELD_SOIL_SCAN_SUMMARY_SQL : FIELD_SOIL_SCAN_SQL).each(conn, lo, hi, [&](const FieldSoilRow &row) {
+        batch->add(row);
+        if (batch->n == RECOMMEND_BATCH) { score_batch(ct, *batch, top, out); fields += (sqlite3_int64)batch->n; batch->n = 0; }
+    });
+    if (batch->n) { score_batch(ct, *batch, top, out); fields += (sqlite3_int64)batch->n; }
+    return ok;
+}
+
+static const vector<string> RECOMMEND_COLUMNS = {
+    "fieldkey", "rank", "cropkey", "crop", "score", "ph_fit", "texture_fit", "season_fit", "nutrient_fit",
+    "n_deficit_ppm", "p_deficit_ppm", "k_deficit_ppm", "ready_by"};
+
+static void print_picks(RowPrinter &rp, const CropTable &ct, const vector<CropPick> &picks, int plant) {
+    auto round_to = [](double v, double scale) { return std::round(v * scale) / scale; };
+    sqlite3_int64 field = 0, rank = 0;
+    for (auto &p : picks) {
+        rank = p.field == field && rank ? rank + 1 : 1;
+        field = p.field;
+        rp.set(0, p.field);
+        rp.set(1, rank);
+        rp.set(2, ct.key[p.crop]);
+        rp.set(3, ct.name[p.crop]);
+        rp.set(4, round_to(p.score, 10));
+        if (p.sampled) rp.set(5, round_to(p.fit.ph, 100)); else rp.set_null(5);
+        if (p.textured && ct.has_texture[p.crop]) rp.set(6, round_to(p.fit.texture, 100)); else rp.set_null(6);
+        rp.set(7, round_to(ct.season_fit[p.crop], 100));
+        if (p.sampled) {
+            rp.set(8, round_to(p.fit.nutrients, 100));
+            rp.set(9, round_to(p.fit.n_deficit, 10));
+            rp.set(10, round_to(p.fit.p_deficit, 10));
+            rp.set(11, round_to(p.fit.k_deficit, 10));
+        } else {
+            for (int col = 8; col <= 11; ++col) rp.set_null(col);
+        }
+        rp.set(12, format_date(plant + ct.days[p.crop]));
+        rp.emit();
+    }
+}
+
+// Scores fields lo..hi (in parallel when the database is a file) and prints the picks in
+// field order; timing goes to `log`.
+static bool recommend_crops(DB &db, const RecommendOptions &o, sqlite3_int64 lo, sqlite3_int64 hi, std::ostream &log) {
+    auto t0 = std::chrono::steady_clock::now();
+    if (o.top < 1) { db.msg() << "top_k must be at least 1.\n"; return false; }
+    std::map<sqlite3_int64, SeasonWindow> seasons;
+    SeasonWindow target;
+    int plant;
+    CropTable ct;
+    if (!load_target_season(db, o.season, seasons, target, plant) || !load_crop_table(db, seasons, plant, ct)) return false;
+    if (ct.size() == 0) { db.msg() << "No crops to recommend.\n"; return false; }
+    size_t top = std::min((size_t)o.top, ct.size());
+    db.out.note("Recommendations for " + target.name + ", planting from " + format_date(plant) + "\n");
+
+    // Chunks small enough that the picks waiting to print stay small.
+    KeyChunks chunks(db, lo, hi, o.jobs, RECOMMEND_CHUNK_KEYS);
+    RowPrinter rp(db, RECOMMEND_COLUMNS);
+    if (!rp) return false;
+    vector<vector<CropPick>> picks(chunks.count());
+    std::atomic<sqlite3_int64> fields{0};
+    bool ok = chunks.run([&](DB &conn, size_t c, sqlite3_int64 a, sqlite3_int64 b) {
+        sqlite3_int64 n = 0;
+        bool scanned = recommend_range(conn, ct, a, b, top, picks[c], n);
+        fields += n;
+        return scanned;
+    }, [&](size_t c) {
+        // Print each chunk once it and those before it are scored, then let it go.
+        print_picks(rp, ct, picks[c], plant);
+        vector<CropPick>().swap(picks[c]);
+    });
+    rp.end("(no fields)");
+    if (!ok) { db.msg() << "Field scan failed.\n"; return false; }
+    size_t workers = chunks.workers();
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    std::ostringstream line;
+    line << fields << " fields x " << ct.size() << " crops scored in " << std::fixed << std::setprecision(3) << secs
+         << " s on " << workers << " connection(s); top " << top << " per field\n";
+    log << line.str();
+    return true;
+}
+
+// Smallest and largest field key; lo > hi when there are no fields.
+static bool field_key_range(DB &db, sqlite3_int64 &lo, sqlite3_int64 &hi) {
+    lo = 0, hi = -1;
+    Stmt stmt = db.prepare("SELECT MIN(fld_fieldkey), MAX(fld_fieldkey) FROM field;");
+    if (!stmt || sqlite3_step(stmt) != SQLITE_ROW) { db.msg() << "Query error: " << sqlite3_errmsg(db.db) << "\n"; return false; }
+    if (sqlite3_column_type(stmt, 0) != SQLITE_NULL) { lo = sqlite3_column_int64(stmt, 0); hi = sqlite3_column_int64(stmt, 1); }
+    return true;
+}
+
+// field < 0: every field.
+bool recommend_crops(DB &db, int field, int top) {
+    if (field >= 0 && !db.id_exists("field", "fld_fieldkey", field)) { db.msg() << "Field not found.\n"; return false; }
+    RecommendOptions o;
+    o.jobs = db.scan_jobs;
+    o.top = top;
+    sqlite3_int64 lo = field, hi = field;
+    if (field < 0 && !field_key_range(db, lo, hi)) return false;
+    return recommend_crops(db, o, lo, hi, db.msg());
+}
+
+void recommend_crops(DB &db) {
+    cout << endl;
+    cout << "Enter field_id: ";
+    int fid; cin >> fid;
+    cout << "How many crops to list? ";
+    int top; cin >> top; cin.ignore();
+    if (!recommend_crops(db, fid, top)) return;
+    promptContinue();
+}
+
+// The `recommend` mode: every field, timing on stderr.
+int run_recommend(DB &db, const RecommendOptions &o) {
+    sqlite3_int64 lo, hi;
+    if (!field_key_range(db, lo, hi)) return 1;
+    return recommend_crops(db, o, lo, hi, std::cerr) ? 0 : 1;
+}
+
+// ---------- Sharded databases ----------
+// aims_cli <db> shard <N> <dir>     split into dir/shard_00.sqlite ... plus the manifest dir/aims.shards
+// aims_cli <dir>/aims.shards --exec avg-yield --exec "latest-sample 42" [--batch] [--format F]
+// Fields are partitioned by farmer key across N database files: shard fld_farmerkey % N
+// holds the farmer, their fields and every row recorded against those fields, plus a full
+// copy of the reference tables (crops, seasons, soil and maintenance types, ...). The
+// manifest lists the shard files in shard order, relative to its own directory.
+//
+// Commands that name a field run unchanged on the shard that owns it; the owner is found
+// with a primary-key probe of each shard's field table and cached. Inserts go to one write
+// pipeline per shard, so shards commit independently. The cross-field aggregates run a
+// partial query on every shard at once, each on its own connection and thread; the partial
+// rows are merged in a temp table on shard 0's connection, where sums and counts are added
+// before anything is divided, and HAVING limits apply to the merged counts.
+
+static const char* SHARD_MANIFEST = "aims.shards";
+
+struct ShardPartition {
+    const char* table;
+    const char* filter;   // rows of src.<table> that belong to the shard; $S is the shard, $N the count
+};
+
+// Every other table is copied whole. temp.shard_fields holds the shard's field keys. The
+// farmer key is reduced as next_sample_key does, so a negative key still lands in [0, N).
+static const ShardPartition SHARD_PARTITIONS[] = {
+    {"farmer", "(f_farmerkey % $N + $N) % $N = $S"},
+    {"field", "(fld_farmerkey % $N + $N) % $N = $S"},
+    {"soilsample", "ss_fieldkey IN temp.shard_fields"},
+    {"soilsample_contaminant", "ssc_samplekey IN (SELECT ss_samplekey FROM src.soilsample WHERE ss_fieldkey IN temp.shard_fields)"},
+    {"fieldcrop", "fldc_fieldkey IN temp.shard_fields"},
+    {"fieldmaintenance", "fldm_fieldkey IN temp.shard_fields"},
+    {"field_summary", "fs_fieldkey IN temp.shard_fields"},
+    {"field_rollup", "fr_fieldkey IN temp.shard_fields"},
+};
+
+static bool is_shard_manifest(const string &path) {
+    return path.size() >= 7 && path.compare(path.size() - 7, 7, ".shards") == 0;
+}
+
+static string shard_file_name(int shard) {
+    char name[32];
+    snprintf(name, sizeof name, "shard_%02d.sqlite", shard);
+    return name;
+}
+
+static bool shard_exec(DB &db, const string &sql) {
+    char* err = nullptr;
+    if (sqlite3_exec(db.db, sql.c_str(), nullptr, nullptr, &err) != SQLITE_OK) {
+        cout << "Shard build failed: " << (err ? err : sqlite3_errmsg(db.db)) << "\n";
+        sqlite3_free(err);
+        return false;
+    }
+    return true;
+}
+
+// Stored columns of src.<table>; generated columns are recomputed by the copy.
+static string shard_copy_columns(DB &db, const string &table) {
+    string cols;
+    Stmt stmt = db.prepare("SELECT name FROM pragma_table_xinfo(?1, 'src') WHERE hidden = 0 ORDER BY cid;");
+    if (!stmt) return cols;
+    sqlite3_bind_text(stmt, 1, table.c_str(), -1, SQLITE_TRANSIENT);
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        if (!cols.empty()) cols += ", ";
+        cols += string("\"") + (const char*)sqlite3_column_text(stmt, 0) + "\"";
+    }
+    return cols;
+}
+
+// Writes shard `shard` of `count` from the database at src_path, in one transaction: tables
+// and their rows first, then indexes, triggers and views (so triggers don't fire on the copy).
+// Virtual tables and their shadow tables aren't copied; the search index is rebuilt instead.
+static bool build_shard(const string &src_path, const string &path, int shard, int count, sqlite3_int64 key_base) {
+    DB db;
+    if (!db.open(path)) return false;
+    if (!shard_exec(db, "PRAGMA foreign_keys = OFF;")) return false;
+    {
+        Stmt attach = db.prepare("ATTACH ?1 AS src;");
+        if (!attach) { cout << "Prepare error: " << sqlite3_errmsg(db.db) << "\n"; return false; }
+        sqlite3_bind_text(attach, 1, src_path.c_str(), -1, SQLITE_TRANSIENT);
+        if (sqlite3_step(attach) != SQLITE_DONE) { cout << "Can't attach " << src_path << ": " << sqlite3_errmsg(db.db) << "\n"; return false; }
+    }
+    string s = std::to_string(shard), n = std::to_string(count);
+    if (!shard_exec(db, "BEGIN;")) return false;
+    bool ok = shard_exec(db, "CREATE TEMP TABLE shard_fields AS SELECT fld_fieldkey FROM src.field WHERE (fld_farmerkey % " + n + " + " + n + ") % " + n + " = " + s + ";");
+
+    vector<std::pair<string, string>> tables;
+    vector<string> others;
+    {
+        Stmt stmt = db.prepare("SELECT m.type, m.name, m.sql FROM src.sqlite_master m "
+                               "WHERE m.sql IS NOT NULL AND m.name NOT LIKE 'sqlite_%' AND NOT EXISTS "
+                               "(SELECT 1 FROM pragma_table_list t WHERE t.schema = 'src' AND t.name = m.name AND t.type IN ('virtual', 'shadow')) "
+                               "ORDER BY m.type <> 'table', m.rowid;");
+        while (ok && stmt && sqlite3_step(stmt) == SQLITE_ROW) {
+            string type = (const char*)sqlite3_column_text(stmt, 0), sql = (const char*)sqlite3_column_text(stmt, 2);
+            if (type == "table") tables.push_back({(const char*)sqlite3_column_text(stmt, 1), sql});
+            else others.push_back(sql);
+        }
+        ok = ok && stmt;
+    }
+    for (size_t i = 0; ok && i < tables.size(); ++i) {
+        const string &t = tables[i].first;
+        string where;
+        for (auto &p : SHARD_PARTITIONS) if (t == p.table) where = " WHERE " + replace_all(replace_all(p.filter, "$S", s), "$N", n);
+        string cols = shard_copy_columns(db, t);
+        ok = shard_exec(db, tables[i].second + ";") &&
+             shard_exec(db, "INSERT INTO main.\"" + t + "\" (" + cols + ") SELECT " + cols + " FROM src.\"" + t + "\"" + where + ";");
+    }
+    for (size_t i = 0; ok && i < others.size(); ++i) ok = shard_exec(db, others[i] + ";");
+
+    int version = 0;
+    {
+        Stmt stmt = db.prepare("PRAGMA src.user_version;");
+        if (stmt && sqlite3_step(stmt) == SQLITE_ROW) version = sqlite3_column_int(stmt, 0);
+    }
+    if (ok && version >= SEARCH_INDEX_VERSION) ok = install_search_index(db);
+    ok = ok && shard_exec(db, "CREATE TABLE shard_info (si_shard INTEGER NOT NULL, si_count INTEGER NOT NULL, si_key_base INTEGER NOT NULL);"
+                              "INSERT INTO shard_info VALUES (" + s + ", " + n + ", " + std::to_string(key_base) + ");"
+                              "PRAGMA user_version = " + std::to_string(version) + ";");
+    db.forget_schema_version();
+    if (!ok) { sqlite3_exec(db.db, "ROLLBACK;", nullptr, nullptr, nullptr); return false; }
+    db.clear_stmt_cache();
+    return shard_exec(db, "COMMIT; DETACH src;");
+}
+
+int run_shard(DB &db, int count, const string &dir) {
+    if (count < 1 || count > 99) { cout << "Shard count must be between 1 and 99.\n"; return 1; }
+    std::error_code ec;
+    std::filesystem::create_directories(dir, ec);
+    if (ec) { cout << "Can't create " << dir << ": " << ec.message() << "\n"; return 1; }
+    std::filesystem::path manifest = std::filesystem::path(dir) / SHARD_MANIFEST;
+    for (int s = 0; s <= count; ++s) {
+        std::filesystem::path p = s < count ? std::filesystem::path(dir) / shard_file_name(s) : manifest;
+        if (file_exists(p.string())) { cout << p.string() << " already exists.\n"; return 1; }
+    }
+
+    sqlite3_int64 key_base = 0;
+    {
+        Stmt stmt = db.prepare("SELECT COALESCE(MAX(ss_samplekey), 0) FROM soilsample;");
+        if (!stmt || sqlite3_step(stmt) != SQLITE_ROW) { cout << "Query error: " << sqlite3_errmsg(db.db) << "\n"; return 1; }
+        key_base = sqlite3_column_int64(stmt, 0);
+    }
+    string src = sqlite3_db_filename(db.db, "main");
+    std::ofstream out(manifest);
+    out << "# aims_cli shard manifest: one database per line, in shard order\n";
+    for (int s = 0; s < count; ++s) {
+        auto t0 = std::chrono::steady_clock::now();
+        string path = (std::filesystem::path(dir) / shard_file_name(s)).string();
+        if (!build_shard(src, path, s, count, key_base)) { out.close(); std::filesystem::remove(manifest, ec); return 1; }
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        cout << path << " (" << std::fixed << std::setprecision(2) << secs << " s)\n";
+        out << shard_file_name(s) << "\n";
+    }
+    cout.unsetf(std::ios::floatfield);
+    cout << std::setprecision(6);
+    out.close();
+    if (!out) { cout << "Can't write " << manifest.string() << "\n"; return 1; }
+    cout << "Wrote " << manifest.string() << "\n";
+    return 0;
+}
+
+// One read-write connection per shard, in manifest order.
+class ShardSet {
+public:
+    bool open(const string &manifest) {
+        std::ifstream in(manifest);
+        if (!in) { cout << "Can't read " << manifest << "\n"; return false; }
+        std::filesystem::path dir = std::filesystem::path(manifest).parent_path();
+        string line;
+        while (getline(in, line)) {
+            size_t a = line.find_first_not_of(" \t\r"), b = line.find_last_not_of(" \t\r");
+            if (a == string::npos || line[a] == '#') continue;
+            std::filesystem::path p = line.substr(a, b - a + 1);
+            paths_.push_back((p.is_absolute() ? p : dir / p).string());
+        }
+        if (paths_.empty()) { cout << "No shards listed in " << manifest << "\n"; return false; }
+        for (size_t s = 0; s < paths_.size(); ++s) {
+            if (!file_exists(paths_[s])) { cout << "DB file not found: " << paths_[s] << "\n"; return false; }
+            auto db = std::make_unique<DB>();
+            if (!db->open(paths_[s])) return false;
+            if (db->shard_key.shard != (int)s || db->shard_key.count != (int)paths_.size()) {
+                cout << paths_[s] << " is not shard " << s << " of " << paths_.size() << "\n";
+                return false;
+            }
+            shards_.push_back(std::move(db));
+        }
+        return true;
+    }
+
+    size_t size() const { return shards_.size(); }
+    DB &shard(size_t s) { return *shards_[s]; }
+    const string &path(size_t s) const { return paths_[s]; }
+
+    // Shard holding field `field`, or -1. Misses aren't cached: the field may be added later.
+    int owner(int field) {
+        auto it = owner_.find(field);
+        if (it != owner_.end()) return it->second;
+        for (size_t s = 0; s < shards_.size(); ++s) {
+            if (shards_[s]->id_exists("field", "fld_fieldkey", field)) return owner_[field] = (int)s;
+        }
+        return -1;
+    }
+
+private:
+    vector<string> paths_;
+    vector<std::unique_ptr<DB>> shards_;
+    std::unordered_map<int, int> owner_;
+};
+
+// A cross-field aggregate as a per-shard partial query and the merge over its rows.
+struct ShardAggregate {
+    const char* command;
+    const char* title;
+    const char* partial_table;   // temp table for the partial rows, columns in partial order
+    const char* partial_sql;
+    const char* partial_summary_sql;   // used instead on shards with field_summary, or nullptr
+    const char* merge_sql;
+};
+
+static const ShardAggregate SHARD_AGGREGATES[] = {
+    {"avg-yield", "\n-- Avg yield per field (aggregated) --\n",
+     "shard_avg_yield (fieldkey, yield_sum, yield_count, observations)",
+     "SELECT fldc_fieldkey, TOTAL(fldc_yield), COUNT(fldc_yield), COUNT(fldc_fieldkey) FROM fieldcrop GROUP BY fldc_fieldkey;",
+     "SELECT fs_fieldkey, fs_yield_sum, fs_planting_count, fs_planting_count FROM field_summary WHERE fs_planting_count > 0;",
+     "SELECT fieldkey, ROUND(SUM(yield_sum) / SUM(yield_count), 2) AS avg_yield, SUM(observations) AS observations "
+     "FROM temp.shard_avg_yield GROUP BY fieldkey ORDER BY fieldkey;"},
+    {"yield-per-season", "\n-- Total yield per season (aggregated) --\n",
+     "shard_yield_per_season (cropkey, yield_sum, plantings)",
+     "SELECT fldc_cropkey, TOTAL(fldc_yield), COUNT(fldc_fieldkey) FROM fieldcrop GROUP BY fldc_cropkey;",
+     nullptr,
+     R"(
+    WITH per_crop AS (
+      SELECT cropkey AS fldc_cropkey, SUM(yield_sum) AS yield_sum, SUM(plantings) AS plantings
+      FROM temp.shard_yield_per_season
+      GROUP BY cropkey
+    )
+    SELECT s.s_seasonkey, s.s_name, ROUND(SUM(pc.yield_sum),2) AS total_yield, SUM(pc.plantings) AS plantings_count
+    FROM season s
+    JOIN crop c ON c.c_preferredseason = s.s_seasonkey
+    JOIN per_crop pc ON pc.fldc_cropkey = c.c_cropkey
+    GROUP BY s.s_seasonkey, s.s_name
+    ORDER BY total_yield DESC;
+    )"},
+    {"avg-npk", "\n-- Avg NPK by soil texture (requires >=5 samples) --\n",
+     "shard_avg_npk (soil_texture, soilkey, samples, n_sum, n_count, p_sum, p_count, k_sum, k_count, cec_sum, cec_count)",
+     R"(
+    SELECT st.st_soil_texture, st.st_soilkey, COUNT(ss.ss_samplekey),
+           TOTAL(ss.ss_nitrogen_ppm), COUNT(ss.ss_nitrogen_ppm), TOTAL(ss.ss_phosphorus_ppm), COUNT(ss.ss_phosphorus_ppm),
+           TOTAL(ss.ss_potassium_ppm), COUNT(ss.ss_potassium_ppm), TOTAL(ss.ss_cec), COUNT(ss.ss_cec)
+    FROM soilsample ss
+    JOIN field fld ON ss.ss_fieldkey = fld.fld_fieldkey
+    JOIN soiltype st ON fld.fld_soilkey = st.st_soilkey
+    GROUP BY st.st_soil_texture;
+    )",
+     nullptr,
+     R"(
+    SELECT soil_texture, SUM(samples) AS sample_count,
+           ROUND(SUM(n_sum) / SUM(n_count),2) AS avg_N,
+           ROUND(SUM(p_sum) / SUM(p_count),2) AS avg_P,
+           ROUND(SUM(k_sum) / SUM(k_count),2) AS avg_K,
+           ROUND(SUM(cec_sum) / SUM(cec_count),2) AS avg_cec
+    FROM temp.shard_avg_npk
+    GROUP BY soil_texture
+    HAVING SUM(samples) >= 5
+    ORDER BY MAX(soilkey) DESC;
+    )"},
+};
+
+// Commands whose first argument is a field key; they run as-is on the owning shard.
+static const char* SHARD_ROUTED[] = {
+    "latest-sample", "rotation", "field-summary", "trend", "yoy", "rollup-window", "on-field",
+    "insert-fieldcrop", "insert-soilsample",
+};
+
+// Partial rows of one shard, copied out of its statement.
+struct ShardPartial {
+    vector<sqlite3_value*> cells;
+    int ncols = 0;
+    bool ok = false;
+    string error;
+    ~ShardPartial() { for (auto* v : cells) sqlite3_value_free(v); }
+};
+
+static void run_shard_partial(DB &db, const ShardAggregate &a, ShardPartial &p) {
+    Stmt stmt = db.prepare(a.partial_summary_sql && has_field_summary(db) ? a.partial_summary_sql : a.partial_sql);
+    if (!stmt) { p.error = string("Prepare error: ") + sqlite3_errmsg(db.db); return; }
+    p.ncols = sqlite3_column_count(stmt);
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        for (int i = 0; i < p.ncols; ++i) p.cells.push_back(sqlite3_value_dup(sqlite3_column_value(stmt, i)));
+    }
+    p.ok = rc == SQLITE_DONE;
+    if (!p.ok) p.error = string("Query error: ") + sqlite3_errmsg(db.db);
+}
+
+bool run_shard_aggregate(ShardSet &set, const ShardAggregate &a) {
+    vector<ShardPartial> parts(set.size());
+    vector<std::thread> threads;
+    for (size_t s = 0; s < set.size(); ++s) threads.emplace_back([&, s] { run_shard_partial(set.shard(s), a, parts[s]); });
+    for (auto &t : threads) t.join();
+
+    DB &db = set.shard(0);
+    for (size_t s = 0; s < parts.size(); ++s) {
+        if (!parts[s].ok) { db.msg() << set.path(s) << ": " << parts[s].error << "\n"; return false; }
+    }
+    string table = a.partial_table;
+    string name = table.substr(0, table.find(' '));
+    string sql = "CREATE TEMP TABLE IF NOT EXISTS " + table + "; DELETE FROM temp." + name + ";";
+    if (sqlite3_exec(db.db, sql.c_str(), nullptr, nullptr, nullptr) != SQLITE_OK) {
+        db.msg() << "Merge error: " << sqlite3_errmsg(db.db) << "\n";
+        return false;
+    }
+    string insert = "INSERT INTO temp." + name + " VALUES (?";
+    for (int i = 1; i < parts[0].ncols; ++i) insert += ", ?";
+    insert += ");";
+    // Every partial row has to land: a missing one would still merge, into wrong totals.
+    auto merge_error = [&] {
+        db.msg() << "Merge error: " << sqlite3_errmsg(db.db) << "\n";
+        if (!sqlite3_get_autocommit(db.db)) sqlite3_exec(db.db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        return false;
+    };
+    if (sqlite3_exec(db.db, "BEGIN;", nullptr, nullptr, nullptr) != SQLITE_OK) return merge_error();
+    {
+        Stmt stmt = db.prepare(insert);
+        if (!stmt) return merge_error();
+        for (auto &p : parts) {
+            for (size_t r = 0; r < p.cells.size(); r += p.ncols) {
+                for (int i = 0; i < p.ncols; ++i) sqlite3_bind_value(stmt, i + 1, p.cells[r + i]);
+                if (sqlite3_step(stmt) != SQLITE_DONE) return merge_error();
+                sqlite3_reset(stmt);
+            }
+        }
+    }
+    if (sqlite3_exec(db.db, "COMMIT;", nullptr, nullptr, nullptr) != SQLITE_OK) return merge_error();
+    db.out.note(a.title);
+    return db.run_and_print(a.merge_sql);
+}
+
+void print_shard_command_help() {
+    cout << "Commands on a sharded database:\n";
+    for (auto &a : SHARD_AGGREGATES) cout << "  " << a.command << "   (merged from every shard)\n";
+    for (auto* name : SHARD_ROUTED) {
+        const Command* c = find_command(name);
+        cout << "  " << name << " " << c->args << "   (on the field's shard)\n";
+    }
+    cout << "  format <table|csv|tsv|ndjson|json|binary>\n";
+}
+
+bool run_shard_command(ShardSet &set, const string &line) {
+    vector<string> words = split_command(line);
+    if (words.empty()) return true;
+    DB &first = set.shard(0);
+    if (words[0] == "help") { print_shard_command_help(); return true; }
+    if (words[0] == "format") {
+        for (size_t s = 0; s < set.size(); ++s) if (!run_command(set.shard(s), line)) return false;
+        return true;
+    }
+    for (auto &a : SHARD_AGGREGATES) {
+        if (words[0] != a.command) continue;
+        auto t0 = std::chrono::steady_clock::now();
+        bool ok = words.size() == 1 && run_shard_aggregate(set, a);
+        if (first.stats) first.stats->record_operation(a.command, (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count());
+        if (!ok) first.msg() << "Command failed: " << line << "\n";
+        return ok;
+    }
+    for (auto* name : SHARD_ROUTED) {
+        if (words[0] != name) continue;
+        // A field no shard has goes to shard 0, which reports it the usual way.
+        int fid, s = words.size() > 1 && parse_int_arg(words[1], fid) ? set.owner(fid) : -1;
+        return run_command(set.shard(s < 0 ? 0 : (size_t)s), line);
+    }
+    first.msg() << "Not available on a sharded database: " << words[0] << " (try 'help')\n";
+    return false;
+}
+
+// run_batch over the shards: one write pipeline per shard, all reporting to one queue so
+// insert messages still come out in command order.
+int run_shard_batch(ShardSet &set, const vector<string> &execs, bool read_stdin, const WriteOptions &write_opts) {
+    std::ios::sync_with_stdio(false);
+    vector<std::unique_ptr<WritePipeline>> pipelines;
+    vector<WriteTicket> deferred;
+    for (size_t s = 0; s < set.size(); ++s) {
+        pipelines.push_back(std::make_unique<WritePipeline>());
+        if (!pipelines.back()->start(set.path(s), write_opts)) return 1;
+        set.shard(s).writes = pipelines.back().get();
+        set.shard(s).deferred_writes = &deferred;
+    }
+    auto drain = [&] {
+        for (auto &p : pipelines) p->flush();
+        return drain_writes(set.shard(0));
+    };
+    int failures = 0;
+    auto run = [&](const string &line) {
+        vector<string> words = split_command(line);
+        if (words.empty() || !is_write_command(words[0])) failures += drain();
+        if (!run_shard_command(set, line)) ++failures;
+    };
+    for (auto &e : execs) run(e);
+    if (read_stdin) {
+        string line;
+        while (getline(cin, line)) {
+            size_t start = line.find_first_not_of(" \t\r");
+            if (start == string::npos || line[start] == '#') continue;
+            run(line);
+        }
+    }
+    failures += drain();
+    for (size_t s = 0; s < set.size(); ++s) {
+        pipelines[s]->stop();
+        set.shard(s).writes = nullptr;
+        set.shard(s).deferred_writes = nullptr;
+    }
+    cout.flush();
+    for (size_t s = 0; s < set.size(); ++s) {
+        if (pipelines[s]->rows_written() == 0) continue;
+        std::cerr << set.path(s) << ": ";
+        pipelines[s]->print_stats(std::cerr);
+    }
+    return failures ? 1 : 0;
+}
+
+int run_sharded(const string &manifest, int argc, char** argv) {
+    vector<string> execs;
+    bool read_stdin = false;
+    WriteOptions write_opts;
+    OutputFormat format = OutputFormat::Table;
+    for (int i = 2; i < argc; ++i) {
+        string a = argv[i];
+        if (a == "--exec" && i + 1 < argc) execs.push_back(argv[++i]);
+        else if (a == "--batch") read_stdin = true;
+        else if (a == "--write-batch-rows" && i + 1 < argc) write_opts.batch_rows = (size_t)std::max(1, std::atoi(argv[++i]));
+        else if (a == "--write-delay-ms" && i + 1 < argc) write_opts.delay_ms = std::max(0, std::atoi(argv[++i]));
+        else if (a == "--format" && i + 1 < argc) {
+            if (!parse_output_format(argv[++i], format)) { cout << "Unknown format: " << argv[i] << "\n"; return 1; }
+        }
+        else { cout << "Unknown argument: " << a << " (a shard manifest takes --exec/--batch commands only)\n"; return 1; }
+    }
+    if (execs.empty() && !read_stdin) { cout << "A shard manifest takes --exec/--batch commands only.\n"; return 1; }
+    ShardSet set;
+    if (!set.open(manifest)) return 1;
+    for (size_t s = 0; s < set.size(); ++s) set.shard(s).out.set_format(format);
+    return run_shard_batch(set, execs, read_stdin, write_opts);
+}
+
+// ---------- HTTP server ----------
+// aims_cli <db> serve [--port 8080] [--bind 127.0.0.1] [--threads N] [--root DIR] [--origin URL]...
+// HTTP/1.1 with keep-alive for the web UI (index.html) and other local dashboards.
+// Every worker thread owns an epoll loop, its own SO_REUSEPORT listening socket (the
+// kernel spreads new connections over them) and its own DB connection with its own
+// statement cache, so nothing on the request path is shared between threads. The
+// database is switched to WAL so readers never wait for another worker's insert.
+//
+//   GET  /api/<command>?<arg>=...   read commands; argument names come from the usage
+//                                   string ("<field_id>" -> field_id), or pass them as
+//                                   path segments: /api/rotation/3
+//   POST /api/insert-...            inserts, arguments in the query or a form body
+//   GET  /api/commands              endpoints and their arguments
+//   GET  /api/stats                 query statistics of all workers (with --stats)
+//   GET  /<path>                    static file under --root (index.html for /); the root
+//                                   defaults to the directory of the executable, which
+//                                   holds index.html
+//
+// A POST carrying an Origin header must come from an allowed origin, so a page on another
+// site can't submit a form to the API: the bind address (and localhost for a loopback
+// bind) plus each --origin given. The Host header is never trusted for this, since a DNS
+// rebinding page controls it. Only web asset types are served as static files (see
+// content_type_for); database files and dot files never are.
+//
+// API responses are {"ok": bool, "results": [[{row}, ...], ...], "messages": ["...", ...]}
+// with one array per result set; a failed operation answers 400 with its messages.
+
+struct ServeEndpoint {
+    const char* command;   // entry in COMMANDS
+    bool writes;           // POST only
+    // First argument refused: the command's whole-table form (see below).
+    const char* refused = nullptr;
+};
+
+// Commands whose output is entirely result sets and messages. script/sql/format change or
+// expose more than a dashboard should. The whole-table analyses (metal-sweep/-exceed,
+// compliance*, rotation-matrix, monocrop-runs, planting-inputs all, recommend all) would
+// hold the worker's event loop for the length of the scan, so they are left to --exec
+// and their own modes.
+static const ServeEndpoint SERVE_ENDPOINTS[] = {
+    {"fields", false},
+    {"crops-by-season", false},
+    {"avg-yield", false},
+    {"latest-sample", false},
+    {"thresholds", false},
+    {"no-recent-maintenance", false},
+    {"avg-npk", false},
+    {"yield-per-season", false},
+    {"rotation", false},
+    {"field-summary", false},
+    {"soil-stats", false},
+    {"trend", false},
+    {"yoy", false},
+    {"rollup-window", false},
+    {"maint-vs-yield", false},
+    {"planting-inputs", false, "all"},
+    {"on-field", false},
+    {"recommend", false, "all"},
+    {"search", false},
+    {"insert-fieldcrop", true},
+    {"insert-soilsample", true},
+};
+
+// "<field_id> <end_date|-> <season name>" -> field_id, end_date, season_name
+static vector<string> usage_names(const char* args) {
+    vector<string> names;
+    for (const char* p = args; *p; ++p) {
+        if (*p != '<') continue;
+        string name;
+        for (++p; *p && *p != '>' && *p != '|'; ++p) name += *p == ' ' ? '_' : *p;
+        while (*p && *p != '>') ++p;
+        names.push_back(name);
+        if (!*p) break;
+    }
+    return names;
+}
+
+static string url_decode(const string &s) {
+    string out;
+    for (size_t i = 0; i < s.size(); ++i) {
+        if (s[i] == '+') out += ' ';
+        else if (s[i] == '%' && i + 2 < s.size() && isxdigit((unsigned char)s[i + 1]) && isxdigit((unsigned char)s[i + 2])) {
+            out += (char)std::stoi(s.substr(i + 1, 2), nullptr, 16);
+            i += 2;
+        } else out += s[i];
+    }
+    return out;
+}
+
+// a=1&b=two -> params (later keys win)
+static void parse_form(const string &s, std::map<string, string> &params) {
+    size_t pos = 0;
+    while (pos <= s.size()) {
+        size_t amp = s.find('&', pos);
+        if (amp == string::npos) amp = s.size();
+        string pair = s.substr(pos, amp - pos);
+        if (!pair.empty()) {
+            size_t eq = pair.find('=');
+            if (eq == string::npos) params[url_decode(pair)] = "";
+            else params[url_decode(pair.substr(0, eq))] = url_decode(pair.substr(eq + 1));
+        }
+        pos = amp + 1;
+    }
+}
+
+#if defined(__linux__)
+
+struct HttpRequest {
+    string method, path;
+    string origin;                     // header, lower-cased; empty when absent
+    std::map<string, string> params;   // query string and form body
+    bool keep_alive = true;
+    bool http11 = true;
+};
+
+static const size_t HTTP_MAX_HEADER = 16 * 1024;
+static const size_t HTTP_MAX_BODY = 1 << 20;
+static const int HTTP_IDLE_SECONDS = 60;
+
+static std::atomic<bool> serve_stop{false};
+
+// Parses one request from the front of buf. Returns the bytes it used, 0 if incomplete,
+// or -status (400, 413, 501) if it can't be served.
+static long parse_http_request(const string &buf, HttpRequest &req) {
+    size_t head_end = buf.find("\r\n\r\n");
+    if (head_end == string::npos) return buf.size() > HTTP_MAX_HEADER ? -413 : 0;
+
+    size_t line_end = buf.find("\r\n");
+    std::istringstream line(buf.substr(0, line_end));
+    string target, version;
+    if (!(line >> req.method >> target >> version) || version.compare(0, 5, "HTTP/") != 0) return -400;
+    req.http11 = version != "HTTP/1.0";
+
+    size_t content_length = 0;
+    bool close = false, keep_alive = false;
+    size_t pos = line_end + 2;
+    while (pos < head_end) {
+        size_t eol = buf.find("\r\n", pos);
+        string h = buf.substr(pos, eol - pos);
+        pos = eol + 2;
+        size_t colon = h.find(':');
+        if (colon == string::npos) return -400;
+        string name = h.substr(0, colon), value = h.substr(colon + 1);
+        std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return (char)tolower(c); });
+        value.erase(0, value.find_first_not_of(" \t"));
+        value.erase(value.find_last_not_of(" \t") + 1);
+        string lower = value;
+        std::transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c) { return (char)tolower(c); });
+        if (name == "content-length") {
+            char* end = nullptr;
+            content_length = (size_t)strtoull(value.c_str(), &end, 10);
+            if (value.empty() || *end || !isdigit((unsigned char)value[0])) return -400;
+        } else if (name == "transfer-encoding") {
+            return -501;
+        } else if (name == "connection") {
+            close = lower.find("close") != string::npos;
+            keep_alive = lower.find("keep-alive") != string::npos;
+        } else if (name == "origin") {
+            req.origin = lower;
+        }
+    }
+    if (content_length > HTTP_MAX_BODY) return -413;
+    size_t total = head_end + 4 + content_length;
+    if (buf.size() < total) return 0;
+
+    req.keep_alive = req.http11 ? !close : keep_alive;
+    size_t q = target.find('?');
+    req.path = url_decode(target.substr(0, q));
+    req.params.clear();
+    if (q != string::npos) parse_form(target.substr(q + 1), req.params);
+    if (content_length) parse_form(buf.substr(head_end + 4, content_length), req.params);
+    return (long)total;
+}
+
+static const char* http_status_text(int status) {
+    switch (status) {
+        case 200: return "OK";
+        case 400: return "Bad Request";
+        case 403: return "Forbidden";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 413: return "Payload Too Large";
+        case 501: return "Not Implemented";
+        case 503: return "Service Unavailable";
+        default: return "Internal Server Error";
+    }
+}
+
+// The static file types serve hands out; anything else under the root (sources, CSV
+// exports, SQL scripts, stats files) is refused, so the root may be a working directory.
+static const char* content_type_for(const string &path) {
+    string ext = std::filesystem::path(path).extension().string();
+    if (ext == ".html" || ext == ".htm") return "text/html; charset=utf-8";
+    if (ext == ".js") return "text/javascript; charset=utf-8";
+    if (ext == ".css") return "text/css; charset=utf-8";
+    if (ext == ".png") return "image/png";
+    if (ext == ".svg") return "image/svg+xml";
+    if (ext == ".ico") return "image/x-icon";
+    return nullptr;
+}
+
+struct HttpConn {
+    int fd = -1;
+    string in;
+    string out;
+    size_t out_off = 0;
+    int file_fd = -1;            // static file body, sent with sendfile after `out`
+    off_t file_off = 0, file_end = 0;
+    bool close_after = false;
+    bool want_write = false;
+    std::chrono::steady_clock::time_point last_active;
+    // A POSTed insert waiting for its group commit, and the response so far.
+    vector<WriteTicket> writes;
+    bool write_ok = true, write_keep_alive = true;
+    string write_results, write_messages;
+
+    bool pending() const { return out_off < out.size() || file_fd >= 0 || !writes.empty(); }
+};
+
+class HttpWorker {
+public:
+    // root: canonical static file directory. origins: the origins POSTs may come from, as
+    // lower-case "http://host:port".
+    HttpWorker(const string &db_path, const std::filesystem::path &root, const vector<string> &origins, WritePipeline* writes)
+        : db_path_(db_path), root_(root), origins_(origins), writes_(writes) {}
+    ~HttpWorker() {
+        for (auto &c : conns_) { if (c.second.file_fd >= 0) ::close(c.second.file_fd); ::close(c.first); }
+        if (ep_ >= 0) ::close(ep_);
+        if (listen_fd_ >= 0) ::close(listen_fd_);
+        if (wake_fd_ >= 0) ::close(wake_fd_);
+    }
+
+    bool init(int listen_fd) {
+        listen_fd_ = listen_fd;
+        if (!db_.open(db_path_)) return false;
+        std::error_code ec;
+        db_file_ = std::filesystem::weakly_canonical(db_path_, ec);
+        sqlite3_busy_timeout(db_.db, 5000);
+        db_.out.set_format(OutputFormat::Json);
+        db_.messages = &messages_;
+        db_.writes = writes_;
+        db_.deferred_writes = &deferred_;
+        db_.scan_jobs = 1;
+        ep_ = epoll_create1(EPOLL_CLOEXEC);
+        wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (ep_ < 0 || wake_fd_ < 0) return false;
+        int wake = wake_fd_;
+        db_.writes_done = [wake] {
+            uint64_t one = 1;
+            ssize_t n = ::write(wake, &one, sizeof one);
+            (void)n;   // the counter only saturates if nobody reads it, and then a wake-up is pending anyway
+        };
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = listen_fd_;
+        if (epoll_ctl(ep_, EPOLL_CTL_ADD, listen_fd_, &ev) != 0) return false;
+        ev.data.fd = wake_fd_;
+        return epoll_ctl(ep_, EPOLL_CTL_ADD, wake_fd_, &ev) == 0;
+    }
+
+    void run() {
+        epoll_event events[256];
+        auto last_sweep = std::chrono::steady_clock::now();
+        while (!serve_stop) {
+            int n = epoll_wait(ep_, events, 256, 1000);
+            if (n < 0 && errno != EINTR) break;
+            for (int i = 0; i < n; ++i) {
+                int fd = events[i].data.fd;
+                if (fd == listen_fd_) { accept_all(); continue; }
+                if (fd == wake_fd_) { finish_writes(); continue; }
+                auto it = conns_.find(fd);
+                if (it == conns_.end()) continue;
+                HttpConn &c = it->second;
+                c.last_active = std::chrono::steady_clock::now();
+                bool keep = true;
+                if (events[i].events & (EPOLLERR | EPOLLHUP)) keep = false;
+                if (keep && (events[i].events & EPOLLOUT)) keep = flush(c) && process(c);
+                if (keep && (events[i].events & (EPOLLIN | EPOLLRDHUP))) keep = on_readable(c);
+                if (!keep) close_conn(fd);
+            }
+            auto now = std::chrono::steady_clock::now();
+            if (now - last_sweep >= std::chrono::seconds(1)) {
+                last_sweep = now;
+                vector<int> idle;
+                for (auto &c : conns_) {
+                    if (now - c.second.last_active > std::chrono::seconds(HTTP_IDLE_SECONDS)) idle.push_back(c.first);
+                }
+                for (int fd : idle) close_conn(fd);
+            }
+        }
+    }
+
+private:
+    void accept_all() {
+        while (true) {
+            int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) return;   // EAGAIN, or out of descriptors until some close
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+            epoll_event ev{};
+            ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;   // reads and writes always run to EAGAIN
+            ev.data.fd = fd;
+            if (epoll_ctl(ep_, EPOLL_CTL_ADD, fd, &ev) != 0) { ::close(fd); continue; }
+            HttpConn &c = conns_[fd];
+            c.fd = fd;
+            c.last_active = std::chrono::steady_clock::now();
+        }
+    }
+
+    void close_conn(int fd) {
+        auto it = conns_.find(fd);
+        if (it == conns_.end()) return;
+        if (it->second.file_fd >= 0) ::close(it->second.file_fd);
+        if (!it->second.writes.empty()) waiting_.erase(std::find(waiting_.begin(), waiting_.end(), fd));
+        epoll_ctl(ep_, EPOLL_CTL_DEL, fd, nullptr);
+        ::close(fd);
+        conns_.erase(it);
+    }
+
+    void set_want_write(HttpConn &c, bool on) {
+        if (c.want_write == on) return;
+        c.want_write = on;
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET | (on ? (uint32_t)EPOLLOUT : 0u);
+        ev.data.fd = c.fd;
+        epoll_ctl(ep_, EPOLL_CTL_MOD, c.fd, &ev);
+    }
+
+    // False when the connection should be closed.
+    bool on_readable(HttpConn &c) {
+        char buf[16384];
+        bool eof = false;
+        while (true) {
+            ssize_t n = recv(c.fd, buf, sizeof buf, 0);
+            if (n > 0) { c.in.append(buf, (size_t)n); continue; }
+            if (n == 0) { eof = true; break; }
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return false;
+        }
+        if (!process(c)) return false;
+        return !eof || c.pending();
+    }
+
+    // Answers complete requests in order; a response still being sent holds back the
+    // next pipelined one.
+    bool process(HttpConn &c) {
+        while (!c.pending() && !c.close_after) {
+            HttpRequest req;
+            long used = parse_http_request(c.in, req);
+            if (used == 0) break;
+            if (used < 0) {
+                c.in.clear();
+                respond(c, (int)-used, "application/json", api_error("Bad request"), false);
+            } else {
+                c.in.erase(0, (size_t)used);
+                handle(c, req);
+            }
+            if (!flush(c)) return false;
+        }
+        return !(c.close_after && !c.pending());
+    }
+
+    bool flush(HttpConn &c) {
+        while (c.out_off < c.out.size()) {
+            ssize_t n = send(c.fd, c.out.data() + c.out_off, c.out.size() - c.out_off, MSG_NOSIGNAL);
+            if (n >= 0) { c.out_off += (size_t)n; continue; }
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) { set_want_write(c, true); return true; }
+            return false;
+        }
+        c.out.clear();
+        c.out_off = 0;
+        while (c.file_fd >= 0 && c.file_off < c.file_end) {
+            ssize_t n = sendfile(c.fd, c.file_fd, &c.file_off, (size_t)(c.file_end - c.file_off));
+            if (n > 0) continue;
+            if (n == 0) break;   // file shrank underneath us
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) { set_want_write(c, true); return true; }
+            return false;
+        }
+        if (c.file_fd >= 0) { ::close(c.file_fd); c.file_fd = -1; }
+        set_want_write(c, false);
+        return !c.close_after;
+    }
+
+    void respond(HttpConn &c, int status, const char* type, const string &body, bool keep_alive, bool head = false,
+                 const char* extra = "") {
+        respond_headers(c, status, type, body.size(), keep_alive, extra);
+        if (!head) c.out += body;
+    }
+
+    void respond_headers(HttpConn &c, int status, const char* type, size_t length, bool keep_alive, const char* extra = "") {
+        char head[512];
+        int n = snprintf(head, sizeof head, "HTTP/1.1 %d %s\r\nServer: aims_cli\r\nContent-Type: %s\r\nContent-Length: %zu\r\n%s%s\r\n",
+                         status, http_status_text(status), type, length, extra, keep_alive ? "" : "Connection: close\r\n");
+        c.out.append(head, (size_t)n);
+        if (!keep_alive) c.close_after = true;
+    }
+
+    static string api_error(const string &message) {
+        return "{\"ok\":false,\"results\":[],\"messages\":[\"" + json_escape(message) + "\"]}";
+    }
+
+    void handle(HttpConn &c, const HttpRequest &req) {
+        bool head = req.method == "HEAD";
+        if (req.path.compare(0, 5, "/api/") == 0) { api(c, req); return; }
+        if (req.method != "GET" && !head) {
+            respond(c, 405, "application/json", api_error("Method not allowed"), req.keep_alive, false, "Allow: GET, HEAD\r\n");
+            return;
+        }
+        static_file(c, req, head);
+    }
+
+    void api(HttpConn &c, const HttpRequest &req) {
+        vector<string> segments;
+        std::stringstream ss(req.path.substr(5));
+        for (string s; getline(ss, s, '/');) if (!s.empty()) segments.push_back(s);
+        if (segments.empty() || segments[0] == "commands") { respond(c, 200, "application/json", commands_json(), req.keep_alive); return; }
+        if (segments[0] == "stats") {
+            if (!db_.stats) respond(c, 404, "application/json", api_error("Statistics are off; start serve with --stats"), req.keep_alive);
+            else respond(c, 200, "application/json", stats_registry().json(), req.keep_alive);
+            return;
+        }
+
+        const ServeEndpoint* ep = nullptr;
+        for (auto &e : SERVE_ENDPOINTS) if (segments[0] == e.command) ep = &e;
+        const Command* cmd = ep ? find_command(ep->command) : nullptr;
+        if (!cmd) { respond(c, 404, "application/json", api_error("Unknown endpoint: " + segments[0]), req.keep_alive); return; }
+        const char* method = ep->writes ? "POST" : "GET";
+        if (req.method != method && !(!ep->writes && req.method == "HEAD")) {
+            string allow = string("Allow: ") + method + "\r\n";
+            respond(c, 405, "application/json", api_error(string(method) + " only"), req.keep_alive, false, allow.c_str());
+            return;
+        }
+        if (ep->writes && !same_origin(req)) {
+            respond(c, 403, "application/json", api_error("Cross-origin request refused"), req.keep_alive);
+            return;
+        }
+
+        vector<string> args(segments.begin() + 1, segments.end());
+        if (args.empty()) {
+            for (auto &name : usage_names(cmd->args)) {
+                auto it = req.params.find(name);
+                if (it == req.params.end()) {
+                    respond(c, 400, "application/json", api_error("Missing argument '" + name + "'; usage: " + cmd->name + " " + cmd->args), req.keep_alive);
+                    return;
+                }
+                args.push_back(it->second);
+            }
+        }
+        if (args.size() != cmd->nargs) {
+            respond(c, 400, "application/json", api_error(string("Usage: ") + cmd->name + " " + cmd->args), req.keep_alive);
+            return;
+        }
+        if (ep->refused && args[0] == ep->refused) {
+            respond(c, 400, "application/json", api_error(string(cmd->name) + " " + ep->refused + " is not served; use --exec"), req.keep_alive);
+            return;
+        }
+
+        results_.clear();
+        messages_.str("");
+        messages_.clear();
+        db_.out.set_target(&results_);
+        bool ok = cmd->run(db_, args);
+        db_.out.flush();
+
+        if (!deferred_.empty()) {
+            // Queued inserts: answered from finish_writes() once their batch is done, so
+            // this loop keeps serving its other connections meanwhile.
+            c.writes.swap(deferred_);
+            c.write_ok = ok;
+            c.write_keep_alive = req.keep_alive;
+            c.write_results = results_;
+            c.write_messages = messages_.str();
+            if (writes_ready(c)) answer_writes(c);   // all rejected before queueing
+            else waiting_.push_back(c.fd);
+            return;
+        }
+        respond_api(c, ok, results_, messages_.str(), req.keep_alive, req.method == "HEAD");
+    }
+
+    void respond_api(HttpConn &c, bool ok, const string &results, const string &messages, bool keep_alive, bool head, int status = 0) {
+        // Json format writes one array per result set per line; string values never hold a raw newline.
+        string body = ok ? "{\"ok\":true,\"results\":[" : "{\"ok\":false,\"results\":[";
+        for (size_t i = 0; i < results.size(); ++i) {
+            if (results[i] != '\n') body += results[i];
+            else if (i + 1 < results.size()) body += ',';
+        }
+        body += "],\"messages\":[";
+        std::istringstream lines(messages);
+        bool first = true;
+        for (string line; getline(lines, line);) {
+            body += first ? "\"" : ",\"";
+            body += json_escape(line) + "\"";
+            first = false;
+        }
+        body += "]}";
+        respond(c, status ? status : ok ? 200 : 400, "application/json", body, keep_alive, head);
+    }
+
+    static bool writes_ready(const HttpConn &c) {
+        for (auto &t : c.writes) if (t.wait_for(std::chrono::seconds(0)) != std::future_status::ready) return false;
+        return true;
+    }
+
+    void answer_writes(HttpConn &c) {
+        bool ok = c.write_ok, busy = false;
+        for (auto &t : c.writes) {
+            const WriteResult &r = t.get();
+            c.write_messages += r.message + "\n";
+            ok = ok && r.ok;
+            busy = busy || r.busy;
+        }
+        c.writes.clear();
+        respond_api(c, ok, c.write_results, c.write_messages, c.write_keep_alive, false, busy ? 503 : 0);
+        c.write_results.clear();
+        c.write_messages.clear();
+    }
+
+    // Answers every connection whose queued inserts are all done, then carries on with
+    // requests it had pipelined behind them.
+    void finish_writes() {
+        uint64_t count;
+        ssize_t n = ::read(wake_fd_, &count, sizeof count);
+        (void)n;
+        for (size_t i = 0; i < waiting_.size();) {
+            int fd = waiting_[i];
+            HttpConn &c = conns_[fd];
+            if (!writes_ready(c)) { ++i; continue; }
+            waiting_[i] = waiting_.back();
+            waiting_.pop_back();
+            answer_writes(c);
+            if (!(flush(c) && process(c))) close_conn(fd);
+        }
+    }
+
+    // No Origin: not a browser form or fetch from another page. Otherwise it has to be one
+    // of the configured origins.
+    bool same_origin(const HttpRequest &req) const {
+        if (req.origin.empty()) return true;
+        return std::find(origins_.begin(), origins_.end(), req.origin) != origins_.end();
+    }
+
+    static string commands_json() {
+        string body = "{\"ok\":true,\"commands\":[";
+        bool first = true;
+        for (auto &e : SERVE_ENDPOINTS) {
+            const Command* cmd = find_command(e.command);
+            if (!cmd) continue;
+            body += first ? "{" : ",{";
+            first = false;
+            body += string("\"name\":\"") + cmd->name + "\",\"method\":\"" + (e.writes ? "POST" : "GET") + "\",\"args\":[";
+            vector<string> names = usage_names(cmd->args);
+            for (size_t i = 0; i < names.size(); ++i) body += (i ? ",\"" : "\"") + json_escape(names[i]) + "\"";
+            body += "]}";
+        }
+        return body + "]}";
+    }
+
+    // Database and journal files, by name, wherever they are.
+    static bool database_file(const string &name) {
+        for (const char* suffix : {".sqlite", "-wal", "-shm", "-journal"}) {
+            size_t n = strlen(suffix);
+            if (name.size() >= n && name.compare(name.size() - n, n, suffix) == 0) return true;
+        }
+        return false;
+    }
+
+    void static_file(HttpConn &c, const HttpRequest &req, bool head) {
+        namespace fs = std::filesystem;
+        string rel = req.path;
+        if (rel.empty() || rel[0] != '/' || rel.find('\0') != string::npos) {
+            respond(c, 400, "application/json", api_error("Bad request"), req.keep_alive);
+            return;
+        }
+        if (rel.back() == '/') rel += "index.html";
+        // Resolved (symlinks included) and checked against the root; no segment may start
+        // with '.', which rules out ".." and dot files alike.
+        fs::path path = (root_ / fs::path(rel).relative_path()).lexically_normal();
+        bool allowed = true;
+        for (auto &part : fs::path(rel).relative_path()) allowed = allowed && (part.empty() || part.native()[0] != '.');
+        std::error_code ec;
+        fs::path real = fs::weakly_canonical(path, ec);
+        fs::path inside = real.lexically_relative(root_);
+        const char* type = content_type_for(real.string());
+        if (!allowed || ec || inside.empty() || *inside.begin() == ".." || !type || database_file(real.filename().string()) ||
+            real == db_file_) {
+            respond(c, 403, "application/json", api_error("Forbidden"), req.keep_alive);
+            return;
+        }
+        int fd = ::open(real.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+            if (fd >= 0) ::close(fd);
+            respond(c, 404, "application/json", api_error("Not found: " + req.path), req.keep_alive);
+            return;
+        }
+        respond_headers(c, 200, type, (size_t)st.st_size, req.keep_alive);
+        if (head) { ::close(fd); return; }
+        c.file_fd = fd;
+        c.file_off = 0;
+        c.file_end = st.st_size;
+    }
+
+    string db_path_;
+    std::filesystem::path root_, db_file_;
+    vector<string> origins_;
+    WritePipeline* writes_;
+    DB db_;
+    int ep_ = -1, listen_fd_ = -1;
+    std::unordered_map<int, HttpConn> conns_;
+    string results_;
+    std::ostringstream messages_;
+    int wake_fd_ = -1;          // eventfd written by the writer thread (db_.writes_done)
+    vector<WriteTicket> deferred_;
+    vector<int> waiting_;       // connections with queued inserts
+};
+
+static int open_listener(const string &address, int port) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof one);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    if (inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1 ||
+        bind(fd, (sockaddr*)&addr, sizeof addr) != 0 || listen(fd, SOMAXCONN) != 0) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int run_serve(DB &db, const string &address, int port, int threads, const string &root_arg, const vector<string> &extra_origins,
+              const WriteOptions &write_opts) {
+    namespace fs = std::filesystem;
+    std::error_code ec;
+    fs::path root = root_arg;
+    if (root.empty()) {
+        // Next to the executable, where index.html is kept, rather than whatever the
+        // working directory happens to hold.
+        root = fs::read_symlink("/proc/self/exe", ec).parent_path();
+        if (ec || !fs::is_regular_file(root / "index.html", ec)) {
+            cout << "No index.html next to the executable; pass --root DIR.\n";
+            return 1;
+        }
+    }
+    root = fs::weakly_canonical(root, ec);
+    if (ec || !fs::is_directory(root, ec)) { cout << "Not a directory: " << root_arg << "\n"; return 1; }
+    {
+        Stmt stmt = db.prepare("PRAGMA journal_mode = WAL;");
+        string journal = stmt && sqlite3_step(stmt) == SQLITE_ROW ? (const char*)sqlite3_column_text(stmt, 0) : "";
+        if (journal != "wal") cout << "Note: journal mode is '" << journal << "', not WAL; inserts will block readers.\n";
+    }
+    string db_path = sqlite3_db_filename(db.db, "main");
+    // POSTed inserts from every worker share the writer's group commits. A full queue
+    // answers 503 instead of stalling the worker that submitted.
+    WritePipeline writes;
+    WriteOptions serve_writes = write_opts;
+    serve_writes.reject_when_full = true;
+    if (!writes.start(db_path, serve_writes)) return 1;
+
+    // The first socket settles the port (for --port 0); the others share it via SO_REUSEPORT.
+    vector<std::unique_ptr<HttpWorker>> workers;
+    vector<string> origins;
+    for (int i = 0; i < threads; ++i) {
+        int fd = open_listener(address, port);
+        if (fd < 0) { cout << "Can't listen on " << address << ":" << port << ": " << strerror(errno) << "\n"; return 1; }
+        if (port == 0) {
+            sockaddr_in addr{};
+            socklen_t len = sizeof addr;
+            getsockname(fd, (sockaddr*)&addr, &len);
+            port = ntohs(addr.sin_port);
+        }
+        if (i == 0) {
+            string p = ":" + std::to_string(port);
+            if (address != "0.0.0.0") origins.push_back("http://" + address + p);
+            if (address.compare(0, 4, "127.") == 0) origins.push_back("http://localhost" + p);
+            for (string o : extra_origins) {
+                while (!o.empty() && o.back() == '/') o.pop_back();
+                std::transform(o.begin(), o.end(), o.begin(), [](unsigned char ch) { return (char)std::tolower(ch); });
+                origins.push_back(o);
+            }
+            if (origins.empty()) cout << "Note: no --origin given for a wildcard bind; browser POSTs will be refused.\n";
+        }
+        workers.push_back(std::make_unique<HttpWorker>(db_path, root, origins, &writes));
+        if (!workers.back()->init(fd)) { cout << "Worker setup failed\n"; return 1; }
+    }
+
+    struct sigaction sa{};
+    sa.sa_handler = [](int) { serve_stop = true; };
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+
+    cout << "Serving http://" << address << ":" << port << "/ from " << root.string() << " with " << threads << " worker(s); Ctrl-C to stop\n";
+    cout.flush();
+    vector<std::thread> pool;
+    for (auto &w : workers) pool.emplace_back([&w] { w->run(); });
+    for (auto &t : pool) t.join();
+    writes.stop();
+    if (writes.rows_written() > 0) writes.print_stats(cout);
+    cout << "Stopped.\n";
+    return 0;
+}
+
+#else
+
+int run_serve(DB &, const string &, int, int, const string &, const vector<string> &, const WriteOptions &) {
+    cout << "serve needs epoll (Linux).\n";
+    return 1;
+}
+
+#endif
+
+// ---------- Main menu ----------
 void show_menu() {
     cout << "\n====== AIMS CLI MENU ======\n";
     cout << "1) Show all fields\n";
@@ -544,22 +8464,237 @@ void show_menu() {
     cout << "9) Crop rotation history for a field\n";
     cout << "10) Insert new fieldcrop (planting/harvest)\n";
     cout << "11) Insert new soilsample\n";
+    cout << "12) Heavy-metal threshold sweep (all 8 metals, in-memory)\n";
+    cout << "13) Soil component statistics by field\n";
+    cout << "14) Field dashboard (summary for one field)\n";
+    cout << "15) Soil and yield trends for a field (monthly, year over year)\n";
+    cout << "16) Contaminant compliance (regulatory limits, all samples)\n";
+    cout << "17) Crop rotation analysis (all fields: transitions, monocropping)\n";
+    cout << "18) Maintenance inputs per planting for a field\n";
+    cout << "19) Search comments, notes and names\n";
+    cout << "20) Crop recommendations for a field (suitability, N/P/K deficit)\n";
     cout << "0) Exit\n";
     cout << "Choose option: ";
 }
 
 
-int main(int argc, char** argv) {
+static int run_main(int argc, char** argv) {
     if (argc < 2) {
-        cout << "Usage: " << argv[0] << " /path/to/aims.sqlite\n";
+        cout << "Usage: " << argv[0] << " /path/to/aims.sqlite [--format table|csv|tsv|ndjson|json|binary] [--exec \"command\"]... [--batch]\n";
+        cout << "       " << "    [--write-batch-rows N] [--write-delay-ms N]   (group commit for insert commands)\n";
+        cout << "       " << argv[0] << " /path/to/aims.sqlite ingest <csv_dir> [--batch-rows N]\n";
+        cout << "       " << argv[0] << " /path/to/new.sqlite generate [--farmers N] [--fields N] [--samples N] [--plantings N] [--applications N] [--seed S]\n";
+        cout << "       " << argv[0] << " /path/to/aims.sqlite bench [--iterations N] [--queries file.sql] [--out bench.json]\n";
+        cout << "       " << argv[0] << " /path/to/aims.sqlite migrate [--to N | --status]\n";
+        cout << "       " << argv[0] << " /path/to/aims.sqlite schema-diff <schema.sql>\n";
+        cout << "       " << argv[0] << " /path/to/aims.sqlite check-plans [--verbose]\n";
+        cout << "       " << argv[0] << " /path/to/aims.sqlite report [--script file.sql] [--jobs N] [--out-dir DIR] [--format F]\n";
+        cout << "       " << argv[0] << " /path/to/aims.sqlite rotations [--jobs N] [--min-run N] [--sequences] [--format F] [--snapshot FILE]\n";
+        cout << "       " << argv[0] << " /path/to/aims.sqlite recommend [--top K] [--jobs N] [--season NAME] [--format F]\n";
+        cout << "       " << argv[0] << " /path/to/aims.sqlite snapshot <file>   (columnar copy for --snapshot FILE with --exec and rotations)\n";
+        cout << "       " << argv[0] << " /path/to/aims.sqlite shard <N> <out_dir>   (split by farmer key into N databases)\n";
+        cout << "       " << argv[0] << " <out_dir>/aims.shards [--format F] [--exec \"command\"]... [--batch]   (routed and merged across shards)\n";
+        cout << "       " << argv[0] << " /path/to/aims.sqlite serve [--port 8080] [--bind 127.0.0.1] [--threads N] [--root DIR] [--origin URL]\n";
+        cout << "       " << "    [--write-batch-rows N] [--write-delay-ms N]\n";
+        cout << "Any mode: [--stats FILE|-] [--slow-ms N] [--slow-log FILE]   (query statistics JSON on exit, slow-query log)\n";
         return 1;
     }
     string dbpath = argv[1];
+    string mode = argc >= 3 ? argv[2] : "";
+
+    if (is_shard_manifest(dbpath)) return run_sharded(dbpath, argc, argv);
+
+    if (mode == "ingest") {
+        if (argc < 4) { cout << "Usage: " << argv[0] << " /path/to/aims.sqlite ingest <csv_dir> [--batch-rows N]\n"; return 1; }
+        sqlite3_int64 batch_rows = 100000;
+        for (int i = 4; i + 1 < argc; ++i) {
+            if (string(argv[i]) == "--batch-rows") batch_rows = std::max(1LL, std::atoll(argv[++i]));
+        }
+        DB db;
+        if (!db.open(dbpath)) return 1;
+        return run_ingest(db, argv[3], batch_rows);
+    }
+
+    if (mode == "generate") {
+        GenerateOptions o;
+        for (int i = 3; i + 1 < argc; i += 2) {
+            string a = argv[i];
+            sqlite3_int64 v = std::atoll(argv[i + 1]);
+            if (a == "--farmers") o.farmers = std::max(1LL, v);
+            else if (a == "--fields") o.fields = std::max(1LL, v);
+            else if (a == "--samples") o.samples = std::max(0LL, v);
+            else if (a == "--plantings") o.plantings = std::max(0LL, v);
+            else if (a == "--applications") o.applications = std::max(0LL, v);
+            else if (a == "--seed") o.seed = (uint64_t)v;
+            else { cout << "Unknown argument: " << a << "\n"; return 1; }
+        }
+        DB db;
+        if (!db.open(dbpath)) return 1;
+        return run_generate(db, o);
+    }
+
+    if (mode == "bench") {
+        if (!file_exists(dbpath)) { cout << "DB file not found: " << dbpath << "\n"; return 1; }
+        int iterations = 100;
+        string queries = "sql_script/queries.sql", out;
+        for (int i = 3; i + 1 < argc; i += 2) {
+            string a = argv[i];
+            if (a == "--iterations") iterations = std::max(1, std::atoi(argv[i + 1]));
+            else if (a == "--queries") queries = argv[i + 1];
+            else if (a == "--out") out = argv[i + 1];
+            else { cout << "Unknown argument: " << a << "\n"; return 1; }
+        }
+        DB db;
+        if (!db.open(dbpath)) return 1;
+        return run_bench(db, iterations, queries, out);
+    }
+
+    if (mode == "migrate") {
+        int target = SCHEMA_VERSION;
+        bool status_only = false;
+        for (int i = 3; i < argc; ++i) {
+            string a = argv[i];
+            if (a == "--to" && i + 1 < argc) target = std::atoi(argv[++i]);
+            else if (a == "--status") status_only = true;
+            else { cout << "Unknown argument: " << a << "\n"; return 1; }
+        }
+        DB db;
+        if (!db.open(dbpath)) return 1;
+        return run_migrate(db, target, status_only);
+    }
+
     if (!file_exists(dbpath)) { cout << "DB file not found: " << dbpath << "\n"; return 1; }
 
+    if (mode == "schema-diff") {
+        if (argc < 4) { cout << "Usage: " << argv[0] << " /path/to/aims.sqlite schema-diff <schema.sql>\n"; return 1; }
+        DB db;
+        if (!db.open(dbpath)) return 1;
+        return run_schema_diff(db, argv[3]);
+    }
+
+    if (mode == "check-plans") {
+        DB db;
+        if (!db.open(dbpath)) return 1;
+        return run_check_plans(db, argc >= 4 && string(argv[3]) == "--verbose");
+    }
+
+    if (mode == "report") {
+        string script = "sql_script/queries.sql", out_dir;
+        int jobs = (int)std::max(1u, std::thread::hardware_concurrency());
+        OutputFormat format = OutputFormat::Table;
+        for (int i = 3; i + 1 < argc; i += 2) {
+            string a = argv[i];
+            if (a == "--script") script = argv[i + 1];
+            else if (a == "--jobs") jobs = std::max(1, std::atoi(argv[i + 1]));
+            else if (a == "--out-dir") out_dir = argv[i + 1];
+            else if (a == "--format") {
+                if (!parse_output_format(argv[i + 1], format)) { cout << "Unknown format: " << argv[i + 1] << "\n"; return 1; }
+            }
+            else { cout << "Unknown argument: " << a << "\n"; return 1; }
+        }
+        DB db;
+        if (!db.open(dbpath)) return 1;
+        return run_report(db, script, jobs, out_dir, format);
+    }
+
+    if (mode == "rotations") {
+        RotationOptions o;
+        OutputFormat format = OutputFormat::Table;
+        string snapshot;
+        for (int i = 3; i < argc; ++i) {
+            string a = argv[i];
+            if (a == "--sequences") o.sequences = true;
+            else if (a == "--jobs" && i + 1 < argc) o.jobs = std::max(1, std::atoi(argv[++i]));
+            else if (a == "--min-run" && i + 1 < argc) o.min_run = std::max(2, std::atoi(argv[++i]));
+            else if (a == "--snapshot" && i + 1 < argc) snapshot = argv[++i];
+            else if (a == "--format" && i + 1 < argc) {
+                if (!parse_output_format(argv[++i], format)) { cout << "Unknown format: " << argv[i] << "\n"; return 1; }
+            }
+            else { cout << "Unknown argument: " << a << "\n"; return 1; }
+        }
+        DB db;
+        if (!db.open(dbpath)) return 1;
+        db.out.set_format(format);
+        if (!snapshot.empty() && !attach_snapshot(db, snapshot)) return 1;
+        return run_rotations(db, o);
+    }
+
+    if (mode == "recommend") {
+        RecommendOptions o;
+        OutputFormat format = OutputFormat::Table;
+        for (int i = 3; i < argc; ++i) {
+            string a = argv[i];
+            if (a == "--top" && i + 1 < argc) o.top = std::max(1, std::atoi(argv[++i]));
+            else if (a == "--jobs" && i + 1 < argc) o.jobs = std::max(1, std::atoi(argv[++i]));
+            else if (a == "--season" && i + 1 < argc) o.season = argv[++i];
+            else if (a == "--format" && i + 1 < argc) {
+                if (!parse_output_format(argv[++i], format)) { cout << "Unknown format: " << argv[i] << "\n"; return 1; }
+            }
+            else { cout << "Unknown argument: " << a << "\n"; return 1; }
+        }
+        DB db;
+        if (!db.open(dbpath)) return 1;
+        db.out.set_format(format);
+        return run_recommend(db, o);
+    }
+
+    if (mode == "snapshot") {
+        if (argc < 4) { cout << "Usage: " << argv[0] << " /path/to/aims.sqlite snapshot <file>\n"; return 1; }
+        DB db;
+        if (!db.open(dbpath)) return 1;
+        return run_snapshot(db, argv[3]);
+    }
+
+    if (mode == "shard") {
+        if (argc < 5) { cout << "Usage: " << argv[0] << " /path/to/aims.sqlite shard <N> <out_dir>\n"; return 1; }
+        DB db;
+        if (!db.open(dbpath)) return 1;
+        return run_shard(db, std::atoi(argv[3]), argv[4]);
+    }
+
+    if (mode == "serve") {
+        string address = "127.0.0.1", root;   // root: next to the executable
+        vector<string> origins;               // besides the bind address
+        int port = 8080;
+        int threads = (int)std::max(1u, std::thread::hardware_concurrency());
+        WriteOptions write_opts;
+        for (int i = 3; i + 1 < argc; i += 2) {
+            string a = argv[i];
+            if (a == "--port") port = std::atoi(argv[i + 1]);
+            else if (a == "--bind") address = argv[i + 1];
+            else if (a == "--threads") threads = std::max(1, std::atoi(argv[i + 1]));
+            else if (a == "--root") root = argv[i + 1];
+            else if (a == "--origin") origins.push_back(argv[i + 1]);
+            else if (a == "--write-batch-rows") write_opts.batch_rows = (size_t)std::max(1, std::atoi(argv[i + 1]));
+            else if (a == "--write-delay-ms") write_opts.delay_ms = std::max(0, std::atoi(argv[i + 1]));
+            else { cout << "Unknown argument: " << a << "\n"; return 1; }
+        }
+        DB db;
+        if (!db.open(dbpath)) return 1;
+        return run_serve(db, address, port, threads, root, origins, write_opts);
+    }
+
     DB db;
     if (!db.open(dbpath)) return 1;
 
+    vector<string> execs;
+    bool read_stdin = false;
+    WriteOptions write_opts;
+    for (int i = 2; i < argc; ++i) {
+        string a = argv[i];
+        if (a == "--exec" && i + 1 < argc) execs.push_back(argv[++i]);
+        else if (a == "--batch") read_stdin = true;
+        else if (a == "--snapshot" && i + 1 < argc) { if (!attach_snapshot(db, argv[++i])) return 1; }
+        else if (a == "--write-batch-rows" && i + 1 < argc) write_opts.batch_rows = (size_t)std::max(1, std::atoi(argv[++i]));
+        else if (a == "--write-delay-ms" && i + 1 < argc) write_opts.delay_ms = std::max(0, std::atoi(argv[++i]));
+        else if (a == "--format" && i + 1 < argc) {
+            OutputFormat f;
+            if (!parse_output_format(argv[++i], f)) { cout << "Unknown format: " << argv[i] << "\n"; return 1; }
+            db.out.set_format(f);
+        }
+        else { cout << "Unknown argument: " << a << "\n"; return 1; }
+    }
+
     // quick sanity: ensure main tables exist
     vector<string> must = {"field","crop","fieldcrop","soilsample","farmer","season"};
     for (auto &t : must) {
@@ -568,24 +8703,43 @@ int main(int argc, char** argv) {
         }
     }
 
+    if (!execs.empty() || read_stdin) return run_batch(db, execs, read_stdin, write_opts);
+
+    string notice;
+    int version = db.schema_version();
+    if (version >= 0 && version < SCHEMA_VERSION) {
+        notice = "Note: database schema is at version " + std::to_string(version) + " (latest " + std::to_string(SCHEMA_VERSION) +
+                 "). Run '" + argv[0] + " " + dbpath + " migrate' to add the query indexes.\n";
+    }
+
     while (true) {
         // system("clear");
         clearScreen();
+        cout << notice;
         show_menu();
         int opt; if (!(cin >> opt)) { cout << "Invalid input. Exiting.\n"; break; }
         cin.ignore();
         switch (opt) {
-            case 1: show_all_fields(db); break;
+            case 1: show_all_fields(db); promptContinue(); break;
             case 2: crops_by_season(db); break;
-            case 3: avg_yield_per_field(db); break;
+            case 3: avg_yield_per_field(db); promptContinue(); break;
             case 4: latest_soil_sample_for_field(db); break;
             case 5: samples_exceeding_thresholds(db); break;
-            case 6: fields_no_recent_maintenance(db); break;
-            case 7: avg_npk_by_soil_texture(db); break;
-            case 8: total_yield_per_season(db); break;
+            case 6: fields_no_recent_maintenance(db); promptContinue(); break;
+            case 7: avg_npk_by_soil_texture(db); promptContinue(); break;
+            case 8: total_yield_per_season(db); promptContinue(); break;
             case 9: crop_rotation_history(db); break;
             case 10: insert_fieldcrop(db); break;
             case 11: insert_soilsample(db); break;
+            case 12: metal_threshold_sweep(db); break;
+            case 13: soil_component_stats(db); promptContinue(); break;
+            case 14: field_dashboard(db); break;
+            case 15: field_trend(db); break;
+            case 16: contaminant_compliance(db); break;
+            case 17: rotation_analysis(db); break;
+            case 18: planting_inputs(db); break;
+            case 19: search_text(db); break;
+            case 20: recommend_crops(db); break;
             case 0: cout << "Goodbye!\n"; db.close(); return 0;
             default: cout << "Unknown option.\n";
         }
@@ -594,3 +8748,19 @@ int main(int argc, char** argv) {
     db.close();
     return 0;
 }
+
+int main(int argc, char** argv) {
+    // Instrumentation options work with every mode, so they are taken out before dispatch.
+    vector<char*> args;
+    for (int i = 0; i < argc; ++i) {
+        string a = argv[i];
+        if (a == "--stats" && i + 1 < argc) { stats_config.enabled = true; stats_config.out = argv[++i]; }
+        else if (a == "--slow-ms" && i + 1 < argc) { stats_config.enabled = true; stats_config.slow_ms = std::atof(argv[++i]); }
+        else if (a == "--slow-log" && i + 1 < argc) stats_config.slow_log = argv[++i];
+        else args.push_back(argv[i]);
+    }
+    args.push_back(nullptr);
+    int rc = run_main((int)args.size() - 1, args.data());
+    if (stats_config.enabled && !stats_config.out.empty()) write_stats_json(stats_config.out);
+    return rc;
+}
@@ -3,7 +3,7 @@ PRAGMA foreign_keys = ON;
 CREATE TABLE IF NOT EXISTS farmer (
     f_farmerkey DECIMAL(9,0) PRIMARY KEY,
     f_fieldkey DECIMAL(12,0) NOT NULL,
-    f_name VARCHAR(100) NOT NULL,
+    f_name VARCHAR(100) NOT NULL
 );
 
 CREATE TABLE IF NOT EXISTS field (
@@ -23,7 +23,7 @@ CREATE TABLE IF NOT EXISTS soiltype (
     st_clay DECIMAL(5,2),
     st_loamy DECIMAL(5,2),
     st_chalky DECIMAL(5,2),
-    st_peaty DECIMAL(5,2),
+    st_peaty DECIMAL(5,2)
 );
 
 CREATE TABLE IF NOT EXISTS soilsample (
@@ -62,7 +62,8 @@ CREATE TABLE IF NOT EXISTS crop (
     c_preferredsoil DECIMAL(3,0) NOT NULL, 
     c_ph DECIMAL (4,2) NOT NULL, 
     c_germ DECIMAL (5,2) NOT NULL, 
-    -- Germination rate as a percentage. c_water DECIMAL(5,0), 
+    -- Germination rate as a percentage. 
+    c_water DECIMAL(5,0), 
     -- Expected water usage of crop in mm/year 
     -- Omitting nutrient use numerics, at least for now. 
     c_nutrientuse VARCHAR(125), 
@@ -108,3 +109,39 @@ CREATE TABLE IF NOT EXISTS fieldmaintenance (
     FOREIGN KEY (fldm_fieldkey) REFERENCES field(fld_fieldkey), 
     FOREIGN KEY (fldm_maintenancekey) REFERENCES maintenance(m_maintenancekey) 
 );
+
+-- Schema version 1: indexes for the queries in aims_cli (aims_cli <db> check-plans).
+CREATE INDEX IF NOT EXISTS idx_soilsample_field_date ON soilsample (ss_fieldkey, ss_sampledate);
+CREATE INDEX IF NOT EXISTS idx_fieldcrop_field_end ON fieldcrop (fldc_fieldkey, fldc_enddate, fldc_cropkey, fldc_yield);
+CREATE INDEX IF NOT EXISTS idx_fieldcrop_crop ON fieldcrop (fldc_cropkey, fldc_fieldkey, fldc_yield);
+CREATE INDEX IF NOT EXISTS idx_fieldmaintenance_field_begin ON fieldmaintenance (fldm_fieldkey, fldm_begindate);
+CREATE INDEX IF NOT EXISTS idx_crop_season ON crop (c_preferredseason, c_cropkey);
+CREATE INDEX IF NOT EXISTS idx_season_name ON season (s_name);
+
+-- Schema version 2: contaminant tables adopted from aims_soil_schema.sql.
+CREATE TABLE IF NOT EXISTS contaminant_type (
+    ct_contaminantkey DECIMAL(6,0) PRIMARY KEY,
+    ct_name VARCHAR(100) NOT NULL UNIQUE,
+    ct_typical_unit VARCHAR(20) DEFAULT 'ppm',
+    ct_reg_threshold DECIMAL(12,4),
+    ct_threshold_unit VARCHAR(20),
+    ct_notes TEXT
+);
+
+CREATE TABLE IF NOT EXISTS soilsample_contaminant (
+    ssc_samplekey DECIMAL(12,0) NOT NULL,
+    ssc_contaminantkey DECIMAL(6,0) NOT NULL,
+    ssc_concentration DECIMAL(12,4) NOT NULL,
+    ssc_detection_limit DECIMAL(12,4),
+    ssc_method VARCHAR(100),
+    ssc_unit VARCHAR(20) DEFAULT 'ppm',
+    PRIMARY KEY (ssc_samplekey, ssc_contaminantkey),
+    FOREIGN KEY (ssc_samplekey) REFERENCES soilsample(ss_samplekey) ON DELETE CASCADE,
+    FOREIGN KEY (ssc_contaminantkey) REFERENCES contaminant_type(ct_contaminantkey)
+);
+
+CREATE INDEX IF NOT EXISTS idx_ssc_contaminant ON soilsample_contaminant (ssc_contaminantkey, ssc_samplekey);
+
+-- Matches migration 2 of aims_cli.cpp. Later migrations (field_summary and its triggers,
+-- which are generated in code) are applied with: aims_cli <db> migrate
+PRAGMA user_version = 2;
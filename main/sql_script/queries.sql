@@ -11,50 +11,22 @@
 -- Important for analyzing the distribution of the dataset for
 -- each field. These statistics inform pattern and variability analyses.
 
-WITH 
-mean_components AS (
-  SELECT 
-    ss_fieldkey AS fieldkey, 
-    ROUND(AVG(ss_sand), 2) AS mean_sand, 
-    ROUND(AVG(ss_silt), 2) AS mean_silt, 
-    ROUND(AVG(ss_clay), 2) AS mean_clay,
-    ROUND(AVG(ss_ph), 2)  AS mean_ph,
-    COUNT(*) AS n 
-  FROM soilsample
-  GROUP BY ss_fieldkey
-),
-squared_diff AS (
-  SELECT mc.fieldkey, 
-    POWER((mc.mean_sand - sample.ss_sand), 2) AS sand, 
-    POWER((mc.mean_silt - sample.ss_silt), 2) AS silt, 
-    POWER((mc.mean_clay - sample.ss_clay), 2) AS clay, 
-    POWER((mc.mean_ph - sample.ss_ph), 2) AS ph
-  FROM soilsample AS sample
-  JOIN mean_components AS mc ON sample.ss_fieldkey = mc.fieldkey
-),
-variance AS (
-  SELECT sd.fieldkey, 
-    (SUM(sd.sand)/(mc.n - 1)) AS var_sand, 
-    (SUM(sd.silt)/(mc.n - 1)) AS var_silt, 
-    (SUM(sd.clay)/(mc.n - 1)) AS var_clay,
-    (SUM(sd.ph)/(mc.n-1)) AS var_ph
-  FROM squared_diff AS sd
-  JOIN mean_components AS mc ON sd.fieldkey = mc.fieldkey
-  GROUP BY sd.fieldkey
-)
+-- Single pass: stddev() is the native Welford aggregate registered by aims_cli, so run
+-- this script with: ./aims_cli.exe database/aims.sqlite --exec "script sql_script/queries.sql"
+
 SELECT 
-    v.fieldkey,
-    mean_sand,
-    ROUND(SQRT(var_sand), 2) AS std_dev_sand,
-    mean_silt,
-    ROUND(SQRT(var_silt), 2) AS std_dev_silt, 
-    mean_clay,
-    ROUND(SQRT(var_clay), 2) AS std_dev_clay,
-    mean_ph,
-    ROUND(SQRT(var_ph), 2) AS std_dev_ph
-FROM variance v
-JOIN mean_components AS mc ON v.fieldkey = mc.fieldkey
-ORDER BY v.fieldkey;
+    ss_fieldkey AS fieldkey,
+    ROUND(AVG(ss_sand), 2) AS mean_sand,
+    ROUND(stddev(ss_sand), 2) AS std_dev_sand,
+    ROUND(AVG(ss_silt), 2) AS mean_silt,
+    ROUND(stddev(ss_silt), 2) AS std_dev_silt, 
+    ROUND(AVG(ss_clay), 2) AS mean_clay,
+    ROUND(stddev(ss_clay), 2) AS std_dev_clay,
+    ROUND(AVG(ss_ph), 2) AS mean_ph,
+    ROUND(stddev(ss_ph), 2) AS std_dev_ph
+FROM soilsample
+GROUP BY ss_fieldkey
+ORDER BY ss_fieldkey;
 
 
 .print ""
@@ -208,6 +180,8 @@ ORDER BY (lm.last_begindate IS NOT NULL), lm.last_begindate;
 
 -- Another statistic, but in a smaller timescale for measuring
 -- local, short-term changes.
+-- On a migrated database, --exec "trend 2 12" reads the same
+-- monthly averages from the field_rollup buckets.
 
 SELECT
   strftime('%Y-%m', ss.ss_sampledate) AS year_month,
@@ -230,6 +204,11 @@ ORDER BY year_month;
 -- Analyze maintenance inputs vs yield patterns.
 -- Useful for analyzing economic constraints and
 -- potential misuse of inputs.
+-- On a migrated database, --exec maint-vs-yield reads the same
+-- yearly totals from the field_rollup buckets.
+-- Calendar years split a winter crop's inputs across two years;
+-- --exec "planting-inputs all" attributes each application to the
+-- plantings whose begin/end window it overlaps instead.
 
 WITH maint_by_year AS (
   SELECT